@@ -64,8 +64,6 @@
 #define BARSIZE 17
 #endif
 
-#define GRAV_DIFF
-
 #define TAG_MAX 256
 
 #define ZSIZE_D	16
@@ -19,7 +19,7 @@
 #include <SDL/SDL.h>
 #include "defines.h"
 
-//Defining PIXELBYTES indicates that R, G, B values are stored in separate bytes, and that the pixel format is therefore suitable for use with MMX instructions
+//Defining PIXELBYTES indicates that R, G, B values are stored in separate bytes, and that the pixel format is therefore suitable for use with SIMD instructions
 
 #define PIXELCHANNELS 3
 #ifdef PIX16
@@ -199,6 +199,8 @@ void xor_rect(pixel *vid, int x, int y, int w, int h);
 
 void blend_line(pixel *vid, int x1, int y1, int x2, int y2, int r, int g, int b, int a);
 
+// Maximum number of threads used by render_parts, including the calling thread (0 means use all the threads in the shared worker pool)
+extern int render_threads;
 void render_parts(pixel *vid);
 
 void render_before(pixel *part_vbuf);
@@ -231,6 +233,12 @@ void render_signs(pixel *vid_buf);
 
 void render_fire(pixel *dst);
 
+// Versions of render_fire for different instruction sets, which all give the same result. RENDER_FIRE_AUTO uses the fastest one supported by the CPU.
+enum { RENDER_FIRE_AUTO=-1, RENDER_FIRE_SCALAR=0, RENDER_FIRE_SSE2, RENDER_FIRE_AVX2, RENDER_FIRE_IMPL_COUNT };
+// Version used by render_fire, for testing and benchmarking. If this version is not supported, the fastest supported one is used.
+extern int render_fire_impl;
+bool render_fire_supported(int impl);
+
 void prepare_alpha(int size, float intensity);
 
 void draw_image(pixel *vid, pixel *img, int x, int y, int w, int h, int a);
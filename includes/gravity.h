@@ -34,6 +34,7 @@ extern float *th_gravmap;
 extern float *th_gravx;
 extern float *th_gravy;
 extern float *th_gravp;
+extern int th_gravchanged;
 
 void gravity_init();
 void gravity_cleanup();
@@ -41,14 +42,17 @@ void gravity_update_async();
 
 void start_grav_async();
 void stop_grav_async();
+// Update the gravity field (th_gravx, th_gravy, th_gravp) for changes in th_gravmap since the last call. th_gravchanged is set to 1 if the field changed.
 void update_grav();
+// Reset th_ogravmap and the stored field to zero, so that the next update_grav calculates the field from scratch
+void grav_clear();
+void grav_direct_init();
+void grav_direct_cleanup();
 void gravity_mask();
 
 void bilinear_interpolation(float *src, float *dst, int sw, int sh, int rw, int rh);
 
-#ifdef GRAVFFT
 void grav_fft_init();
 void grav_fft_cleanup();
-#endif
 
 #endif
@@ -7,7 +7,11 @@
 #include <math.h>
 #include "simulation/Simulation.h"
 #include "simulation/air/SimAir.hpp"
+#include "simulation/elements/ETRD.hpp"
+#include "simulation/elements/WIRE.hpp"
+#include "simulation/elements/LIFE.hpp"
 #include "common/Threading.hpp"
+#include <vector>
 
 char *benchmark_file = NULL;
 double benchmark_loops_multiply = 1.0; // Increase for more accurate results (particularly on fast computers)
@@ -133,38 +137,50 @@ void benchmark_run()
 				}
 				BENCHMARK_END()
 
-				printf("Render particles: ");
-				BENCHMARK_INIT(benchmark_repeat_count, 1500)
+				// Thread counts for the render benchmarks: 1, 2, 4, ..., and all the threads render_parts would use by default
+				std::vector<int> renderThreadCounts;
+				int maxRenderThreads = WorkerThreads::getShared()->threadCount()+1;
+				for (int n=1; n<maxRenderThreads; n*=2)
+					renderThreadCounts.push_back(n);
+				renderThreadCounts.push_back(maxRenderThreads);
+
+				for (int threads : renderThreadCounts)
 				{
-					parse_save(file_data, size, 1, 0, 0, globalSim->walls.getDataPtr(), globalSim->signs, parts);
-					sys_pause = framerender = 0;
-					display_mode = 0;
-					render_mode = RENDER_BASC;
-					decorations_enable = 1;
-					globalSim->UpdateParticles();
-					BENCHMARK_RUN()
+					render_threads = threads;
+					printf("Render particles (%d threads): ", threads);
+					BENCHMARK_INIT(benchmark_repeat_count, 1500)
 					{
-						render_parts(vid_buf);
+						parse_save(file_data, size, 1, 0, 0, globalSim->walls.getDataPtr(), globalSim->signs, parts);
+						sys_pause = framerender = 0;
+						display_mode = 0;
+						render_mode = RENDER_BASC;
+						decorations_enable = 1;
+						globalSim->UpdateParticles();
+						BENCHMARK_RUN()
+						{
+							render_parts(vid_buf);
+						}
 					}
-				}
-				BENCHMARK_END()
+					BENCHMARK_END()
 
-				printf("Render particles+fire: ");
-				BENCHMARK_INIT(benchmark_repeat_count, 1200)
-				{
-					parse_save(file_data, size, 1, 0, 0, globalSim->walls.getDataPtr(), globalSim->signs, parts);
-					sys_pause = framerender = 0;
-					display_mode = 0;
-					render_mode = RENDER_FIRE;
-					decorations_enable = 1;
-					globalSim->UpdateParticles();
-					BENCHMARK_RUN()
+					printf("Render particles+fire (%d threads): ", threads);
+					BENCHMARK_INIT(benchmark_repeat_count, 1200)
 					{
-						render_parts(vid_buf);
-						render_fire(vid_buf);
+						parse_save(file_data, size, 1, 0, 0, globalSim->walls.getDataPtr(), globalSim->signs, parts);
+						sys_pause = framerender = 0;
+						display_mode = 0;
+						render_mode = RENDER_FIRE;
+						decorations_enable = 1;
+						globalSim->UpdateParticles();
+						BENCHMARK_RUN()
+						{
+							render_parts(vid_buf);
+							render_fire(vid_buf);
+						}
 					}
+					BENCHMARK_END()
 				}
-				BENCHMARK_END()
+				render_threads = 0;
 
 
 			}
@@ -217,6 +233,7 @@ void benchmark_run()
 		{
 			auto as0 = AirSimulator_sync::create(0);
 			auto as1 = AirSimulator_sync::create(1);
+			auto as1p = AirSimulator_sync::create(1, 0);
 			AirData od, nd;
 			AirSimulator_params_roInput params;
 			params.wallsData = globalSim->walls.getDataPtr();
@@ -244,6 +261,22 @@ void benchmark_run()
 			}
 			BENCHMARK_END()
 
+			printf("New air (parallel): ");
+			params.ambientHeatEnabled = false;
+			BENCHMARK_START(benchmark_repeat_count, 3000)
+			{
+				as1p->simulate(params);
+			}
+			BENCHMARK_END()
+
+			printf("New air (parallel) + ambient heat: ");
+			params.ambientHeatEnabled = true;
+			BENCHMARK_START(benchmark_repeat_count, 3000)
+			{
+				as1p->simulate(params);
+			}
+			BENCHMARK_END()
+
 			printf("Old air: ");
 			params.ambientHeatEnabled = false;
 			BENCHMARK_START(benchmark_repeat_count, 3000)
@@ -261,24 +294,166 @@ void benchmark_run()
 			BENCHMARK_END()
 		}
 
-		printf("render_fire: ");
-		BENCHMARK_INIT(benchmark_repeat_count, 50)
+		const char *renderFireImplNames[RENDER_FIRE_IMPL_COUNT] = { "scalar", "SSE2", "AVX2" };
+		for (int impl=RENDER_FIRE_AUTO; impl<RENDER_FIRE_IMPL_COUNT; impl++)
+		{
+			if (impl!=RENDER_FIRE_AUTO && !render_fire_supported(impl))
+				continue;
+			render_fire_impl = impl;
+			if (impl==RENDER_FIRE_AUTO)
+				printf("render_fire: ");
+			else
+				printf("render_fire (%s): ", renderFireImplNames[impl]);
+			BENCHMARK_INIT(benchmark_repeat_count, 50)
+			{
+				int j, i;
+				for (j=YRES/CELL/4; j<YRES/CELL-YRES/CELL/4; j++)
+					for (i=XRES/CELL/4; i<XRES/CELL-XRES/CELL/4; i++)
+					{
+						fire_r[j][i] = 255;
+						fire_g[j][i] = 255;
+						fire_b[j][i] = 255;
+					}
+				BENCHMARK_RUN()
+				{
+					render_fire(vid_buf);
+				}
+			}
+			BENCHMARK_END()
+		}
+		render_fire_impl = RENDER_FIRE_AUTO;
+
+		{
+			// Cost of LIFE should depend on how much LIFE there is, not on the size of the simulation
+			LIFE_ElemDataSim *lifeData = globalSim->elemData<LIFE_ElemDataSim>(PT_LIFE);
+			printf("LIFE - one glider: ");
+			BENCHMARK_INIT(benchmark_repeat_count, 20000)
+			{
+				clear_sim();
+				const int glider[5][2] = {{1,0}, {2,1}, {0,2}, {1,2}, {2,2}};
+				for (int j=0; j<5; j++)
+				{
+					int i = globalSim->part_create(-1, SimPosI(XCNTR+glider[j][0], YCNTR+glider[j][1]), PT_LIFE);
+					if (i>=0)
+						Element_LIFE::setType(globalSim, parts[i], 0);
+				}
+				BENCHMARK_RUN()
+				{
+					lifeData->Simulation_BeforeUpdate();
+				}
+			}
+			BENCHMARK_END()
+
+			printf("LIFE - dense soup: ");
+			BENCHMARK_INIT(benchmark_repeat_count, 200)
+			{
+				clear_sim();
+				srand(1);
+				for (int y=CELL; y<YRES-CELL; y++)
+					for (int x=CELL; x<XRES-CELL; x++)
+						if (rand()%100 < 35)
+						{
+							int i = globalSim->part_create(-1, SimPosI(x, y), PT_LIFE);
+							if (i>=0)
+								Element_LIFE::setType(globalSim, parts[i], 0);
+						}
+				BENCHMARK_RUN()
+				{
+					lifeData->Simulation_BeforeUpdate();
+				}
+			}
+			BENCHMARK_END()
+			clear_sim();
+		}
+
+		// Detectors with the maximum range, which mostly do not find anything so have to search their whole area
+		printf("DTEC and TSNS grid: ");
+		BENCHMARK_INIT(benchmark_repeat_count, 100)
+		{
+			clear_sim();
+			srand(1);
+			for (int y=CELL; y<YRES-CELL; y+=8)
+				for (int x=CELL; x<XRES-CELL; x+=8)
+				{
+					int i = globalSim->part_create(-1, SimPosI(x, y), ((x+y)%16) ? PT_DTEC : PT_TSNS);
+					if (i>=0)
+					{
+						parts[i].ctype = PT_PHOT;
+						parts[i].tmp2 = 25;
+						parts[i].temp = 1000.0f;
+					}
+					if (rand()%4==0)
+						globalSim->part_create(-1, SimPosI(x+1+rand()%6, y+1+rand()%6), PT_DMND);
+				}
+			sys_pause = framerender = 0;
+			BENCHMARK_RUN()
+			{
+				globalSim->UpdateParticles();
+			}
+		}
+		BENCHMARK_END()
+
+		// Large block of conductors with no sparks in it
+		printf("Idle circuit - METL and SWCH: ");
+		BENCHMARK_INIT(benchmark_repeat_count, 100)
+		{
+			clear_sim();
+			for (int y=YRES/4; y<YRES*3/4; y++)
+				for (int x=XRES/4; x<XRES*3/4; x++)
+					globalSim->part_create(-1, SimPosI(x, y), (y%8) ? PT_METL : PT_SWCH);
+			sys_pause = framerender = 0;
+			BENCHMARK_RUN()
+			{
+				globalSim->UpdateParticles();
+			}
+		}
+		BENCHMARK_END()
+
+		// Long WIRE lines with a spark head every 8 pixels, so that most WIRE particles change state each frame
+		printf("WIRE - lines: ");
+		BENCHMARK_INIT(benchmark_repeat_count, 100)
 		{
-			int j, i;
-			for (j=YRES/CELL/4; j<YRES/CELL-YRES/CELL/4; j++)
-				for (i=XRES/CELL/4; i<XRES/CELL-XRES/CELL/4; i++)
+			clear_sim();
+			for (int y=CELL+2; y<YRES-CELL-2; y+=3)
+				for (int x=CELL+2; x<XRES-CELL-2; x++)
 				{
-					fire_r[j][i] = 255;
-					fire_g[j][i] = 255;
-					fire_b[j][i] = 255;
+					int i = globalSim->part_create(-1, SimPosI(x, y), PT_WIRE);
+					if (i>=0 && x%8==0)
+						Element_WIRE::setState(parts[i], Element_WIRE::State::HeadNormal);
 				}
+			sys_pause = framerender = 0;
 			BENCHMARK_RUN()
 			{
-				render_fire(vid_buf);
+				globalSim->UpdateParticles();
 			}
 		}
 		BENCHMARK_END()
 
+		// Many electrodes, most of which have recently sparked so cannot be used
+		printf("ETRD nearest electrode search - 3000 ETRD: ");
+		BENCHMARK_INIT(benchmark_repeat_count, 200)
+		{
+			clear_sim();
+			srand(1);
+			std::vector<int> electrodes;
+			for (int j=0; j<3000; j++)
+			{
+				int i = globalSim->part_create(-1, SimPosI(CELL+rand()%(XRES-2*CELL), CELL+rand()%(YRES-2*CELL)), PT_ETRD);
+				if (i>=0)
+				{
+					parts[i].life = (rand()%20) ? 5 : 0;
+					electrodes.push_back(i);
+				}
+			}
+			BENCHMARK_RUN()
+			{
+				for (int i : electrodes)
+					Element_ETRD::nearestSparkablePart(globalSim, i);
+			}
+		}
+		BENCHMARK_END()
+		clear_sim();
+
 		gravity_init();
 		update_grav();
 		printf("Gravity - no gravmap changes: ");
@@ -296,6 +471,26 @@ void benchmark_run()
 		}
 		BENCHMARK_END()
 
+		printf("Gravity - 16 gravmap cells changed: ");
+		BENCHMARK_START(benchmark_repeat_count, 1000)
+		{
+			int j;
+			for (j=0; j<16; j++)
+				th_gravmap[(j*37%(YRES/CELL))*(XRES/CELL) + j*59%(XRES/CELL)] = ((bench_i+j)%5)+1.0f;
+			update_grav();
+		}
+		BENCHMARK_END()
+
+		printf("Gravity - all gravmap cells changed: ");
+		BENCHMARK_START(benchmark_repeat_count, 10)
+		{
+			int j;
+			for (j=0; j<(XRES/CELL)*(YRES/CELL); j++)
+				th_gravmap[j] = ((bench_i+j)%5)+1.0f;
+			update_grav();
+		}
+		BENCHMARK_END()
+
 		printf("Gravity - membwand: ");
 		BENCHMARK_START(benchmark_repeat_count, 10000)
 		{
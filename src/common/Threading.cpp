@@ -0,0 +1,374 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common/Threading.hpp"
+#include "common/tpt-stdint.h"
+#include <algorithm>
+
+/* Chase-Lev work stealing deque ("Correct and Efficient Work-Stealing for Weak Memory Models", Le et al. 2013).
+ * Only the owning worker calls push() and pop(), which work on the bottom end. Any thread may call steal(), which takes from the top end.
+ * The buffer grows when full. Old buffers are kept until the deque is destroyed, since a thief may still be reading from one.
+ */
+class WorkerThreads::TaskDeque
+{
+protected:
+	class Buffer
+	{
+	public:
+		int64_t mask;
+		std::unique_ptr<std::atomic<Task*>[]> items;
+		explicit Buffer(int64_t size) : mask(size-1), items(new std::atomic<Task*>[size]) {}
+		int64_t size() const { return mask+1; }
+		Task *get(int64_t i) const { return items[i&mask].load(std::memory_order_relaxed); }
+		void put(int64_t i, Task *task) { items[i&mask].store(task, std::memory_order_relaxed); }
+	};
+	std::atomic<int64_t> top, bottom;
+	std::atomic<Buffer*> buffer;
+	std::vector<std::unique_ptr<Buffer> > buffers;
+
+	Buffer *grow(Buffer *oldBuf, int64_t t, int64_t b)
+	{
+		Buffer *newBuf = new Buffer(oldBuf->size()*2);
+		for (int64_t i=t; i<b; i++)
+			newBuf->put(i, oldBuf->get(i));
+		buffers.emplace_back(newBuf);
+		buffer.store(newBuf, std::memory_order_release);
+		return newBuf;
+	}
+
+public:
+	TaskDeque() : top(0), bottom(0)
+	{
+		buffers.emplace_back(new Buffer(64));
+		buffer.store(buffers.back().get(), std::memory_order_relaxed);
+	}
+
+	void push(Task *task)
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed);
+		int64_t t = top.load(std::memory_order_acquire);
+		Buffer *buf = buffer.load(std::memory_order_relaxed);
+		if (b-t > buf->size()-1)
+			buf = grow(buf, t, b);
+		buf->put(b, task);
+		std::atomic_thread_fence(std::memory_order_release);
+		bottom.store(b+1, std::memory_order_relaxed);
+	}
+
+	Task *pop()
+	{
+		int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+		Buffer *buf = buffer.load(std::memory_order_relaxed);
+		bottom.store(b, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t t = top.load(std::memory_order_relaxed);
+		if (t>b)
+		{
+			// Empty
+			bottom.store(b+1, std::memory_order_relaxed);
+			return nullptr;
+		}
+		Task *task = buf->get(b);
+		if (t==b)
+		{
+			// Last item, so race with thieves for it
+			if (!top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed))
+				task = nullptr;
+			bottom.store(b+1, std::memory_order_relaxed);
+		}
+		return task;
+	}
+
+	Task *steal()
+	{
+		int64_t t = top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		int64_t b = bottom.load(std::memory_order_acquire);
+		if (t>=b)
+			return nullptr;
+		Buffer *buf = buffer.load(std::memory_order_acquire);
+		Task *task = buf->get(t);
+		if (!top.compare_exchange_strong(t, t+1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			return nullptr;
+		return task;
+	}
+};
+
+class WorkerThreads::Worker
+{
+public:
+	TaskDeque deque;
+	std::thread thread;
+	uint32_t stealRng;
+};
+
+// Worker which the current thread is, if any
+static thread_local WorkerThreads *currentPool = nullptr;
+static thread_local size_t currentWorkerId = 0;
+
+/* Shared state for one parallel_for call.
+ * The job is added to the task queues once for each helper. Each run() takes chunks until there are none left, then drops a reference. Queue entries which are only taken after all the chunks have been claimed just drop their reference, so the caller does not need to wait for them, only for chunks which have been claimed.
+ * Whichever thread drops the last reference owns the job, so that the calling thread can reuse it for its next parallel_for without allocating.
+ */
+class WorkerThreads::ParallelForJob : public Task
+{
+public:
+	RangeFunction f;
+	void *data;
+	int begin, end, grain, chunks;
+	std::atomic<int> nextChunk, chunksDone, refs;
+
+	void start(RangeFunction f_, void *data_, int begin_, int end_, int grain_, int chunks_, int refs_)
+	{
+		f = f_;
+		data = data_;
+		begin = begin_;
+		end = end_;
+		grain = grain_;
+		chunks = chunks_;
+		nextChunk.store(0, std::memory_order_relaxed);
+		chunksDone.store(0, std::memory_order_relaxed);
+		refs.store(refs_, std::memory_order_release);
+	}
+	void runChunks()
+	{
+		int c;
+		while ((c = nextChunk.fetch_add(1, std::memory_order_relaxed)) < chunks)
+		{
+			int chunkBegin = begin + c*grain;
+			f(data, chunkBegin, (c==chunks-1) ? end : chunkBegin+grain);
+			chunksDone.fetch_add(1, std::memory_order_release);
+		}
+	}
+	// Returns true if this was the last reference
+	bool release()
+	{
+		return (refs.fetch_sub(1, std::memory_order_acq_rel) == 1);
+	}
+	void run() override
+	{
+		runChunks();
+		if (release())
+			delete this;
+	}
+};
+
+static thread_local std::unique_ptr<WorkerThreads::Task> cachedParallelForJob;
+
+
+WorkerThreads::WorkerThreads(size_t threadCount) :
+	sharedQueueSize(0), pendingTasks(0), sleepingWorkers(0), shouldStop(false), slotCount(0)
+{
+	workers.reserve(threadCount);
+	for (size_t i=0; i<threadCount; i++)
+	{
+		workers.emplace_back(new Worker());
+		workers.back()->stealRng = 2463534242u + 0x9E3779B9u*uint32_t(i);
+	}
+	// Threads are started after all the deques have been created, since a worker may try to steal from any of them
+	for (size_t i=0; i<threadCount; i++)
+		workers[i]->thread = std::thread(&WorkerThreads::runWorker, this, i);
+}
+
+WorkerThreads::~WorkerThreads()
+{
+	stopThreads();
+
+	// Run anything which was not started. Running a task may add more tasks, which (since this is not a worker thread) go in sharedQueue.
+	for (auto &worker : workers)
+	{
+		while (Task *task = worker->deque.pop())
+			task->run();
+	}
+	while (!sharedQueue.empty())
+	{
+		Task *task = sharedQueue.front();
+		sharedQueue.pop_front();
+		task->run();
+	}
+
+	// All tasks have finished, so every slot is back in the free list
+	for (TaskSlot *slot : freeSlots)
+		delete slot;
+}
+
+std::shared_ptr<WorkerThreads> WorkerThreads::getShared()
+{
+	static std::shared_ptr<WorkerThreads> sharedWorkers = std::make_shared<WorkerThreads>(std::max(std::thread::hardware_concurrency(), 3u) - 1);
+	return sharedWorkers;
+}
+
+void WorkerThreads::stopThreads()
+{
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		shouldStop = true;
+	}
+	idleWaitCV.notify_all();
+
+	for (auto &worker : workers)
+	{
+		if (worker->thread.joinable())
+			worker->thread.join();
+	}
+}
+
+void WorkerThreads::submit(Task *task, int copies)
+{
+	// pendingTasks is increased first, so that it is never less than the number of tasks in the queues. This means a worker never goes to sleep while there is a task it could take.
+	pendingTasks.fetch_add(copies);
+	if (currentPool==this)
+	{
+		TaskDeque &deque = workers[currentWorkerId]->deque;
+		for (int i=0; i<copies; i++)
+			deque.push(task);
+	}
+	else
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		for (int i=0; i<copies; i++)
+			sharedQueue.push_back(task);
+		sharedQueueSize.fetch_add(copies, std::memory_order_relaxed);
+	}
+
+	// A sleeping worker increments sleepingWorkers and then checks pendingTasks while holding mtx, so either it sees the new task or it is seen here
+	int sleeping = sleepingWorkers.load();
+	if (sleeping>0)
+	{
+		{
+			std::lock_guard<std::mutex> l(mtx);
+		}
+		if (copies>1 && sleeping>1)
+			idleWaitCV.notify_all();
+		else
+			idleWaitCV.notify_one();
+	}
+}
+
+WorkerThreads::TaskSlot *WorkerThreads::acquireSlot()
+{
+	{
+		std::lock_guard<std::mutex> l(slotsMutex);
+		if (!freeSlots.empty())
+		{
+			TaskSlot *slot = freeSlots.back();
+			freeSlots.pop_back();
+			return slot;
+		}
+		slotCount++;
+	}
+	return new TaskSlot(this);
+}
+
+void WorkerThreads::releaseSlot(TaskSlot *slot)
+{
+	std::lock_guard<std::mutex> l(slotsMutex);
+	freeSlots.push_back(slot);
+}
+
+WorkerThreads::Task *WorkerThreads::findTask(size_t workerId)
+{
+	Worker &self = *workers[workerId];
+	Task *task = self.deque.pop();
+	if (!task && sharedQueueSize.load(std::memory_order_relaxed)>0)
+	{
+		std::lock_guard<std::mutex> l(mtx);
+		if (!sharedQueue.empty())
+		{
+			task = sharedQueue.front();
+			sharedQueue.pop_front();
+			sharedQueueSize.fetch_sub(1, std::memory_order_relaxed);
+		}
+	}
+	if (!task && workers.size()>1)
+	{
+		// Try each other worker once, starting at a random one
+		self.stealRng ^= self.stealRng << 13;
+		self.stealRng ^= self.stealRng >> 17;
+		self.stealRng ^= self.stealRng << 5;
+		size_t start = self.stealRng % workers.size();
+		for (size_t i=0; i<workers.size() && !task; i++)
+		{
+			size_t victim = (start+i) % workers.size();
+			if (victim!=workerId)
+				task = workers[victim]->deque.steal();
+		}
+	}
+	if (task)
+		pendingTasks.fetch_sub(1);
+	return task;
+}
+
+void WorkerThreads::runWorker(size_t workerId)
+{
+	const int spinCount = 64;
+	currentPool = this;
+	currentWorkerId = workerId;
+	while (!shouldStop.load(std::memory_order_relaxed))
+	{
+		Task *task = nullptr;
+		for (int spin=0; spin<spinCount && !task; spin++)
+		{
+			task = findTask(workerId);
+			if (!task)
+			{
+				if (pendingTasks.load(std::memory_order_relaxed)<=0)
+					break;
+				std::this_thread::yield();
+			}
+		}
+		if (task)
+		{
+			task->run();
+			continue;
+		}
+
+		std::unique_lock<std::mutex> l(mtx);
+		sleepingWorkers.fetch_add(1);
+		idleWaitCV.wait(l, [this](){ return (pendingTasks.load()>0 || shouldStop); });
+		sleepingWorkers.fetch_sub(1);
+	}
+	currentPool = nullptr;
+}
+
+void WorkerThreads::parallel_for_impl(int begin, int end, int grain, int maxThreads, RangeFunction f, void *data)
+{
+	if (end<=begin)
+		return;
+	grain = std::max(grain, 1);
+	int chunks = int((int64_t(end)-begin+grain-1)/grain);
+	int helpers = std::min<int64_t>(chunks-1, workers.size());
+	if (maxThreads>0)
+		helpers = std::min(helpers, maxThreads-1);
+	if (helpers<=0)
+	{
+		f(data, begin, end);
+		return;
+	}
+
+	ParallelForJob *job = static_cast<ParallelForJob*>(cachedParallelForJob.release());
+	if (!job)
+		job = new ParallelForJob();
+	job->start(f, data, begin, end, grain, chunks, helpers+1);
+	submit(job, helpers);
+
+	job->runChunks();
+	// Only chunks which have already been claimed by another thread are left, so wait for those to finish
+	while (job->chunksDone.load(std::memory_order_acquire) < chunks)
+		std::this_thread::yield();
+
+	if (job->release())
+		cachedParallelForJob.reset(job);
+}
@@ -16,100 +16,194 @@
 #ifndef Threading_h
 #define Threading_h
 
-#include <functional>
-#include <thread>
+#include <atomic>
 #include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
 #include <future>
-#include <queue>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include "common/Compat.hpp"
 
+/*
+ * Thread pool with a work stealing scheduler.
+ *
+ * Each worker thread has its own lock-free task deque. Tasks added by a worker thread go on the bottom of that worker's deque, and the worker takes tasks from the bottom too, so nested work runs while its data is still in cache. Idle workers steal from the top of other workers' deques.
+ * Tasks added by any other thread (such as the main thread) go into a shared queue, and are started in the order they were added.
+ * Idle workers spin briefly looking for work, then sleep until a task is added.
+ */
 class WorkerThreads
 {
+public:
+	// An entry in the task queues. run() is called once for each time the task was added to a queue.
+	class Task
+	{
+	public:
+		virtual void run() = 0;
+		virtual ~Task() {}
+	};
+
 protected:
-	std::queue<std::function<void()> > taskQueue;
-	std::vector<std::thread> threads;
-	std::condition_variable idleWaitCV;
-	std::mutex mtx;
-	bool shouldStop;
-	TH_ENTRY_POINT void runWorker()
+	/* Queue entry for asyncTask.
+	 * Slots are reused (see acquireSlot and releaseSlot), and the function is stored inside the slot unless it is larger than inlineSize, so usually the only allocation for a task is the shared state of its future.
+	 */
+	class TaskSlot : public Task
 	{
-		while (true)
+	public:
+		// Large enough for the background air simulation tasks, which take a copy of the air simulation parameters
+		static const size_t inlineSize = 256;
+		WorkerThreads *pool;
+		void *fn;// points to storage, or to a heap allocated function if it did not fit
+		void (*invokeFn)(void *fn);
+		void (*destroyFn)(void *fn);
+		typename std::aligned_storage<inlineSize, alignof(std::max_align_t)>::type storage;
+
+		explicit TaskSlot(WorkerThreads *pool_) : pool(pool_), fn(nullptr), invokeFn(nullptr), destroyFn(nullptr) {}
+		template<class fn_t>
+		struct FitsInline : std::integral_constant<bool, sizeof(fn_t)<=inlineSize && alignof(fn_t)<=alignof(std::max_align_t)> {};
+		template<class Function>
+		void set(Function &&f)
+		{
+			typedef typename std::decay<Function>::type fn_t;
+			// Chosen at compile time, so that placement new is not instantiated for functions which are too large for the storage
+			construct<fn_t>(std::forward<Function>(f), FitsInline<fn_t>());
+			invokeFn = [](void *p) {
+				(*static_cast<fn_t*>(p))();
+			};
+		}
+		bool isInline() const
 		{
-			std::function<void()> task;
-			bool runTask = false;
+			return fn==&storage;
+		}
+		void run() override
+		{
+			invokeFn(fn);
+			destroyFn(fn);
+			fn = nullptr;
+			pool->releaseSlot(this);
+		}
+	protected:
+		template<class fn_t, class Function>
+		void construct(Function &&f, std::true_type)
+		{
+			fn = ::new (&storage) fn_t(std::forward<Function>(f));
+			destroyFn = [](void *p) {
+				static_cast<fn_t*>(p)->~fn_t();
+			};
+		}
+		template<class fn_t, class Function>
+		void construct(Function &&f, std::false_type)
+		{
+			fn = new fn_t(std::forward<Function>(f));
+			destroyFn = [](void *p) {
+				delete static_cast<fn_t*>(p);
+			};
+		}
+	};
 
+	// Calls a function and stores the result (or exception) in a promise
+	template<class Result, class Function>
+	class PromiseCall
+	{
+	public:
+		std::promise<Result> promise;
+		Function f;
+		PromiseCall(std::promise<Result> &&promise_, Function &&f_) : promise(std::move(promise_)), f(std::move(f_)) {}
+		void operator()()
+		{
+			try
 			{
-				std::unique_lock<std::mutex> l(mtx);
-				if (taskQueue.empty() && !shouldStop)
-					idleWaitCV.wait(l, [this](){ return (!taskQueue.empty() || shouldStop); });
-
-				if (shouldStop)
-				{
-					return;
-				}
-				if (!taskQueue.empty())
-				{
-					runTask = true;
-					task = taskQueue.front();
-					taskQueue.pop();
-				}
+				setValue(promise, f);
+			}
+			catch (...)
+			{
+				promise.set_exception(std::current_exception());
 			}
-
-			if (runTask)
-				task();
 		}
+	};
+	template<class Result, class Function>
+	static void setValue(std::promise<Result> &promise, Function &f)
+	{
+		promise.set_value(f());
 	}
-	void stopThreads()
+	template<class Function>
+	static void setValue(std::promise<void> &promise, Function &f)
 	{
-		{
-			std::lock_guard<std::mutex> l(mtx);
-			shouldStop = true;
-		}
-		idleWaitCV.notify_all();
-
-		for (auto it=threads.begin(); it!=threads.end(); ++it)
-			it->join();
-		threads.resize(0);
+		f();
+		promise.set_value();
 	}
 
+	class TaskDeque;
+	class Worker;
+	class ParallelForJob;
+	typedef void (*RangeFunction)(void *data, int begin, int end);
+
+	std::vector<std::unique_ptr<Worker> > workers;
+	// Tasks added by threads which are not workers in this pool. Protected by mtx.
+	std::deque<Task*> sharedQueue;
+	std::atomic<int> sharedQueueSize;
+	// Number of tasks which have been added but not yet taken out of a queue, used to decide whether workers can sleep
+	std::atomic<int> pendingTasks;
+	std::atomic<int> sleepingWorkers;
+	std::atomic<bool> shouldStop;
+	std::condition_variable idleWaitCV;
+	std::mutex mtx;
+	// asyncTask slots which are not in use, and the total number of slots which have been created. Protected by slotsMutex.
+	std::vector<TaskSlot*> freeSlots;
+	size_t slotCount;
+	std::mutex slotsMutex;
+
+	TH_ENTRY_POINT void runWorker(size_t workerId);
+	Task *findTask(size_t workerId);
+	// Adds a task to the queues 'copies' times
+	void submit(Task *task, int copies);
+	void stopThreads();
+	TaskSlot *acquireSlot();
+	void releaseSlot(TaskSlot *slot);
+	void parallel_for_impl(int begin, int end, int grain, int maxThreads, RangeFunction f, void *data);
+
 public:
+	// Runs f(args...) on a worker thread
 	template<class Function, class... Args>
 	std::shared_future<typename std::result_of<Function(Args...)>::type> asyncTask(Function&& f, Args&&... args)
 	{
-		using taskpkg_t = std::packaged_task<typename std::result_of<Function(Args...)>::type()>;
-		auto task = new taskpkg_t(std::bind(std::forward<Function>(f), std::forward<Args>(args)...));
-		auto taskFuture = task->get_future().share();
-
-		{
-			std::lock_guard<std::mutex> l(mtx);
-			taskQueue.emplace([task](){
-				(*task)();
-				delete task;
-			});
-		}
-
-		idleWaitCV.notify_one();
+		typedef typename std::result_of<Function(Args...)>::type result_t;
+		typedef decltype(std::bind(std::forward<Function>(f), std::forward<Args>(args)...)) bound_t;
+		std::promise<result_t> promise;
+		auto taskFuture = promise.get_future().share();
+		TaskSlot *slot = acquireSlot();
+		slot->set(PromiseCall<result_t, bound_t>(std::move(promise), std::bind(std::forward<Function>(f), std::forward<Args>(args)...)));
+		submit(slot, 1);
 		return taskFuture;
 	}
 
-	WorkerThreads(size_t threadCount=1) : shouldStop(false)
+	/* Calls f(rangeBegin, rangeEnd) for consecutive chunks of [begin, end), each chunk being grain items long (apart from the last one), and returns once all chunks are done.
+	 * The calling thread works on chunks too, with up to maxThreads-1 workers helping (maxThreads=0 means no limit apart from the size of the pool). Chunks are handed out one at a time as threads become free, so uneven chunks still balance out.
+	 * Nothing is allocated per chunk, and f is not copied, so f can be a lambda capturing local variables by reference. This can be called from inside a task (including from f in another parallel_for).
+	 */
+	template<class Function>
+	void parallel_for(int begin, int end, int grain, Function &&f, int maxThreads=0)
 	{
-		threads.reserve(threadCount);
-		for (size_t i=0; i<threadCount; i++)
-			threads.emplace_back(std::thread(&WorkerThreads::runWorker, this));
+		typedef typename std::remove_reference<Function>::type fn_t;
+		parallel_for_impl(begin, end, grain, maxThreads, [](void *data, int rangeBegin, int rangeEnd) {
+			(*static_cast<fn_t*>(data))(rangeBegin, rangeEnd);
+		}, const_cast<void*>(static_cast<const void*>(&f)));
 	}
-	virtual ~WorkerThreads()
-	{
-		stopThreads();
 
-		while (!taskQueue.empty())
-		{
-			std::function<void()> task = taskQueue.front();
-			task();
-			taskQueue.pop();
-		}
-	}
+	size_t threadCount() const { return workers.size(); }
+
+	// Pool shared by all the parts of the simulation which use multiple threads (air, gravity, and the tiled particle update), so that each one does not need its own threads
+	// Tasks added from outside the pool start in the order they were added, so such a task may wait for one added before it, but must not wait for one added after it
+	static std::shared_ptr<WorkerThreads> getShared();
+
+	WorkerThreads(size_t threadCount=1);
+	// Tasks which have not been started yet are run by the thread calling the destructor
+	virtual ~WorkerThreads();
 };
 
 
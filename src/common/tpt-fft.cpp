@@ -0,0 +1,254 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common/tpt-fft.h"
+#include <algorithm>
+#include <cmath>
+
+tpt_fft::tpt_fft(int n_) :
+	n(n_), maxRadix(1)
+{
+	// Split n into factors, using radix 4 where possible since that butterfly is the cheapest per element
+	int remaining = n, p = 4;
+	while (remaining>1)
+	{
+		while (remaining%p)
+		{
+			if (p==4)
+				p = 2;
+			else if (p==2)
+				p = 3;
+			else
+				p += 2;
+			if (p*p>remaining)
+				p = remaining;
+		}
+		remaining /= p;
+		factors.push_back(p);
+		factors.push_back(remaining);
+		maxRadix = std::max(maxRadix, p);
+	}
+	if (factors.empty())
+	{
+		factors.push_back(1);
+		factors.push_back(1);
+	}
+	scratch.resize(maxRadix);
+
+	twiddlesFwd.resize(n);
+	twiddlesInv.resize(n);
+	const double pi = 3.14159265358979323846;
+	for (int i=0; i<n; i++)
+	{
+		double phase = -2*pi*i/n;
+		twiddlesFwd[i] = cpx(std::cos(phase), std::sin(phase));
+		twiddlesInv[i] = std::conj(twiddlesFwd[i]);
+	}
+}
+
+void tpt_fft::forward(const cpx *in, cpx *out, int inStride)
+{
+	work(out, in, 1, inStride, factors.data(), twiddlesFwd.data());
+}
+
+void tpt_fft::inverse(const cpx *in, cpx *out, int inStride)
+{
+	work(out, in, 1, inStride, factors.data(), twiddlesInv.data());
+}
+
+// Decimation in time: out[q*m .. q*m+m-1] is set to the transform of every p-th input element starting at element q, then these are combined by a radix p butterfly
+void tpt_fft::work(cpx *out, const cpx *in, int fstride, int inStride, const int *f, const cpx *tw)
+{
+	const int p = f[0], m = f[1];
+	if (m==1)
+	{
+		for (int q=0; q<p; q++)
+			out[q] = in[q*fstride*inStride];
+	}
+	else
+	{
+		for (int q=0; q<p; q++)
+			work(out+q*m, in+q*fstride*inStride, fstride*p, inStride, f+2, tw);
+	}
+
+	switch (p)
+	{
+	case 1:
+		break;
+	case 2:
+		butterfly2(out, fstride, m, tw);
+		break;
+	case 3:
+		butterfly3(out, fstride, m, tw);
+		break;
+	case 4:
+		butterfly4(out, fstride, m, tw, tw==twiddlesInv.data());
+		break;
+	default:
+		butterflyGeneric(out, fstride, m, p, tw);
+		break;
+	}
+}
+
+void tpt_fft::butterfly2(cpx *out, int fstride, int m, const cpx *tw)
+{
+	for (int k=0; k<m; k++)
+	{
+		cpx t = out[k+m]*tw[k*fstride];
+		out[k+m] = out[k]-t;
+		out[k] += t;
+	}
+}
+
+void tpt_fft::butterfly3(cpx *out, int fstride, int m, const cpx *tw)
+{
+	// Imaginary part of exp(-+2*pi*i/3), depending on direction
+	const float epi3 = tw[fstride*m].imag();
+	for (int k=0; k<m; k++)
+	{
+		cpx s1 = out[k+m]*tw[k*fstride];
+		cpx s2 = out[k+2*m]*tw[2*k*fstride];
+		cpx s3 = s1+s2;
+		cpx t = (s1-s2)*epi3;
+		cpx base = out[k] - s3*0.5f;
+		out[k] += s3;
+		out[k+m] = cpx(base.real()-t.imag(), base.imag()+t.real());
+		out[k+2*m] = cpx(base.real()+t.imag(), base.imag()-t.real());
+	}
+}
+
+void tpt_fft::butterfly4(cpx *out, int fstride, int m, const cpx *tw, bool inverse)
+{
+	for (int k=0; k<m; k++)
+	{
+		cpx a = out[k];
+		cpx b = out[k+m]*tw[k*fstride];
+		cpx c = out[k+2*m]*tw[2*k*fstride];
+		cpx d = out[k+3*m]*tw[3*k*fstride];
+		cpx s0 = a+c, s1 = a-c, s2 = b+d, s3 = b-d;
+		// s3 multiplied by -i (forward) or i (inverse)
+		cpx s3r = inverse ? cpx(-s3.imag(), s3.real()) : cpx(s3.imag(), -s3.real());
+		out[k] = s0+s2;
+		out[k+m] = s1+s3r;
+		out[k+2*m] = s0-s2;
+		out[k+3*m] = s1-s3r;
+	}
+}
+
+void tpt_fft::butterflyGeneric(cpx *out, int fstride, int m, int p, const cpx *tw)
+{
+	for (int u=0; u<m; u++)
+	{
+		for (int q=0; q<p; q++)
+			scratch[q] = out[u+q*m];
+		for (int q1=0; q1<p; q1++)
+		{
+			const int k = u+q1*m;
+			cpx sum = scratch[0];
+			int twIdx = 0;
+			for (int q=1; q<p; q++)
+			{
+				twIdx += fstride*k;
+				if (twIdx>=n)
+					twIdx %= n;
+				sum += scratch[q]*tw[twIdx];
+			}
+			out[k] = sum;
+		}
+	}
+}
+
+
+tpt_fft_real2d::tpt_fft_real2d(int nx_, int ny_) :
+	nx(nx_), ny(ny_), nxComplex(nx_/2+1), rowFft(nx_), colFft(ny_),
+	rowIn(nx_), rowOut(nx_), colOut(ny_), tmp(ny_*(nx_/2+1))
+{}
+
+void tpt_fft_real2d::forward(const float *in, cpx *out)
+{
+	// Transform rows two at a time, by putting one row in the real part and the other in the imaginary part of a complex FFT
+	for (int y=0; y<ny; y+=2)
+	{
+		const float *a = in + y*nx;
+		const bool hasB = (y+1<ny);
+		const float *b = in + (y+1)*nx;
+		for (int x=0; x<nx; x++)
+			rowIn[x] = cpx(a[x], hasB ? b[x] : 0.0f);
+		rowFft.forward(rowIn.data(), rowOut.data());
+		cpx *outA = out + y*nxComplex, *outB = out + (y+1)*nxComplex;
+		for (int k=0; k<nxComplex; k++)
+		{
+			cpx z = rowOut[k], zc = std::conj(rowOut[(nx-k)%nx]);
+			outA[k] = (z+zc)*0.5f;
+			if (hasB)
+			{
+				cpx d = (z-zc)*0.5f;
+				outB[k] = cpx(d.imag(), -d.real());
+			}
+		}
+	}
+
+	for (int x=0; x<nxComplex; x++)
+	{
+		colFft.forward(out+x, colOut.data(), nxComplex);
+		for (int y=0; y<ny; y++)
+			out[y*nxComplex+x] = colOut[y];
+	}
+}
+
+void tpt_fft_real2d::inverse(const cpx *in, float *out)
+{
+	for (int x=0; x<nxComplex; x++)
+	{
+		colFft.inverse(in+x, colOut.data(), nxComplex);
+		for (int y=0; y<ny; y++)
+			tmp[y*nxComplex+x] = colOut[y];
+	}
+
+	// Inverse of forward(): rebuild the full spectrum of (row a) + i*(row b) from the half spectra of the two rows
+	for (int y=0; y<ny; y+=2)
+	{
+		const bool hasB = (y+1<ny);
+		const cpx *a = tmp.data() + y*nxComplex, *b = tmp.data() + (y+1)*nxComplex;
+		for (int k=0; k<nx; k++)
+		{
+			cpx va, vb;
+			if (k<nxComplex)
+			{
+				va = a[k];
+				vb = hasB ? b[k] : cpx(0.0f, 0.0f);
+			}
+			else
+			{
+				va = std::conj(a[nx-k]);
+				vb = hasB ? std::conj(b[nx-k]) : cpx(0.0f, 0.0f);
+			}
+			if (k==0 || 2*k==nx)
+			{
+				va = cpx(va.real(), 0.0f);
+				vb = cpx(vb.real(), 0.0f);
+			}
+			rowIn[k] = cpx(va.real()-vb.imag(), va.imag()+vb.real());
+		}
+		rowFft.inverse(rowIn.data(), rowOut.data());
+		float *outA = out + y*nx, *outB = out + (y+1)*nx;
+		for (int x=0; x<nx; x++)
+		{
+			outA[x] = rowOut[x].real();
+			if (hasB)
+				outB[x] = rowOut[x].imag();
+		}
+	}
+}
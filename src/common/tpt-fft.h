@@ -0,0 +1,73 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef tptfft_h
+#define tptfft_h
+
+#include <complex>
+#include <vector>
+
+/*
+ * Simple FFTs, used instead of FFTW when it is not available.
+ *
+ * tpt_fft: 1D complex FFT of any size (mixed radix Cooley-Tukey, with special cases for radix 2, 3 and 4). Sizes with only small prime factors are fastest.
+ * tpt_fft_real2d: 2D FFT of real data, with the same data layout as fftwf_plan_dft_r2c_2d and fftwf_plan_dft_c2r_2d.
+ *
+ * Like FFTW, the transforms are unnormalised: a forward transform followed by an inverse transform multiplies the data by the number of elements.
+ * Each object holds scratch space, so one object must not be used by more than one thread at a time.
+ */
+
+class tpt_fft
+{
+public:
+	typedef std::complex<float> cpx;
+protected:
+	int n;
+	int maxRadix;
+	std::vector<int> factors;// pairs of (radix, size remaining after dividing by this and previous radixes)
+	std::vector<cpx> twiddlesFwd, twiddlesInv;
+	std::vector<cpx> scratch;
+
+	void work(cpx *out, const cpx *in, int fstride, int inStride, const int *f, const cpx *tw);
+	void butterfly2(cpx *out, int fstride, int m, const cpx *tw);
+	void butterfly3(cpx *out, int fstride, int m, const cpx *tw);
+	void butterfly4(cpx *out, int fstride, int m, const cpx *tw, bool inverse);
+	void butterflyGeneric(cpx *out, int fstride, int m, int p, const cpx *tw);
+public:
+	explicit tpt_fft(int n_);
+	int size() const { return n; }
+	// in and out must not overlap. inStride is the distance between consecutive input elements.
+	void forward(const cpx *in, cpx *out, int inStride=1);
+	void inverse(const cpx *in, cpx *out, int inStride=1);
+};
+
+class tpt_fft_real2d
+{
+public:
+	typedef tpt_fft::cpx cpx;
+protected:
+	int nx, ny, nxComplex;
+	tpt_fft rowFft, colFft;
+	std::vector<cpx> rowIn, rowOut, colOut, tmp;
+public:
+	// Real data is ny rows of nx values, transformed data is ny rows of nx/2+1 complex values
+	tpt_fft_real2d(int nx_, int ny_);
+	int complexSize() const { return ny*nxComplex; }
+	void forward(const float *in, cpx *out);
+	// As with FFTW, the input should be the transform of real data (or a product of such transforms). Imaginary parts which would be zero for such data are ignored.
+	void inverse(const cpx *in, float *out);
+};
+
+#endif
@@ -16,17 +16,42 @@
 #include "common/tpt-rng.h"
 #include <time.h>
 
+thread_local RandomStore_auto *RandomStore_threadable::threadStore = nullptr;
+
 tpt_rng::tpt_rng()
 {
-	gen.seed(time(NULL));
+	seed(time(NULL));
 }
 
-uint_fast32_t tpt_rng::randUint32()
+void tpt_rng::philox4x32(const uint32_t ctrIn[4], const uint32_t keyIn[2], uint32_t out[4])
 {
-	return gen();
+	const uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;
+	const uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;
+	uint32_t c0 = ctrIn[0], c1 = ctrIn[1], c2 = ctrIn[2], c3 = ctrIn[3];
+	uint32_t k0 = keyIn[0], k1 = keyIn[1];
+	for (int round=0; round<10; round++)
+	{
+		uint64_t p0 = uint64_t(M0)*c0;
+		uint64_t p1 = uint64_t(M1)*c2;
+		uint32_t hi0 = uint32_t(p0>>32), lo0 = uint32_t(p0);
+		uint32_t hi1 = uint32_t(p1>>32), lo1 = uint32_t(p1);
+		c0 = hi1^c1^k0;
+		c1 = lo1;
+		c2 = hi0^c3^k1;
+		c3 = lo0;
+		k0 += W0;
+		k1 += W1;
+	}
+	out[0] = c0;
+	out[1] = c1;
+	out[2] = c2;
+	out[3] = c3;
 }
 
-uint_fast64_t tpt_rng::randUint64()
+void tpt_rng::nextBlock()
 {
-	return (uint_fast64_t(gen())<<32) | gen();
+	philox4x32(ctr, key, block);
+	if (!++ctr[0])
+		++ctr[1];
+	blockPos = 0;
 }
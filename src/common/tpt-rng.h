@@ -16,12 +16,12 @@
 #ifndef tptrng_h
 #define tptrng_h
 
-#include <random>
+#include "common/tpt-stdint.h"
 
 /*
  * Classes to help with using random numbers in TPT
  *
- * tpt_rng: wrapper around a C++11 random number generator
+ * tpt_rng: counter-based random number generator, with functions to get random numbers in various forms
  * RandomStore and RandomStore_auto: classes to help split a random number into several smaller random numbers, in an attempt to reduce the amount of time spent generating random numbers.
  *
  *
@@ -57,8 +57,13 @@
 class tpt_rng
 {
 protected:
-	// TODO: test effects of different generators on Simulation (speed, and are numbers still random enough with different generators).
-	std::mt19937 gen;
+	// Philox4x32-10 counter-based generator (Salmon et al. 2011, "Parallel random numbers: as easy as 1, 2, 3")
+	// Each block of 4 random numbers is a function of just the key and the counter, so the state is small and many independent streams can be created cheaply (see seed(seedVal, streamId)).
+	uint32_t key[2];
+	uint32_t ctr[4];// ctr[0..1]: block number within the stream, ctr[2..3]: stream ID
+	uint32_t block[4];
+	int blockPos;
+	void nextBlock();
 
 	static constexpr uint_fast32_t getChanceThreshold_frac(uint_fast32_t numerator, uint_fast32_t denominator)
 	{
@@ -81,13 +86,35 @@ public:
 	tpt_rng();
 	void seed(uint_fast32_t val)
 	{
-		gen.seed(val);
+		seed(val, 0);
 	}
+	// Start stream number streamId for the given seed. Different streams do not overlap, so code that might run in a different order (e.g. on multiple threads) can get the same results for a given seed by using a separate stream for each independent piece of work,
+	// e.g. rng.seed(frameSeed, particleId)
+	void seed(uint64_t seedVal, uint64_t streamId)
+	{
+		key[0] = uint32_t(seedVal);
+		key[1] = uint32_t(seedVal>>32);
+		ctr[0] = ctr[1] = 0;
+		ctr[2] = uint32_t(streamId);
+		ctr[3] = uint32_t(streamId>>32);
+		blockPos = 4;
+	}
+
+	// Philox4x32-10 applied to a single counter value. Exposed mainly for testing against the reference implementation.
+	static void philox4x32(const uint32_t ctrIn[4], const uint32_t keyIn[2], uint32_t out[4]);
 
 	// These should always return the specified number of bits of random data.
-	// (So if the generator is changed from mt19937 to something else, these functions should be modified if necessary, possibly using std::independent_bits_engine)
-	uint_fast32_t randUint32();
-	uint_fast64_t randUint64();
+	uint_fast32_t randUint32()
+	{
+		if (blockPos>=4)
+			nextBlock();
+		return block[blockPos++];
+	}
+	uint_fast64_t randUint64()
+	{
+		uint_fast64_t hi = randUint32();
+		return (hi<<32) | randUint32();
+	}
 
 	/* Functions which return true with approximately the specified chance.
 	 * If the arguments in the calling functions are constants, then any decent optimising compiler should be able to calculate getChanceThreshold at compile time. (This has been tested - in g++ with optimisations on, calling any of these chance functions produces instructions which just generate a random number, then compare it to a constant, no calculation is performed at runtime to get the constant).
@@ -321,4 +348,48 @@ public:
 	uint_fast64_t randUint64() { return rng->randUint64(); }
 };
 
+// Wrapper around RandomStore_auto for code which may be run on several threads at once (e.g. the tiled particle update).
+// Normally all functions use the RandomStore_auto passed to the constructor. While thread stores are enabled, after a thread calls setThreadStore(store), functions called from that thread use that store instead, until setThreadStore(nullptr) is called.
+// Thread stores are only checked while enabled, so that single threaded code does not pay for the thread_local lookup on every call.
+class RandomStore_threadable
+{
+protected:
+	RandomStore_auto defaultStore;
+	bool threadStoresEnabled;
+	static thread_local RandomStore_auto *threadStore;
+public:
+	RandomStore_threadable(tpt_rng *rng_) : defaultStore(rng_), threadStoresEnabled(false)
+	{}
+	static void setThreadStore(RandomStore_auto *store)
+	{
+		threadStore = store;
+	}
+	void enableThreadStores(bool enabled)
+	{
+		threadStoresEnabled = enabled;
+	}
+	RandomStore_auto& get()
+	{
+		if (threadStoresEnabled && threadStore)
+			return *threadStore;
+		return defaultStore;
+	}
+
+	void clearStore() { get().clearStore(); }
+	uint_fast32_t getRandomBits(int bitsNeeded) { return get().getRandomBits(bitsNeeded); }
+	int randInt(int minVal, int maxVal, int bitsToUse) { return get().randInt(minVal, maxVal, bitsToUse); }
+	int randInt(int minVal, int maxVal) { return get().randInt(minVal, maxVal); }
+	bool chance(uint_fast32_t numerator, uint_fast32_t denominator) { return get().chance(numerator, denominator); }
+	template <int minVal, int maxVal>
+	int randInt() { return get().template randInt<minVal,maxVal>(); }
+	template <uint_fast32_t numerator, uint_fast32_t denominator>
+	bool chance() { return get().template chance<numerator,denominator>(); }
+	float randFloat(float minVal, float maxVal) { return get().randFloat(minVal, maxVal); }
+	float randFloat() { return get().randFloat(); }
+	bool chancef(float p) { return get().chancef(p); }
+	bool chancef(double p) { return get().chancef(p); }
+	uint_fast32_t randUint32() { return get().randUint32(); }
+	uint_fast64_t randUint64() { return get().randUint64(); }
+};
+
 #endif
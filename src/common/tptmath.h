@@ -17,6 +17,11 @@
 #define tptmath_h
 
 #include <cmath>
+#include "common/tpt-stdint.h"
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 class tptmath
 {
@@ -57,6 +62,68 @@ public:
 		return std::fmod(x, y) + (x>=0 ? 0 : y);
 	}
 
+	// Index of the lowest set bit. x must not be zero.
+	static int ctz64(uint64_t x)
+	{
+#if defined(__GNUC__)
+		return __builtin_ctzll(x);
+#elif defined(_MSC_VER) && defined(_WIN64)
+		unsigned long i;
+		_BitScanForward64(&i, x);
+		return i;
+#else
+		int i = 0;
+		while (!(x&1))
+		{
+			x >>= 1;
+			i++;
+		}
+		return i;
+#endif
+	}
+	// Index of the highest set bit. x must not be zero.
+	static int bsr64(uint64_t x)
+	{
+#if defined(__GNUC__)
+		return 63-__builtin_clzll(x);
+#elif defined(_MSC_VER) && defined(_WIN64)
+		unsigned long i;
+		_BitScanReverse64(&i, x);
+		return i;
+#else
+		int i = 0;
+		while (x>>=1)
+			i++;
+		return i;
+#endif
+	}
+	// Number of set bits
+	static int popcount32(uint32_t x)
+	{
+#if defined(__GNUC__)
+		return __builtin_popcount(x);
+#else
+		x = x - ((x>>1) & 0x55555555);
+		x = (x & 0x33333333) + ((x>>2) & 0x33333333);
+		x = (x + (x>>4)) & 0x0F0F0F0F;
+		return (x * 0x01010101) >> 24;
+#endif
+	}
+	// Z-order (Morton) index of 16 bit coordinates: bits of x go in even bit positions, bits of y in odd bit positions
+	static uint32_t morton2d(uint16_t x, uint16_t y)
+	{
+		uint32_t mx = x, my = y;
+		mx = (mx | (mx<<8)) & 0x00FF00FF;
+		mx = (mx | (mx<<4)) & 0x0F0F0F0F;
+		mx = (mx | (mx<<2)) & 0x33333333;
+		mx = (mx | (mx<<1)) & 0x55555555;
+		my = (my | (my<<8)) & 0x00FF00FF;
+		my = (my | (my<<4)) & 0x0F0F0F0F;
+		my = (my | (my<<2)) & 0x33333333;
+		my = (my | (my<<1)) & 0x55555555;
+		return mx | (my<<1);
+	}
+
 	// X ~ binomial(n,p), returns P(X>=1)
 	// e.g. If a reaction has n chances of occurring, each time with probability p, this returns the probability that it occurs at least once.
 	static float binomial_gte1(int n, float p)
@@ -54,6 +54,9 @@
 #include "images.h"
 #endif
 
+#include "common/Compat.hpp"
+#include "common/Intrinsics.hpp"
+#include "common/Threading.hpp"
 #include "common/tptmath.h"
 #include "simulation/Simulation.h"
 #include "simulation/SimulationSharedData.h"
@@ -61,18 +64,14 @@
 #include "simulation/walls/WallTypes.hpp"
 #include "simulation/CellsData_fastloop.hpp"
 #include "graphics/ARGBColour.h"
+#include <algorithm>
+#include <vector>
 
 #ifdef HIGH_QUALITY_RESAMPLE
 #include "lib/resampler/resampler.h"
 #include <algorithm>
 #endif
 
-#if defined(__MMX__)
-#include <mmintrin.h>
-#if defined(__SSE__)
-#include <xmmintrin.h>
-#endif
-#endif
 
 #include "simulation/elements/EMP.hpp"
 #include "simulation/elements/PRTI.h"
@@ -206,8 +205,6 @@ unsigned char fire_g[YRES/CELL][XRES/CELL];
 unsigned char fire_b[YRES/CELL][XRES/CELL];
 
 unsigned int fire_alpha[CELL*3][CELL*3];
-uint64_t fire_alpha_mmx[CELL*3][CELL*3];
-bool fire_mmx = true;
 pixel *pers_bg;
 
 char * flm_data;
@@ -2004,474 +2001,709 @@ GLfloat blurLineV[(((YRES*XRES)*2))];
 GLfloat blurLineC[(((YRES*XRES)*2)*4)];
 GLfloat ablurLineV[(((YRES*XRES)*2))];
 GLfloat ablurLineC[(((YRES*XRES)*2)*4)];
+// Number of values and vertices in each of the above arrays, reset by render_parts
+static int cfireV, cfireC, cfire;
+static int csmokeV, csmokeC, csmoke;
+static int cblobV, cblobC, cblob;
+static int cblurV, cblurC, cblur;
+static int cglowV, cglowC, cglow;
+static int cflatV, cflatC, cflat;
+static int caddV, caddC, cadd;
+static int clineV, clineC, cline;
+static int cblurLineV, cblurLineC, cblurLine;
+static int cablurLineV, cablurLineC, cablurLine;
 #endif
-void render_parts(pixel *vid)
+int render_threads = 0;
+
+// How one particle will be drawn, worked out before anything is drawn
+class PartRenderInfo
+{
+public:
+	int i, t, nx, ny;
+	int pixel_mode;
+	int cola, colr, colg, colb;
+	int firea, firer, fireg, fireb;
+	// Random numbers for PMODE_SPARK, PMODE_FLARE and PMODE_LFLARE
+	unsigned char flicker[3];
+	// Text and debug lines which are drawn outside the rows between yMin and yMax
+	bool drawHp, drawChannelLines;
+	// Range of rows which drawing this particle may change
+	int yMin, yMax;
+	const Stickman_data *cplayer;
+};
+
+// Whole screen, for drawing particles on a single thread without the row checks in PartsRenderStrip
+class PartsRenderScreen
+{
+public:
+	pixel *vid;
+	explicit PartsRenderScreen(pixel *vid_) : vid(vid_) {}
+	void setpixel(int x, int y, pixel c)
+	{
+		vid[y*(XRES+BARSIZE)+x] = c;
+	}
+	void blendpixel(int x, int y, int r, int g, int b, int a)
+	{
+		::blendpixel(vid, x, y, r, g, b, a);
+	}
+	void addpixel(int x, int y, int r, int g, int b, int a)
+	{
+		::addpixel(vid, x, y, r, g, b, a);
+	}
+	void draw_line(int x1, int y1, int x2, int y2, int r, int g, int b)
+	{
+		::draw_line(vid, x1, y1, x2, y2, r, g, b, XRES+BARSIZE);
+	}
+};
+
+// Rows yStart to yEnd-1 of the screen, which one thread is drawing particles into.
+// Pixels outside these rows are skipped, so a particle which overlaps several strips can be drawn by each of the threads without any pixel being drawn twice.
+class PartsRenderStrip
+{
+public:
+	pixel *vid;
+	int yStart, yEnd;
+	PartsRenderStrip(pixel *vid_, int yStart_, int yEnd_) : vid(vid_), yStart(yStart_), yEnd(yEnd_) {}
+	bool containsRow(int y) const { return (y>=yStart && y<yEnd); }
+	void setpixel(int x, int y, pixel c)
+	{
+		if (containsRow(y))
+			vid[y*(XRES+BARSIZE)+x] = c;
+	}
+	void blendpixel(int x, int y, int r, int g, int b, int a)
+	{
+		if (containsRow(y))
+			::blendpixel(vid, x, y, r, g, b, a);
+	}
+	void addpixel(int x, int y, int r, int g, int b, int a)
+	{
+		if (containsRow(y))
+			::addpixel(vid, x, y, r, g, b, a);
+	}
+	// Same as draw_line (with width XRES+BARSIZE), but only drawing the pixels in this strip
+	void draw_line(int x1, int y1, int x2, int y2, int r, int g, int b)
+	{
+		int dx, dy, i, sx, sy, check, e, x, y;
+		const int w = XRES+BARSIZE;
+
+		dx = abs(x1-x2);
+		dy = abs(y1-y2);
+		sx = tptmath::isign(x2-x1);
+		sy = tptmath::isign(y2-y1);
+		x = x1;
+		y = y1;
+		check = 0;
+
+		if (dy>dx)
+		{
+			dx = dx+dy;
+			dy = dx-dy;
+			dx = dx-dy;
+			check = 1;
+		}
+
+		e = (dy<<2)-dx;
+		for (i=0; i<=dx; i++)
+		{
+			if (x>=0 && x<w && containsRow(y) && y>=0 && y<YRES+MENUSIZE)
+				vid[x+y*w] = PIXRGB(r, g, b);
+			if (e>=0)
+			{
+				if (check==1)
+					x = x+sx;
+				else
+					y = y+sy;
+				e = e-(dx<<2);
+			}
+			if (check==1)
+				y = y+sy;
+			else
+				x = x+sx;
+			e = e+(dy<<2);
+		}
+	}
+};
+
+// Works out the colours and effects for particle i, returning false if it should not be drawn.
+// This is always done for each particle in order on one thread, since it may call Lua, fill graphicscache, use rand(), and update the fire arrays.
+static TPT_FORCEINLINE bool render_parts_prepare(Simulation *sim, int i, PartRenderInfo &info)
 {
-	Simulation *sim = globalSim;
 	pixel defaultColour;
-	int deca, decr, decg, decb, cola, colr, colg, colb, firea, firer=0, fireg=0, fireb=0, pixel_mode, q, i, t, nx, ny, x, y;
-	int orbd[4] = {0, 0, 0, 0}, orbl[4] = {0, 0, 0, 0};
-	float gradv, flicker;
-#ifdef OGLR
-	float fnx, fny, flx, fly;
-	int cfireV = 0, cfireC = 0, cfire = 0;
-	int csmokeV = 0, csmokeC = 0, csmoke = 0;
-	int cblobV = 0, cblobC = 0, cblob = 0;
-	int cblurV = 0, cblurC = 0, cblur = 0;
-	int cglowV = 0, cglowC = 0, cglow = 0;
-	int cflatV = 0, cflatC = 0, cflat = 0;
-	int caddV = 0, caddC = 0, cadd = 0;
-	int clineV = 0, clineC = 0, cline = 0;
-	int cblurLineV = 0, cblurLineC = 0, cblurLine = 0;
-	int cablurLineV = 0, cablurLineC = 0, cablurLine = 0;
-	GLuint origBlendSrc, origBlendDst;
+	int deca, decr, decg, decb, cola, colr, colg, colb, firea, firer=0, fireg=0, fireb=0, pixel_mode, q, t, nx, ny;
+	float gradv;
+
+	t = parts[i].type;
+	nx = (int)(parts[i].x+0.5f);
+	ny = (int)(parts[i].y+0.5f);
+
+	// TODO: fix this (fixing would be easier if normal parts and energy parts were separated in pmap)
+	//if(photons[ny][nx]&0xFF && !(globalSim->elements[t].Properties & TYPE_ENERGY) && t!=PT_STKM && t!=PT_STKM2 && t!=PT_FIGH)
+	//	continue;
+
+	//Defaults
+	defaultColour = sim->elements[t].Colour;
+	pixel_mode = 0 | PMODE_FLAT;
+	cola = 255;
+	colr = COLR(defaultColour);
+	colg = COLG(defaultColour);
+	colb = COLB(defaultColour);
+	firea = 0;
 	
-	glGetIntegerv(GL_BLEND_SRC, &origBlendSrc);
-	glGetIntegerv(GL_BLEND_DST, &origBlendDst);
-	//Render to the particle FBO
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, partsFbo);
-#else
-	if (GRID_MODE)//draws the grid
+	deca = (parts[i].dcolour>>24)&0xFF;
+	decr = (parts[i].dcolour>>16)&0xFF;
+	decg = (parts[i].dcolour>>8)&0xFF;
+	decb = (parts[i].dcolour)&0xFF;
+		
+	if (graphicscache[t].isready)
 	{
-		for (ny=0; ny<YRES; ny++)
-			for (nx=0; nx<XRES; nx++)
+		pixel_mode = graphicscache[t].pixel_mode;
+		cola = graphicscache[t].cola;
+		colr = graphicscache[t].colr;
+		colg = graphicscache[t].colg;
+		colb = graphicscache[t].colb;
+		firea = graphicscache[t].firea;
+		firer = graphicscache[t].firer;
+		fireg = graphicscache[t].fireg;
+		fireb = graphicscache[t].fireb;
+	}
+	else if(!(colour_mode & COLOUR_BASC))	//Don't get special effects for BASIC colour mode
+	{
+#ifdef LUACONSOLE
+		if (lua_gr_func[t])
+		{
+			if (luacon_graphics_update(t,i, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb))
 			{
-				if (ny%(4*GRID_MODE)==0 || nx%(4*GRID_MODE)==0)
-					blendpixel(vid, nx, ny, 100, 100, 100, 80);
+				graphicscache[t].isready = 1;
+				graphicscache[t].pixel_mode = pixel_mode;
+				graphicscache[t].cola = cola;
+				graphicscache[t].colr = colr;
+				graphicscache[t].colg = colg;
+				graphicscache[t].colb = colb;
+				graphicscache[t].firea = firea;
+				graphicscache[t].firer = firer;
+				graphicscache[t].fireg = fireg;
+				graphicscache[t].fireb = fireb;
+			}
+		}
+		else if (sim->elements[t].Graphics)
+		{
+#else
+		if (sim->elements[t].Graphics)
+		{
+#endif
+			if ((*(sim->elements[t].Graphics))(sim, &(parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb)) //That's a lot of args, a struct might be better
+			{
+				graphicscache[t].isready = 1;
+				graphicscache[t].pixel_mode = pixel_mode;
+				graphicscache[t].cola = cola;
+				graphicscache[t].colr = colr;
+				graphicscache[t].colg = colg;
+				graphicscache[t].colb = colb;
+				graphicscache[t].firea = firea;
+				graphicscache[t].firer = firer;
+				graphicscache[t].fireg = fireg;
+				graphicscache[t].fireb = fireb;
 			}
+		}
+		else
+		{
+			if(Element::Graphics_default(sim, &(parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb))
+			{
+				graphicscache[t].isready = 1;
+				graphicscache[t].pixel_mode = pixel_mode;
+				graphicscache[t].cola = cola;
+				graphicscache[t].colr = colr;
+				graphicscache[t].colg = colg;
+				graphicscache[t].colb = colb;
+				graphicscache[t].firea = firea;
+				graphicscache[t].firer = firer;
+				graphicscache[t].fireg = fireg;
+				graphicscache[t].fireb = fireb;
+			}
+		}
+	}
+	if(sim->elements[t].Properties & PROP_HOT_GLOW && parts[i].temp>(globalSim->elements[t].HighTemperatureTransitionThreshold-800.0f))
+	{
+		float thresh = globalSim->elements[t].HighTemperatureTransitionThreshold;
+		gradv = 3.1415/(2*thresh-(thresh-800.0f));
+		float caddress = fminf(800.0f, parts[i].temp-(thresh-800.0f));
+		colr += sin(gradv*caddress) * 226;
+		colg += sin(gradv*caddress*4.55f +3.14f) * 34;
+		colb += sin(gradv*caddress*2.22f +3.14f) * 64;
+	}
+	
+	if(pixel_mode & FIRE_ADD && !(render_mode & FIRE_ADD))
+		pixel_mode |= PMODE_GLOW;
+	if(pixel_mode & FIRE_BLEND && !(render_mode & FIRE_BLEND))
+		pixel_mode |= PMODE_BLUR;
+	if(pixel_mode & PMODE_BLUR && !(render_mode & PMODE_BLUR))
+		pixel_mode |= PMODE_FLAT;
+	if(pixel_mode & PMODE_GLOW && !(render_mode & PMODE_GLOW))
+		pixel_mode |= PMODE_BLEND;
+	if (render_mode & PMODE_BLOB)
+		pixel_mode |= PMODE_BLOB;
+		
+	pixel_mode &= render_mode;
+	
+	//Alter colour based on display mode
+	if(colour_mode & COLOUR_HEAT)
+	{
+		int caddress = tptmath::clamp_int(int(tptmath::clamp_flt(parts[i].temp-MIN_TEMP, 0.0f, TEMP_RANGE)*1024/TEMP_RANGE) *3, 0, (1024-1)*3);
+		firea = 255;
+		firer = colr = (unsigned char)color_data[caddress];
+		fireg = colg = (unsigned char)color_data[caddress+1];
+		fireb = colb = (unsigned char)color_data[caddress+2];
+		cola = 255;
+		if(pixel_mode & (FIREMODE | PMODE_GLOW))
+			pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
+		else if (!pixel_mode)
+			pixel_mode |= PMODE_FLAT;
+	}
+	else if(colour_mode & COLOUR_LIFE)
+	{
+		gradv = 0.4f;
+		if (!(parts[i].life<5))
+			q = sqrt(parts[i].life);
+		else
+			q = parts[i].life;
+		colr = colg = colb = sin(gradv*q) * 100 + 128;
+		cola = 255;
+		if(pixel_mode & (FIREMODE | PMODE_GLOW)) pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
 	}
+	else if (colour_mode & COLOUR_BASC)
+	{
+		colr = COLR(defaultColour);
+		colg = COLG(defaultColour);
+		colb = COLB(defaultColour);
+		pixel_mode = PMODE_FLAT;
+	}
+					
+	//Apply decoration colour
+	if(!(colour_mode & ~COLOUR_GRAD))
+	{
+		if(!(pixel_mode & NO_DECO) && decorations_enable)
+		{
+			colr = (deca*decr + (255-deca)*colr) >> 8;
+			colg = (deca*decg + (255-deca)*colg) >> 8;
+			colb = (deca*decb + (255-deca)*colb) >> 8;
+		}
+		
+		if(pixel_mode & DECO_FIRE && decorations_enable)
+		{
+			firer = (deca*decr + (255-deca)*firer) >> 8;
+			fireg = (deca*decg + (255-deca)*fireg) >> 8;
+			fireb = (deca*decb + (255-deca)*fireb) >> 8;
+		}
+	}
+
+	if (colour_mode & COLOUR_GRAD)
+	{
+		float frequency = 0.05;
+		int q = parts[i].temp-40;
+		colr = sin(frequency*q) * 16 + colr;
+		colg = sin(frequency*q) * 16 + colg;
+		colb = sin(frequency*q) * 16 + colb;
+		if(pixel_mode & (FIREMODE | PMODE_GLOW)) pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
+	}
+	
+#ifndef OGLR
+	//All colours are now set, check ranges
+	if(colr>255) colr = 255;
+	else if(colr<0) colr = 0;
+	if(colg>255) colg = 255;
+	else if(colg<0) colg = 0;
+	if(colb>255) colb = 255;
+	else if(colb<0) colb = 0;
+	if(cola>255) cola = 255;
+	else if(cola<0) cola = 0;
+
+	if(firer>255) firer = 255;
+	else if(firer<0) firer = 0;
+	if(fireg>255) fireg = 255;
+	else if(fireg<0) fireg = 0;
+	if(fireb>255) fireb = 255;
+	else if(fireb<0) fireb = 0;
+	if(firea>255) firea = 255;
+	else if(firea<0) firea = 0;
 #endif
-	for(i = 0; i<=globalSim->parts_lastActiveIndex; i++) {
-		if (parts[i].type) {
-			t = parts[i].type;
 
-			nx = (int)(parts[i].x+0.5f);
-			ny = (int)(parts[i].y+0.5f);
-#ifdef OGLR
-			fnx = parts[i].x;
-			fny = parts[i].y;
-			flx = parts[i].lastX;
-			fly = parts[i].lastY;
+	info.cplayer = NULL;
+	info.drawHp = false;
+	if (pixel_mode & PSPEC_STICKMAN)
+	{
+		const Stickman_data *cplayer = NULL;
+		if(t==PT_STKM || t==PT_STKM2)
+			cplayer = &globalSim->elemData<STKM_ElemDataSim>(t)->player;
+		else if(t==PT_FIGH)
+			cplayer = globalSim->elemData<FIGH_ElemDataSim>(PT_FIGH)->GetFighterData(parts[i]);
+		if (!cplayer)
+			return false;
+
+		info.cplayer = cplayer;
+		info.drawHp = (mousex>(nx-3) && mousex<(nx+3) && mousey<(ny+3) && mousey>(ny-3));
+		if (colour_mode!=COLOUR_HEAT)
+		{
+			if (cplayer->elem<PT_NUM)
+			{
+				colr = COLR(sim->elements[cplayer->elem].Colour);
+				colg = COLG(sim->elements[cplayer->elem].Colour);
+				colb = COLB(sim->elements[cplayer->elem].Colour);
+			}
+			else
+			{
+				colr = 0x80;
+				colg = 0x80;
+				colb = 0xFF;
+			}
+		}
+	}
+
+	info.drawChannelLines = false;
+	if ((pixel_mode & EFFECT_LINES) && DEBUG_MODE && !(display_mode&DISPLAY_PERS) && (t==PT_PRTI || t==PT_PRTO || t==PT_WIFI) && mousex==nx && mousey==ny)
+		info.drawChannelLines = (i==sim->pmap(SimPosI(nx,ny)).first(PMapCategory::Plain));
+
+	// Random numbers are taken in the same order as when each particle was drawn straight after working out its colours
+	info.flicker[0] = (pixel_mode & PMODE_SPARK) ? rand()%20 : 0;
+	info.flicker[1] = (pixel_mode & PMODE_FLARE) ? rand()%20 : 0;
+	info.flicker[2] = (pixel_mode & PMODE_LFLARE) ? rand()%20 : 0;
+
+	info.i = i;
+	info.t = t;
+	info.nx = nx;
+	info.ny = ny;
+	info.pixel_mode = pixel_mode;
+	info.cola = cola;
+	info.colr = colr;
+	info.colg = colg;
+	info.colb = colb;
+	info.firea = firea;
+	info.firer = firer;
+	info.fireg = fireg;
+	info.fireb = fireb;
+
+#ifndef OGLR
+	//Fire effects
+	if(firea && (pixel_mode & FIRE_BLEND))
+	{
+		firea /= 2;
+		fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
+		fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
+		fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
+	}
+	if(firea && (pixel_mode & FIRE_ADD))
+	{
+		firea /= 8;
+		firer = ((firea*firer) >> 8) + fire_r[ny/CELL][nx/CELL];
+		fireg = ((firea*fireg) >> 8) + fire_g[ny/CELL][nx/CELL];
+		fireb = ((firea*fireb) >> 8) + fire_b[ny/CELL][nx/CELL];
+	
+		if(firer>255)
+			firer = 255;
+		if(fireg>255)
+			fireg = 255;
+		if(fireb>255)
+			fireb = 255;
+		
+		fire_r[ny/CELL][nx/CELL] = firer;
+		fire_g[ny/CELL][nx/CELL] = fireg;
+		fire_b[ny/CELL][nx/CELL] = fireb;
+	}
+	if(firea && (pixel_mode & FIRE_SPARK))
+	{
+		firea /= 4;
+		fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
+		fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
+		fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
+	}
 #endif
+	return true;
+}
 
+// Furthest distance from the particle reached by the lines drawn for PMODE_SPARK, PMODE_FLARE and PMODE_LFLARE, which start at distance x and fade by a factor of falloff per pixel
+static int render_parts_sparkReach(float gradv, float falloff, int x)
+{
+	int reach = x;
+	for (; gradv>0.5; x++)
+	{
+		reach = x;
+		gradv = gradv/falloff;
+	}
+	return reach;
+}
 
-			// TODO: fix this (fixing would be easier if normal parts and energy parts were separated in pmap)
-			//if(photons[ny][nx]&0xFF && !(globalSim->elements[t].Properties & TYPE_ENERGY) && t!=PT_STKM && t!=PT_STKM2 && t!=PT_FIGH)
-			//	continue;
-				
-			//Defaults
-			defaultColour = sim->elements[t].Colour;
-			pixel_mode = 0 | PMODE_FLAT;
-			cola = 255;
-			colr = COLR(defaultColour);
-			colg = COLG(defaultColour);
-			colb = COLB(defaultColour);
-			firea = 0;
-			
-			deca = (parts[i].dcolour>>24)&0xFF;
-			decr = (parts[i].dcolour>>16)&0xFF;
-			decg = (parts[i].dcolour>>8)&0xFF;
-			decb = (parts[i].dcolour)&0xFF;
-				
-			/*if(display_mode == RENDER_NONE)
+// Sets info.yMin and info.yMax to the range of rows which drawing the particle may change
+static void render_parts_rowRange(PartRenderInfo &info)
+{
+	const particle &p = parts[info.i];
+	const int mode = info.pixel_mode;
+	int reach = 0;
+	if (mode & (PMODE_BLOB | PMODE_FLARE | PMODE_LFLARE))
+		reach = 1;
+	if (mode & PMODE_BLUR)
+		reach = std::max(reach, 3);
+	if (mode & PSPEC_STICKMAN)
+		reach = std::max(reach, 3);
+	if (mode & PMODE_GLOW)
+		reach = std::max(reach, 5);
+	if (mode & (EFFECT_GRAVIN | EFFECT_GRAVOUT))
+		reach = std::max(reach, 16);
+	// One extra pixel for the spark lines, in case of any difference in floating point rounding between this and the drawing code
+	if (mode & PMODE_SPARK)
+		reach = std::max(reach, render_parts_sparkReach(4*p.life + float(info.flicker[0]), 1.5f, 0) + 1);
+	if (mode & (PMODE_FLARE | PMODE_LFLARE))
+	{
+		for (int k=1; k<=2; k++)
+		{
+			if (!(mode & (k==1 ? PMODE_FLARE : PMODE_LFLARE)))
+				continue;
+			float gradv = float(info.flicker[k]) + fabs(p.vx)*17 + fabs(p.vy)*17;
+			if (gradv>255)
+				gradv = 255;
+			reach = std::max(reach, render_parts_sparkReach(gradv, (k==1) ? 1.2f : 1.01f, 1) + 1);
+		}
+	}
+	info.yMin = info.ny - reach;
+	info.yMax = info.ny + reach;
+
+	if (info.cplayer)
+	{
+		// Legs, and the rocket boots drawn around the ends of the legs
+		for (int k=1; k<16; k+=4)
+		{
+			int legY = (int)info.cplayer->legs[k];
+			info.yMin = std::min(info.yMin, legY-1);
+			info.yMax = std::max(info.yMax, legY+1);
+		}
+	}
+	if ((mode & EFFECT_LINES) && info.t==PT_SOAP && (p.ctype&3) == 3 && p.tmp >= 0 && p.tmp < NPART)
+	{
+		int endY = (int)(parts[p.tmp].y+0.5f);
+		info.yMin = std::min(info.yMin, endY);
+		info.yMax = std::max(info.yMax, endY);
+	}
+}
+
+static void render_parts_grid(PartsRenderStrip &strip)
+{
+	if (GRID_MODE)//draws the grid
+	{
+		for (int ny=std::max(strip.yStart, 0); ny<std::min(strip.yEnd, YRES); ny++)
+			for (int nx=0; nx<XRES; nx++)
 			{
-				if(decorations_enable)
-				{
-					colr = (deca*decr + (255-deca)*colr) >> 8;
-					colg = (deca*decg + (255-deca)*colg) >> 8;
-					colb = (deca*decb + (255-deca)*colb) >> 8;
-				}
-#ifdef OGLR
-		        flatV[cflatV++] = nx;
-		        flatV[cflatV++] = ny;
-		        flatC[cflatC++] = ((float)colr)/255.0f;
-		        flatC[cflatC++] = ((float)colg)/255.0f;
-		        flatC[cflatC++] = ((float)colb)/255.0f;
-		        flatC[cflatC++] = 1.0f;
-		        cflat++;
-#else
-		        vid[ny*(XRES+BARSIZE)+nx] = PIXRGB(colr,colg,colb);
-#endif
+				if (ny%(4*GRID_MODE)==0 || nx%(4*GRID_MODE)==0)
+					strip.blendpixel(nx, ny, 100, 100, 100, 80);
 			}
-			else*/
-			{	
-				if (graphicscache[t].isready)
-				{
-					pixel_mode = graphicscache[t].pixel_mode;
-					cola = graphicscache[t].cola;
-					colr = graphicscache[t].colr;
-					colg = graphicscache[t].colg;
-					colb = graphicscache[t].colb;
-					firea = graphicscache[t].firea;
-					firer = graphicscache[t].firer;
-					fireg = graphicscache[t].fireg;
-					fireb = graphicscache[t].fireb;
-				}
-				else if(!(colour_mode & COLOUR_BASC))	//Don't get special effects for BASIC colour mode
-				{
+	}
+}
+
 #ifdef LUACONSOLE
-					if (lua_gr_func[t])
-					{
-						if (luacon_graphics_update(t,i, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb))
-						{
-							graphicscache[t].isready = 1;
-							graphicscache[t].pixel_mode = pixel_mode;
-							graphicscache[t].cola = cola;
-							graphicscache[t].colr = colr;
-							graphicscache[t].colg = colg;
-							graphicscache[t].colb = colb;
-							graphicscache[t].firea = firea;
-							graphicscache[t].firer = firer;
-							graphicscache[t].fireg = fireg;
-							graphicscache[t].fireb = fireb;
-						}
-					}
-					else if (sim->elements[t].Graphics)
-					{
-#else
-					if (sim->elements[t].Graphics)
-					{
+static bool render_parts_luaGraphics()
+{
+	for (int t=0; t<PT_NUM; t++)
+	{
+		if (lua_gr_func[t])
+			return true;
+	}
+	return false;
+}
 #endif
-						if ((*(sim->elements[t].Graphics))(sim, &(parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb)) //That's a lot of args, a struct might be better
-						{
-							graphicscache[t].isready = 1;
-							graphicscache[t].pixel_mode = pixel_mode;
-							graphicscache[t].cola = cola;
-							graphicscache[t].colr = colr;
-							graphicscache[t].colg = colg;
-							graphicscache[t].colb = colb;
-							graphicscache[t].firea = firea;
-							graphicscache[t].firer = firer;
-							graphicscache[t].fireg = fireg;
-							graphicscache[t].fireb = fireb;
-						}
-					}
-					else
-					{
-						if(Element::Graphics_default(sim, &(parts[i]), nx, ny, &pixel_mode, &cola, &colr, &colg, &colb, &firea, &firer, &fireg, &fireb))
-						{
-							graphicscache[t].isready = 1;
-							graphicscache[t].pixel_mode = pixel_mode;
-							graphicscache[t].cola = cola;
-							graphicscache[t].colr = colr;
-							graphicscache[t].colg = colg;
-							graphicscache[t].colb = colb;
-							graphicscache[t].firea = firea;
-							graphicscache[t].firer = firer;
-							graphicscache[t].fireg = fireg;
-							graphicscache[t].fireb = fireb;
-						}
-					}
-				}
-				if(sim->elements[t].Properties & PROP_HOT_GLOW && parts[i].temp>(globalSim->elements[t].HighTemperatureTransitionThreshold-800.0f))
-				{
-					float thresh = globalSim->elements[t].HighTemperatureTransitionThreshold;
-					gradv = 3.1415/(2*thresh-(thresh-800.0f));
-					float caddress = fminf(800.0f, parts[i].temp-(thresh-800.0f));
-					colr += sin(gradv*caddress) * 226;
-					colg += sin(gradv*caddress*4.55f +3.14f) * 34;
-					colb += sin(gradv*caddress*2.22f +3.14f) * 64;
-				}
-				
-				if(pixel_mode & FIRE_ADD && !(render_mode & FIRE_ADD))
-					pixel_mode |= PMODE_GLOW;
-				if(pixel_mode & FIRE_BLEND && !(render_mode & FIRE_BLEND))
-					pixel_mode |= PMODE_BLUR;
-				if(pixel_mode & PMODE_BLUR && !(render_mode & PMODE_BLUR))
-					pixel_mode |= PMODE_FLAT;
-				if(pixel_mode & PMODE_GLOW && !(render_mode & PMODE_GLOW))
-					pixel_mode |= PMODE_BLEND;
-				if (render_mode & PMODE_BLOB)
-					pixel_mode |= PMODE_BLOB;
-					
-				pixel_mode &= render_mode;
-				
-				//Alter colour based on display mode
-				if(colour_mode & COLOUR_HEAT)
-				{
-					int caddress = tptmath::clamp_int(int(tptmath::clamp_flt(parts[i].temp-MIN_TEMP, 0.0f, TEMP_RANGE)*1024/TEMP_RANGE) *3, 0, (1024-1)*3);
-					firea = 255;
-					firer = colr = (unsigned char)color_data[caddress];
-					fireg = colg = (unsigned char)color_data[caddress+1];
-					fireb = colb = (unsigned char)color_data[caddress+2];
-					cola = 255;
-					if(pixel_mode & (FIREMODE | PMODE_GLOW))
-						pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
-					else if (!pixel_mode)
-						pixel_mode |= PMODE_FLAT;
-				}
-				else if(colour_mode & COLOUR_LIFE)
-				{
-					gradv = 0.4f;
-					if (!(parts[i].life<5))
-						q = sqrt(parts[i].life);
-					else
-						q = parts[i].life;
-					colr = colg = colb = sin(gradv*q) * 100 + 128;
-					cola = 255;
-					if(pixel_mode & (FIREMODE | PMODE_GLOW)) pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
-				}
-				else if (colour_mode & COLOUR_BASC)
-				{
-					colr = COLR(defaultColour);
-					colg = COLG(defaultColour);
-					colb = COLB(defaultColour);
-					pixel_mode = PMODE_FLAT;
-				}
-								
-				//Apply decoration colour
-				if(!(colour_mode & ~COLOUR_GRAD))
-				{
-					if(!(pixel_mode & NO_DECO) && decorations_enable)
-					{
-						colr = (deca*decr + (255-deca)*colr) >> 8;
-						colg = (deca*decg + (255-deca)*colg) >> 8;
-						colb = (deca*decb + (255-deca)*colb) >> 8;
-					}
-					
-					if(pixel_mode & DECO_FIRE && decorations_enable)
-					{
-						firer = (deca*decr + (255-deca)*firer) >> 8;
-						fireg = (deca*decg + (255-deca)*fireg) >> 8;
-						fireb = (deca*decb + (255-deca)*fireb) >> 8;
-					}
-				}
 
-				if (colour_mode & COLOUR_GRAD)
-				{
-					float frequency = 0.05;
-					int q = parts[i].temp-40;
-					colr = sin(frequency*q) * 16 + colr;
-					colg = sin(frequency*q) * 16 + colg;
-					colb = sin(frequency*q) * 16 + colb;
-					if(pixel_mode & (FIREMODE | PMODE_GLOW)) pixel_mode = (pixel_mode & ~(FIREMODE|PMODE_GLOW)) | PMODE_BLUR;
-				}
-				
-	#ifndef OGLR
-				//All colours are now set, check ranges
-				if(colr>255) colr = 255;
-				else if(colr<0) colr = 0;
-				if(colg>255) colg = 255;
-				else if(colg<0) colg = 0;
-				if(colb>255) colb = 255;
-				else if(colb<0) colb = 0;
-				if(cola>255) cola = 255;
-				else if(cola<0) cola = 0;
-
-				if(firer>255) firer = 255;
-				else if(firer<0) firer = 0;
-				if(fireg>255) fireg = 255;
-				else if(fireg<0) fireg = 0;
-				if(fireb>255) fireb = 255;
-				else if(fireb<0) fireb = 0;
-				if(firea>255) firea = 255;
-				else if(firea<0) firea = 0;
-	#endif
-					
-				//Pixel rendering
-				if(pixel_mode & PSPEC_STICKMAN)
-				{
-					char buff[20];  //Buffer for HP
-					int s;
-					int legr, legg, legb;
-					Stickman_data *cplayer = NULL;
-					if(t==PT_STKM || t==PT_STKM2)
-						cplayer = &globalSim->elemData<STKM_ElemDataSim>(t)->player;
-					else if(t==PT_FIGH)
-						cplayer = globalSim->elemData<FIGH_ElemDataSim>(PT_FIGH)->GetFighterData(parts[i]);
-					if (!cplayer)
-						continue;
+// Draws one particle which has been prepared by render_parts_prepare.
+// Must only change pixels through strip (a PartsRenderScreen or PartsRenderStrip), and must not change any other shared state, since it may be called from several threads at once.
+template<class RenderTarget>
+static TPT_FORCEINLINE void render_parts_draw(const PartRenderInfo &info, RenderTarget &strip)
+{
+	const int i = info.i, t = info.t, nx = info.nx, ny = info.ny, pixel_mode = info.pixel_mode;
+	const int cola = info.cola, colr = info.colr, colg = info.colg, colb = info.colb;
+	int orbd[4] = {0, 0, 0, 0}, orbl[4] = {0, 0, 0, 0};
+	int x, y;
+	float gradv, flicker;
+#ifdef OGLR
+	int firea = info.firea, firer = info.firer, fireg = info.fireg, fireb = info.fireb;
+	float fnx = parts[i].x, fny = parts[i].y;
+	float flx = parts[i].lastX, fly = parts[i].lastY;
+#endif
 
-					if (mousex>(nx-3) && mousex<(nx+3) && mousey<(ny+3) && mousey>(ny-3)) //If mouse is in the head
-					{
-						sprintf(buff, "%3d", parts[i].life);  //Show HP
-						drawtext(vid, mousex-8-2*(parts[i].life<100)-2*(parts[i].life<10), mousey-12, buff, 255, 255, 255, 255);
-					}
+	//Pixel rendering
+	if(pixel_mode & PSPEC_STICKMAN)
+	{
+		char buff[20];  //Buffer for HP
+		int legr, legg, legb;
+		const Stickman_data *cplayer = info.cplayer;
+
+		if (info.drawHp) //If mouse is in the head
+		{
+			sprintf(buff, "%3d", parts[i].life);  //Show HP
+			drawtext(strip.vid, mousex-8-2*(parts[i].life<100)-2*(parts[i].life<10), mousey-12, buff, 255, 255, 255, 255);
+		}
 
-					if (colour_mode!=COLOUR_HEAT)
-					{
-						if (cplayer->elem<PT_NUM)
-						{
-							colr = COLR(sim->elements[cplayer->elem].Colour);
-							colg = COLG(sim->elements[cplayer->elem].Colour);
-							colb = COLB(sim->elements[cplayer->elem].Colour);
-						}
-						else
-						{
-							colr = 0x80;
-							colg = 0x80;
-							colb = 0xFF;
-						}
-					}
 #ifdef OGLR
-					glColor4f(((float)colr)/255.0f, ((float)colg)/255.0f, ((float)colb)/255.0f, 1.0f);
-					glBegin(GL_LINE_STRIP);
-					if(t==PT_FIGH)
-					{
-						glVertex2f(fnx, fny+2);
-						glVertex2f(fnx+2, fny);
-						glVertex2f(fnx, fny-2);
-						glVertex2f(fnx-2, fny);
-						glVertex2f(fnx, fny+2);
-					}
-					else
-					{
-						glVertex2f(fnx-2, fny-2);
-						glVertex2f(fnx+2, fny-2);
-						glVertex2f(fnx+2, fny+2);
-						glVertex2f(fnx-2, fny+2);
-						glVertex2f(fnx-2, fny-2);
-					}
-					glEnd();
-					glBegin(GL_LINES);
+		glColor4f(((float)colr)/255.0f, ((float)colg)/255.0f, ((float)colb)/255.0f, 1.0f);
+		glBegin(GL_LINE_STRIP);
+		if(t==PT_FIGH)
+		{
+			glVertex2f(fnx, fny+2);
+			glVertex2f(fnx+2, fny);
+			glVertex2f(fnx, fny-2);
+			glVertex2f(fnx-2, fny);
+			glVertex2f(fnx, fny+2);
+		}
+		else
+		{
+			glVertex2f(fnx-2, fny-2);
+			glVertex2f(fnx+2, fny-2);
+			glVertex2f(fnx+2, fny+2);
+			glVertex2f(fnx-2, fny+2);
+			glVertex2f(fnx-2, fny-2);
+		}
+		glEnd();
+		glBegin(GL_LINES);
 
-					if (colour_mode!=COLOUR_HEAT)
-					{
-						if (t==PT_STKM2)
-							glColor4f(100.0f/255.0f, 100.0f/255.0f, 1.0f, 1.0f);
-						else
-							glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
-					}
+		if (colour_mode!=COLOUR_HEAT)
+		{
+			if (t==PT_STKM2)
+				glColor4f(100.0f/255.0f, 100.0f/255.0f, 1.0f, 1.0f);
+			else
+				glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+		}
 
-					glVertex2f(nx, ny+3);
-					glVertex2f(cplayer->legs[0], cplayer->legs[1]);
-					
-					glVertex2f(cplayer->legs[0], cplayer->legs[1]);
-					glVertex2f(cplayer->legs[4], cplayer->legs[5]);
-					
-					glVertex2f(nx, ny+3);
-					glVertex2f(cplayer->legs[8], cplayer->legs[9]);
-					
-					glVertex2f(cplayer->legs[8], cplayer->legs[9]);
-					glVertex2f(cplayer->legs[12], cplayer->legs[13]);
-					glEnd();
+		glVertex2f(nx, ny+3);
+		glVertex2f(cplayer->legs[0], cplayer->legs[1]);
+		
+		glVertex2f(cplayer->legs[0], cplayer->legs[1]);
+		glVertex2f(cplayer->legs[4], cplayer->legs[5]);
+		
+		glVertex2f(nx, ny+3);
+		glVertex2f(cplayer->legs[8], cplayer->legs[9]);
+		
+		glVertex2f(cplayer->legs[8], cplayer->legs[9]);
+		glVertex2f(cplayer->legs[12], cplayer->legs[13]);
+		glEnd();
 #else
-					s = XRES+BARSIZE;
+		if (t==PT_STKM2)
+		{
+			legr = 100;
+			legg = 100;
+			legb = 255;
+		}
+		else
+		{
+			legr = 255;
+			legg = 255;
+			legb = 255;
+		}
 
-					if (t==PT_STKM2)
-					{
-						legr = 100;
-						legg = 100;
-						legb = 255;
-					}
-					else
-					{
-						legr = 255;
-						legg = 255;
-						legb = 255;
-					}
+		if (colour_mode==COLOUR_HEAT)
+		{
+			legr = colr;
+			legg = colg;
+			legb = colb;
+		}
 
-					if (colour_mode==COLOUR_HEAT)
-					{
-						legr = colr;
-						legg = colg;
-						legb = colb;
-					}
-
-					//head
-					if(t==PT_FIGH)
-					{
-						draw_line(vid , nx, ny+2, nx+2, ny, colr, colg, colb, s);
-						draw_line(vid , nx+2, ny, nx, ny-2, colr, colg, colb, s);
-						draw_line(vid , nx, ny-2, nx-2, ny, colr, colg, colb, s);
-						draw_line(vid , nx-2, ny, nx, ny+2, colr, colg, colb, s);
-					}
-					else
-					{
-						draw_line(vid , nx-2, ny+2, nx+2, ny+2, colr, colg, colb, s);
-						draw_line(vid , nx-2, ny-2, nx+2, ny-2, colr, colg, colb, s);
-						draw_line(vid , nx-2, ny-2, nx-2, ny+2, colr, colg, colb, s);
-						draw_line(vid , nx+2, ny-2, nx+2, ny+2, colr, colg, colb, s);
-					}
-					//legs
-					draw_line(vid , nx, ny+3, cplayer->legs[0], cplayer->legs[1], legr, legg, legb, s);
-					draw_line(vid , cplayer->legs[0], cplayer->legs[1], cplayer->legs[4], cplayer->legs[5], legr, legg, legb, s);
-					draw_line(vid , nx, ny+3, cplayer->legs[8], cplayer->legs[9], legr, legg, legb, s);
-					draw_line(vid , cplayer->legs[8], cplayer->legs[9], cplayer->legs[12], cplayer->legs[13], legr, legg, legb, s);
-					if (cplayer->rocketBoots)
-					{
-						for (int leg=0; leg<2; leg++)
-						{
-							int nx = cplayer->legs[leg*8+4], ny = cplayer->legs[leg*8+5];
-							int colr = 255, colg = 0, colb = 255;
-							if (((int)(cplayer->comm)&0x04) == 0x04 || (((int)(cplayer->comm)&0x01) == 0x01 && leg==0) || (((int)(cplayer->comm)&0x02) == 0x02 && leg==1))
-								blendpixel(vid, nx, ny, 0, 255, 0, 255);
-							else
-								blendpixel(vid, nx, ny, 255, 0, 0, 255);
-							blendpixel(vid, nx+1, ny, colr, colg, colb, 223);
-							blendpixel(vid, nx-1, ny, colr, colg, colb, 223);
-							blendpixel(vid, nx, ny+1, colr, colg, colb, 223);
-							blendpixel(vid, nx, ny-1, colr, colg, colb, 223);
-
-							blendpixel(vid, nx+1, ny-1, colr, colg, colb, 112);
-							blendpixel(vid, nx-1, ny-1, colr, colg, colb, 112);
-							blendpixel(vid, nx+1, ny+1, colr, colg, colb, 112);
-							blendpixel(vid, nx-1, ny+1, colr, colg, colb, 112);
-						}
-					}
+		//head
+		if(t==PT_FIGH)
+		{
+			strip.draw_line(nx, ny+2, nx+2, ny, colr, colg, colb);
+			strip.draw_line(nx+2, ny, nx, ny-2, colr, colg, colb);
+			strip.draw_line(nx, ny-2, nx-2, ny, colr, colg, colb);
+			strip.draw_line(nx-2, ny, nx, ny+2, colr, colg, colb);
+		}
+		else
+		{
+			strip.draw_line(nx-2, ny+2, nx+2, ny+2, colr, colg, colb);
+			strip.draw_line(nx-2, ny-2, nx+2, ny-2, colr, colg, colb);
+			strip.draw_line(nx-2, ny-2, nx-2, ny+2, colr, colg, colb);
+			strip.draw_line(nx+2, ny-2, nx+2, ny+2, colr, colg, colb);
+		}
+		//legs
+		strip.draw_line(nx, ny+3, cplayer->legs[0], cplayer->legs[1], legr, legg, legb);
+		strip.draw_line(cplayer->legs[0], cplayer->legs[1], cplayer->legs[4], cplayer->legs[5], legr, legg, legb);
+		strip.draw_line(nx, ny+3, cplayer->legs[8], cplayer->legs[9], legr, legg, legb);
+		strip.draw_line(cplayer->legs[8], cplayer->legs[9], cplayer->legs[12], cplayer->legs[13], legr, legg, legb);
+		if (cplayer->rocketBoots)
+		{
+			for (int leg=0; leg<2; leg++)
+			{
+				int nx = cplayer->legs[leg*8+4], ny = cplayer->legs[leg*8+5];
+				int colr = 255, colg = 0, colb = 255;
+				if (((int)(cplayer->comm)&0x04) == 0x04 || (((int)(cplayer->comm)&0x01) == 0x01 && leg==0) || (((int)(cplayer->comm)&0x02) == 0x02 && leg==1))
+					strip.blendpixel(nx, ny, 0, 255, 0, 255);
+				else
+					strip.blendpixel(nx, ny, 255, 0, 0, 255);
+				strip.blendpixel(nx+1, ny, colr, colg, colb, 223);
+				strip.blendpixel(nx-1, ny, colr, colg, colb, 223);
+				strip.blendpixel(nx, ny+1, colr, colg, colb, 223);
+				strip.blendpixel(nx, ny-1, colr, colg, colb, 223);
+
+				strip.blendpixel(nx+1, ny-1, colr, colg, colb, 112);
+				strip.blendpixel(nx-1, ny-1, colr, colg, colb, 112);
+				strip.blendpixel(nx+1, ny+1, colr, colg, colb, 112);
+				strip.blendpixel(nx-1, ny+1, colr, colg, colb, 112);
+			}
+		}
 #endif
-				}
+	}
 #ifdef OGLR
-				if((display_mode & DISPLAY_EFFE) && (fabs(fnx-flx)>1.5f || fabs(fny-fly)>1.5f))
-				{
-					if(pixel_mode & PMODE_FLAT)
-					{
-						blurLineV[cblurLineV++] = nx;
-						blurLineV[cblurLineV++] = ny;
-						blurLineC[cblurLineC++] = ((float)colr)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colg)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colb)/255.0f;
-						blurLineC[cblurLineC++] = 1.0f;
-						cblurLine++;
-						
-						blurLineV[cblurLineV++] = flx;
-						blurLineV[cblurLineV++] = fly;
-						blurLineC[cblurLineC++] = ((float)colr)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colg)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colb)/255.0f;
-						blurLineC[cblurLineC++] = 0.0f;
-						cblurLine++;
-					}
-					else if(pixel_mode & PMODE_BLEND)
-					{
-						blurLineV[cblurLineV++] = nx;
-						blurLineV[cblurLineV++] = ny;
-						blurLineC[cblurLineC++] = ((float)colr)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colg)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colb)/255.0f;
-						blurLineC[cblurLineC++] = ((float)cola)/255.0f;
-						cblurLine++;
-						
-						blurLineV[cblurLineV++] = flx;
-						blurLineV[cblurLineV++] = fly;
-						blurLineC[cblurLineC++] = ((float)colr)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colg)/255.0f;
-						blurLineC[cblurLineC++] = ((float)colb)/255.0f;
-						blurLineC[cblurLineC++] = 0.0f;
-						cblurLine++;
-					}
-					else if(pixel_mode & PMODE_ADD)
-					{
-						ablurLineV[cablurLineV++] = nx;
-						ablurLineV[cablurLineV++] = ny;
-						ablurLineC[cablurLineC++] = ((float)colr)/255.0f;
-						ablurLineC[cablurLineC++] = ((float)colg)/255.0f;
-						ablurLineC[cablurLineC++] = ((float)colb)/255.0f;
-						ablurLineC[cablurLineC++] = ((float)cola)/255.0f;
-						cablurLine++;
-						
-						ablurLineV[cablurLineV++] = flx;
-						ablurLineV[cablurLineV++] = fly;
-						ablurLineC[cablurLineC++] = ((float)colr)/255.0f;
-						ablurLineC[cablurLineC++] = ((float)colg)/255.0f;
-						ablurLineC[cablurLineC++] = ((float)colb)/255.0f;
-						ablurLineC[cablurLineC++] = 0.0f;
-						cablurLine++;
-					}
-				}
+	if((display_mode & DISPLAY_EFFE) && (fabs(fnx-flx)>1.5f || fabs(fny-fly)>1.5f))
+	{
+		if(pixel_mode & PMODE_FLAT)
+		{
+			blurLineV[cblurLineV++] = nx;
+			blurLineV[cblurLineV++] = ny;
+			blurLineC[cblurLineC++] = ((float)colr)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colg)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colb)/255.0f;
+			blurLineC[cblurLineC++] = 1.0f;
+			cblurLine++;
+			
+			blurLineV[cblurLineV++] = flx;
+			blurLineV[cblurLineV++] = fly;
+			blurLineC[cblurLineC++] = ((float)colr)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colg)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colb)/255.0f;
+			blurLineC[cblurLineC++] = 0.0f;
+			cblurLine++;
+		}
+		else if(pixel_mode & PMODE_BLEND)
+		{
+			blurLineV[cblurLineV++] = nx;
+			blurLineV[cblurLineV++] = ny;
+			blurLineC[cblurLineC++] = ((float)colr)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colg)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colb)/255.0f;
+			blurLineC[cblurLineC++] = ((float)cola)/255.0f;
+			cblurLine++;
+			
+			blurLineV[cblurLineV++] = flx;
+			blurLineV[cblurLineV++] = fly;
+			blurLineC[cblurLineC++] = ((float)colr)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colg)/255.0f;
+			blurLineC[cblurLineC++] = ((float)colb)/255.0f;
+			blurLineC[cblurLineC++] = 0.0f;
+			cblurLine++;
+		}
+		else if(pixel_mode & PMODE_ADD)
+		{
+			ablurLineV[cablurLineV++] = nx;
+			ablurLineV[cablurLineV++] = ny;
+			ablurLineC[cablurLineC++] = ((float)colr)/255.0f;
+			ablurLineC[cablurLineC++] = ((float)colg)/255.0f;
+			ablurLineC[cablurLineC++] = ((float)colb)/255.0f;
+			ablurLineC[cablurLineC++] = ((float)cola)/255.0f;
+			cablurLine++;
+			
+			ablurLineV[cablurLineV++] = flx;
+			ablurLineV[cablurLineV++] = fly;
+			ablurLineC[cablurLineC++] = ((float)colr)/255.0f;
+			ablurLineC[cablurLineC++] = ((float)colg)/255.0f;
+			ablurLineC[cablurLineC++] = ((float)colb)/255.0f;
+			ablurLineC[cablurLineC++] = 0.0f;
+			cablurLine++;
+		}
+	}
 #endif
-				if(pixel_mode & PMODE_FLAT)
-				{
+	if(pixel_mode & PMODE_FLAT)
+	{
 #ifdef OGLR
                     flatV[cflatV++] = nx;
                     flatV[cflatV++] = ny;
@@ -2481,11 +2713,11 @@ void render_parts(pixel *vid)
                     flatC[cflatC++] = 1.0f;
                     cflat++;
 #else
-					vid[ny*(XRES+BARSIZE)+nx] = PIXRGB(colr,colg,colb);
+		strip.setpixel(nx, ny, PIXRGB(colr,colg,colb));
 #endif
-				}
-				if(pixel_mode & PMODE_BLEND)
-				{
+	}
+	if(pixel_mode & PMODE_BLEND)
+	{
 #ifdef OGLR
                     flatV[cflatV++] = nx;
                     flatV[cflatV++] = ny;
@@ -2495,11 +2727,11 @@ void render_parts(pixel *vid)
                     flatC[cflatC++] = ((float)cola)/255.0f;
                     cflat++;
 #else
-					blendpixel(vid, nx, ny, colr, colg, colb, cola);
+		strip.blendpixel(nx, ny, colr, colg, colb, cola);
 #endif
-				}
-				if(pixel_mode & PMODE_ADD)
-				{
+	}
+	if(pixel_mode & PMODE_ADD)
+	{
 #ifdef OGLR
                     addV[caddV++] = nx;
                     addV[caddV++] = ny;
@@ -2509,11 +2741,11 @@ void render_parts(pixel *vid)
                     addC[caddC++] = ((float)cola)/255.0f;
                     cadd++;
 #else
-					addpixel(vid, nx, ny, colr, colg, colb, cola);
+		strip.addpixel(nx, ny, colr, colg, colb, cola);
 #endif
-				}
-				if(pixel_mode & PMODE_BLOB)
-				{
+	}
+	if(pixel_mode & PMODE_BLOB)
+	{
 #ifdef OGLR
                     blobV[cblobV++] = nx;
                     blobV[cblobV++] = ny;
@@ -2523,22 +2755,22 @@ void render_parts(pixel *vid)
                     blobC[cblobC++] = 1.0f;
                     cblob++;
 #else
-					vid[ny*(XRES+BARSIZE)+nx] = PIXRGB(colr,colg,colb);
+		strip.setpixel(nx, ny, PIXRGB(colr,colg,colb));
 
-					blendpixel(vid, nx+1, ny, colr, colg, colb, 223);
-					blendpixel(vid, nx-1, ny, colr, colg, colb, 223);
-					blendpixel(vid, nx, ny+1, colr, colg, colb, 223);
-					blendpixel(vid, nx, ny-1, colr, colg, colb, 223);
+		strip.blendpixel(nx+1, ny, colr, colg, colb, 223);
+		strip.blendpixel(nx-1, ny, colr, colg, colb, 223);
+		strip.blendpixel(nx, ny+1, colr, colg, colb, 223);
+		strip.blendpixel(nx, ny-1, colr, colg, colb, 223);
 
-					blendpixel(vid, nx+1, ny-1, colr, colg, colb, 112);
-					blendpixel(vid, nx-1, ny-1, colr, colg, colb, 112);
-					blendpixel(vid, nx+1, ny+1, colr, colg, colb, 112);
-					blendpixel(vid, nx-1, ny+1, colr, colg, colb, 112);
+		strip.blendpixel(nx+1, ny-1, colr, colg, colb, 112);
+		strip.blendpixel(nx-1, ny-1, colr, colg, colb, 112);
+		strip.blendpixel(nx+1, ny+1, colr, colg, colb, 112);
+		strip.blendpixel(nx-1, ny+1, colr, colg, colb, 112);
 #endif
-				}
-				if(pixel_mode & PMODE_GLOW)
-				{
-					int cola1 = (5*cola)/255;
+	}
+	if(pixel_mode & PMODE_GLOW)
+	{
+		int cola1 = (5*cola)/255;
 #ifdef OGLR
                     glowV[cglowV++] = nx;
                     glowV[cglowV++] = ny;
@@ -2548,30 +2780,30 @@ void render_parts(pixel *vid)
                     glowC[cglowC++] = 1.0f;
                     cglow++;
 #else
-					addpixel(vid, nx, ny, colr, colg, colb, (192*cola)/255);
-					addpixel(vid, nx+1, ny, colr, colg, colb, (96*cola)/255);
-					addpixel(vid, nx-1, ny, colr, colg, colb, (96*cola)/255);
-					addpixel(vid, nx, ny+1, colr, colg, colb, (96*cola)/255);
-					addpixel(vid, nx, ny-1, colr, colg, colb, (96*cola)/255);
-					
-					for (x = 1; x < 6; x++) {
-						addpixel(vid, nx, ny-x, colr, colg, colb, cola1);
-						addpixel(vid, nx, ny+x, colr, colg, colb, cola1);
-						addpixel(vid, nx-x, ny, colr, colg, colb, cola1);
-						addpixel(vid, nx+x, ny, colr, colg, colb, cola1);
-						for (y = 1; y < 6; y++) {
-							if(x + y > 7)
-								continue;
-							addpixel(vid, nx+x, ny-y, colr, colg, colb, cola1);
-							addpixel(vid, nx-x, ny+y, colr, colg, colb, cola1);
-							addpixel(vid, nx+x, ny+y, colr, colg, colb, cola1);
-							addpixel(vid, nx-x, ny-y, colr, colg, colb, cola1);
-						}
-					}
+		strip.addpixel(nx, ny, colr, colg, colb, (192*cola)/255);
+		strip.addpixel(nx+1, ny, colr, colg, colb, (96*cola)/255);
+		strip.addpixel(nx-1, ny, colr, colg, colb, (96*cola)/255);
+		strip.addpixel(nx, ny+1, colr, colg, colb, (96*cola)/255);
+		strip.addpixel(nx, ny-1, colr, colg, colb, (96*cola)/255);
+		
+		for (x = 1; x < 6; x++) {
+			strip.addpixel(nx, ny-x, colr, colg, colb, cola1);
+			strip.addpixel(nx, ny+x, colr, colg, colb, cola1);
+			strip.addpixel(nx-x, ny, colr, colg, colb, cola1);
+			strip.addpixel(nx+x, ny, colr, colg, colb, cola1);
+			for (y = 1; y < 6; y++) {
+				if(x + y > 7)
+					continue;
+				strip.addpixel(nx+x, ny-y, colr, colg, colb, cola1);
+				strip.addpixel(nx-x, ny+y, colr, colg, colb, cola1);
+				strip.addpixel(nx+x, ny+y, colr, colg, colb, cola1);
+				strip.addpixel(nx-x, ny-y, colr, colg, colb, cola1);
+			}
+		}
 #endif
-				}
-				if(pixel_mode & PMODE_BLUR)
-				{
+	}
+	if(pixel_mode & PMODE_BLUR)
+	{
 #ifdef OGLR
                     blurV[cblurV++] = nx;
                     blurV[cblurV++] = ny;
@@ -2581,300 +2813,296 @@ void render_parts(pixel *vid)
                     blurC[cblurC++] = 1.0f;
                     cblur++;
 #else
-					for (x=-3; x<4; x++)
-					{
-						for (y=-3; y<4; y++)
-						{
-							if (abs(x)+abs(y) <2 && !(abs(x)==2||abs(y)==2))
-								blendpixel(vid, x+nx, y+ny, colr, colg, colb, 30);
-							if (abs(x)+abs(y) <=3 && abs(x)+abs(y))
-								blendpixel(vid, x+nx, y+ny, colr, colg, colb, 20);
-							if (abs(x)+abs(y) == 2)
-								blendpixel(vid, x+nx, y+ny, colr, colg, colb, 10);
-						}
-					}
+		for (x=-3; x<4; x++)
+		{
+			for (y=-3; y<4; y++)
+			{
+				if (abs(x)+abs(y) <2 && !(abs(x)==2||abs(y)==2))
+					strip.blendpixel(x+nx, y+ny, colr, colg, colb, 30);
+				if (abs(x)+abs(y) <=3 && abs(x)+abs(y))
+					strip.blendpixel(x+nx, y+ny, colr, colg, colb, 20);
+				if (abs(x)+abs(y) == 2)
+					strip.blendpixel(x+nx, y+ny, colr, colg, colb, 10);
+			}
+		}
 #endif
-				}
-				if(pixel_mode & PMODE_SPARK)
-				{
-					flicker = rand()%20;
+	}
+	if(pixel_mode & PMODE_SPARK)
+	{
+		flicker = info.flicker[0];
 #ifdef OGLR
-					//Oh god, this is awful
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx-5;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 1.0f - ((float)flicker)/30;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx+5;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny-5;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 1.0f - ((float)flicker)/30;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny+5;
-				    cline++;
+		//Oh god, this is awful
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx-5;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 1.0f - ((float)flicker)/30;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx+5;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny-5;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 1.0f - ((float)flicker)/30;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny+5;
+	    cline++;
 #else
-					gradv = 4*parts[i].life + flicker;
-					for (x = 0; gradv>0.5; x++) {
-						addpixel(vid, nx+x, ny, colr, colg, colb, gradv);
-						addpixel(vid, nx-x, ny, colr, colg, colb, gradv);
-
-						addpixel(vid, nx, ny+x, colr, colg, colb, gradv);
-						addpixel(vid, nx, ny-x, colr, colg, colb, gradv);
-						gradv = gradv/1.5f;
-					}
+		gradv = 4*parts[i].life + flicker;
+		for (x = 0; gradv>0.5; x++) {
+			strip.addpixel(nx+x, ny, colr, colg, colb, gradv);
+			strip.addpixel(nx-x, ny, colr, colg, colb, gradv);
+
+			strip.addpixel(nx, ny+x, colr, colg, colb, gradv);
+			strip.addpixel(nx, ny-x, colr, colg, colb, gradv);
+			gradv = gradv/1.5f;
+		}
 #endif
-				}
-				if(pixel_mode & PMODE_FLARE)
-				{
-					flicker = rand()%20;
+	}
+	if(pixel_mode & PMODE_FLARE)
+	{
+		flicker = info.flicker[1];
 #ifdef OGLR
-					//Oh god, this is awful
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx-10;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 1.0f - ((float)flicker)/40;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx+10;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny-10;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 1.0f - ((float)flicker)/30;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny+10;
-				    cline++;
+		//Oh god, this is awful
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx-10;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 1.0f - ((float)flicker)/40;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx+10;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny-10;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 1.0f - ((float)flicker)/30;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny+10;
+	    cline++;
 #else
-					gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
-					blendpixel(vid, nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
-					blendpixel(vid, nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(vid, nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(vid, nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(vid, nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					if (gradv>255) gradv=255;
-					blendpixel(vid, nx+1, ny-1, colr, colg, colb, gradv);
-					blendpixel(vid, nx-1, ny-1, colr, colg, colb, gradv);
-					blendpixel(vid, nx+1, ny+1, colr, colg, colb, gradv);
-					blendpixel(vid, nx-1, ny+1, colr, colg, colb, gradv);
-					for (x = 1; gradv>0.5; x++) {
-						addpixel(vid, nx+x, ny, colr, colg, colb, gradv);
-						addpixel(vid, nx-x, ny, colr, colg, colb, gradv);
-						addpixel(vid, nx, ny+x, colr, colg, colb, gradv);
-						addpixel(vid, nx, ny-x, colr, colg, colb, gradv);
-						gradv = gradv/1.2f;
-					}
+		gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
+		strip.blendpixel(nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
+		strip.blendpixel(nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		strip.blendpixel(nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		strip.blendpixel(nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		strip.blendpixel(nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		if (gradv>255) gradv=255;
+		strip.blendpixel(nx+1, ny-1, colr, colg, colb, gradv);
+		strip.blendpixel(nx-1, ny-1, colr, colg, colb, gradv);
+		strip.blendpixel(nx+1, ny+1, colr, colg, colb, gradv);
+		strip.blendpixel(nx-1, ny+1, colr, colg, colb, gradv);
+		for (x = 1; gradv>0.5; x++) {
+			strip.addpixel(nx+x, ny, colr, colg, colb, gradv);
+			strip.addpixel(nx-x, ny, colr, colg, colb, gradv);
+			strip.addpixel(nx, ny+x, colr, colg, colb, gradv);
+			strip.addpixel(nx, ny-x, colr, colg, colb, gradv);
+			gradv = gradv/1.2f;
+		}
 #endif
-				}
-				if(pixel_mode & PMODE_LFLARE)
-				{
-					flicker = rand()%20;
+	}
+	if(pixel_mode & PMODE_LFLARE)
+	{
+		flicker = info.flicker[2];
 #ifdef OGLR
-					//Oh god, this is awful
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx-70;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 1.0f - ((float)flicker)/30;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx+70;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny-70;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 1.0f - ((float)flicker)/50;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny;
-				    cline++;
-				    
-				    lineC[clineC++] = ((float)colr)/255.0f;
-				    lineC[clineC++] = ((float)colg)/255.0f;
-				    lineC[clineC++] = ((float)colb)/255.0f;
-				    lineC[clineC++] = 0.0f;
-				    lineV[clineV++] = fnx;
-				    lineV[clineV++] = fny+70;
-				    cline++;
+		//Oh god, this is awful
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx-70;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 1.0f - ((float)flicker)/30;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx+70;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny-70;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 1.0f - ((float)flicker)/50;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny;
+	    cline++;
+	    
+	    lineC[clineC++] = ((float)colr)/255.0f;
+	    lineC[clineC++] = ((float)colg)/255.0f;
+	    lineC[clineC++] = ((float)colb)/255.0f;
+	    lineC[clineC++] = 0.0f;
+	    lineV[clineV++] = fnx;
+	    lineV[clineV++] = fny+70;
+	    cline++;
 #else
-					gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
-					blendpixel(vid, nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
-					blendpixel(vid, nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(vid, nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(vid, nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					blendpixel(vid, nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
-					if (gradv>255) gradv=255;
-					blendpixel(vid, nx+1, ny-1, colr, colg, colb, gradv);
-					blendpixel(vid, nx-1, ny-1, colr, colg, colb, gradv);
-					blendpixel(vid, nx+1, ny+1, colr, colg, colb, gradv);
-					blendpixel(vid, nx-1, ny+1, colr, colg, colb, gradv);
-					for (x = 1; gradv>0.5; x++) {
-						addpixel(vid, nx+x, ny, colr, colg, colb, gradv);
-						addpixel(vid, nx-x, ny, colr, colg, colb, gradv);
-						addpixel(vid, nx, ny+x, colr, colg, colb, gradv);
-						addpixel(vid, nx, ny-x, colr, colg, colb, gradv);
-						gradv = gradv/1.01f;
-					}
+		gradv = flicker + fabs(parts[i].vx)*17 + fabs(parts[i].vy)*17;
+		strip.blendpixel(nx, ny, colr, colg, colb, (gradv*4)>255?255:(gradv*4) );
+		strip.blendpixel(nx+1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		strip.blendpixel(nx-1, ny, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		strip.blendpixel(nx, ny+1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		strip.blendpixel(nx, ny-1, colr, colg, colb, (gradv*2)>255?255:(gradv*2) );
+		if (gradv>255) gradv=255;
+		strip.blendpixel(nx+1, ny-1, colr, colg, colb, gradv);
+		strip.blendpixel(nx-1, ny-1, colr, colg, colb, gradv);
+		strip.blendpixel(nx+1, ny+1, colr, colg, colb, gradv);
+		strip.blendpixel(nx-1, ny+1, colr, colg, colb, gradv);
+		for (x = 1; gradv>0.5; x++) {
+			strip.addpixel(nx+x, ny, colr, colg, colb, gradv);
+			strip.addpixel(nx-x, ny, colr, colg, colb, gradv);
+			strip.addpixel(nx, ny+x, colr, colg, colb, gradv);
+			strip.addpixel(nx, ny-x, colr, colg, colb, gradv);
+			gradv = gradv/1.01f;
+		}
 #endif
-				}
-				if (pixel_mode & EFFECT_GRAVIN)
-				{
-					int nxo = 0;
-					int nyo = 0;
-					int r;
-					float drad = 0.0f;
-					float ddist = 0.0f;
-					Element_PRTI::orbitalparts_get(parts[i].life, parts[i].ctype, orbd, orbl);
-					for (r = 0; r < 4; r++) {
-						ddist = ((float)orbd[r])/16.0f;
-						drad = float(orbl[r]) * M_PI / 128;
-						nxo = (int)(ddist*cos(drad));
-						nyo = (int)(ddist*sin(drad));
-						if (ny+nyo>0 && ny+nyo<YRES && nx+nxo>0 && nx+nxo<XRES && globalSim->pmap_find_one(nx+nxo, ny+nyo, PT_PRTI)<0)
-							addpixel(vid, nx+nxo, ny+nyo, colr, colg, colb, 255-orbd[r]);
-					}
-				}
-				if (pixel_mode & EFFECT_GRAVOUT)
-				{
-					int nxo = 0;
-					int nyo = 0;
-					int r;
-					float drad = 0.0f;
-					float ddist = 0.0f;
-					Element_PRTI::orbitalparts_get(parts[i].life, parts[i].ctype, orbd, orbl);
-					for (r = 0; r < 4; r++) {
-						ddist = ((float)orbd[r])/16.0f;
-						drad = float(orbl[r]) * M_PI / 128;
-						nxo = (int)(ddist*cos(drad));
-						nyo = (int)(ddist*sin(drad));
-						if (ny+nyo>0 && ny+nyo<YRES && nx+nxo>0 && nx+nxo<XRES && globalSim->pmap_find_one(nx+nxo, ny+nyo, PT_PRTO)<0)
-							addpixel(vid, nx+nxo, ny+nyo, colr, colg, colb, 255-orbd[r]);
-					}
-				}
-				if ((pixel_mode & EFFECT_LINES) && t==PT_SOAP)
-				{
-					if ((parts[i].ctype&3) == 3 && parts[i].tmp >= 0 && parts[i].tmp < NPART)
-						draw_line(vid, nx, ny, (int)(parts[parts[i].tmp].x+0.5f), (int)(parts[parts[i].tmp].y+0.5f), colr, colg, colb, XRES+BARSIZE);
-				}
-				else if ((pixel_mode & EFFECT_LINES) && DEBUG_MODE && !(display_mode&DISPLAY_PERS) && (t==PT_PRTI || t==PT_PRTO || t==PT_WIFI))
-				{
-					int topPart = sim->pmap(SimPosI(nx,ny)).first(PMapCategory::Plain);
-					if (mousex==nx && mousey==ny && i==topPart) //draw lines connecting wifi/portal channels
-					{
-						int type = parts[i].type;// which element we're drawing lines to
-						if (type == PT_PRTI)
-							type = PT_PRTO;
-						else if (type == PT_PRTO)
-							type = PT_PRTI;
-
-						ElemDataSim_channels *elemData;
-						if (type==PT_PRTO)
-							elemData = globalSim->elemData<ElemDataSim_channels>(PT_PRTI);
-						else
-							elemData = globalSim->elemData<ElemDataSim_channels>(type);
+	}
+	if (pixel_mode & EFFECT_GRAVIN)
+	{
+		int nxo = 0;
+		int nyo = 0;
+		int r;
+		float drad = 0.0f;
+		float ddist = 0.0f;
+		Element_PRTI::orbitalparts_get(parts[i].life, parts[i].ctype, orbd, orbl);
+		for (r = 0; r < 4; r++) {
+			ddist = ((float)orbd[r])/16.0f;
+			drad = float(orbl[r]) * M_PI / 128;
+			nxo = (int)(ddist*cos(drad));
+			nyo = (int)(ddist*sin(drad));
+			if (ny+nyo>0 && ny+nyo<YRES && nx+nxo>0 && nx+nxo<XRES && globalSim->pmap_find_one(nx+nxo, ny+nyo, PT_PRTI)<0)
+				strip.addpixel(nx+nxo, ny+nyo, colr, colg, colb, 255-orbd[r]);
+		}
+	}
+	if (pixel_mode & EFFECT_GRAVOUT)
+	{
+		int nxo = 0;
+		int nyo = 0;
+		int r;
+		float drad = 0.0f;
+		float ddist = 0.0f;
+		Element_PRTI::orbitalparts_get(parts[i].life, parts[i].ctype, orbd, orbl);
+		for (r = 0; r < 4; r++) {
+			ddist = ((float)orbd[r])/16.0f;
+			drad = float(orbl[r]) * M_PI / 128;
+			nxo = (int)(ddist*cos(drad));
+			nyo = (int)(ddist*sin(drad));
+			if (ny+nyo>0 && ny+nyo<YRES && nx+nxo>0 && nx+nxo<XRES && globalSim->pmap_find_one(nx+nxo, ny+nyo, PT_PRTO)<0)
+				strip.addpixel(nx+nxo, ny+nyo, colr, colg, colb, 255-orbd[r]);
+		}
+	}
+	if ((pixel_mode & EFFECT_LINES) && t==PT_SOAP)
+	{
+		if ((parts[i].ctype&3) == 3 && parts[i].tmp >= 0 && parts[i].tmp < NPART)
+			strip.draw_line(nx, ny, (int)(parts[parts[i].tmp].x+0.5f), (int)(parts[parts[i].tmp].y+0.5f), colr, colg, colb);
+	}
+	else if (info.drawChannelLines) //draw lines connecting wifi/portal channels
+	{
+		int type = parts[i].type;// which element we're drawing lines to
+		if (type == PT_PRTI)
+			type = PT_PRTO;
+		else if (type == PT_PRTO)
+			type = PT_PRTI;
+
+		ElemDataSim_channels *elemData;
+		if (type==PT_PRTO)
+			elemData = globalSim->elemData<ElemDataSim_channels>(PT_PRTI);
+		else
+			elemData = globalSim->elemData<ElemDataSim_channels>(type);
 
-						int channel = elemData->GetChannelId(parts[i]);
-						for (int z = 0; z<globalSim->parts_lastActiveIndex; z++) {
-							if (parts[z].type==type)
-							{
-								if (elemData->GetChannelId(parts[z])==channel)
-									xor_line(nx,ny,(int)(parts[z].x+0.5f),(int)(parts[z].y+0.5f),vid);
-							}
-						}
-					}
-				}
-				//Fire effects
-				if(firea && (pixel_mode & FIRE_BLEND))
-				{
+		int channel = elemData->GetChannelId(parts[i]);
+		for (int z = 0; z<globalSim->parts_lastActiveIndex; z++) {
+			if (parts[z].type==type)
+			{
+				if (elemData->GetChannelId(parts[z])==channel)
+					xor_line(nx,ny,(int)(parts[z].x+0.5f),(int)(parts[z].y+0.5f),strip.vid);
+			}
+		}
+	}
 #ifdef OGLR
+	//Fire effects
+	if(firea && (pixel_mode & FIRE_BLEND))
+	{
                     smokeV[csmokeV++] = nx;
                     smokeV[csmokeV++] = ny;
                     smokeC[csmokeC++] = ((float)firer)/255.0f;
@@ -2882,16 +3110,9 @@ void render_parts(pixel *vid)
                     smokeC[csmokeC++] = ((float)fireb)/255.0f;
                     smokeC[csmokeC++] = ((float)firea)/255.0f;
                     csmoke++;
-#else
-					firea /= 2;
-					fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
-					fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
-					fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
-#endif
-				}
-				if(firea && (pixel_mode & FIRE_ADD))
-				{
-#ifdef OGLR
+	}
+	if(firea && (pixel_mode & FIRE_ADD))
+	{
                     fireV[cfireV++] = nx;
                     fireV[cfireV++] = ny;
                     fireC[cfireC++] = ((float)firer)/255.0f;
@@ -2899,43 +3120,113 @@ void render_parts(pixel *vid)
                     fireC[cfireC++] = ((float)fireb)/255.0f;
                     fireC[cfireC++] = ((float)firea)/255.0f;
                     cfire++;
-#else
-					firea /= 8;
-					firer = ((firea*firer) >> 8) + fire_r[ny/CELL][nx/CELL];
-					fireg = ((firea*fireg) >> 8) + fire_g[ny/CELL][nx/CELL];
-					fireb = ((firea*fireb) >> 8) + fire_b[ny/CELL][nx/CELL];
-				
-					if(firer>255)
-						firer = 255;
-					if(fireg>255)
-						fireg = 255;
-					if(fireb>255)
-						fireb = 255;
-					
-					fire_r[ny/CELL][nx/CELL] = firer;
-					fire_g[ny/CELL][nx/CELL] = fireg;
-					fire_b[ny/CELL][nx/CELL] = fireb;
+	}
+	if(firea && (pixel_mode & FIRE_SPARK))
+	{
+		smokeV[csmokeV++] = nx;
+		smokeV[csmokeV++] = ny;
+		smokeC[csmokeC++] = ((float)firer)/255.0f;
+		smokeC[csmokeC++] = ((float)fireg)/255.0f;
+		smokeC[csmokeC++] = ((float)fireb)/255.0f;
+		smokeC[csmokeC++] = ((float)firea)/255.0f;
+		csmoke++;
+	}
 #endif
-				}
-				if(firea && (pixel_mode & FIRE_SPARK))
-				{
+}
+
+/* Draws all the particles.
+ *
+ * The colours and effects for each particle are worked out first, on the calling thread. Without OpenGL, the drawing can then be split across multiple threads (up to render_threads), each drawing a horizontal strip of the screen.
+ * Each strip draws every particle whose effects reach into it, in particle order and skipping pixels outside the strip. So every pixel is changed by exactly the same sequence of operations as when drawing on one thread, and the result is identical, including glow and blur effects which cross between strips.
+ */
+void render_parts(pixel *vid)
+{
+	Simulation *sim = globalSim;
 #ifdef OGLR
-					smokeV[csmokeV++] = nx;
-					smokeV[csmokeV++] = ny;
-					smokeC[csmokeC++] = ((float)firer)/255.0f;
-					smokeC[csmokeC++] = ((float)fireg)/255.0f;
-					smokeC[csmokeC++] = ((float)fireb)/255.0f;
-					smokeC[csmokeC++] = ((float)firea)/255.0f;
-					csmoke++;
+	cfireV = cfireC = cfire = 0;
+	csmokeV = csmokeC = csmoke = 0;
+	cblobV = cblobC = cblob = 0;
+	cblurV = cblurC = cblur = 0;
+	cglowV = cglowC = cglow = 0;
+	cflatV = cflatC = cflat = 0;
+	caddV = caddC = cadd = 0;
+	clineV = clineC = cline = 0;
+	cblurLineV = cblurLineC = cblurLine = 0;
+	cablurLineV = cablurLineC = cablurLine = 0;
+	GLuint origBlendSrc, origBlendDst;
+	
+	glGetIntegerv(GL_BLEND_SRC, &origBlendSrc);
+	glGetIntegerv(GL_BLEND_DST, &origBlendDst);
+	//Render to the particle FBO
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, partsFbo);
+
+	int threadCount = 1;
 #else
-					firea /= 4;
-					fire_r[ny/CELL][nx/CELL] = (firea*firer + (255-firea)*fire_r[ny/CELL][nx/CELL]) >> 8;
-					fire_g[ny/CELL][nx/CELL] = (firea*fireg + (255-firea)*fire_g[ny/CELL][nx/CELL]) >> 8;
-					fire_b[ny/CELL][nx/CELL] = (firea*fireb + (255-firea)*fire_b[ny/CELL][nx/CELL]) >> 8;
+	int threadCount = (render_threads>0) ? render_threads : int(WorkerThreads::getShared()->threadCount())+1;
 #endif
-				}
+#ifdef LUACONSOLE
+	// Lua graphics functions might draw things, so these must be called at the same point in the drawing as before
+	if (threadCount>1 && render_parts_luaGraphics())
+		threadCount = 1;
+#endif
+
+	if (threadCount<=1)
+	{
+		PartsRenderScreen screen(vid);
+#ifndef OGLR
+		PartsRenderStrip allRows(vid, 0, YRES+MENUSIZE);
+		render_parts_grid(allRows);
+#endif
+		for (int i = globalSim->parts_firstActive(); i>=0; i = globalSim->parts_nextActive(i))
+		{
+			PartRenderInfo info;
+			if (parts[i].type && render_parts_prepare(sim, i, info))
+				render_parts_draw(info, screen);
+		}
+	}
+	else
+	{
+		static std::vector<PartRenderInfo> partInfo;
+		partInfo.clear();
+		bool canSplit = true;
+		for (int i = globalSim->parts_firstActive(); i>=0; i = globalSim->parts_nextActive(i))
+		{
+			PartRenderInfo info;
+			if (parts[i].type && render_parts_prepare(sim, i, info))
+			{
+				if (info.drawHp || info.drawChannelLines)
+					canSplit = false;
+				partInfo.push_back(info);
 			}
 		}
+
+		// Bin particles by strip. Several strips per thread, so that the work still balances when particles are not spread evenly.
+		// HP text and debug lines are not limited to the rows found by render_parts_rowRange, so if there are any then everything is drawn as one strip.
+		const int rows = YRES+MENUSIZE;
+		const int stripHeight = canSplit ? std::max(16, rows/(threadCount*4)) : rows;
+		const int stripCount = (rows+stripHeight-1)/stripHeight;
+		static std::vector<std::vector<int> > stripParts;
+		stripParts.resize(stripCount);
+		for (auto &bin : stripParts)
+			bin.clear();
+		for (size_t k=0; k<partInfo.size(); k++)
+		{
+			render_parts_rowRange(partInfo[k]);
+			int firstStrip = tptmath::clamp_int(partInfo[k].yMin, 0, rows-1) / stripHeight;
+			int lastStrip = tptmath::clamp_int(partInfo[k].yMax, 0, rows-1) / stripHeight;
+			for (int s=firstStrip; s<=lastStrip; s++)
+				stripParts[s].push_back(k);
+		}
+
+		WorkerThreads::getShared()->parallel_for(0, stripCount, 1, [&](int begin, int end) {
+			for (int s=begin; s<end; s++)
+			{
+				PartsRenderStrip strip(vid, s*stripHeight, std::min(rows, (s+1)*stripHeight));
+				render_parts_grid(strip);
+				for (int k : stripParts[s])
+					render_parts_draw(partInfo[k], strip);
+			}
+		}, threadCount);
 	}
 #ifdef OGLR		
         
@@ -3823,91 +4114,286 @@ void render_gravlensing(pixel *src, pixel * dst)
 	}
 }
 
-void render_fire(pixel *vid)
+/* render_fire draws the fire glow, by adding fire_alpha (scaled by the fire colour) to the pixels around each cell which has fire, then spreads and fades the fire in each cell.
+ *
+ * There are versions of the drawing (the "splat") and of the fire decay for each instruction set, all of which give exactly the same results.
+ * Since each colour channel of a pixel is increased by a non-negative amount and capped at 255, the order in which the cells are drawn does not matter. Each cell is drawn using its value from before the decay, so all the drawing is done first, then all the decay.
+ */
+
+int render_fire_impl = RENDER_FIRE_AUTO;
+
+// fire_alpha, with each value repeated once for each byte of a pixel
+static uint16_t fire_alpha_lanes[CELL*3][CELL*3][4];
+
+// Draws the fire for one cell, where (x,y) is the top left of the area drawn (one cell beyond the cell in each direction)
+static void render_fire_splatCell_scalar(pixel *vid, int x, int y, int r, int g, int b)
+{
+	for (int dy=0; dy<CELL*3; dy++)
+		for (int dx=0; dx<CELL*3; dx++)
+			addpixel(vid, x+dx, y+dy, r, g, b, fire_alpha[dy][dx]);
+}
+
+#if defined(PIXELBYTES) && defined(__SSE2__)
+#define RENDER_FIRE_HAVE_SSE2 1
+#endif
+#if defined(PIXELBYTES) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RENDER_FIRE_HAVE_AVX2 1
+#define RENDER_FIRE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+#if defined(RENDER_FIRE_HAVE_SSE2) || defined(RENDER_FIRE_HAVE_AVX2)
+/* The SIMD versions work on the pixel bytes directly, with the R/G/B values of the fire colour zero extended to 16 bits, so that a multiply by the 16 bit fire_alpha values gives alpha*colour for all three channels at once.
+ * (alpha*colour)>>8 is then capped at 255 (using the high half of the multiply to detect overflow), packed back into bytes, and added to the pixel with saturation, which gives the same answer as addpixel.
+ * Only cells where the whole area drawn is inside vid are drawn this way, the rest use render_fire_splatCell_scalar.
+ */
+
+// Fire colour for the SIMD versions. Bytes which are not R/G/B are 0 in colour, and are set by masking the result with pixelMask and then adding pixelBase.
+static inline pixel render_fire_colour(int r, int g, int b)
+{
+	return PIXRGB(r, g, b) & ~PIXRGB(0, 0, 0);
+}
+static const pixel render_fire_pixelMask = PIXRGB(255, 255, 255);
+static const pixel render_fire_pixelBase = PIXRGB(0, 0, 0);
+#endif
+
+#ifdef RENDER_FIRE_HAVE_SSE2
+// Calculates the amounts to add to 4 pixels, from alpha values for pixels 0-1 and 2-3
+static inline __m128i render_fire_scale_sse2(__m128i colour, __m128i alpha01, __m128i alpha23)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i max8 = _mm_set1_epi16(0xFF);
+	__m128i lo01 = _mm_srli_epi16(_mm_mullo_epi16(colour, alpha01), 8);
+	__m128i lo23 = _mm_srli_epi16(_mm_mullo_epi16(colour, alpha23), 8);
+	__m128i over01 = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_mulhi_epu16(colour, alpha01), zero), max8);
+	__m128i over23 = _mm_andnot_si128(_mm_cmpeq_epi16(_mm_mulhi_epu16(colour, alpha23), zero), max8);
+	return _mm_packus_epi16(_mm_or_si128(lo01, over01), _mm_or_si128(lo23, over23));
+}
+
+static void render_fire_splatCell_sse2(pixel *vid, int x, int y, int r, int g, int b)
+{
+	const __m128i colour1 = _mm_unpacklo_epi8(_mm_cvtsi32_si128(render_fire_colour(r, g, b)), _mm_setzero_si128());
+	const __m128i colour = _mm_unpacklo_epi64(colour1, colour1);
+	const __m128i mask = _mm_set1_epi32(render_fire_pixelMask);
+	const __m128i base = _mm_set1_epi32(render_fire_pixelBase);
+	for (int dy=0; dy<CELL*3; dy++)
+	{
+		pixel *row = vid+(y+dy)*(XRES+BARSIZE)+x;
+		const uint16_t *alpha = fire_alpha_lanes[dy][0];
+		for (int dx=0; dx<CELL*3; dx+=4)
+		{
+			__m128i add = render_fire_scale_sse2(colour, _mm_loadu_si128((const __m128i*)(alpha+dx*4)), _mm_loadu_si128((const __m128i*)(alpha+dx*4+8)));
+			__m128i pix = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(row+dx)), add);
+			_mm_storeu_si128((__m128i*)(row+dx), _mm_or_si128(_mm_and_si128(pix, mask), base));
+		}
+	}
+}
+#endif
+
+#ifdef RENDER_FIRE_HAVE_AVX2
+RENDER_FIRE_TARGET_AVX2 static void render_fire_splatCell_avx2(pixel *vid, int x, int y, int r, int g, int b)
+{
+	const __m256i colour = _mm256_broadcastq_epi64(_mm_unpacklo_epi8(_mm_cvtsi32_si128(render_fire_colour(r, g, b)), _mm_setzero_si128()));
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i max8 = _mm256_set1_epi16(0xFF);
+	const __m256i mask = _mm256_set1_epi32(render_fire_pixelMask);
+	const __m256i base = _mm256_set1_epi32(render_fire_pixelBase);
+	for (int dy=0; dy<CELL*3; dy++)
+	{
+		pixel *row = vid+(y+dy)*(XRES+BARSIZE)+x;
+		const uint16_t *alpha = fire_alpha_lanes[dy][0];
+		int dx = 0;
+		for (; dx+8<=CELL*3; dx+=8)
+		{
+			// Alpha for pixels 0-3 and 4-7. Packing works within each 128 bit half, so gives pixels in the order 0,1,4,5,2,3,6,7, which is fixed by the permute.
+			__m256i alpha0 = _mm256_loadu_si256((const __m256i*)(alpha+dx*4));
+			__m256i alpha1 = _mm256_loadu_si256((const __m256i*)(alpha+dx*4+16));
+			__m256i lo0 = _mm256_srli_epi16(_mm256_mullo_epi16(colour, alpha0), 8);
+			__m256i lo1 = _mm256_srli_epi16(_mm256_mullo_epi16(colour, alpha1), 8);
+			__m256i over0 = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_mulhi_epu16(colour, alpha0), zero), max8);
+			__m256i over1 = _mm256_andnot_si256(_mm256_cmpeq_epi16(_mm256_mulhi_epu16(colour, alpha1), zero), max8);
+			__m256i add = _mm256_permute4x64_epi64(_mm256_packus_epi16(_mm256_or_si256(lo0, over0), _mm256_or_si256(lo1, over1)), 0xD8);
+			__m256i pix = _mm256_adds_epu8(_mm256_loadu_si256((const __m256i*)(row+dx)), add);
+			_mm256_storeu_si256((__m256i*)(row+dx), _mm256_or_si256(_mm256_and_si256(pix, mask), base));
+		}
+		for (; dx<CELL*3; dx+=4)
+		{
+			__m128i colour128 = _mm256_castsi256_si128(colour);
+			__m128i add = render_fire_scale_sse2(colour128, _mm_loadu_si128((const __m128i*)(alpha+dx*4)), _mm_loadu_si128((const __m128i*)(alpha+dx*4+8)));
+			__m128i pix = _mm_adds_epu8(_mm_loadu_si128((const __m128i*)(row+dx)), add);
+			_mm_storeu_si128((__m128i*)(row+dx), _mm_or_si128(_mm_and_si128(pix, _mm256_castsi256_si128(mask)), _mm256_castsi256_si128(base)));
+		}
+	}
+}
+#endif
+
+typedef void (*render_fire_splatCell_fn)(pixel *vid, int x, int y, int r, int g, int b);
+
+static void render_fire_splat(pixel *vid, render_fire_splatCell_fn splatCell)
 {
-	int i,j,x,y,r,g,b;
-	for (j=0; j<YRES/CELL; j++)
-		for (i=0; i<XRES/CELL; i++)
+	for (int j=0; j<YRES/CELL; j++)
+		for (int i=0; i<XRES/CELL; i++)
 		{
-			r = fire_r[j][i];
-			g = fire_g[j][i];
-			b = fire_b[j][i];
+			int r = fire_r[j][i];
+			int g = fire_g[j][i];
+			int b = fire_b[j][i];
 			if (r || g || b)
 			{
-#if defined(__MMX__) and defined(PIXELBYTES)
-				// optimised fire rendering using MMX instructions
-				// If the max fire_alpha value is greater than 256, the slow rendering method is used so that answers are capped correctly
-				if (fire_mmx)// set in prepare_alpha() depending on the max fire_alpha value
-				{
-					__m64 fireColour = _m_from_int(PIXRGB(r,g,b));// the fire colour for this cell, in the pixel format used by SDL
-					__m64 zero = _m_from_int(0);
-					fireColour = _mm_unpacklo_pi8(fireColour, zero);// Zero extend the 8 bit R/G/B colour values into 16 bit values, so that they can be multiplied by the alpha value
-					for (y=-CELL; y<2*CELL; y++)
-						for (x=-CELL; x<2*CELL; x++)
-						{
-							if (!globalSim->InBounds(i*CELL+x, j*CELL+y))
-								continue;
-#if defined(__SSE__) and defined(__GNUC__) and !defined(__clang__)
-							// unsigned multiply allows a slight optimisation, but is not available in the MMX instruction set
-							// With SSE, alpha is multiplied by 2^8 when initialised, and the high 16 bits of the answer are stored (equivalent to dividing the answer by 2^16), so the answer stored is alpha*colour/256
-							__m64 tmp = (__m64)(fire_alpha_mmx[y+CELL][x+CELL]);
-
-							// (in these asm instructions, the second operand is where the result is stored)
-							__asm__("\
-								pmulhuw %[fireColour], %[tmp] /* Multiply packed 16 bit R/G/B fireColour values by packed 16 bit alpha values, store the high 16 bits of each result */\n\t\
-								packuswb %[zero], %[tmp] /* Squash the 16 bit colour values back into 8 bit values (saturating, values over 255 are set to 255) */\n\t\
-								paddusb %[tmp], %[pixelColour] /* Add the scaled fire colour to the pixel. Saturating 8 bit addition - each pair of bytes is added separately, and if the result is over 255 it is set to 255 */"
-								: [pixelColour] "+y" (vid[(j*CELL+y)*(XRES+BARSIZE)+i*CELL+x]),
-								  [tmp] "+&y" (tmp)
-								: [fireColour] "y" (fireColour),
-								  [zero] "y" (zero));
-#else
-							// if only signed multiply is available, alpha can't be premultiplied by 256 since that could correspond to a negative number
-							// therefore use a slightly slower method
-							__m64 fireAdd = _mm_mullo_pi16(fireColour, (__m64)(fire_alpha_mmx[y+CELL][x+CELL]));// multiply each R/G/B colour value in fireColour by the alpha value for this pixel location
-							fireAdd = _mm_srli_pi16(fireAdd, 8);// Divide results by 256 (shift right by 8)
-							fireAdd = _mm_packs_pu16 (fireAdd, zero);// Squash the 16 bit colour values back into 8 bit values (saturating, values over 255 are set to 255)
-							// fireAdd now contains the fire colour in the pixel format used by SDL, scaled by fire_alpha[y+CELL][x+CELL]/256
-
-							// Now add it to the pixel
-							__m64 pixColour = _m_from_int(vid[(j*CELL+y)*(XRES+BARSIZE)+i*CELL+x]);// Get the current pixel colour
-							pixColour = _mm_adds_pu8(pixColour, fireAdd);// Saturating 8 bit addition of pixColour and fireAdd. Each pair of bytes is added separately, and if the result is over 255 it is set to 255
-							vid[(j*CELL+y)*(XRES+BARSIZE)+i*CELL+x] = _m_to_int(pixColour);// Store the modified pixel colour back into the video buffer
-#endif
-						}
-					_mm_empty();// needed for floating point instructions to work after using MMX instructions
-				}
+				int x = (i-1)*CELL, y = (j-1)*CELL;
+				if (x>=0 && y>=0 && x+CELL*3<=XRES+BARSIZE && y+CELL*3<=YRES+MENUSIZE)
+					splatCell(vid, x, y, r, g, b);
 				else
-				{
-					for (y=-CELL; y<2*CELL; y++)
-						for (x=-CELL; x<2*CELL; x++)
-							addpixel(vid, i*CELL+x, j*CELL+y, r, g, b, fire_alpha[y+CELL][x+CELL]);
-				}
-#else
-				for (y=-CELL; y<2*CELL; y++)
-					for (x=-CELL; x<2*CELL; x++)
-						addpixel(vid, i*CELL+x, j*CELL+y, r, g, b, fire_alpha[y+CELL][x+CELL]);
-#endif
+					render_fire_splatCell_scalar(vid, x, y, r, g, b);
 			}
+		}
+}
 
-			r *= 8;
-			g *= 8;
-			b *= 8;
-			for (y=-1; y<2; y++)
-				for (x=-1; x<2; x++)
-					if ((x || y) && i+x>=0 && j+y>=0 && i+x<XRES/CELL && j+y<YRES/CELL)
-					{
-						r += fire_r[j+y][i+x];
-						g += fire_g[j+y][i+x];
-						b += fire_b[j+y][i+x];
-					}
-			r /= 16;
-			g /= 16;
-			b /= 16;
-			fire_r[j][i] = r>4 ? r-4 : 0;
-			fire_g[j][i] = g>4 ? g-4 : 0;
-			fire_b[j][i] = b>4 ? b-4 : 0;
+/* Fire decay: each cell becomes (8*itself + the 8 surrounding cells)/16 - 4.
+ * Cells are updated in place in order, so the cells above and to the left have already been updated when a cell is calculated. This makes each cell depend on the one to its left, so that part has to be done one cell at a time, but the sum of the rest of the cells can be calculated for a whole row at once.
+ */
+
+// Sum of 8*cur[i], cur[i+1], and the three cells above and below i, for one cell. up and down are NULL for the top and bottom rows.
+static inline int render_fire_decaySum(const unsigned char *up, const unsigned char *cur, const unsigned char *down, int i)
+{
+	const int w = XRES/CELL;
+	int sum = 8*cur[i];
+	if (i+1<w)
+		sum += cur[i+1];
+	for (int k=std::max(i-1, 0); k<=std::min(i+1, w-1); k++)
+	{
+		if (up)
+			sum += up[k];
+		if (down)
+			sum += down[k];
+	}
+	return sum;
+}
+
+static void render_fire_decaySums_scalar(const unsigned char *up, const unsigned char *cur, const unsigned char *down, uint16_t *sums)
+{
+	for (int i=0; i<XRES/CELL; i++)
+		sums[i] = render_fire_decaySum(up, cur, down, i);
+}
+
+#ifdef RENDER_FIRE_HAVE_SSE2
+static void render_fire_decaySums_sse2(const unsigned char *up, const unsigned char *cur, const unsigned char *down, uint16_t *sums)
+{
+	const int w = XRES/CELL;
+	const __m128i zero = _mm_setzero_si128();
+	sums[0] = render_fire_decaySum(up, cur, down, 0);
+	int i = 1;
+	// 8 cells at a time, for cells which have neighbours on both sides
+	for (; i+8<w; i+=8)
+	{
+		__m128i sum = _mm_slli_epi16(_mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cur+i)), zero), 3);
+		sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(cur+i+1)), zero));
+		for (int k=-1; k<=1; k++)
+		{
+			if (up)
+				sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(up+i+k)), zero));
+			if (down)
+				sum = _mm_add_epi16(sum, _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(down+i+k)), zero));
+		}
+		_mm_storeu_si128((__m128i*)(sums+i), sum);
+	}
+	for (; i<w; i++)
+		sums[i] = render_fire_decaySum(up, cur, down, i);
+}
+#endif
+
+#ifdef RENDER_FIRE_HAVE_AVX2
+RENDER_FIRE_TARGET_AVX2 static void render_fire_decaySums_avx2(const unsigned char *up, const unsigned char *cur, const unsigned char *down, uint16_t *sums)
+{
+	const int w = XRES/CELL;
+	sums[0] = render_fire_decaySum(up, cur, down, 0);
+	int i = 1;
+	// 16 cells at a time, for cells which have neighbours on both sides
+	for (; i+16<w; i+=16)
+	{
+		__m256i sum = _mm256_slli_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(cur+i))), 3);
+		sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(cur+i+1))));
+		for (int k=-1; k<=1; k++)
+		{
+			if (up)
+				sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(up+i+k))));
+			if (down)
+				sum = _mm256_add_epi16(sum, _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(down+i+k))));
+		}
+		_mm256_storeu_si256((__m256i*)(sums+i), sum);
+	}
+	for (; i<w; i++)
+		sums[i] = render_fire_decaySum(up, cur, down, i);
+}
+#endif
+
+typedef void (*render_fire_decaySums_fn)(const unsigned char *up, const unsigned char *cur, const unsigned char *down, uint16_t *sums);
+
+static void render_fire_decayChannel(unsigned char fire[YRES/CELL][XRES/CELL], render_fire_decaySums_fn decaySums)
+{
+	uint16_t sums[XRES/CELL];
+	for (int j=0; j<YRES/CELL; j++)
+	{
+		decaySums(j>0 ? fire[j-1] : NULL, fire[j], j<YRES/CELL-1 ? fire[j+1] : NULL, sums);
+		int left = 0;
+		for (int i=0; i<XRES/CELL; i++)
+		{
+			int c = (sums[i]+left)/16;
+			left = fire[j][i] = c>4 ? c-4 : 0;
 		}
+	}
+}
+
+bool render_fire_supported(int impl)
+{
+	switch (impl)
+	{
+	case RENDER_FIRE_SCALAR:
+		return true;
+#ifdef RENDER_FIRE_HAVE_SSE2
+	case RENDER_FIRE_SSE2:
+		return true;
+#endif
+#ifdef RENDER_FIRE_HAVE_AVX2
+	case RENDER_FIRE_AVX2:
+		return __builtin_cpu_supports("avx2");
+#endif
+	default:
+		return false;
+	}
+}
+
+void render_fire(pixel *vid)
+{
+	static int bestImpl = -1;
+	if (bestImpl<0)
+	{
+		bestImpl = RENDER_FIRE_SCALAR;
+		for (int impl=RENDER_FIRE_SCALAR; impl<RENDER_FIRE_IMPL_COUNT; impl++)
+			if (render_fire_supported(impl))
+				bestImpl = impl;
+	}
+	int impl = (render_fire_impl!=RENDER_FIRE_AUTO && render_fire_supported(render_fire_impl)) ? render_fire_impl : bestImpl;
+
+	render_fire_splatCell_fn splatCell = render_fire_splatCell_scalar;
+	render_fire_decaySums_fn decaySums = render_fire_decaySums_scalar;
+#ifdef RENDER_FIRE_HAVE_SSE2
+	if (impl==RENDER_FIRE_SSE2)
+	{
+		splatCell = render_fire_splatCell_sse2;
+		decaySums = render_fire_decaySums_sse2;
+	}
+#endif
+#ifdef RENDER_FIRE_HAVE_AVX2
+	if (impl==RENDER_FIRE_AVX2)
+	{
+		splatCell = render_fire_splatCell_avx2;
+		decaySums = render_fire_decaySums_avx2;
+	}
+#endif
+
+	render_fire_splat(vid, splatCell);
+	render_fire_decayChannel(fire_r, decaySums);
+	render_fire_decayChannel(fire_g, decaySums);
+	render_fire_decayChannel(fire_b, decaySums);
 }
 
 void prepare_alpha(int size, float intensity)
@@ -3923,25 +4409,15 @@ void prepare_alpha(int size, float intensity)
 				for (j=-CELL; j<CELL; j++)
 					temp[y+CELL+j][x+CELL+i] += expf(-0.1f*(i*i+j*j));
 
-	fire_mmx = true;
 	for (x=0; x<CELL*3; x++)
 		for (y=0; y<CELL*3; y++)
 		{
-			uint64_t tmp = (int)(multiplier*temp[y][x]/(CELL*CELL));
+			unsigned int tmp = (int)(multiplier*temp[y][x]/(CELL*CELL));
 			if (tmp>65535)
 				tmp = 65535;
 			fire_alpha[y][x] = tmp;
-#if defined(__MMX__) and defined(PIXELBYTES)
-			if (tmp>255)
-				fire_mmx = false;
-#if defined(__SSE__) and defined(__GNUC__) and !defined(__clang__)
-			tmp *= 256;
-#endif
-			// Now duplicate the alpha value (which is less than 65535 so a 16 bit value) 4 times in tmp for MMX optimisations
-			tmp |= (tmp<<16);
-			tmp |= (tmp<<32);
-			fire_alpha_mmx[y][x] = tmp;
-#endif
+			for (i=0; i<4; i++)
+				fire_alpha_lanes[y][x][i] = tmp;
 		}
 			
 #ifdef OGLR
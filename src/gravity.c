@@ -17,15 +17,21 @@
 
 #include <math.h>
 #include <sys/types.h>
-#include <pthread.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <memory>
 #include "defines.h"
 #include "gravity.h"
 #include "powder.h"
 #include "simulation/Simulation.h"
+#include "simulation/gravity/GravitySimulator.hpp"
 
 #ifdef GRAVFFT
 #include <fftw3.h>
-#endif 
+#else
+#include "common/tpt-fft.h"
+#endif
 
 
 float *gravmap = NULL;//Maps to be used by the main thread
@@ -41,15 +47,16 @@ float *th_gravx = NULL;
 float *th_gravy = NULL;
 float *th_gravp = NULL;
 
+// Gravity field (before masking) caused by th_ogravmap, kept between runs so that changes to a few cells can be added to it
+float *th_gravfieldx = NULL;
+float *th_gravfieldy = NULL;
+
 int gravityMode = 0; // starts enabled in "vertical" mode...
 int ngrav_enable = 0; //Newtonian gravity
 int th_gravchanged = 0;
 
-pthread_t gravthread;
-pthread_mutex_t gravmutex;
-pthread_cond_t gravcv;
-int grav_ready = 0;
-int gravthread_done = 0;
+std::unique_ptr<GravitySimulator_async> gravSimulator;
+std::shared_future<bool> gravSimFuture;
 
 void bilinear_interpolation(float *src, float *dst, int sw, int sh, int rw, int rh)
 {
@@ -85,6 +92,8 @@ void gravity_init()
 	th_gravy = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
 	th_gravx = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
 	th_gravp = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
+	th_gravfieldx = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
+	th_gravfieldy = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
 	gravmap = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
 	gravy = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
 	gravx = (float*)calloc((XRES/CELL)*(YRES/CELL), sizeof(float));
@@ -94,116 +103,54 @@ void gravity_init()
 
 void gravity_cleanup()
 {
-#ifdef GRAVFFT
+	stop_grav_async();
+	grav_direct_cleanup();
 	grav_fft_cleanup();
-#endif
 }
 
 void gravity_update_async()
 {
-	int result;
+	bool gotResult = false;
 	if(ngrav_enable)
 	{
-		pthread_mutex_lock(&gravmutex);
-		result = grav_ready;
-		if(result) //Did the gravity thread finish?
+		//Did the gravity simulation finish? Only update if not paused
+		if (gravSimFuture.valid() && gravSimFuture.wait_for(std::chrono::seconds(0))==std::future_status::ready && (!sys_pause||framerender))
 		{
-			if (!sys_pause||framerender){ //Only update if not paused
-				//Switch the full size gravmaps, we don't really need the two above any more
-				float *tmpf;
-
-				if (gravity_cleared)
-				{
-					memset(th_gravx, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memset(th_gravy, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memset(th_gravp, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memset(th_ogravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					gravity_cleared = 0;
-				}
-
-				if(th_gravchanged)
-				{
-				#if !defined(GRAVFFT) && defined(GRAV_DIFF)
-					memcpy(gravy, th_gravy, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memcpy(gravx, th_gravx, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-					memcpy(gravp, th_gravp, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-				#else
-					tmpf = gravy;
-					gravy = th_gravy;
-					th_gravy = tmpf;
-	
-					tmpf = gravx;
-					gravx = th_gravx;
-					th_gravx = tmpf;
-	
-					tmpf = gravp;
-					gravp = th_gravp;
-					th_gravp = tmpf;
-				#endif
-				}
-
-				tmpf = gravmap;
-				gravmap = th_gravmap;
-				th_gravmap = tmpf;
-
-				grav_ready = 0; //Tell the other thread that we're ready for it to continue
-				pthread_cond_signal(&gravcv);
+			bool changed = gravSimFuture.get();
+			if (gravity_cleared)
+			{
+				//gravx/y/p have already been cleared, so discard the results and start again from an empty gravity map
+				grav_clear();
+				gravity_cleared = 0;
+			}
+			else if (changed)
+			{
+				std::swap(gravx, th_gravx);
+				std::swap(gravy, th_gravy);
+				std::swap(gravp, th_gravp);
 			}
+
+			//th_gravmap was cleared at the end of the gravity simulation run, so gravmap is ready for use in the next frame
+			std::swap(gravmap, th_gravmap);
+			gravSimFuture = gravSimulator->simulate();
+			gotResult = true;
 		}
-		pthread_mutex_unlock(&gravmutex);
 		//Apply the gravity mask
 		membwand(gravy, gravmask, (XRES/CELL)*(YRES/CELL)*sizeof(float), (XRES/CELL)*(YRES/CELL)*sizeof(unsigned));
 		membwand(gravx, gravmask, (XRES/CELL)*(YRES/CELL)*sizeof(float), (XRES/CELL)*(YRES/CELL)*sizeof(unsigned));
-		memset(gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+		if (!gotResult)
+			memset(gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
 	}
 }
 
-void* update_grav_async(void* unused)
-{
-	int done = 0;
-	int thread_done = 0;
-	memset(th_ogravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	memset(th_gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	memset(th_gravy, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	memset(th_gravx, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	memset(th_gravp, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	//memset(th_gravy, 0, XRES*YRES*sizeof(float));
-	//memset(th_gravx, 0, XRES*YRES*sizeof(float));
-	//memset(th_gravp, 0, XRES*YRES*sizeof(float));
-#ifdef GRAVFFT
-	grav_fft_init();
-#endif
-	while(!thread_done){
-		if(!done){
-			update_grav();
-			done = 1;
-			pthread_mutex_lock(&gravmutex);
-			
-			grav_ready = done;
-			thread_done = gravthread_done;
-			
-			pthread_mutex_unlock(&gravmutex);
-		} else {
-			pthread_mutex_lock(&gravmutex);
-			pthread_cond_wait(&gravcv, &gravmutex);
-		    
-			done = grav_ready;
-			thread_done = gravthread_done;
-			
-			pthread_mutex_unlock(&gravmutex);
-		}
-	}
-	pthread_exit(NULL);
-}
-
 void start_grav_async()
 {
 	if(!ngrav_enable){
-		gravthread_done = 0;
-		grav_ready = 0;
-		pthread_mutex_init (&gravmutex, NULL);
-		pthread_cond_init(&gravcv, NULL);
-		pthread_create(&gravthread, NULL, update_grav_async, NULL); //Start asynchronous gravity simulation
+		gravSimulator.reset(new GravitySimulator_async());
+		memset(th_gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+		grav_clear();
+		gravity_cleared = 0;
+		gravSimFuture = gravSimulator->simulate();
 		ngrav_enable = 1;
 	}
 	memset(gravy, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
@@ -214,12 +161,10 @@ void start_grav_async()
 void stop_grav_async()
 {
 	if(ngrav_enable){
-		pthread_mutex_lock(&gravmutex);
-		gravthread_done = 1;
-		pthread_cond_signal(&gravcv);
-		pthread_mutex_unlock(&gravmutex);
-		pthread_join(gravthread, NULL);
-		pthread_mutex_destroy(&gravmutex); //Destroy the mutex
+		if (gravSimFuture.valid())
+			gravSimFuture.wait();
+		gravSimFuture = std::shared_future<bool>();
+		gravSimulator.reset();
 		ngrav_enable = 0;
 	}
 	//Clear the grav velocities
@@ -228,6 +173,117 @@ void stop_grav_async()
 	memset(gravp, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
 }
 
+/* Changes to the gravity map can be applied to the gravity field by adding the field caused by each changed cell (direct superposition),
+ * which takes time proportional to the number of changed cells. If more than GRAV_DIRECT_MAX_CELLS cells have changed, the whole field
+ * is recalculated using FFTs instead (with FFTW if available, otherwise with the slower built-in FFT).
+ * Each direct update adds a little rounding error to the stored field, so the field is also recalculated from scratch once
+ * GRAV_DIRECT_MAX_TOTAL cells have been added since the last full calculation. */
+#ifdef GRAVFFT
+#define GRAV_DIRECT_MAX_CELLS 64
+#else
+#define GRAV_DIRECT_MAX_CELLS 384
+#endif
+#define GRAV_DIRECT_MAX_TOTAL (GRAV_DIRECT_MAX_CELLS*16)
+
+//Field caused by a unit point mass, indexed by the offset (target-source) from the mass, with the mass at (XRES/CELL-1, YRES/CELL-1)
+#define GRAV_KERNEL_W (XRES/CELL*2-1)
+#define GRAV_KERNEL_H (YRES/CELL*2-1)
+float *th_gravkernelx = NULL, *th_gravkernely = NULL;
+int *th_gravchangedcells = NULL;
+int th_gravdirecttotal = 0;// number of cells added to th_gravfieldx/y by grav_direct_add since they were last calculated from scratch
+
+void grav_direct_init()
+{
+	int x, y, dx, dy;
+	float distance;
+	if (th_gravkernelx) return;
+	th_gravkernelx = (float*)calloc(GRAV_KERNEL_W*GRAV_KERNEL_H, sizeof(float));
+	th_gravkernely = (float*)calloc(GRAV_KERNEL_W*GRAV_KERNEL_H, sizeof(float));
+	th_gravchangedcells = (int*)calloc((XRES/CELL)*(YRES/CELL), sizeof(int));
+	for (y=0; y<GRAV_KERNEL_H; y++)
+	{
+		for (x=0; x<GRAV_KERNEL_W; x++)
+		{
+			dx = x-(XRES/CELL-1);
+			dy = y-(YRES/CELL-1);
+			if (dx==0 && dy==0)
+				continue;
+			distance = sqrtf(dx*dx + dy*dy);
+			th_gravkernelx[y*GRAV_KERNEL_W+x] = M_GRAV * -dx / pow(distance, 3);
+			th_gravkernely[y*GRAV_KERNEL_W+x] = M_GRAV * -dy / pow(distance, 3);
+		}
+	}
+}
+
+void grav_direct_cleanup()
+{
+	free(th_gravkernelx);
+	free(th_gravkernely);
+	free(th_gravchangedcells);
+	th_gravkernelx = th_gravkernely = NULL;
+	th_gravchangedcells = NULL;
+}
+
+//Stores the indices of cells where th_gravmap differs from th_ogravmap in th_gravchangedcells
+//Returns the number of changed cells, or maxCount+1 if more than maxCount cells have changed (in which case only the first maxCount are stored)
+int grav_find_changed(int maxCount)
+{
+	int i, count = 0;
+	for (i=0; i<(XRES/CELL)*(YRES/CELL); i++)
+	{
+		if (th_ogravmap[i]!=th_gravmap[i])
+		{
+			if (count==maxCount)
+				return maxCount+1;
+			th_gravchangedcells[count++] = i;
+		}
+	}
+	return count;
+}
+
+//Adds the gravity field caused by a mass of val in the given cell to th_gravfieldx and th_gravfieldy
+void grav_direct_add(int cell, float val)
+{
+	int x, y;
+	int cx = cell%(XRES/CELL), cy = cell/(XRES/CELL);
+	for (y=0; y<YRES/CELL; y++)
+	{
+		//Kernel values for this row, starting at the offset for x=0
+		int k = (y-cy+YRES/CELL-1)*GRAV_KERNEL_W + XRES/CELL-1-cx;
+		float *gx = th_gravfieldx + y*(XRES/CELL), *gy = th_gravfieldy + y*(XRES/CELL);
+		const float *kx = th_gravkernelx + k, *ky = th_gravkernely + k;
+		for (x=0; x<XRES/CELL; x++)
+		{
+			gx[x] += val*kx[x];
+			gy[x] += val*ky[x];
+		}
+	}
+}
+
+//Calculate the velocity maps caused by a point mass, for use in the FFT convolution
+//The maps are (XRES/CELL*2)x(YRES/CELL*2), with the point mass at (XRES/CELL, YRES/CELL)
+void grav_fft_pointmass(float *ptgravx, float *ptgravy)
+{
+	int xblock2 = XRES/CELL*2;
+	int yblock2 = YRES/CELL*2;
+	int x, y;
+	float distance, scaleFactor;
+	//(XRES/CELL)*(YRES/CELL)*4 is size of data array, scaling needed because the FFTs calculate an unnormalized DFT
+	scaleFactor = -M_GRAV/((XRES/CELL)*(YRES/CELL)*4);
+	for (y=0; y<yblock2; y++)
+	{
+		for (x=0; x<xblock2; x++)
+		{
+			if (x==XRES/CELL && y==YRES/CELL) continue;
+			distance = sqrtf(pow(x-(XRES/CELL), 2) + pow(y-(YRES/CELL), 2));
+			ptgravx[y*xblock2+x] = scaleFactor*(x-(XRES/CELL)) / pow(distance, 3);
+			ptgravy[y*xblock2+x] = scaleFactor*(y-(YRES/CELL)) / pow(distance, 3);
+		}
+	}
+	ptgravx[yblock2*xblock2/2+xblock2/2] = 0.0f;
+	ptgravy[yblock2*xblock2/2+xblock2/2] = 0.0f;
+}
+
 #ifdef GRAVFFT
 int grav_fft_status = 0;
 float *th_ptgravx, *th_ptgravy, *th_gravmapbig, *th_gravxbig, *th_gravybig;
@@ -238,8 +294,7 @@ void grav_fft_init()
 {
 	int xblock2 = XRES/CELL*2;
 	int yblock2 = YRES/CELL*2;
-	int x, y, fft_tsize = (xblock2/2+1)*yblock2;
-	float distance, scaleFactor;
+	int fft_tsize = (xblock2/2+1)*yblock2;
 	fftwf_plan plan_ptgravx, plan_ptgravy;
 	if (grav_fft_status) return;
 
@@ -262,21 +317,8 @@ void grav_fft_init()
 	plan_gravx_inverse = fftwf_plan_dft_c2r_2d(yblock2, xblock2, th_gravxbigt, th_gravxbig, FFTW_MEASURE);
 	plan_gravy_inverse = fftwf_plan_dft_c2r_2d(yblock2, xblock2, th_gravybigt, th_gravybig, FFTW_MEASURE);
 
-	//(XRES/CELL)*(YRES/CELL)*4 is size of data array, scaling needed because FFTW calculates an unnormalized DFT
-	scaleFactor = -M_GRAV/((XRES/CELL)*(YRES/CELL)*4);
 	//calculate velocity map caused by a point mass
-	for (y=0; y<yblock2; y++)
-	{
-		for (x=0; x<xblock2; x++)
-		{
-			if (x==XRES/CELL && y==YRES/CELL) continue;
-			distance = sqrtf(pow(x-(XRES/CELL), 2) + pow(y-(YRES/CELL), 2));
-			th_ptgravx[y*xblock2+x] = scaleFactor*(x-(XRES/CELL)) / pow(distance, 3);
-			th_ptgravy[y*xblock2+x] = scaleFactor*(y-(YRES/CELL)) / pow(distance, 3);
-		}
-	}
-	th_ptgravx[yblock2*xblock2/2+xblock2/2] = 0.0f;
-	th_ptgravy[yblock2*xblock2/2+xblock2/2] = 0.0f;
+	grav_fft_pointmass(th_ptgravx, th_ptgravy);
 
 	//transform point mass velocity maps
 	fftwf_execute(plan_ptgravx);
@@ -309,17 +351,147 @@ void grav_fft_cleanup()
 	grav_fft_status = 0;
 }
 
-void update_grav()
+//Transform the padded gravmap, do the convolution with the point mass velocity maps, and inverse transform into th_gravxbig and th_gravybig
+void grav_fft_convolve()
 {
-	int x, y;
 	int xblock2 = XRES/CELL*2, yblock2 = YRES/CELL*2;
 	int i, fft_tsize = (xblock2/2+1)*yblock2;
 	float mr, mc, pr, pc, gr, gc;
+	//transform gravmap
+	fftwf_execute(plan_gravmap);
+	//do convolution (multiply the complex numbers)
+	for (i=0; i<fft_tsize; i++)
+	{
+		mr = th_gravmapbigt[i][0];
+		mc = th_gravmapbigt[i][1];
+		pr = th_ptgravxt[i][0];
+		pc = th_ptgravxt[i][1];
+		gr = mr*pr-mc*pc;
+		gc = mr*pc+mc*pr;
+		th_gravxbigt[i][0] = gr;
+		th_gravxbigt[i][1] = gc;
+		pr = th_ptgravyt[i][0];
+		pc = th_ptgravyt[i][1];
+		gr = mr*pr-mc*pc;
+		gc = mr*pc+mc*pr;
+		th_gravybigt[i][0] = gr;
+		th_gravybigt[i][1] = gc;
+	}
+	//inverse transform
+	fftwf_execute(plan_gravx_inverse);
+	fftwf_execute(plan_gravy_inverse);
+}
+
+#else
+// FFTW not available, use the built-in FFT
+int grav_fft_status = 0;
+tpt_fft_real2d *grav_fft = NULL;
+float *th_gravmapbig, *th_gravxbig, *th_gravybig;
+tpt_fft::cpx *th_ptgravxt, *th_ptgravyt, *th_gravmapbigt, *th_gravxbigt, *th_gravybigt;
+
+void grav_fft_init()
+{
+	int xblock2 = XRES/CELL*2;
+	int yblock2 = YRES/CELL*2;
+	int fft_tsize;
+	float *th_ptgravx, *th_ptgravy;
+	if (grav_fft_status) return;
+
+	grav_fft = new tpt_fft_real2d(xblock2, yblock2);
+	fft_tsize = grav_fft->complexSize();
+	th_ptgravxt = new tpt_fft::cpx[fft_tsize];
+	th_ptgravyt = new tpt_fft::cpx[fft_tsize];
+	th_gravmapbigt = new tpt_fft::cpx[fft_tsize];
+	th_gravxbigt = new tpt_fft::cpx[fft_tsize];
+	th_gravybigt = new tpt_fft::cpx[fft_tsize];
+	th_gravmapbig = new float[xblock2*yblock2]();
+	th_gravxbig = new float[xblock2*yblock2];
+	th_gravybig = new float[xblock2*yblock2];
+
+	//calculate and transform velocity map caused by a point mass
+	th_ptgravx = new float[xblock2*yblock2];
+	th_ptgravy = new float[xblock2*yblock2];
+	grav_fft_pointmass(th_ptgravx, th_ptgravy);
+	grav_fft->forward(th_ptgravx, th_ptgravxt);
+	grav_fft->forward(th_ptgravy, th_ptgravyt);
+	delete[] th_ptgravx;
+	delete[] th_ptgravy;
+
+	grav_fft_status = 1;
+}
+
+void grav_fft_cleanup()
+{
+	if (!grav_fft_status) return;
+	delete grav_fft;
+	delete[] th_ptgravxt;
+	delete[] th_ptgravyt;
+	delete[] th_gravmapbigt;
+	delete[] th_gravxbigt;
+	delete[] th_gravybigt;
+	delete[] th_gravmapbig;
+	delete[] th_gravxbig;
+	delete[] th_gravybig;
+	grav_fft = NULL;
+	grav_fft_status = 0;
+}
+
+//Transform the padded gravmap, do the convolution with the point mass velocity maps, and inverse transform into th_gravxbig and th_gravybig
+void grav_fft_convolve()
+{
+	int i, fft_tsize = grav_fft->complexSize();
+	grav_fft->forward(th_gravmapbig, th_gravmapbigt);
+	for (i=0; i<fft_tsize; i++)
+	{
+		th_gravxbigt[i] = th_gravmapbigt[i]*th_ptgravxt[i];
+		th_gravybigt[i] = th_gravmapbigt[i]*th_ptgravyt[i];
+	}
+	grav_fft->inverse(th_gravxbigt, th_gravxbig);
+	grav_fft->inverse(th_gravybigt, th_gravybig);
+}
+#endif
+
+void grav_clear()
+{
+	memset(th_ogravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	memset(th_gravfieldx, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	memset(th_gravfieldy, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+	th_gravdirecttotal = 0;
+}
+
+void update_grav()
+{
+	int x, y, i;
+	int xblock2 = XRES/CELL*2;
 	float *tmp;
+	int changedCount;
 	if (!grav_fft_status) grav_fft_init();
-	if (memcmp(th_ogravmap, th_gravmap, sizeof(float)*(XRES/CELL)*(YRES/CELL))!=0)
+	if (!th_gravkernelx) grav_direct_init();
+	changedCount = grav_find_changed(GRAV_DIRECT_MAX_CELLS);
+	if (changedCount==0)
+	{
+		th_gravchanged = 0;
+	}
+	else if (changedCount<=GRAV_DIRECT_MAX_CELLS && th_gravdirecttotal+changedCount<=GRAV_DIRECT_MAX_TOTAL)
+	{
+		th_gravchanged = 1;
+		th_gravdirecttotal += changedCount;
+		for (i=0; i<changedCount; i++)
+		{
+			int cell = th_gravchangedcells[i];
+			grav_direct_add(cell, th_gravmap[cell]-th_ogravmap[cell]);
+		}
+		for (i=0; i<(XRES/CELL)*(YRES/CELL); i++)
+		{
+			th_gravx[i] = th_gravfieldx[i];
+			th_gravy[i] = th_gravfieldy[i];
+			th_gravp[i] = sqrtf(th_gravx[i]*th_gravx[i] + th_gravy[i]*th_gravy[i]);
+		}
+	}
+	else
 	{
 		th_gravchanged = 1;
+		th_gravdirecttotal = 0;
 
 		//copy gravmap into padded gravmap array
 		for (y=0; y<YRES/CELL; y++)
@@ -329,108 +501,23 @@ void update_grav()
 				th_gravmapbig[(y+YRES/CELL)*xblock2+XRES/CELL+x] = th_gravmap[y*(XRES/CELL)+x];
 			}
 		}
-		//transform gravmap
-		fftwf_execute(plan_gravmap);
-		//do convolution (multiply the complex numbers)
-		for (i=0; i<fft_tsize; i++)
-		{
-			mr = th_gravmapbigt[i][0];
-			mc = th_gravmapbigt[i][1];
-			pr = th_ptgravxt[i][0];
-			pc = th_ptgravxt[i][1];
-			gr = mr*pr-mc*pc;
-			gc = mr*pc+mc*pr;
-			th_gravxbigt[i][0] = gr;
-			th_gravxbigt[i][1] = gc;
-			pr = th_ptgravyt[i][0];
-			pc = th_ptgravyt[i][1];
-			gr = mr*pr-mc*pc;
-			gc = mr*pc+mc*pr;
-			th_gravybigt[i][0] = gr;
-			th_gravybigt[i][1] = gc;
-		}
-		//inverse transform, and copy from padded arrays into normal velocity maps
-		fftwf_execute(plan_gravx_inverse);
-		fftwf_execute(plan_gravy_inverse);
+		grav_fft_convolve();
+		//copy from padded arrays into normal velocity maps
 		for (y=0; y<YRES/CELL; y++)
 		{
 			for (x=0; x<XRES/CELL; x++)
 			{
-				th_gravx[y*(XRES/CELL)+x] = th_gravxbig[y*xblock2+x];
-				th_gravy[y*(XRES/CELL)+x] = th_gravybig[y*xblock2+x];
+				th_gravfieldx[y*(XRES/CELL)+x] = th_gravx[y*(XRES/CELL)+x] = th_gravxbig[y*xblock2+x];
+				th_gravfieldy[y*(XRES/CELL)+x] = th_gravy[y*(XRES/CELL)+x] = th_gravybig[y*xblock2+x];
 				th_gravp[y*(XRES/CELL)+x] = sqrtf(pow(th_gravxbig[y*xblock2+x],2)+pow(th_gravybig[y*xblock2+x],2));
 			}
 		}
 	}
-	else
-	{
-		th_gravchanged = 0;
-	}
 	tmp = th_ogravmap;
 	th_ogravmap = th_gravmap;
 	th_gravmap = tmp;
 }
 
-#else
-// gravity without fast Fourier transforms
-
-void update_grav(void)
-{
-	int x, y, i, j, changed = 0;
-	float val, distance;
-	th_gravchanged = 0;
-#ifndef GRAV_DIFF
-	//Find any changed cells
-	for (i=0; i<YRES/CELL; i++)
-	{
-		if(changed)
-			break;
-		for (j=0; j<XRES/CELL; j++)
-		{
-			if(th_ogravmap[i*(XRES/CELL)+j]!=th_gravmap[i*(XRES/CELL)+j]){
-				changed = 1;
-				break;
-			}
-		}
-	}
-	if(!changed)
-		goto fin;
-	memset(th_gravy, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-	memset(th_gravx, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-#endif
-	th_gravchanged = 1;
-	for (i = 0; i < YRES / CELL; i++) {
-		for (j = 0; j < XRES / CELL; j++) {
-#ifdef GRAV_DIFF
-			if (th_ogravmap[i*(XRES/CELL)+j] != th_gravmap[i*(XRES/CELL)+j])
-			{
-#else
-			if (th_gravmap[i*(XRES/CELL)+j] > 0.0001f || th_gravmap[i*(XRES/CELL)+j]<-0.0001f) //Only calculate with populated or changed cells.
-			{
-#endif
-				for (y = 0; y < YRES / CELL; y++) {
-					for (x = 0; x < XRES / CELL; x++) {
-						if (x == j && y == i)//Ensure it doesn't calculate with itself
-							continue;
-						distance = sqrt(pow(j - x, 2) + pow(i - y, 2));
-#ifdef GRAV_DIFF
-						val = th_gravmap[i*(XRES/CELL)+j] - th_ogravmap[i*(XRES/CELL)+j];
-#else
-						val = th_gravmap[i*(XRES/CELL)+j];
-#endif
-						th_gravx[y*(XRES/CELL)+x] += M_GRAV * val * (j - x) / pow(distance, 3);
-						th_gravy[y*(XRES/CELL)+x] += M_GRAV * val * (i - y) / pow(distance, 3);
-						th_gravp[y*(XRES/CELL)+x] += M_GRAV * val / pow(distance, 2);
-					}
-				}
-			}
-		}
-	}
-fin:
-	memcpy(th_ogravmap, th_gravmap, (XRES/CELL)*(YRES/CELL)*sizeof(float));
-}
-#endif
-
 
 
 void grav_mask_r(int x, int y, char checkmap[YRES/CELL][XRES/CELL], char shape[YRES/CELL][XRES/CELL], char *shapeout)
@@ -141,13 +141,28 @@ void luacon_open(){
 	lua_pushlightuserdata(l, parts);
 	lua_setfield(l, tptProperties, "partsdata");
 	
-	luaL_dostring (l, "ffi = require(\"ffi\")\n\
+	// The particle declaration given to ffi must have the same layout as simulation/Particle.h
+	static_assert(offsetof(particle, type)==0 && offsetof(particle, life)==4 && offsetof(particle, ctype)==8, "Lua FFI particle declaration is out of date");
+	static_assert(offsetof(particle, x)==12 && offsetof(particle, y)==16 && offsetof(particle, vx)==20 && offsetof(particle, vy)==24 && offsetof(particle, temp)==28, "Lua FFI particle declaration is out of date");
+	static_assert(offsetof(particle, pmap_prev)==32 && offsetof(particle, pmap_next)==36 && offsetof(particle, tmp)==40 && offsetof(particle, flags)==44, "Lua FFI particle declaration is out of date");
+	static_assert(offsetof(particle, tmp2)==48 && offsetof(particle, dcolour)==52 && offsetof(particle, pavg)==56 && offsetof(particle, transitionStoredEnergy)==64 && offsetof(particle, transitionPendingFrames)==68, "Lua FFI particle declaration is out of date");
+#ifdef OGLR
+	static_assert(offsetof(particle, lastX)==72 && offsetof(particle, lastY)==76 && sizeof(particle)==80, "Lua FFI particle declaration is out of date");
+#else
+	static_assert(sizeof(particle)==72, "Lua FFI particle declaration is out of date");
+#endif
+	static const char ffiParticleScript[] = "ffi = require(\"ffi\")\n\
 ffi.cdef[[\n\
-typedef struct { int type; int life, ctype; float x, y, vx, vy; float temp; float pavg[2]; int flags; int tmp; int tmp2; unsigned int dcolour; } particle;\n\
+typedef struct { int type; int life, ctype; float x, y, vx, vy; float temp; int pmap_prev; int pmap_next; int tmp; int flags; int tmp2; unsigned int dcolour; float pavg[2]; float transitionStoredEnergy; int transitionPendingFrames;"
+#ifdef OGLR
+" float lastX, lastY;"
+#endif
+" } particle;\n\
 ]]\n\
 tpt.parts = ffi.cast(\"particle *\", tpt.partsdata)\n\
 ffi = nil\n\
-tpt.partsdata = nil");
+tpt.partsdata = nil";
+	luaL_dostring (l, ffiParticleScript);
 	//Since ffi is REALLY REALLY dangrous, we'll remove it from the environment completely (TODO)
 	//lua_pushstring(l, "parts");
 	//tptPartsCData = lua_gettable(l, tptProperties);
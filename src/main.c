@@ -610,8 +610,8 @@ int main(int argc, char *argv[])
 			debug_perf_istart %= DEBUG_PERF_FRAMECOUNT;
 		}
 		
-		gravity_update_async(); //Check for updated velocity maps from gravity thread
-		if (!sys_pause||framerender) //Only update if not paused
+		gravity_update_async(); //Check for updated velocity maps from gravity thread, and clear the old gravmap if Newtonian gravity is enabled
+		if ((!sys_pause||framerender) && !ngrav_enable) //Only update if not paused
 			memset(gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float)); //Clear the old gravmap
 
 		if (framerender) {
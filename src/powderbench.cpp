@@ -0,0 +1,423 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Headless benchmark: loads every save in a directory and times the main phases of a frame separately.
+ * Does not call any SDL functions, so it can be run on machines without a display (e.g. for nightly regression tracking).
+ *
+ * Usage: powderbench <save directory> [frames N] [warmup N] [spatialsort N] [tiledthreads N] [builtin NAME] [output file.json]
+ * spatialsort N sets Simulation::spatialSortInterval, to compare particle update speed with and without spatial sorting.
+ * tiledthreads N enables the tiled multithreaded particle update with N threads (see SimTiledUpdate).
+ * builtin NAME adds a generated scene to the benchmark (see bench_builtin), and can be used more than once. Use "-" as the save directory to run only built in scenes.
+ * Built in scenes: heat (heat conduction in a lava pool and layered furnace).
+ * Results are written as JSON to stdout (or to the output file), progress and errors go to stderr.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(WIN32) && !defined(__GNUC__)
+#include <io.h>
+#else
+#include <dirent.h>
+#endif
+
+#include "defines.h"
+#include "powder.h"
+#include "gravity.h"
+#include "graphics.h"
+#include "powdergraphics.h"
+#include "misc.h"
+#include "save.h"
+
+#include "simulation/Simulation.h"
+#include "simulation/SimulationSharedData.h"
+#include "simulation/air/SimAir.hpp"
+
+namespace
+{
+
+typedef std::chrono::steady_clock bench_clock;
+
+class PhaseTimings
+{
+public:
+	std::string name;
+	std::vector<double> samples;// milliseconds
+
+	PhaseTimings(std::string name_) : name(name_) {}
+
+	template <class F>
+	void time(F f)
+	{
+		bench_clock::time_point start = bench_clock::now();
+		f();
+		bench_clock::time_point end = bench_clock::now();
+		samples.push_back(std::chrono::duration<double, std::milli>(end-start).count());
+	}
+
+	// nearest-rank percentile, samples must already be sorted
+	static double percentile(const std::vector<double> &sorted, double p)
+	{
+		if (sorted.empty())
+			return 0.0;
+		size_t rank = (size_t)std::ceil(p/100.0 * sorted.size());
+		if (rank<1)
+			rank = 1;
+		return sorted[std::min(rank, sorted.size())-1];
+	}
+
+	void writeJson(FILE *f) const
+	{
+		std::vector<double> sorted = samples;
+		std::sort(sorted.begin(), sorted.end());
+		double mean = 0.0;
+		for (double s : sorted)
+			mean += s;
+		if (!sorted.empty())
+			mean /= sorted.size();
+		fprintf(f, "\"%s\": {\"samples\": %d, \"mean\": %.6f, \"min\": %.6f, \"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f}",
+			name.c_str(), (int)sorted.size(), mean,
+			sorted.empty() ? 0.0 : sorted.front(),
+			percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+			sorted.empty() ? 0.0 : sorted.back());
+	}
+};
+
+std::string json_escape(const std::string &s)
+{
+	std::string out;
+	for (char c : s)
+	{
+		if (c=='"' || c=='\\')
+		{
+			out += '\\';
+			out += c;
+		}
+		else if ((unsigned char)c < 0x20)
+		{
+			char buf[8];
+			sprintf(buf, "\\u%04x", (unsigned char)c);
+			out += buf;
+		}
+		else
+			out += c;
+	}
+	return out;
+}
+
+std::vector<std::string> list_saves(std::string folder)
+{
+	std::vector<std::string> results;
+	if (folder.size() && folder.back()!='/' && folder.back()!='\\')
+		folder += '/';
+	const char *fname;
+#if defined(WIN32) && !defined(__GNUC__)
+	struct _finddata_t current_file;
+	intptr_t findfile_handle = _findfirst((folder + "*.*").c_str(), &current_file);
+	if (findfile_handle == -1L)
+		return results;
+	do
+	{
+		fname = current_file.name;
+#else
+	struct dirent *entry;
+	DIR *directory = opendir(folder.c_str());
+	if (!directory)
+		return results;
+	while ((entry = readdir(directory)))
+	{
+		fname = entry->d_name;
+#endif
+		size_t len = strlen(fname);
+		if (len>4 && (!strcmp(fname+len-4, ".cps") || !strcmp(fname+len-4, ".stm")))
+			results.push_back(folder + fname);
+	}
+#if defined(WIN32) && !defined(__GNUC__)
+	while (_findnext(findfile_handle, &current_file) == 0);
+	_findclose(findfile_handle);
+#else
+	closedir(directory);
+#endif
+	std::sort(results.begin(), results.end());
+	return results;
+}
+
+// Equivalent of gravity_update_async() plus GravitySimulator_async, but run synchronously so that update_grav() can be timed on its own
+void grav_step_sync(PhaseTimings &t)
+{
+	const size_t mapSize = (XRES/CELL)*(YRES/CELL)*sizeof(float);
+	if (gravity_cleared)
+	{
+		grav_clear();
+		gravity_cleared = 0;
+	}
+	std::swap(gravmap, th_gravmap);
+	t.time([]() {
+		update_grav();
+	});
+	memset(th_gravmap, 0, mapSize);
+	if (th_gravchanged)
+	{
+		std::swap(gravx, th_gravx);
+		std::swap(gravy, th_gravy);
+		std::swap(gravp, th_gravp);
+	}
+	membwand(gravy, gravmask, mapSize, (XRES/CELL)*(YRES/CELL)*sizeof(unsigned));
+	membwand(gravx, gravmask, mapSize, (XRES/CELL)*(YRES/CELL)*sizeof(unsigned));
+}
+
+// Runs frames on whatever is currently in the simulation, and writes the timings
+bool bench_run(FILE *out, int frames, int warmup, int spatialSort, int tiledThreads, pixel *vid_buf)
+{
+	// parse_save starts the gravity thread if the save has Newtonian gravity enabled.
+	// Stop it and run gravity synchronously instead, so it does not run concurrently with the other timed phases.
+	bool gravEnabled = ngrav_enable;
+	if (gravEnabled)
+	{
+		stop_grav_async();
+		ngrav_enable = 1;
+	}
+	sys_pause = framerender = 0;
+	globalSim->spatialSortInterval = spatialSort;
+	globalSim->option_tiledUpdateThreads(tiledThreads);
+	display_mode = 0;
+	decorations_enable = 1;
+
+	PhaseTimings tAir("air"), tParts("update_particles"), tGrav("gravity"), tRender("render_parts"), tFrame("frame");
+	for (int frame=-warmup; frame<frames; frame++)
+	{
+		if (frame==0)
+		{
+			// end of warmup
+			tAir.samples.clear();
+			tParts.samples.clear();
+			tGrav.samples.clear();
+			tRender.samples.clear();
+		}
+		bench_clock::time_point frameStart = bench_clock::now();
+
+		globalSim->air.applyChanges();
+		tAir.time([]() {
+			globalSim->air.simulate_sync();
+		});
+		if (globalSim->walls.gravwl_timeout==1)
+			gravity_mask();
+
+		tParts.time([]() {
+			globalSim->UpdateParticles();
+		});
+
+		if (gravEnabled)
+			grav_step_sync(tGrav);
+
+		memset(vid_buf, 0, (XRES+BARSIZE)*YRES*PIXELSIZE);
+		tRender.time([vid_buf]() {
+			render_parts(vid_buf);
+		});
+
+		if (frame>=0)
+			tFrame.samples.push_back(std::chrono::duration<double, std::milli>(bench_clock::now()-frameStart).count());
+	}
+	if (gravEnabled)
+		ngrav_enable = 0;
+
+	fprintf(out, "\"particles\": %d, \"newtonian_gravity\": %s, \"phases\": {", globalSim->parts_count, gravEnabled ? "true" : "false");
+	tAir.writeJson(out);
+	fprintf(out, ", ");
+	tParts.writeJson(out);
+	if (gravEnabled)
+	{
+		fprintf(out, ", ");
+		tGrav.writeJson(out);
+	}
+	fprintf(out, ", ");
+	tRender.writeJson(out);
+	fprintf(out, ", ");
+	tFrame.writeJson(out);
+	fprintf(out, "}}");
+	return true;
+}
+
+bool bench_save(FILE *out, const std::string &filename, int frames, int warmup, int spatialSort, int tiledThreads, pixel *vid_buf)
+{
+	int size;
+	void *file_data = file_load((char*)filename.c_str(), &size);
+	fprintf(out, "\t\t{\"file\": \"%s\", ", json_escape(filename).c_str());
+	if (!file_data)
+	{
+		fprintf(out, "\"error\": \"could not read file\"}");
+		return false;
+	}
+	if (parse_save(file_data, size, 1, 0, 0, globalSim->walls.getDataPtr(), globalSim->signs, parts))
+	{
+		fprintf(out, "\"error\": \"could not parse save\"}");
+		free(file_data);
+		return false;
+	}
+	free(file_data);
+	return bench_run(out, frames, warmup, spatialSort, tiledThreads, vid_buf);
+}
+
+
+void builtin_fill(SimPosI p1, SimPosI p2, int t, float temp, int ctype=0)
+{
+	for (int y=p1.y; y<=p2.y; y++)
+	{
+		for (int x=p1.x; x<=p2.x; x++)
+		{
+			int i = globalSim->part_create(-1, SimPosI(x,y), t);
+			if (i>=0)
+			{
+				globalSim->parts[i].temp = temp;
+				globalSim->parts[i].ctype = ctype;
+			}
+		}
+	}
+}
+
+// Scenes which are generated instead of loaded from a save, for benchmarking particular parts of the simulation
+bool bench_builtin(FILE *out, const std::string &name, int frames, int warmup, int spatialSort, int tiledThreads, pixel *vid_buf)
+{
+	fprintf(out, "\t\t{\"builtin\": \"%s\", ", json_escape(name).c_str());
+	clear_sim();
+	if (name=="heat")
+	{
+		// Heat conduction: a lava pool in a diamond basin, and a furnace of alternating brick and metal layers which is hot on one side and cold on the other
+		// The lava is created first, since part_create does not create particles in occupied positions, so the DMND fill only creates the walls and floor around it
+		builtin_fill(SimPosI(24, YRES-130), SimPosI(XRES-25, YRES-24), PT_LAVA, 2300.0f, PT_STNE);
+		builtin_fill(SimPosI(20, YRES-130), SimPosI(XRES-21, YRES-20), PT_DMND, R_TEMP+273.15f);
+		for (int y=40; y<200; y++)
+		{
+			int t = ((y/4)%2) ? PT_METL : PT_BRCK;
+			builtin_fill(SimPosI(60, y), SimPosI(XRES/2-1, y), t, 2000.0f);
+			builtin_fill(SimPosI(XRES/2, y), SimPosI(XRES-61, y), t, 300.0f);
+		}
+		if (globalSim->elementCount[PT_LAVA] != (XRES-48)*107 || globalSim->elementCount[PT_DMND] != (XRES-40)*111-(XRES-48)*107)
+		{
+			fprintf(out, "\"error\": \"scene not created correctly\"}");
+			return false;
+		}
+	}
+	else
+	{
+		fprintf(out, "\"error\": \"unknown builtin scene\"}");
+		return false;
+	}
+	return bench_run(out, frames, warmup, spatialSort, tiledThreads, vid_buf);
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+	const char *saveDir = NULL, *outFilename = NULL;
+	int frames = 300, warmup = 60, spatialSort = 0, tiledThreads = 0;
+	std::vector<std::string> builtins;
+	for (int i=1; i<argc; i++)
+	{
+		if (!strcmp(argv[i], "frames") && i+1<argc)
+			frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "warmup") && i+1<argc)
+			warmup = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "spatialsort") && i+1<argc)
+			spatialSort = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "tiledthreads") && i+1<argc)
+			tiledThreads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "builtin") && i+1<argc)
+			builtins.push_back(argv[++i]);
+		else if (!saveDir)
+			saveDir = argv[i];
+		else if (!outFilename)
+			outFilename = argv[i];
+	}
+	if (!saveDir || frames<1 || warmup<0 || spatialSort<0 || tiledThreads<0)
+	{
+		fprintf(stderr, "Usage: %s <save directory> [frames N] [warmup N] [spatialsort N] [tiledthreads N] [builtin NAME] [output file.json]\n", argv[0]);
+		return 1;
+	}
+
+	std::vector<std::string> saves;
+	if (strcmp(saveDir, "-"))
+		saves = list_saves(saveDir);
+	if (saves.empty() && builtins.empty())
+	{
+		fprintf(stderr, "No saves found in %s\n", saveDir);
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if (outFilename)
+	{
+		out = fopen(outFilename, "w");
+		if (!out)
+		{
+			fprintf(stderr, "Unable to open %s for writing\n", outFilename);
+			return 1;
+		}
+	}
+
+	std::shared_ptr<SimulationSharedData> simSD = std::make_shared<SimulationSharedData>();
+	std::shared_ptr<Simulation> mainSim = std::make_shared<Simulation>(simSD);
+
+	pixel *vid_buf = (pixel*)calloc((XRES+BARSIZE)*(YRES+MENUSIZE), PIXELSIZE);
+	pers_bg = (pixel*)calloc((XRES+BARSIZE)*YRES, PIXELSIZE);
+	gravity_init();
+	colour_mode = COLOUR_DEFAULT;
+	init_display_modes();
+	TRON_init_graphics();
+	prepare_alpha(CELL, 1.0f);
+	prepare_graphicscache();
+	flm_data = generate_gradient(flm_data_colours, flm_data_pos, flm_data_points, 200);
+	plasma_data = generate_gradient(plasma_data_colours, plasma_data_pos, plasma_data_points, 200);
+	clear_sim();
+
+	fprintf(out, "{\n\t\"frames\": %d,\n\t\"warmup\": %d,\n\t\"spatial_sort_interval\": %d,\n\t\"tiled_update_threads\": %d,\n\t\"units\": \"ms\",\n\t\"saves\": [\n", frames, warmup, spatialSort, tiledThreads);
+	int failed = 0;
+	const size_t benchCount = saves.size()+builtins.size();
+	for (size_t i=0; i<benchCount; i++)
+	{
+		bool ok;
+		if (i<saves.size())
+		{
+			fprintf(stderr, "[%d/%d] %s\n", (int)i+1, (int)benchCount, saves[i].c_str());
+			ok = bench_save(out, saves[i], frames, warmup, spatialSort, tiledThreads, vid_buf);
+		}
+		else
+		{
+			const std::string &name = builtins[i-saves.size()];
+			fprintf(stderr, "[%d/%d] builtin %s\n", (int)i+1, (int)benchCount, name.c_str());
+			ok = bench_builtin(out, name, frames, warmup, spatialSort, tiledThreads, vid_buf);
+		}
+		if (!ok)
+			failed++;
+		fprintf(out, (i+1<benchCount) ? ",\n" : "\n");
+	}
+	fprintf(out, "\t]\n}\n");
+
+	if (out!=stdout)
+		fclose(out);
+	free(vid_buf);
+	free(pers_bg);
+	gravity_cleanup();
+	return failed ? 2 : 0;
+}
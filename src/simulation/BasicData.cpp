@@ -16,10 +16,12 @@
 #include "simulation/BasicData.hpp"
 #include <algorithm>
 #include <cstring>
+#include <vector>
 
 Sim_BasicData::Sim_BasicData(std::shared_ptr<SimulationSharedData> sd) :
 	simSD(sd),
-	pfree(-1)
+	pfree(-1),
+	partsFreeDelay(false)
 {
 	elements = simSD->elements;
 	elemDataShared_ = simSD->elemDataShared_;
@@ -41,8 +43,11 @@ Sim_BasicData::~Sim_BasicData()
 void Sim_BasicData::clear()
 {
 	pmap.clear();
+	partsByBucket.clear();
 	elementCount.fill(0);
+	partsByType.clear();
 	std::memset(parts, 0, sizeof(particle)*NPART);
+	partsActive.clear();
 	parts_count = 0;
 	parts_lastActiveIndex = 0;
 #ifdef DEBUG_PARTSALLOC
@@ -53,29 +58,46 @@ void Sim_BasicData::clear()
 		parts[i].life = i+1;
 	parts[NPART-1].life = -1;
 	pfree = 0;
+	partsFreeDelayed.clear();
 }
 
-/* Recalculates elementCount[] values */
+/* Stops delaying reuse of freed particle IDs (see partsFreeDelay), and adds the IDs freed while it was on to the free list */
+void Sim_BasicData::part_freeDelayedFinish()
+{
+	partsFreeDelay = false;
+	for (int i : partsFreeDelayed)
+	{
+		parts[i].life = pfree;
+		pfree = i;
+	}
+	partsFreeDelayed.clear();
+}
+
+/* Recalculates elementCount[] values and partsByType lists */
 void Sim_BasicData::recalc_elementCount()
 {
 	elementCount.fill(0);
+	partsByType.clear();
 	parts_count = 0;
 	for (int i=0; i<NPART; i++)
 	{
 		if (parts[i].type)
 		{
 			elementCount[parts[i].type]++;
+			partsByType.set(i, parts[i].type);
 			parts_count++;
 		}
 	}
 }
 
-/* Completely recalculates the entire pmap.
+/* Completely recalculates the entire pmap (and partsActive).
  * Avoid this as much as possible. */
 void Sim_BasicData::recalc_pmap()
 {
 	int i;
 	pmap.clear();
+	partsByBucket.clear();
+	partsActive.clear();
 #ifdef DEBUG_PARTSALLOC
 	for (i=0; i<NPART; i++)
 		partsFree[i] = true;
@@ -85,6 +107,7 @@ void Sim_BasicData::recalc_pmap()
 		if (parts[i].type)
 		{
 			pmap_add(i, SimPosF(parts[i].x, parts[i].y), parts[i].type);
+			partsActive.set(i);
 #ifdef DEBUG_PARTSALLOC
 			partsFree[i] = false;
 #endif
@@ -95,41 +118,22 @@ void Sim_BasicData::recalc_pmap()
 /* Recalculates the pfree/parts[].life linked list for particles with ID <= parts_lastActiveIndex.
  * This ensures that future particle allocations are done near the start of the parts array, to keep parts_lastActiveIndex low.
  * parts_lastActiveIndex is also decreased if appropriate.
- * Does not modify or even read any particles beyond parts_lastActiveIndex */
+ * Does not modify or even read any particles beyond parts_lastActiveIndex, and only reads partsActive to find which particles are in use */
 void Sim_BasicData::recalc_freeParticles()
 {
-	int lastPartUsed = 0;
+	int lastPartUsed = std::max(partsActive.prev_or_equal(parts_lastActiveIndex), 0);
 	int lastPartUnused = -1;
 
-	for (int i=0; i<=parts_lastActiveIndex; i++)
+	const int lastWord = parts_lastActiveIndex>>6;
+	for (int w=0; w<=lastWord; w++)
 	{
-		if (parts[i].type)
-		{
-			// TODO: do stuff with commented out code below
-			// int x, y, t;
-			/*t = parts[i].type;
-			x = (int)(parts[i].x+0.5f);
-			y = (int)(parts[i].y+0.5f);
-			if (x>=0 && y>=0 && x<XRES && y<YRES)
-			{
-				if (elements[t].Properties & TYPE_ENERGY)
-					photons[y][x] = t|(i<<8);
-				else
-				{
-					// Particles are sometimes allowed to go inside INVS and FILT
-					// To make particles collide correctly when inside these elements, these elements must not overwrite an existing pmap entry from particles inside them
-					if (!pmap[y][x] || (t!=PT_INVIS && t!= PT_FILT))
-						pmap[y][x] = t|(i<<8);
-					// Count number of particles at each location, for excess stacking check
-					// (there are a few exceptions, including energy particles - currently no limit on stacking those)
-					if (t!=PT_THDR && t!=PT_EMBR && t!=PT_FIGH && t!=PT_PLSM)
-						pmap_count[y][x]++;
-				}
-			}*/
-			lastPartUsed = i;
-		}
-		else
+		uint64_t freeBits = ~partsActive.word(w);
+		if (w==lastWord && (parts_lastActiveIndex&63)!=63)
+			freeBits &= (uint64_t(2)<<(parts_lastActiveIndex&63))-1;
+		while (freeBits)
 		{
+			int i = (w<<6) + tptmath::ctz64(freeBits);
+			freeBits &= freeBits-1;
 			if (lastPartUnused<0) pfree = i;
 			else parts[lastPartUnused].life = i;
 			lastPartUnused = i;
@@ -148,4 +152,79 @@ void Sim_BasicData::recalc_freeParticles()
 	parts_lastActiveIndex = lastPartUsed;
 }
 
+/* Renumbers particles so that they are packed at the start of the parts array in Z-order of their position.
+ * Particles which are close together in the simulation then tend to be close together in memory, so looking at neighbouring particles through pmap is more cache friendly.
+ * Particles in the same position keep their relative order, and each pmap list keeps its order.
+ * Note that this changes the order in which particles are updated.
+ * ElemDataSim::Simulation_PartsRenumbered is called afterwards so that elements can update any stored particle IDs. */
+void Sim_BasicData::parts_sortSpatially()
+{
+	std::vector<uint64_t> keys;
+	keys.reserve(parts_count);
+	for (int i=parts_firstActive(); i>=0; i=parts_nextActive(i))
+	{
+		SimPosI pos = SimPosF(parts[i].x, parts[i].y);
+		keys.push_back((uint64_t(tptmath::morton2d(pos.x, pos.y))<<32) | uint32_t(i));
+	}
+	if (keys.empty())
+		return;
+	std::sort(keys.begin(), keys.end());
+
+	const int count = keys.size();
+	std::vector<int> newIds(NPART, -1);
+	std::vector<particle> sorted(count);
+	for (int k=0; k<count; k++)
+	{
+		int i = int(keys[k] & 0xFFFFFFFF);
+		newIds[i] = k;
+		sorted[k] = parts[i];
+	}
+	for (int k=0; k<count; k++)
+	{
+		if (sorted[k].pmap_prev>=0)
+			sorted[k].pmap_prev = newIds[sorted[k].pmap_prev];
+		if (sorted[k].pmap_next>=0)
+			sorted[k].pmap_next = newIds[sorted[k].pmap_next];
+	}
+	for (int y=0; y<YRES; y++)
+	{
+		for (int x=0; x<XRES; x++)
+		{
+			ParticleMapEntry &entry = pmap[y][x];
+			if (entry.count())
+			{
+				entry.setFirst(newIds[entry.first()]);
+				entry.setFirstEnergy(newIds[entry.first(PMapCategory::Energy)]);
+			}
+		}
+	}
+
+	const int oldLastIndex = parts_lastActiveIndex;
+	std::copy(sorted.begin(), sorted.end(), parts);
+	if (oldLastIndex>=count)
+		std::memset(parts+count, 0, sizeof(particle)*(oldLastIndex+1-count));
 
+	partsActive.clear();
+	partsByType.clear();
+	partsByBucket.clear();
+	for (int k=0; k<count; k++)
+	{
+		partsActive.set(k);
+		partsByType.set(k, parts[k].type);
+		partsByBucket.add(k, SimPosF(parts[k].x, parts[k].y), parts[k].type);
+#ifdef DEBUG_PARTSALLOC
+		partsFree[k] = false;
+#endif
+	}
+#ifdef DEBUG_PARTSALLOC
+	for (int k=count; k<=oldLastIndex; k++)
+		partsFree[k] = true;
+#endif
+	recalc_freeParticles();
+
+	for (int t=0; t<PT_NUM; t++)
+	{
+		if (elemDataSim_[t])
+			elemDataSim_[t]->Simulation_PartsRenumbered(newIds.data());
+	}
+}
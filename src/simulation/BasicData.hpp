@@ -21,11 +21,17 @@
 #include "simulation/ElemDataShared.h"
 #include "simulation/ElemDataSim.h"
 #include "simulation/Particle.h"
+#include "simulation/ParticleBitset.hpp"
+#include "simulation/ParticleTypeLists.hpp"
+#include "simulation/ParticleTypeBuckets.hpp"
+#include "simulation/ParticleTypeChanges.hpp"
 #include "simulation/ParticleMap.hpp"
 #include "common/tptmath.h"
 #include "common/tpt-stdint.h"
+#include <algorithm>
 #include <array>
 #include <memory>
+#include <vector>
 
 class SimulationSharedData;
 
@@ -39,14 +45,22 @@ public:
 
 	Element *elements;
 	std::array<int,PT_NUM> elementCount;
+	ParticleTypeLists partsByType;// IDs of particles of each type, maintained alongside elementCount
+	ParticleTypeBuckets partsByBucket;// IDs of particles of some types in each area of the simulation, maintained alongside pmap
+	ParticleTypeChanges typeChanges;// positions where particles of some types have changed during the current frame, maintained alongside pmap
 	int parts_lastActiveIndex;
 	int parts_count;
 	int pfree;
 	ParticleMap pmap;
 	particle parts[NPART];
+	ParticleBitset partsActive;// bit is set for each particle ID with parts[i].type!=0
 #ifdef DEBUG_PARTSALLOC
 	bool partsFree[NPART];
 #endif
+	// While partsFreeDelay is true, part_free puts IDs in partsFreeDelayed instead of the free list, so that they are not reused until part_freeDelayedFinish() is called.
+	// Used by the tiled particle update, so that an ID freed in one tile is not given to a particle in a different tile while it might still be looked at by the first tile.
+	bool partsFreeDelay;
+	std::vector<int> partsFreeDelayed;
 
 	Sim_BasicData(std::shared_ptr<SimulationSharedData> sd);
 	virtual ~Sim_BasicData();
@@ -54,6 +68,20 @@ public:
 	void recalc_freeParticles();
 	void recalc_pmap();
 	void recalc_elementCount();
+	void parts_sortSpatially();
+	void part_freeDelayedFinish();
+
+	// Iterating over all particles:
+	//   for (int i=parts_firstActive(); i>=0; i=parts_nextActive(i))
+	// Particles created or killed during the loop are handled the same as in a loop over 0..parts_lastActiveIndex with a parts[i].type check.
+	int parts_firstActive() const
+	{
+		return partsActive.first(parts_lastActiveIndex);
+	}
+	int parts_nextActive(int i) const
+	{
+		return partsActive.next(i, parts_lastActiveIndex);
+	}
 
 	template <class ElemDataClass_T>
 	ElemDataClass_T * elemData(int elementId)
@@ -186,12 +214,16 @@ public:
 	void pmap_add(int i, SimPosI pos, int t)
 	{
 		// NB: all arguments are assumed to be within bounds
-		pmap(pos).add(parts, i, pmap_category(t));
+		pmap.add(parts, i, pos, pmap_category(t));
+		partsByBucket.add(i, pos, t);
+		typeChanges.mark(pos, t);
 	}
 	void pmap_remove(int i, SimPosI pos, int t)
 	{
 		// NB: all arguments are assumed to be within bounds
-		pmap(pos).remove(parts, i, pmap_category(t));
+		pmap.remove(parts, i, pos, pmap_category(t));
+		partsByBucket.remove(i, pos, t);
+		typeChanges.mark(pos, t);
 	}
 
 	// Finds a particle of type t at position pos, returns the ID. Returns a negative number if no particle is found.
@@ -212,6 +244,51 @@ public:
 	{
 		return (pmap_findDifferentOne(pos, t, c)>=0);
 	}
+	/* Calls f(pos) for each position in the rectangle from p1 to p2 (inclusive, clipped to the simulation area) which contains particles of category c. Empty positions are skipped using the pmap occupancy bits, without looking at their lists.
+	 * Positions are visited in the same order as a loop over x containing a loop over y, or in the reverse of that order if reverse is true. Stops and returns true as soon as f returns true.
+	 * The occupancy bits for each strip of 64 columns are read before calling f for the positions in it, so f must not add or remove particles in the rectangle.
+	 */
+	template<class Function>
+	bool pmap_forEachOccupied(SimPosI p1, SimPosI p2, PMapCategory c, bool reverse, Function &&f) const
+	{
+		const int xMin = std::max<int>(p1.x, 0), yMin = std::max<int>(p1.y, 0);
+		const int xMax = std::min<int>(p2.x, XRES-1), yMax = std::min<int>(p2.y, YRES-1);
+		if (xMin>xMax || yMin>yMax)
+			return false;
+		const int strips = (xMax-xMin)/64 + 1;
+		uint64_t rowBits[YRES];
+		for (int s=0; s<strips; s++)
+		{
+			const int stripX = xMin + (reverse ? strips-1-s : s)*64;
+			const int width = std::min(64, xMax-stripX+1);
+			uint64_t columns = 0;
+			for (int y=yMin; y<=yMax; y++)
+			{
+				rowBits[y] = pmap.occupiedSpan(c, stripX, y, width);
+				columns |= rowBits[y];
+			}
+			while (columns)
+			{
+				const int col = reverse ? tptmath::bsr64(columns) : tptmath::ctz64(columns);
+				const uint64_t bit = uint64_t(1)<<col;
+				columns &= ~bit;
+				if (reverse)
+				{
+					for (int y=yMax; y>=yMin; y--)
+						if ((rowBits[y]&bit) && f(SimPosI(stripX+col, y)))
+							return true;
+				}
+				else
+				{
+					for (int y=yMin; y<=yMax; y++)
+						if ((rowBits[y]&bit) && f(SimPosI(stripX+col, y)))
+							return true;
+				}
+			}
+		}
+		return false;
+	}
+
 	// Returns true if a particle of type t exists halfway between i1 and i2
 	bool check_middle_particle_type(int i1, int i2, int t) const
 	{
@@ -248,6 +325,7 @@ public:
 		if (i>parts_lastActiveIndex)
 			parts_lastActiveIndex = i;
 		parts_count++;
+		partsActive.set(i);
 #ifdef DEBUG_PARTSALLOC
 		if (!partsFree[i])
 			printf("Particle allocated that isn't free: %d\n", i);
@@ -258,9 +336,17 @@ public:
 	void part_free(int i)
 	{
 		parts[i].type = 0;
-		parts[i].life = pfree;
-		pfree = i;
+		if (partsFreeDelay)
+		{
+			partsFreeDelayed.push_back(i);
+		}
+		else
+		{
+			parts[i].life = pfree;
+			pfree = i;
+		}
 		parts_count--;
+		partsActive.reset(i);
 #ifdef DEBUG_PARTSALLOC
 		if (partsFree[i])
 			printf("Particle freed twice: %d\n", i);
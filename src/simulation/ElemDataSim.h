@@ -26,6 +26,8 @@ protected:
 public:
 	ElemDataSim(Simulation *s, int t_) : sim(s), elementId(t_) {}
 	virtual bool Check();
+	// Called after particle IDs have been changed by Sim_BasicData::parts_sortSpatially. newIds[oldId] is the new ID of each particle, or -1 if there was no particle with that ID.
+	virtual void Simulation_PartsRenumbered(const int *newIds);
 	virtual ~ElemDataSim();
 };
 
@@ -16,25 +16,37 @@
 #ifndef Particle_h
 #define Particle_h
 
+#include <cstddef>
+
+// Fields are grouped by how often the main particle loops use them, so that the frequently used ones are next to each other.
+// The particle array is not aligned to particle boundaries (sizeof(particle) is not a power of two), so this only means that a loop reading the hot fields touches at most two cache lines per particle instead of spreading reads across the whole struct. It is not a structure-of-arrays layout.
+// The Lua FFI interface in luaconsole.c declares this layout field by field, so it needs updating if fields are added or moved.
 class particle
 {
 public:
+	// hot
 	int type;
 	int life, ctype;
 	float x, y, vx, vy;
-#ifdef OGLR
-	float lastX, lastY;
-#endif
 	float temp;
-	float transitionStoredEnergy;
-	int transitionPendingFrames;
-	float pavg[2];
-	int flags;
+
+	// warm
+	int pmap_prev;
+	int pmap_next;
 	int tmp;
+	int flags;
+
+	// cold
 	int tmp2;
 	unsigned int dcolour;
-	int pmap_prev;
-	int pmap_next;
+	float pavg[2];
+	float transitionStoredEnergy;
+	int transitionPendingFrames;
+#ifdef OGLR
+	float lastX, lastY;
+#endif
 };
 
+static_assert(offsetof(particle, temp)+sizeof(float) <= 32, "Frequently used particle properties should be kept together at the start of the struct");
+
 #endif
@@ -0,0 +1,98 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef simulation_ParticleBitset_h
+#define simulation_ParticleBitset_h
+
+#include "simulation/Config.hpp"
+#include "common/tptmath.h"
+#include "common/tpt-stdint.h"
+#include <cstring>
+
+/* One bit per particle ID.
+ * Used to skip large gaps of unused particle IDs quickly, by checking 64 particles at a time. */
+class ParticleBitset
+{
+public:
+	static const int wordCount = (NPART+63)/64;
+protected:
+	uint64_t words[wordCount];
+public:
+	ParticleBitset()
+	{
+		clear();
+	}
+	void clear()
+	{
+		std::memset(words, 0, sizeof(words));
+	}
+	void set(int i)
+	{
+		words[i>>6] |= uint64_t(1)<<(i&63);
+	}
+	void reset(int i)
+	{
+		words[i>>6] &= ~(uint64_t(1)<<(i&63));
+	}
+	bool test(int i) const
+	{
+		return (words[i>>6]>>(i&63)) & 1;
+	}
+	uint64_t word(int wordId) const
+	{
+		return words[wordId];
+	}
+
+	// Returns the lowest set ID which is >i and <=last, or -1 if there isn't one
+	int next(int i, int last) const
+	{
+		i++;
+		if (i>last)
+			return -1;
+		int w = i>>6, lastW = last>>6;
+		uint64_t bits = words[w] & (~uint64_t(0) << (i&63));
+		while (!bits)
+		{
+			if (++w > lastW)
+				return -1;
+			bits = words[w];
+		}
+		i = (w<<6) + tptmath::ctz64(bits);
+		return (i<=last) ? i : -1;
+	}
+	int first(int last) const
+	{
+		return next(-1, last);
+	}
+	// Returns the highest set ID which is <=last, or -1 if there isn't one
+	int prev_or_equal(int last) const
+	{
+		if (last<0)
+			return -1;
+		int w = last>>6;
+		uint64_t bits = words[w];
+		if ((last&63)!=63)
+			bits &= (uint64_t(2)<<(last&63))-1;
+		while (!bits)
+		{
+			if (--w < 0)
+				return -1;
+			bits = words[w];
+		}
+		return (w<<6) + tptmath::bsr64(bits);
+	}
+};
+
+#endif
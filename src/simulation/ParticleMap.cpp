@@ -15,16 +15,53 @@
 
 #include "simulation/ParticleMap.hpp"
 #include <algorithm>
+#include <unordered_map>
 
-void ParticleMap::clear()
+namespace
+{
+// Counts which are too large to fit in a ParticleMapEntry, indexed by entry address and category.
+// Only used for positions with thousands of stacked particles, so speed does not matter much.
+std::mutex overflowMutex;
+std::unordered_map<uintptr_t, uint_least32_t> overflowCounts;
+
+uintptr_t overflowKey(const ParticleMapEntry *entry, PMapCategory c)
+{
+	return reinterpret_cast<uintptr_t>(entry)*2 + (c==PMapCategory::Plain ? 1 : 0);
+}
+}
+
+int ParticleMapEntry::countOverflow_get(PMapCategory c) const
+{
+	std::lock_guard<std::mutex> lock(overflowMutex);
+	auto it = overflowCounts.find(overflowKey(this, c));
+	if (it==overflowCounts.end())
+		return countOverflow;
+	return it->second;
+}
+
+void ParticleMapEntry::countOverflow_set(PMapCategory c, uint_least32_t n)
 {
-	ParticleMapEntry ce;
-	ce.clear();
+	std::lock_guard<std::mutex> lock(overflowMutex);
+	if (n>=countOverflow)
+		overflowCounts[overflowKey(this, c)] = n;
+	else
+		overflowCounts.erase(overflowKey(this, c));
+}
 
-	ParticleMapEntry *pmap_flat = reinterpret_cast<ParticleMapEntry*>(pmap);
-	for (int i=0; i<XRES*YRES; i++)
+void ParticleMap::clear()
+{
+	for (int y=0; y<YRES; y++)
+	{
+		for (int x=0; x<XRES; x++)
+			pmap[y][x].clear();
+	}
+	for (int y=0; y<YRES; y++)
 	{
-		pmap_flat[i] = ce;
+		for (int w=0; w<occupiedWordsPerRow; w++)
+		{
+			plainOccupied_[y][w].store(0, std::memory_order_relaxed);
+			energyOccupied_[y][w].store(0, std::memory_order_relaxed);
+		}
 	}
+	stackingCandidates_.clear();
 }
-
@@ -17,9 +17,13 @@
 #define simulation_ParticleMap_h
 
 #include "simulation/SimulationSharedData.h"
+#include "simulation/Config.hpp"
 #include "simulation/Position.hpp"
 #include "common/tpt-stdint.h"
+#include <atomic>
+#include <mutex>
 #include <stdexcept>
+#include <vector>
 
 /* The particle map is basically a large number of linked lists, one per integer coordinate.
  * 
@@ -108,24 +112,74 @@ class ParticleMapEntry
 {
 public:
 	class iterator;
+
+	// Positions with more plain particles than this are checked for excessive stacking (see Simulation::StackingCheck)
+	static const int stackingThreshold = 5;
+
 protected:
-	uint_least32_t count_;// number of particles, including energy particles
-	uint_least32_t count_plain_;// number of particles, not including energy particles
-public:
-	int first_;// ID of first particle
-	int first_energy_;// ID of first energy particle, or if there are no energy particles, ID of last non-energy particle
+	/* Packed into 64 bits, since most positions contain 0 or 1 particles and separate 32 bit fields would double the size of the pmap:
+	 *  bits 0-17: first - ID of first particle
+	 *  bits 18-35: first_energy - ID of first energy particle, or if there are no energy particles, ID of last non-energy particle
+	 *  bits 36-49: number of plain (non-energy) particles
+	 *  bits 50-63: number of energy particles
+	 * The IDs are only meaningful if there are some particles in this position.
+	 * If a count is too large to fit, countOverflow is stored instead, and the actual count is stored in ParticleMapOverflow.
+	 */
+	uint64_t data_;
+
+	static const int idBits = 18;
+	static const uint64_t idMask = (uint64_t(1)<<idBits)-1;
+	static const int countBits = 14;
+	static const uint_least32_t countOverflow = (1<<countBits)-1;
+	static const int firstShift = 0, firstEnergyShift = idBits, plainCountShift = 2*idBits, energyCountShift = 2*idBits+countBits;
+	static_assert(NPART <= (1<<idBits), "particle IDs do not fit in ParticleMapEntry");
+	static_assert(energyCountShift+countBits == 64, "ParticleMapEntry fields do not fill 64 bits");
 
-	void incCount(PMapCategory_single c)
+	static int countShift(PMapCategory c)
+	{
+		return (c==PMapCategory::Plain) ? plainCountShift : energyCountShift;
+	}
+	void setId(int shift, int i)
+	{
+		// Negative IDs only occur when the list becomes empty, in which case the ID is not used
+		const uint64_t id = (i<0) ? 0 : uint64_t(i);
+		data_ = (data_ & ~(idMask<<shift)) | (id<<shift);
+	}
+	int countCategory(PMapCategory c) const
 	{
-		count_++;
-		if (c==PMapCategory::Plain)
-			count_plain_++;
+		const uint_least32_t n = (data_>>countShift(c)) & countOverflow;
+		if (n==countOverflow)
+			return countOverflow_get(c);
+		return n;
 	}
-	void decCount(PMapCategory_single c)
+	int countOverflow_get(PMapCategory c) const;
+	void countOverflow_set(PMapCategory c, uint_least32_t n);
+	void setCount(PMapCategory c, uint_least32_t n)
 	{
-		count_--;
-		if (c==PMapCategory::Plain)
-			count_plain_--;
+		// Uses the overflow table if the count is too large, or if it was previously in the overflow table (so that it gets removed)
+		if (n>=countOverflow || ((data_>>countShift(c)) & countOverflow)==countOverflow)
+		{
+			countOverflow_set(c, n);
+			if (n>=countOverflow)
+				n = countOverflow;
+		}
+		data_ = (data_ & ~(uint64_t(countOverflow)<<countShift(c))) | (uint64_t(n)<<countShift(c));
+	}
+	void incCount(PMapCategory c)
+	{
+		const uint_least32_t n = (data_>>countShift(c)) & countOverflow;
+		if (n<countOverflow-1)
+			data_ += uint64_t(1)<<countShift(c);
+		else
+			setCount(c, countCategory(c)+1);
+	}
+	void decCount(PMapCategory c)
+	{
+		const uint_least32_t n = (data_>>countShift(c)) & countOverflow;
+		if (n!=countOverflow)
+			data_ -= uint64_t(1)<<countShift(c);
+		else
+			setCount(c, countCategory(c)-1);
 	}
 
 public:
@@ -135,31 +189,42 @@ public:
 		{
 		case PMapCategory::All:
 		default:
-			return count_;
+			return countCategory(PMapCategory::Plain) + countCategory(PMapCategory::Energy);
 		case PMapCategory::Energy:
-			return count_-count_plain_;
+			return countCategory(PMapCategory::Energy);
 		case PMapCategory::Plain:
-			return count_plain_;
+			return countCategory(PMapCategory::Plain);
 		}
 	}
 	int first(PMapCategory c=PMapCategory::All) const
 	{
 		if (c==PMapCategory::Energy)
-			return first_energy_;
+			return (data_>>firstEnergyShift) & idMask;
 		else
-			return first_;
+			return (data_>>firstShift) & idMask;
+	}
+	// For changing the stored IDs when particles are renumbered (the list itself is not changed)
+	void setFirst(int i)
+	{
+		setId(firstShift, i);
+	}
+	void setFirstEnergy(int i)
+	{
+		setId(firstEnergyShift, i);
 	}
 
 
-	void add(particle *parts, int i, PMapCategory_single c)
+	// Returns true if the number of plain particles has just gone above stackingThreshold
+	bool add(particle *parts, int i, PMapCategory_single c)
 	{
+		const int countPlain = count(PMapCategory::Plain), countEnergy = count(PMapCategory::Energy);
 		if (c==PMapCategory::Energy)
 		{
-			if (count(PMapCategory::Energy))
+			if (countEnergy)
 			{
 				// If there are some energy particles already, insert at head of energy particle list
-				int prevHead = first_energy_;
-				if (count(PMapCategory::Plain))
+				int prevHead = first(PMapCategory::Energy);
+				if (countPlain)
 				{
 					// If there are some non-energy particles, link to end of that list
 					parts[i].pmap_prev = parts[prevHead].pmap_prev;
@@ -172,10 +237,10 @@ public:
 				parts[i].pmap_next = prevHead;
 				parts[prevHead].pmap_prev = i;
 			}
-			else if (count(PMapCategory::Plain))
+			else if (countPlain)
 			{
 				// If there are no energy particles, then first_energy is the last non-energy particle. Insert this particle after it.
-				int i_prev = first_energy_;
+				int i_prev = first(PMapCategory::Energy);
 				parts[i_prev].pmap_next = i;
 				parts[i].pmap_prev = i_prev;
 				parts[i].pmap_next = -1;
@@ -186,28 +251,29 @@ public:
 				parts[i].pmap_next = -1;
 				parts[i].pmap_prev = -1;
 			}
-			first_energy_ = i;
-			if (!count(PMapCategory::Plain))
-				first_ = i;
+			setFirstEnergy(i);
+			if (!countPlain)
+				setFirst(i);
 		}
 		else
 		{
-			if (count(PMapCategory::All))
+			if (countPlain+countEnergy)
 			{
-				parts[first_].pmap_prev = i;
-				parts[i].pmap_next = first_;
+				parts[first()].pmap_prev = i;
+				parts[i].pmap_next = first();
 			}
 			else
 			{
 				parts[i].pmap_next = -1;
 				// If this is the only particle, it is the last non-energy particle too (which is the ID stored in first_energy when there are no energy particles)
-				first_energy_ = i;
+				setFirstEnergy(i);
 			}
 			parts[i].pmap_prev = -1;
-			first_ = i;
+			setFirst(i);
 		}
 
 		incCount(c);
+		return (c==PMapCategory::Plain && countPlain+1==stackingThreshold+1);
 	}
 	void remove(particle *parts, int i, PMapCategory_single c)
 	{
@@ -216,23 +282,23 @@ public:
 		if (parts[i].pmap_next>=0)
 			parts[parts[i].pmap_next].pmap_prev = parts[i].pmap_prev;
 
-		if (first_==i)
-			first_ = parts[i].pmap_next;
+		if (first()==i)
+			setFirst(parts[i].pmap_next);
 
 		if (count(PMapCategory::Energy)<=1)
 		{
-			if (first_energy_==i)
+			if (first(PMapCategory::Energy)==i)
 			{
 				// energyCount==1 and is first_energy: this is the only energy particle left
 				// energyCount==0 and is first_energy: this particle is a non-energy particle and is at the end of the list
 				// In both cases, set first_energy to pmap_prev so that first_energy is the ID of the last non-energy particle
-				first_energy_ = parts[i].pmap_prev;
+				setFirstEnergy(parts[i].pmap_prev);
 			}
 		}
-		else if (first_energy_==i)
+		else if (first(PMapCategory::Energy)==i)
 		{
 			// this is the first energy particle in the list and is being removed, so update first_energy to point at next item
-			first_energy_ = parts[i].pmap_next;
+			setFirstEnergy(parts[i].pmap_next);
 		}
 
 		decCount(c);
@@ -263,15 +329,56 @@ public:
 
 	void clear()
 	{
-		count_ = count_plain_ = 0;
+		if (((data_>>plainCountShift) & countOverflow)==countOverflow)
+			countOverflow_set(PMapCategory::Plain, 0);
+		if (((data_>>energyCountShift) & countOverflow)==countOverflow)
+			countOverflow_set(PMapCategory::Energy, 0);
+		data_ = 0;
 	}
+	ParticleMapEntry() : data_(0) {}
+	ParticleMapEntry(const ParticleMapEntry&) = delete;
+	ParticleMapEntry& operator=(const ParticleMapEntry&) = delete;
 };
 
 class ParticleMap
 {
 protected:
 	ParticleMapEntry pmap[YRES][XRES];
+	// Positions where the number of plain particles has gone above ParticleMapEntry::stackingThreshold, so that Simulation::StackingCheck does not need to look at every position.
+	// May contain duplicates, and positions which are no longer above the threshold.
+	std::vector<SimPosI> stackingCandidates_;
+	std::mutex stackingCandidatesMutex;// the tiled particle update may move particles into a position on several threads at once
+
+	// One bit per position for each category, set if there are any particles of that category in that position. Allows quickly counting the empty positions around a particle, and skipping empty positions when searching an area.
+	// Atomic because neighbouring tiles in the tiled particle update may change different bits in the same word.
+	static const int occupiedWordsPerRow = (XRES+63)/64;
+	std::atomic<uint64_t> plainOccupied_[YRES][occupiedWordsPerRow];
+	std::atomic<uint64_t> energyOccupied_[YRES][occupiedWordsPerRow];
+	void setOccupied(std::atomic<uint64_t> (&bits)[YRES][occupiedWordsPerRow], SimPosI pos, bool occupied)
+	{
+		std::atomic<uint64_t> &word = bits[pos.y][pos.x>>6];
+		const uint64_t bit = uint64_t(1)<<(pos.x&63);
+		if (concurrentUpdates)
+		{
+			if (occupied)
+				word.fetch_or(bit, std::memory_order_relaxed);
+			else
+				word.fetch_and(~bit, std::memory_order_relaxed);
+		}
+		else
+		{
+			uint64_t value = word.load(std::memory_order_relaxed);
+			word.store(occupied ? (value|bit) : (value&~bit), std::memory_order_relaxed);
+		}
+	}
+	std::atomic<uint64_t> (&occupiedBits(PMapCategory_single c))[YRES][occupiedWordsPerRow]
+	{
+		return (PMapCategory(c)==PMapCategory::Plain) ? plainOccupied_ : energyOccupied_;
+	}
 public:
+	// Must be set while particles might be added or removed by several threads at once (i.e. during the tiled particle update)
+	bool concurrentUpdates;
+
 	ParticleMapEntry& operator() (SimPosI pos)
 	{
 #ifdef DEBUG_BOUNDSCHECK
@@ -303,7 +410,80 @@ public:
 
 	void clear();
 
-	ParticleMap()
+	// Adds or removes particle i from the list at pos, keeping the occupancy bits and stacking candidates up to date
+	void add(particle *parts, int i, SimPosI pos, PMapCategory_single c)
+	{
+		ParticleMapEntry &entry = (*this)(pos);
+		if (entry.add(parts, i, c))
+			addStackingCandidate(pos);
+		if (entry.count(c)==1)
+			setOccupied(occupiedBits(c), pos, true);
+	}
+	void remove(particle *parts, int i, SimPosI pos, PMapCategory_single c)
+	{
+		ParticleMapEntry &entry = (*this)(pos);
+		entry.remove(parts, i, c);
+		if (!entry.count(c))
+			setOccupied(occupiedBits(c), pos, false);
+	}
+
+	// Word w of the occupancy bits for row y, covering positions (w*64,y) to (w*64+63,y) in bits 0 to 63
+	uint64_t plainOccupiedWord(int y, int w) const
+	{
+		return plainOccupied_[y][w].load(std::memory_order_relaxed);
+	}
+	// Same as plainOccupiedWord, but for the given category
+	uint64_t occupiedWord(PMapCategory c, int y, int w) const
+	{
+		switch (c)
+		{
+		case PMapCategory::All:
+		default:
+			return plainOccupied_[y][w].load(std::memory_order_relaxed) | energyOccupied_[y][w].load(std::memory_order_relaxed);
+		case PMapCategory::Energy:
+			return energyOccupied_[y][w].load(std::memory_order_relaxed);
+		case PMapCategory::Plain:
+			return plainOccupied_[y][w].load(std::memory_order_relaxed);
+		}
+	}
+	bool plainOccupied(SimPosI pos) const
+	{
+		return (plainOccupiedWord(pos.y, pos.x>>6) >> (pos.x&63)) & 1;
+	}
+	bool occupied(SimPosI pos, PMapCategory c=PMapCategory::All) const
+	{
+		return (occupiedWord(c, pos.y, pos.x>>6) >> (pos.x&63)) & 1;
+	}
+	// Occupancy bits for positions (x,y) to (x+width-1,y) in bits 0 to width-1. width must be between 1 and 64, and the positions must be within bounds.
+	uint64_t occupiedSpan(PMapCategory c, int x, int y, int width) const
+	{
+		const int w = x>>6, offset = x&63;
+		uint64_t bits = occupiedWord(c, y, w) >> offset;
+		if (offset+width>64)
+			bits |= occupiedWord(c, y, w+1) << (64-offset);
+		return (width<64) ? (bits & ((uint64_t(1)<<width)-1)) : bits;
+	}
+	// Occupancy bits for positions (x-1,y), (x,y), (x+1,y) in bits 0, 1, 2. x-1 and x+1 must be within bounds.
+	unsigned int plainOccupied3(int x, int y) const
+	{
+		const int first = x-1, w = first>>6, offset = first&63;
+		uint64_t bits = plainOccupiedWord(y, w) >> offset;
+		if (offset>61)
+			bits |= plainOccupiedWord(y, w+1) << (64-offset);
+		return bits & 7;
+	}
+
+	void addStackingCandidate(SimPosI pos)
+	{
+		std::lock_guard<std::mutex> lock(stackingCandidatesMutex);
+		stackingCandidates_.push_back(pos);
+	}
+	std::vector<SimPosI>& stackingCandidates()
+	{
+		return stackingCandidates_;
+	}
+
+	ParticleMap() : concurrentUpdates(false)
 	{
 		clear();
 	}
@@ -0,0 +1,127 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef simulation_ParticleTypeBuckets_h
+#define simulation_ParticleTypeBuckets_h
+
+#include "simulation/Config.hpp"
+#include "simulation/ElementNumbers.h"
+#include "simulation/Position.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/* Lists of the IDs of particles of an element in each bucketSize x bucketSize square of the simulation, so that the particles of that element near a position can be found without going through all of them.
+ *
+ * Only kept for elements which have been added with track(), since the lists need updating whenever one of those particles moves.
+ * Updated by Sim_BasicData::pmap_add and pmap_remove, and by Simulation::part_change_type.
+ *
+ * Particles within a bucket are not in any particular order.
+ * Like partsByType, buckets may contain stale IDs if parts[i].type is set directly, so check parts[i].type when using them.
+ */
+class ParticleTypeBuckets
+{
+public:
+	static const int bucketSize = 16;
+	static const int bucketsX = (XRES+bucketSize-1)/bucketSize;
+	static const int bucketsY = (YRES+bucketSize-1)/bucketSize;
+
+protected:
+	class Grid
+	{
+	public:
+		std::vector<int> buckets[bucketsY][bucketsX];
+	};
+	std::unique_ptr<Grid> grids[PT_NUM];
+	std::vector<int> slot;// index of each tracked particle in its bucket
+	std::mutex mutex;// the tiled particle update may move particles on several threads at once
+
+	std::vector<int>& bucket(int t, SimPosI pos)
+	{
+		return grids[t]->buckets[pos.y/bucketSize][pos.x/bucketSize];
+	}
+
+public:
+	// Starts keeping lists for element t. Particles of that element which already exist are not added.
+	void track(int t)
+	{
+		if (!grids[t])
+			grids[t].reset(new Grid());
+		slot.resize(NPART, 0);
+	}
+	bool isTracked(int t) const
+	{
+		return grids[t]!=nullptr;
+	}
+	void clear()
+	{
+		for (int t=0; t<PT_NUM; t++)
+		{
+			if (!grids[t])
+				continue;
+			for (int by=0; by<bucketsY; by++)
+				for (int bx=0; bx<bucketsX; bx++)
+					grids[t]->buckets[by][bx].clear();
+		}
+	}
+
+	void add(int i, SimPosI pos, int t)
+	{
+		if (!grids[t])
+			return;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<int> &list = bucket(t, pos);
+		slot[i] = list.size();
+		list.push_back(i);
+	}
+	void remove(int i, SimPosI pos, int t)
+	{
+		if (!grids[t])
+			return;
+		std::lock_guard<std::mutex> lock(mutex);
+		std::vector<int> &list = bucket(t, pos);
+		const int s = slot[i];
+		// Particle might not be in the list if its type was set directly
+		if (s>=(int)list.size() || list[s]!=i)
+			return;
+		const int moved = list.back();
+		list[s] = moved;
+		slot[moved] = s;
+		list.pop_back();
+	}
+
+	const std::vector<int>& get(int t, int bx, int by) const
+	{
+		return grids[t]->buckets[by][bx];
+	}
+	// Whether particle i is in the list for element t at pos. Always true for elements which are not tracked.
+	bool check(int i, SimPosI pos, int t) const
+	{
+		if (!grids[t])
+			return true;
+		const std::vector<int> &list = grids[t]->buckets[pos.y/bucketSize][pos.x/bucketSize];
+		return (slot[i]<(int)list.size() && list[slot[i]]==i);
+	}
+	// Smallest length_1() of the distance from pos to any position in bucket (bx,by)
+	static int minDistance(SimPosI pos, int bx, int by)
+	{
+		const int x0 = bx*bucketSize, y0 = by*bucketSize;
+		const int dx = (pos.x<x0) ? x0-pos.x : ((pos.x>=x0+bucketSize) ? pos.x-(x0+bucketSize-1) : 0);
+		const int dy = (pos.y<y0) ? y0-pos.y : ((pos.y>=y0+bucketSize) ? pos.y-(y0+bucketSize-1) : 0);
+		return dx+dy;
+	}
+};
+
+#endif
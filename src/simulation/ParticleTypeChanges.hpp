@@ -0,0 +1,106 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef simulation_ParticleTypeChanges_h
+#define simulation_ParticleTypeChanges_h
+
+#include "simulation/Config.hpp"
+#include "simulation/ElementNumbers.h"
+#include "simulation/Position.hpp"
+#include "common/tpt-stdint.h"
+#include <algorithm>
+#include <atomic>
+
+/* Records which positions are next to a particle of certain elements which has been added, removed, moved, or changed type, so that an element can cache information about its surroundings for a frame and find out where that information has become out of date.
+ *
+ * Only kept for elements which have been added with track(), and only between start() and stop().
+ * Updated by Sim_BasicData::pmap_add and pmap_remove, and by Simulation::part_change_type. Changes made by setting parts[i].type directly are not recorded.
+ */
+class ParticleTypeChanges
+{
+public:
+	static const int wordsPerRow = (XRES+63)/64;
+
+protected:
+	bool tracked[PT_NUM];
+	bool active;
+	// Atomic because the tiled particle update may move particles on several threads at once, while other threads are reading
+	std::atomic<bool> anyChanged;
+	// One bit for each position (bit x&63 of word x>>6 in row y), set if the position is within 1 pixel of a change
+	std::atomic<uint64_t> changed[YRES][wordsPerRow];
+
+	void clearChanged()
+	{
+		for (int y=0; y<YRES; y++)
+			for (int i=0; i<wordsPerRow; i++)
+				changed[y][i].store(0, std::memory_order_relaxed);
+	}
+
+public:
+	ParticleTypeChanges() : active(false), anyChanged(false)
+	{
+		std::fill_n(tracked, PT_NUM, false);
+		clearChanged();
+	}
+	void track(int t)
+	{
+		tracked[t] = true;
+	}
+	bool isTracked(int t) const
+	{
+		return tracked[t];
+	}
+	// Clears all recorded changes and starts recording new ones
+	void start()
+	{
+		if (anyChanged.load(std::memory_order_relaxed))
+			clearChanged();
+		anyChanged.store(false, std::memory_order_relaxed);
+		active = true;
+	}
+	void stop()
+	{
+		active = false;
+	}
+
+	void mark(SimPosI pos, int t)
+	{
+		if (!active || !tracked[t])
+			return;
+		if (!anyChanged.load(std::memory_order_relaxed))
+			anyChanged.store(true, std::memory_order_relaxed);
+		const int xMin = std::max(pos.x-1, 0), xMax = std::min(pos.x+1, XRES-1);
+		for (int y=std::max(pos.y-1, 0); y<=std::min(pos.y+1, YRES-1); y++)
+		{
+			// The 3 positions in this row are in at most 2 words
+			uint64_t bits = 0;
+			for (int x=xMin; x<=xMax; x++)
+			{
+				bits |= uint64_t(1) << (x&63);
+				if (x==xMax || ((x+1)&63)==0)
+				{
+					changed[y][x>>6].fetch_or(bits, std::memory_order_relaxed);
+					bits = 0;
+				}
+			}
+		}
+	}
+	// Whether a particle of a tracked element at pos or one of the 8 positions around it has changed since start()
+	bool changedNear(SimPosI pos) const
+	{
+		return anyChanged.load(std::memory_order_relaxed) && ((changed[pos.y][pos.x>>6].load(std::memory_order_relaxed) >> (pos.x&63)) & 1);
+	}
+};
+
+#endif
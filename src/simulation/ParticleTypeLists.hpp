@@ -0,0 +1,86 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef simulation_ParticleTypeLists_h
+#define simulation_ParticleTypeLists_h
+
+#include "simulation/Config.hpp"
+#include "simulation/ElementNumbers.h"
+#include <algorithm>
+#include <vector>
+
+/* A list of particle IDs for each element, so that code which only cares about one element does not need to go through all particles.
+ *
+ * Particles within a list are not in any particular order.
+ * Removing a particle moves the last particle in that list into its place, so if particles are killed while going through a list, go through it backwards:
+ *   const std::vector<int> &ids = sim->partsByType.get(t);
+ *   for (int j=ids.size()-1; j>=0; j--) { int i = ids[j]; ... }
+ * Particles added to the list during the loop are then not visited. If the loop body does not create or kill particles of that type, a range-based for loop can be used instead.
+ *
+ * Some old code (console commands, Lua) sets parts[i].type directly. Lists may therefore contain stale IDs until the next recalc, so check parts[i].type when using them.
+ */
+class ParticleTypeLists
+{
+protected:
+	std::vector<int> lists[PT_NUM];
+	int listType[NPART];// which list each particle is in, 0 if none
+	int listPos[NPART];// index of each particle in lists[listType[i]]
+public:
+	ParticleTypeLists()
+	{
+		clear();
+	}
+	void clear()
+	{
+		for (int t=0; t<PT_NUM; t++)
+			lists[t].clear();
+		std::fill(listType, listType+NPART, 0);
+	}
+	const std::vector<int>& get(int t) const
+	{
+		return lists[t];
+	}
+	void remove(int i)
+	{
+		int t = listType[i];
+		if (!t)
+			return;
+		std::vector<int> &list = lists[t];
+		int pos = listPos[i];
+		int moved = list.back();
+		list[pos] = moved;
+		listPos[moved] = pos;
+		list.pop_back();
+		listType[i] = 0;
+	}
+	// Adds particle i to the list for element t, removing it from its previous list if necessary
+	void set(int i, int t)
+	{
+		if (listType[i]==t)
+			return;
+		remove(i);
+		if (!t)
+			return;
+		listType[i] = t;
+		listPos[i] = lists[t].size();
+		lists[t].push_back(i);
+	}
+	bool check(int i, int t) const
+	{
+		return listType[i]==t && (!t || (listPos[i]<(int)lists[t].size() && lists[t][listPos[i]]==i));
+	}
+};
+
+#endif
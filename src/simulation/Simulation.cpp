@@ -24,6 +24,7 @@
 #include "simulation/ElemDataSim.h"
 #include "simulation/Simulation.h"
 #include "simulation/SimulationSharedData.h"
+#include "simulation/TiledUpdate.hpp"
 #include <cmath>
 #include <algorithm>
 
@@ -45,6 +46,9 @@ bool ElemDataSim::Check()
 	return true;
 }
 
+void ElemDataSim::Simulation_PartsRenumbered(const int *newIds)
+{}
+
 std::array<SimPosDI,9> const Simulation::posdata_D1 =
 {{{-1,-1},{ 0,-1},{ 1,-1},  {-1, 0},{ 0, 0},{ 1, 0},  {-1, 1},{ 0, 1},{ 1, 1}}};
 std::array<SimPosDI,8> const Simulation::posdata_D1_noCentre =
@@ -78,6 +82,10 @@ Simulation::Simulation(std::shared_ptr<SimulationSharedData> sd) :
 	walls(this),
 	heatMode(HeatMode::Normal),
 	edgeMode(0),
+	framesSinceSpatialSort(0),
+	partsLockEnabled(false),
+	spatialSortInterval(0),
+	skipIdleElectronicsChecks(true),
 	airMode(0),
 	ambientHeatEnabled(false),
 	ambientTemp(295.15f)
@@ -98,6 +106,19 @@ Simulation::Simulation(std::shared_ptr<SimulationSharedData> sd) :
 Simulation::~Simulation()
 {}
 
+int Simulation::option_tiledUpdateThreads()
+{
+	return tiledUpdate ? tiledUpdate->getThreadCount() : 0;
+}
+
+void Simulation::option_tiledUpdateThreads(int threadCount)
+{
+	if (threadCount<=0)
+		tiledUpdate.reset();
+	else if (threadCount!=option_tiledUpdateThreads())
+		tiledUpdate.reset(new SimTiledUpdate(this, threadCount));
+}
+
 void Simulation::clear()
 {
 	option_edgeMode(0);
@@ -107,6 +128,7 @@ void Simulation::clear()
 	walls.clear();
 	signs.clear();
 	stackingCheckQueued = false;
+	framesSinceSpatialSort = 0;
 
 	hook_cleared.Trigger();
 	Sim_BasicData::clear();
@@ -192,7 +214,7 @@ bool Simulation::Check()
 				if (!isEnergyPart)
 					lastPlainId = i;
 			}
-			if (alleged_energyCount==0 && count>0 && pmap[y][x].first_energy_!=lastPlainId)
+			if (alleged_energyCount==0 && count>0 && pmap[y][x].first(PMapCategory::Energy)!=lastPlainId)
 			{
 				printf("pmap list for %d,%d has no energy particles but first_energy != ID of last non-energy particle (%d)\n", x, y, i);
 				isGood = false;
@@ -212,6 +234,16 @@ bool Simulation::Check()
 
 	for (i=0; i<NPART; i++)
 	{
+		if (partsActive.test(i) != (parts[i].type!=0))
+		{
+			printf("partsActive bit for particle %d is %d, but type is %d\n", i, (int)partsActive.test(i), parts[i].type);
+			isGood = false;
+		}
+		if (!partsByType.check(i, parts[i].type))
+		{
+			printf("Particle %d is missing from the partsByType list for its type (%d)\n", i, parts[i].type);
+			isGood = false;
+		}
 		if (parts[i].type)
 		{
 			if (i>parts_lastActiveIndex)
@@ -244,6 +276,37 @@ bool Simulation::Check()
 				printf("Particle %d at %d,%d does not appear in the pmap list for that location\n", i, x, y);
 				isGood = false;
 			}
+			if (!partsByBucket.check(i, pos, parts[i].type))
+			{
+				printf("Particle %d at %d,%d is missing from the partsByBucket list for that location\n", i, pos.x, pos.y);
+				isGood = false;
+			}
+		}
+	}
+
+	// Check that every position which StackingCheck needs to look at is in the list of stacking candidates, and that the occupancy bits are correct
+	std::vector<bool> isStackingCandidate(XRES*YRES, false);
+	for (SimPosI pos : pmap.stackingCandidates())
+		isStackingCandidate[pos.y*XRES+pos.x] = true;
+	for (y=0; y<YRES; y++)
+	{
+		for (x=0; x<XRES; x++)
+		{
+			if (pmap[y][x].count(PMapCategory::Plain)>ParticleMapEntry::stackingThreshold && !isStackingCandidate[y*XRES+x])
+			{
+				printf("Position %d,%d has %d plain particles but is not in the list of stacking candidates\n", x, y, pmap[y][x].count(PMapCategory::Plain));
+				isGood = false;
+			}
+			if (pmap.plainOccupied(SimPosI(x,y)) != (pmap[y][x].count(PMapCategory::Plain)>0))
+			{
+				printf("Occupancy bit for %d,%d does not match the number of plain particles (%d)\n", x, y, pmap[y][x].count(PMapCategory::Plain));
+				isGood = false;
+			}
+			if (pmap.occupied(SimPosI(x,y), PMapCategory::Energy) != (pmap[y][x].count(PMapCategory::Energy)>0))
+			{
+				printf("Energy occupancy bit for %d,%d does not match the number of energy particles (%d)\n", x, y, pmap[y][x].count(PMapCategory::Energy));
+				isGood = false;
+			}
 		}
 	}
 
@@ -283,6 +346,11 @@ bool Simulation::Check()
 			printf("elementCount for %s is wrong: value is %d, should be %d\n", elements[i].Identifier.c_str(), elementCount[i], elementCountCheck[i]);
 			isGood = false;
 		}
+		if (i && (int)partsByType.get(i).size()!=elementCountCheck[i])
+		{
+			printf("partsByType list for %s has the wrong length: %d, should be %d\n", elements[i].Identifier.c_str(), (int)partsByType.get(i).size(), elementCountCheck[i]);
+			isGood = false;
+		}
 	}
 	delete[] elementCountCheck;
 
@@ -297,50 +365,65 @@ bool Simulation::Check()
 void Simulation::StackingCheck()
 {
 	stackingCheckQueued = false;
-	for (int y=0; y<YRES; y++)
+
+	// Only positions in the list of stacking candidates can have more than stackingThreshold plain particles.
+	// Sort them into the same order as a scan through every position would use, so that random numbers are used in the same order.
+	std::vector<SimPosI> &candidates = pmap.stackingCandidates();
+	if (candidates.empty())
+		return;
+	auto posKey = [](SimPosI pos) { return pos.y*XRES + pos.x; };
+	std::sort(candidates.begin(), candidates.end(), [&posKey](SimPosI a, SimPosI b) {
+		return posKey(a) < posKey(b);
+	});
+	candidates.erase(std::unique(candidates.begin(), candidates.end(), [&posKey](SimPosI a, SimPosI b) {
+		return posKey(a) == posKey(b);
+	}), candidates.end());
+	// Remove positions which are no longer above the threshold (they will be added again if they go above it)
+	candidates.erase(std::remove_if(candidates.begin(), candidates.end(), [this](SimPosI pos) {
+		return pmap(pos).count(PMapCategory::Plain) <= ParticleMapEntry::stackingThreshold;
+	}), candidates.end());
+
+	const std::vector<SimPosI> positions = candidates;
+	for (SimPosI pos : positions)
 	{
-		for (int x=0; x<XRES; x++)
+		int count = 0;
+		FOR_SIM_PMAP_POS(this, PMapCategory::Plain, pos, i)
 		{
-			SimPosI pos(x,y);
-			int count = 0;
-			FOR_SIM_PMAP_POS(this, PMapCategory::Plain, pos, i)
+			int t = parts[i].type;
+			if (t!=PT_THDR && t!=PT_EMBR && t!=PT_FIGH && t!=PT_PLSM)
 			{
-				int t = parts[i].type;
-				if (t!=PT_THDR && t!=PT_EMBR && t!=PT_FIGH && t!=PT_PLSM)
-				{
-					count++;
-				}
+				count++;
 			}
+		}
 
-			// Use a threshold for now, since some particle stacking can be normal (e.g. BIZR + FILT)
-			if (count>5)
+		// Use a threshold for now, since some particle stacking can be normal (e.g. BIZR + FILT)
+		if (count>ParticleMapEntry::stackingThreshold)
+		{
+			bool excessive = false;
+			if (walls.type(pos)==WL_EHOLE)
 			{
-				bool excessive = false;
-				if (walls.type(pos)==WL_EHOLE)
-				{
-					// Allow more stacking in E-hole
-					if (count>1500)
-						excessive = true;
-				}
-				// Random chance to turn into BHOL that increases with the amount of stacking, up to a threshold where it is certain to turn into BHOL
-				else if (count>=1500 || rng.randInt<0,1600>()<=(count+100))
-				{
+				// Allow more stacking in E-hole
+				if (count>1500)
 					excessive = true;
-				}
+			}
+			// Random chance to turn into BHOL that increases with the amount of stacking, up to a threshold where it is certain to turn into BHOL
+			else if (count>=1500 || rng.randInt<0,1600>()<=(count+100))
+			{
+				excessive = true;
+			}
 
-				if (excessive)
+			if (excessive)
+			{
+				FOR_SIM_PMAP_POS(this, PMapCategory::Plain, pos, i)
 				{
-					FOR_SIM_PMAP_POS(this, PMapCategory::Plain, pos, i)
-					{
-						part_kill(i);
-					}
-					// Create black hole, strength depends on number of stacked particles
-					int p = part_create(-3, pos, PT_NBHL);
-					if (p>=0)
-					{
-						parts[p].temp = MAX_TEMP;
-						parts[p].tmp = std::min(count, 512000);
-					}
+					part_kill(i);
+				}
+				// Create black hole, strength depends on number of stacked particles
+				int p = part_create(-3, pos, PT_NBHL);
+				if (p>=0)
+				{
+					parts[p].temp = MAX_TEMP;
+					parts[p].tmp = std::min(count, 512000);
 				}
 			}
 		}
@@ -360,6 +443,7 @@ int Simulation::part_create(int p, SimPosF newPosF, int t)
 {
 	// This function is only for actually creating particles.
 	// Not for tools, or changing things into spark, or special brush things like setting clone ctype.
+	auto partsLock = part_lock();
 
 	newPosF = pos_handleEdges(SimPosF(SimPosFT(newPosF)));
 	SimPosI newPos = newPosF;
@@ -462,6 +546,7 @@ int Simulation::part_create(int p, SimPosF newPosF, int t)
 	}
 
 	elementCount[t]++;
+	partsByType.set(i, t);
 	return i;
 }
 
@@ -473,6 +558,7 @@ bool Simulation::part_change_type(int i, SimPosI pos, int t)//changes the type o
 	if (t==parts[i].type)
 		return true;
 
+	auto partsLock = part_lock();
 	if (!t)
 	{
 #ifdef DEBUG_PARTSALLOC
@@ -496,6 +582,7 @@ bool Simulation::part_change_type(int i, SimPosI pos, int t)//changes the type o
 
 	parts[i].type = t;
 	if (t) elementCount[t]++;
+	partsByType.set(i, t);
 
 	if (pmap_category(oldType) != pmap_category(t) || !t)
 	{
@@ -503,6 +590,14 @@ bool Simulation::part_change_type(int i, SimPosI pos, int t)//changes the type o
 		if (t)
 			pmap_add(i, pos, t);
 	}
+	else
+	{
+		// Particle stays in the same pmap list, but may need moving to a different partsByBucket list
+		partsByBucket.remove(i, pos, oldType);
+		partsByBucket.add(i, pos, t);
+		typeChanges.mark(pos, oldType);
+		typeChanges.mark(pos, t);
+	}
 
 	if (elements[oldType].Func_ChangeType)
 	{
@@ -517,6 +612,7 @@ bool Simulation::part_change_type(int i, SimPosI pos, int t)//changes the type o
 
 void Simulation::part_kill(int i, SimPosI pos)//kills particle number i, with integer coords already known (or to override coords)
 {
+	auto partsLock = part_lock();
 	int t = parts[i].type;
 	if (t && elements[t].Func_ChangeType)
 	{
@@ -530,6 +626,7 @@ void Simulation::part_kill(int i, SimPosI pos)//kills particle number i, with in
 
 	pmap_remove(i, pos, t);
 	elementCount[t]--;
+	partsByType.remove(i);
 	part_free(i);
 }
 
@@ -884,6 +981,19 @@ void Simulation::InitCanMove()
 	can_move[PT_THDR][PT_THDR] = MoveResult::ALLOW;
 	can_move[PT_EMBR][PT_EMBR] = MoveResult::ALLOW;
 	can_move[PT_TRON][PT_SWCH] = MoveResult::DYNAMIC;
+
+	// heat_conduct_pair[type being updated][neighbour type]
+	for (int t=0; t<PT_NUM; t++)
+	{
+		for (int rt=0; rt<PT_NUM; rt++)
+		{
+			heat_conduct_pair[t][rt] = elements[rt].HeatConduct
+				&& (t!=PT_FILT||(rt!=PT_BRAY&&rt!=PT_BIZR&&rt!=PT_BIZRG))
+				&& (rt!=PT_FILT||(t!=PT_BRAY&&t!=PT_PHOT&&t!=PT_BIZR&&t!=PT_BIZRG))
+				&& (t!=PT_ELEC||rt!=PT_DEUT)
+				&& (t!=PT_DEUT||rt!=PT_ELEC);
+		}
+	}
 }
 
 MoveResult::Code Simulation::part_canMove_dynamic(int pt, SimPosI newPos, int ri, MoveResult::Code result)
@@ -1197,6 +1307,7 @@ MoveResult::Code Simulation::part_move(int i, SimPosI srcPos, SimPosF destPosF)
 			int rt = parts[ri].type;
 			if (rt==PT_PRTI)
 			{
+				auto partsLock = part_lock();
 				PortalChannel *channel = elemData<PRTI_ElemDataSim>(PT_PRTI)->GetParticleChannel(parts[ri]);
 				SimPosDI diff = srcPos-destPos;
 				int slot = PRTI_ElemDataSim::GetPosIndex(diff.x, diff.y);
@@ -1335,1035 +1446,1116 @@ void Simulation::interpolateMove(InterpolateMoveResult &result, bool interact, i
 }
 
 
-//the main function for updating particles
-void Simulation::UpdateParticles()
+/* The update for each particle is split into three stages, so that the tiled update can run stages in different places (see SimTiledUpdate):
+ *  UpdateParticle_start - interactions with air and gravity, heat transfer, and transitions
+ *  UpdateParticle_element - the element update function
+ *  UpdateParticle_move - movement
+ * Each stage returns false if the update for this particle has finished (e.g. if it has been killed), in which case the remaining stages should not be run.
+ */
+void Simulation::UpdateParticle(int i)
 {
-	int i, j, x, y, t, nx, ny, r, surround_space, s, rt, nt;
-	float mv, dx, dy, nrx, nry, dp, ctemph, ctempl, gravtot, gel_scale;
-	int fin_x, fin_y, clear_x, clear_y, stagnant;
-	float fin_xf, fin_yf, clear_xf, clear_yf;
-	float nn, ct1, ct2, swappage;
+	UpdateParticleState st;
+	st.i = i;
+	if (UpdateParticle_start(st) && UpdateParticle_element(st))
+		UpdateParticle_move(st);
+}
+
+bool Simulation::UpdateParticle_start(UpdateParticleState &st)
+{
+	const int i = st.i;
+	int x, y, t, nx, ny, surround_space, s, rt, nt;
+	float ctemph, ctempl, gravtot, gel_scale, swappage;
 	float pt = R_TEMP;
 	float c_heat = 0.0f;
 	int h_count = 0;
-	int lighting_ok=1;
-	unsigned int elem_properties;
 	float pGravX, pGravY, pGravD;
 	bool transitionOccurred;
 
-	recalc_freeParticles();
-	if (!sys_pause||framerender)
-	{
-		walls.simBeforeUpdate();
-		air.initBlockingData();
-	}
-
-	if (sys_pause && lighting_recreate>0 && elementCount[PT_LIGH])
-    {
-        for (i=0; i<=parts_lastActiveIndex; i++)
-        {
-            if (parts[i].type==PT_LIGH && parts[i].tmp2>0)
-            {
-                lighting_ok=0;
-                break;
-            }
-        }
-    }
-	
-	if (lighting_ok)
-        lighting_recreate--;
+	t = parts[i].type;
+	x = (int)(parts[i].x+0.5f);
+	y = (int)(parts[i].y+0.5f);
 
-    if (lighting_recreate<0)
-        lighting_recreate=1;
+	SimPosCell cellPos = SimPosI(x,y);
 
-    if (lighting_recreate>21)
-        lighting_recreate=21;
-	
-	if (sys_pause&&!framerender)//do nothing if paused
-		return;
-		
+	//this kills any particle out of the screen, or in a wall where it isn't supposed to go
+	if (!pos_inMainArea(cellPos) || (walls.type(cellPos) && isWallDeadly(cellPos,t)))
+	{
+		part_kill(i);
+		return false;
+	}
+	walls.detect(cellPos);
 
-	if (stackingCheckQueued || rng.chance<1,10>())
-		StackingCheck();
+	//adding to velocity from the particle's velocity
+	air.vx.multiply(cellPos, elements[t].AirLoss);
+	air.vy.multiply(cellPos, elements[t].AirLoss);
+	air.vx.add(cellPos, elements[t].AirDrag*parts[i].vx);
+	air.vy.add(cellPos, elements[t].AirDrag*parts[i].vy);
 
-	//wire!
-	if (elementCount[PT_WIRE])
+	if (elements[t].PressureAdd_NoAmbHeat)
 	{
-		for (i=0; i<=parts_lastActiveIndex; i++)
+		if (t==PT_GAS||t==PT_NBLE)
 		{
-			if (parts[i].type==PT_WIRE)
-				parts[i].tmp=parts[i].ctype;
+			if (air.pv.get(cellPos)<3.5f)
+				air.pv.blend_legacy(cellPos, 3.5f, elements[t].PressureAdd_NoAmbHeat);
+			if (y+CELL<YRES)
+			{
+				SimPosCell c = SimPosCell(cellPos.x,cellPos.y+1);
+				if (air.pv.get(c)<3.5f)
+					air.pv.blend_legacy(c, 3.5f, elements[t].PressureAdd_NoAmbHeat);
+			}
+			if (x+CELL<XRES)
+			{
+				SimPosCell c = SimPosCell(cellPos.x+1,cellPos.y);
+				if (air.pv.get(c)<3.5f)
+					air.pv.blend_legacy(c, 3.5f, elements[t].PressureAdd_NoAmbHeat);
+				if (y+CELL<YRES)
+				{
+					SimPosCell c = SimPosCell(cellPos.x+1,cellPos.y+1);
+					if (air.pv.get(c)<3.5f)
+						air.pv.blend_legacy(c, 3.5f, elements[t].PressureAdd_NoAmbHeat);
+				}
+			}
 		}
-	}
-
-	if (ppip_changed)
-	{
-		for (i=0; i<=parts_lastActiveIndex; i++)
+		else//add the hotair variable to the pressure map, like black hole, or white hole.
 		{
-			if (parts[i].type==PT_PPIP)
+			air.pv.add(cellPos, elements[t].PressureAdd_NoAmbHeat);
+			if (y+CELL<YRES)
+				air.pv.add(SimPosCell(cellPos.x,cellPos.y+1), elements[t].PressureAdd_NoAmbHeat);
+			if (x+CELL<XRES)
 			{
-				parts[i].tmp |= (parts[i].tmp&0xE0000000)>>3;
-				parts[i].tmp &= ~0xE0000000;
+				air.pv.add(SimPosCell(cellPos.x+1,cellPos.y), elements[t].PressureAdd_NoAmbHeat);
+				if (y+CELL<YRES)
+					air.pv.add(SimPosCell(cellPos.x+1,cellPos.y+1), elements[t].PressureAdd_NoAmbHeat);
 			}
 		}
-		ppip_changed = 0;
 	}
 
-	hook_beforeUpdate.Trigger();
-	for (i=0; i<=parts_lastActiveIndex; i++)
-		if (parts[i].type)
+	if (elements[t].Gravity || !(elements[t].Properties & TYPE_SOLID))
+	{
+		//Gravity mode by Moach
+		switch (gravityMode)
 		{
-			t = parts[i].type;
-#ifdef OGLR
-			parts[i].lastX = parts[i].x;
-			parts[i].lastY = parts[i].y;
+		default:
+		case 0:
+			pGravX = 0.0f;
+			pGravY = elements[t].Gravity;
+			break;
+		case 1:
+			pGravX = pGravY = 0.0f;
+			break;
+		case 2:
+			pGravD = 0.01f - hypotf((x - XCNTR), (y - YCNTR));
+			pGravX = elements[t].Gravity * ((float)(x - XCNTR) / pGravD);
+			pGravY = elements[t].Gravity * ((float)(y - YCNTR) / pGravD);
+		}
+		//Get some gravity from the gravity map
+		if (t==PT_ANAR)
+		{
+			// perhaps we should have a elements variable for this
+			pGravX -= gravx[(y/CELL)*(XRES/CELL)+(x/CELL)];
+			pGravY -= gravy[(y/CELL)*(XRES/CELL)+(x/CELL)];
+		}
+		else if(t!=PT_STKM && t!=PT_STKM2 && t!=PT_FIGH && !(elements[t].Properties & TYPE_SOLID))
+		{
+			pGravX += gravx[(y/CELL)*(XRES/CELL)+(x/CELL)];
+			pGravY += gravy[(y/CELL)*(XRES/CELL)+(x/CELL)];
+		}
+	}
+	else
+		pGravX = pGravY = 0;
+	//velocity updates for the particle
+	if (!(parts[i].flags&FLAG_MOVABLE))
+	{
+		parts[i].vx *= elements[t].Loss;
+		parts[i].vy *= elements[t].Loss;
+	}
+	//particle gets velocity from the vx and vy maps
+	parts[i].vx += elements[t].Advection*air.vx.get(cellPos) + pGravX;
+	parts[i].vy += elements[t].Advection*air.vy.get(cellPos) + pGravY;
+
+
+	if (elements[t].Diffusion)//the random diffusion that gases have
+	{
+#ifdef REALISTIC
+		//The magic number controlls diffusion speed
+		parts[i].vx += 0.05f*sqrtf(parts[i].temp)*elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
+		parts[i].vy += 0.05f*sqrtf(parts[i].temp)*elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
+#else
+		parts[i].vx += elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
+		parts[i].vy += elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
 #endif
-			if (t<0 || t>=PT_NUM)
-			{
-				part_kill(i);
-				continue;
+	}
+
+	gel_scale = 1.0f;
+	if (t==PT_GEL)
+		gel_scale = parts[i].tmp*2.55f;
+
+	if (option_heatMode()!=HeatMode::Legacy)
+	{
+		if (y-2 >= 0 && y-2 < YRES && (elements[t].Properties&TYPE_LIQUID) && (t!=PT_GEL || rng.chance(parts[i].tmp,100))) {//some heat convection for liquids
+			int swapIndex = pmap_find_one(x,y-2,t);
+			if (swapIndex>=0) {
+				if (parts[i].temp>parts[swapIndex].temp) {
+					swappage = parts[i].temp;
+					parts[i].temp = parts[swapIndex].temp;
+					parts[swapIndex].temp = swappage;
+				}
 			}
-			elem_properties = elements[t].Properties;
-			if (parts[i].life>0 && (elem_properties&PROP_LIFE_DEC))
+		}
+	}
+
+	transitionOccurred = false;
+
+	surround_space = nt = 0;//if nt is greater than 1 after this, then there is a particle around the current particle, that is NOT the current particle's type, for water movement.
+
+	// surround_space = number of surrounding positions with no plain particles
+	// bits 0-2: y-1, bits 3-5: y (with the bit for the particle's own position cleared), bits 6-8: y+1
+	const unsigned int surroundOccupied = pmap.plainOccupied3(x, y-1) | ((pmap.plainOccupied3(x, y)&5)<<3) | (pmap.plainOccupied3(x, y+1)<<6);
+	surround_space = 8 - tptmath::popcount32(surroundOccupied);
+	// nt = number of surrounding positions with no particles of type t
+	if (pmap_category(t)==PMapCategory::Plain)
+	{
+		// Empty positions definitely do not contain t, and for positions with a single plain particle there is no need to go through the list
+		nt = surround_space;
+		for (ny=-1; ny<2; ny++)
+		{
+			for (nx=-1; nx<2; nx++)
 			{
-				// automatically decrease life
-				parts[i].life--;
-				if (parts[i].life<=0 && (elem_properties&(PROP_LIFE_KILL_DEC|PROP_LIFE_KILL)))
-				{
-					// kill on change to no life
-					part_kill(i);
+				if (!(surroundOccupied & (1<<((ny+1)*3+nx+1))))
 					continue;
+				const ParticleMapEntry &entry = pmap[y+ny][x+nx];
+				if (entry.count(PMapCategory::Plain)==1)
+				{
+					if (parts[entry.first(PMapCategory::Plain)].type!=t)
+						nt++;
 				}
-			}
-			else if (parts[i].life<=0 && (elem_properties&PROP_LIFE_KILL))
-			{
-				// kill if no life
-				part_kill(i);
-				continue;
+				else if (entry.find_one(parts, t, PMapCategory::Plain)<0)
+					nt++;
 			}
 		}
-	//the main particle loop function, goes over all particles.
-	for (i=0; i<=parts_lastActiveIndex; i++)
-		if (parts[i].type)
-		{
-			t = parts[i].type;
-			x = (int)(parts[i].x+0.5f);
-			y = (int)(parts[i].y+0.5f);
-
-			SimPosCell cellPos = SimPosI(x,y);
+	}
+	else
+	{
+		for (nx=-1; nx<2; nx++)
+			for (ny=-1; ny<2; ny++) {
+				if ((nx||ny) && pmap_find_one(x+nx,y+ny,t)<0)
+					nt++;//there is nothing or a different particle
+			}
+	}
 
-			//this kills any particle out of the screen, or in a wall where it isn't supposed to go
-			if (!pos_inMainArea(cellPos) || (walls.type(cellPos) && isWallDeadly(cellPos,t)))
+	if (option_heatMode()!=HeatMode::Legacy)
+	{
+		//heat transfer code
+		//this is probably a bit slower now, with the removal of the fixed size surround_hconduct array
+		if (t&&(t!=PT_HSWC||parts[i].life==10) && rng.chance(elements[t].HeatConduct*gel_scale,250))
+		{
+			if (ambientHeatEnabled && !(elements[t].Properties&PROP_NOAMBHEAT))
 			{
-				part_kill(i);
-				continue;
+				c_heat = (air.hv.get(cellPos)-parts[i].temp)*0.04;
+				c_heat = tptmath::clamp_flt(c_heat, -TEMP_RANGE, TEMP_RANGE);
+				part_add_temp(parts[i], c_heat);
+				air.hv.add(cellPos, -c_heat);
 			}
-			walls.detect(cellPos);
 
-			//adding to velocity from the particle's velocity
-			air.vx.multiply(cellPos, elements[t].AirLoss);
-			air.vy.multiply(cellPos, elements[t].AirLoss);
-			air.vx.add(cellPos, elements[t].AirDrag*parts[i].vx);
-			air.vy.add(cellPos, elements[t].AirDrag*parts[i].vy);
-
-			if (elements[t].PressureAdd_NoAmbHeat)
+			h_count = 0;
+			c_heat = 0.0f;
+			// IDs of the particles which heat is conducted to are stored, so that the neighbourhood does not need to be searched again to set their new temperature (unless there are lots of stacked particles)
+			const int maxHeatNeighbours = 32;
+			int heatNeighbours[maxHeatNeighbours];
+			const bool *heatConducts = heat_conduct_pair[t];
+			int rcount, ri, rnext, rx, ry;
+			for (rx=-1; rx<2; rx++)
 			{
-				if (t==PT_GAS||t==PT_NBLE)
+				for (ry=-1; ry<2; ry++)
 				{
-					if (air.pv.get(cellPos)<3.5f)
-						air.pv.blend_legacy(cellPos, 3.5f, elements[t].PressureAdd_NoAmbHeat);
-					if (y+CELL<YRES)
-					{
-						SimPosCell c = SimPosCell(cellPos.x,cellPos.y+1);
-						if (air.pv.get(c)<3.5f)
-							air.pv.blend_legacy(c, 3.5f, elements[t].PressureAdd_NoAmbHeat);
-					}
-					if (x+CELL<XRES)
+					FOR_PMAP_POSITION_NOENERGY(this, x+rx, y+ry, rcount, ri, rnext)
 					{
-						SimPosCell c = SimPosCell(cellPos.x+1,cellPos.y);
-						if (air.pv.get(c)<3.5f)
-							air.pv.blend_legacy(c, 3.5f, elements[t].PressureAdd_NoAmbHeat);
-						if (y+CELL<YRES)
+						rt = parts[ri].type;
+						// ri!=i instead of just using all particles found because this loop excludes energy particles so might not include particle i. Particle i included below in pt calculation. 
+						if (ri!=i && heatConducts[rt] && (rt!=PT_HSWC||parts[ri].life==10))
 						{
-							SimPosCell c = SimPosCell(cellPos.x+1,cellPos.y+1);
-							if (air.pv.get(c)<3.5f)
-								air.pv.blend_legacy(c, 3.5f, elements[t].PressureAdd_NoAmbHeat);
+							c_heat += parts[ri].temp;
+							if (h_count<maxHeatNeighbours)
+								heatNeighbours[h_count] = ri;
+							h_count++;
 						}
 					}
 				}
-				else//add the hotair variable to the pressure map, like black hole, or white hole.
-				{
-					air.pv.add(cellPos, elements[t].PressureAdd_NoAmbHeat);
-					if (y+CELL<YRES)
-						air.pv.add(SimPosCell(cellPos.x,cellPos.y+1), elements[t].PressureAdd_NoAmbHeat);
-					if (x+CELL<XRES)
-					{
-						air.pv.add(SimPosCell(cellPos.x+1,cellPos.y), elements[t].PressureAdd_NoAmbHeat);
-						if (y+CELL<YRES)
-							air.pv.add(SimPosCell(cellPos.x+1,cellPos.y+1), elements[t].PressureAdd_NoAmbHeat);
-					}
-				}
 			}
-
-			if (elements[t].Gravity || !(elements[t].Properties & TYPE_SOLID))
+			pt = (c_heat+parts[i].temp)/(h_count+1);
+			pt = parts[i].temp = tptmath::clamp_flt(pt, MIN_TEMP, MAX_TEMP);
+			if (h_count<=maxHeatNeighbours)
 			{
-				//Gravity mode by Moach
-				switch (gravityMode)
-				{
-				default:
-				case 0:
-					pGravX = 0.0f;
-					pGravY = elements[t].Gravity;
-					break;
-				case 1:
-					pGravX = pGravY = 0.0f;
-					break;
-				case 2:
-					pGravD = 0.01f - hypotf((x - XCNTR), (y - YCNTR));
-					pGravX = elements[t].Gravity * ((float)(x - XCNTR) / pGravD);
-					pGravY = elements[t].Gravity * ((float)(y - YCNTR) / pGravD);
-				}
-				//Get some gravity from the gravity map
-				if (t==PT_ANAR)
-				{
-					// perhaps we should have a elements variable for this
-					pGravX -= gravx[(y/CELL)*(XRES/CELL)+(x/CELL)];
-					pGravY -= gravy[(y/CELL)*(XRES/CELL)+(x/CELL)];
-				}
-				else if(t!=PT_STKM && t!=PT_STKM2 && t!=PT_FIGH && !(elements[t].Properties & TYPE_SOLID))
-				{
-					pGravX += gravx[(y/CELL)*(XRES/CELL)+(x/CELL)];
-					pGravY += gravy[(y/CELL)*(XRES/CELL)+(x/CELL)];
-				}
+				for (int k=0; k<h_count; k++)
+					parts[heatNeighbours[k]].temp = pt;
 			}
 			else
-				pGravX = pGravY = 0;
-			//velocity updates for the particle
-			if (!(parts[i].flags&FLAG_MOVABLE))
-			{
-				parts[i].vx *= elements[t].Loss;
-				parts[i].vy *= elements[t].Loss;
-			}
-			//particle gets velocity from the vx and vy maps
-			parts[i].vx += elements[t].Advection*air.vx.get(cellPos) + pGravX;
-			parts[i].vy += elements[t].Advection*air.vy.get(cellPos) + pGravY;
-
-
-			if (elements[t].Diffusion)//the random diffusion that gases have
-			{
-#ifdef REALISTIC
-				//The magic number controlls diffusion speed
-				parts[i].vx += 0.05f*sqrtf(parts[i].temp)*elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
-				parts[i].vy += 0.05f*sqrtf(parts[i].temp)*elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
-#else
-				parts[i].vx += elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
-				parts[i].vy += elements[t].Diffusion*rng.randFloat(-1.0f,1.0f);
-#endif
-			}
-
-			gel_scale = 1.0f;
-			if (t==PT_GEL)
-				gel_scale = parts[i].tmp*2.55f;
-
-			if (option_heatMode()!=HeatMode::Legacy)
 			{
-				if (y-2 >= 0 && y-2 < YRES && (elements[t].Properties&TYPE_LIQUID) && (t!=PT_GEL || rng.chance(parts[i].tmp,100))) {//some heat convection for liquids
-					int swapIndex = pmap_find_one(x,y-2,t);
-					if (swapIndex>=0) {
-						if (parts[i].temp>parts[swapIndex].temp) {
-							swappage = parts[i].temp;
-							parts[i].temp = parts[swapIndex].temp;
-							parts[swapIndex].temp = swappage;
+				for (rx=-1; rx<2; rx++)
+				{
+					for (ry=-1; ry<2; ry++)
+					{
+						FOR_PMAP_POSITION_NOENERGY(this, x+rx, y+ry, rcount, ri, rnext)
+						{
+							rt = parts[ri].type;
+							if (heatConducts[rt] && (rt!=PT_HSWC||parts[ri].life==10))
+								parts[ri].temp = pt;
 						}
 					}
 				}
 			}
 
-			transitionOccurred = false;
+			ctemph = ctempl = pt;
+			// change boiling point with pressure
+			if (((elements[t].Properties&TYPE_LIQUID) && element_isValid(elements[t].HighTemperatureTransitionElement)
+					&& (elements[elements[t].HighTemperatureTransitionElement].Properties&TYPE_GAS))
+			        || t==PT_LNTG || t==PT_SLTW)
+				ctemph -= 2.0f*air.pv.get(cellPos);
+			else if (((elements[t].Properties&TYPE_GAS) && element_isValid(elements[t].LowTemperatureTransitionElement)
+					 && (elements[elements[t].LowTemperatureTransitionElement].Properties&TYPE_LIQUID))
+			         || t==PT_WTRV)
+				ctempl -= 2.0f*air.pv.get(cellPos);
+			s = 1;
 
-			j = surround_space = nt = 0;//if nt is greater than 1 after this, then there is a particle around the current particle, that is NOT the current particle's type, for water movement.
+			//A fix for ice with ctype = 0
+			if ((t==PT_ICEI || t==PT_SNOW) && (!element_isValidThing(parts[i].ctype) || parts[i].ctype==PT_ICEI || parts[i].ctype==PT_SNOW))
+				parts[i].ctype = PT_WATR;
 
-			for (nx=-1; nx<2; nx++)
-				for (ny=-1; ny<2; ny++) {
-					if (nx||ny) {
-						if (!pmap[y+ny][x+nx].count(PMapCategory::Plain))
-							surround_space++;//there is empty space
-						if (pmap_find_one(x+nx,y+ny,t)<0)
-							nt++;//there is nothing or a different particle
-					}
-				}
+			if (ctemph>=elements[t].HighTemperatureTransitionThreshold && elements[t].HighTemperatureTransitionElement>-1) {
+				// particle type change due to high temperature
 
-			if (option_heatMode()!=HeatMode::Legacy)
-			{
-				//heat transfer code
-				//this is probably a bit slower now, with the removal of the fixed size surround_hconduct array
-				if (t&&(t!=PT_HSWC||parts[i].life==10) && rng.chance(elements[t].HeatConduct*gel_scale,250))
-				{
-					if (ambientHeatEnabled && !(elements[t].Properties&PROP_NOAMBHEAT))
-					{
-						c_heat = (air.hv.get(cellPos)-parts[i].temp)*0.04;
-						c_heat = tptmath::clamp_flt(c_heat, -TEMP_RANGE, TEMP_RANGE);
-						part_add_temp(parts[i], c_heat);
-						air.hv.add(cellPos, -c_heat);
-					}
+				if (elements[t].HighTemperatureTransitionElement!=PT_NUM)
+					t = elements[t].HighTemperatureTransitionElement;
+				else if (t==PT_ICEI || t==PT_SNOW) {
+					if (IsValidElement(parts[i].ctype) && parts[i].ctype!=t) {
+						if (elements[parts[i].ctype].LowTemperatureTransitionElement==PT_ICEI || elements[parts[i].ctype].LowTemperatureTransitionElement==PT_SNOW)
+						{
+							if (pt<elements[parts[i].ctype].LowTemperatureTransitionThreshold)
+								s = 0;
+						}
+						else if (pt<273.15f)
+ 									s = 0;
 
-					h_count = 0;
-					c_heat = 0.0f;
-					int rcount, ri, rnext, rx, ry;
-					for (rx=-1; rx<2; rx++)
-					{
-						for (ry=-1; ry<2; ry++)
+						if (s)
 						{
-							FOR_PMAP_POSITION_NOENERGY(this, x+rx, y+ry, rcount, ri, rnext)
-							{
-								rt = parts[ri].type;
-								// ri!=i instead of just using all particles found because this loop excludes energy particles so might not include particle i. Particle i included below in pt calculation. 
-								if (ri!=i&&elements[rt].HeatConduct&&(rt!=PT_HSWC||parts[ri].life==10)
-									&&(t!=PT_FILT||(rt!=PT_BRAY&&rt!=PT_BIZR&&rt!=PT_BIZRG))
-									&&(rt!=PT_FILT||(t!=PT_BRAY&&t!=PT_PHOT&&t!=PT_BIZR&&t!=PT_BIZRG))
-									&&(t!=PT_ELEC||rt!=PT_DEUT)
-									&&(t!=PT_DEUT||rt!=PT_ELEC))
-								{
-									c_heat += parts[ri].temp;
-									h_count++;
-								}
-							}
+							t = parts[i].ctype;
+							parts[i].ctype = PT_NONE;
+							parts[i].life = 0;
 						}
 					}
-					pt = (c_heat+parts[i].temp)/(h_count+1);
-					pt = parts[i].temp = tptmath::clamp_flt(pt, MIN_TEMP, MAX_TEMP);
-					for (rx=-1; rx<2; rx++)
+					else s = 0;
+				}
+				else if (t==PT_SLTW) {
+					if (rng.chance<1,4>()) t = PT_SALT;
+					else t = PT_WTRV;
+				}
+				else if (t == PT_BRMT)
+				{
+					if (parts[i].ctype == PT_TUNG)
 					{
-						for (ry=-1; ry<2; ry++)
+						if (ctemph < elements[parts[i].ctype].HighTemperatureTransitionThreshold)
+							s = 0;
+						else
 						{
-							FOR_PMAP_POSITION_NOENERGY(this, x+rx, y+ry, rcount, ri, rnext)
-							{
-								rt = parts[ri].type;
-								if (elements[rt].HeatConduct&&(rt!=PT_HSWC||parts[ri].life==10)
-									&&(t!=PT_FILT||(rt!=PT_BRAY&&rt!=PT_BIZR&&rt!=PT_BIZRG))
-									&&(rt!=PT_FILT||(t!=PT_BRAY&&t!=PT_PHOT&&t!=PT_BIZR&&t!=PT_BIZRG))
-									&&(t!=PT_ELEC||rt!=PT_DEUT)
-									&&(t!=PT_DEUT||rt!=PT_ELEC))
-								{
-									parts[ri].temp = pt;
-								}
-							}
+							t = PT_LAVA;
+							parts[i].ctype = PT_TUNG;
 						}
 					}
-
-					ctemph = ctempl = pt;
-					// change boiling point with pressure
-					if (((elements[t].Properties&TYPE_LIQUID) && element_isValid(elements[t].HighTemperatureTransitionElement)
-							&& (elements[elements[t].HighTemperatureTransitionElement].Properties&TYPE_GAS))
-					        || t==PT_LNTG || t==PT_SLTW)
-						ctemph -= 2.0f*air.pv.get(cellPos);
-					else if (((elements[t].Properties&TYPE_GAS) && element_isValid(elements[t].LowTemperatureTransitionElement)
-							 && (elements[elements[t].LowTemperatureTransitionElement].Properties&TYPE_LIQUID))
-					         || t==PT_WTRV)
-						ctempl -= 2.0f*air.pv.get(cellPos);
-					s = 1;
-
-					//A fix for ice with ctype = 0
-					if ((t==PT_ICEI || t==PT_SNOW) && (!element_isValidThing(parts[i].ctype) || parts[i].ctype==PT_ICEI || parts[i].ctype==PT_SNOW))
-						parts[i].ctype = PT_WATR;
-
-					if (ctemph>=elements[t].HighTemperatureTransitionThreshold && elements[t].HighTemperatureTransitionElement>-1) {
-						// particle type change due to high temperature
-
-						if (elements[t].HighTemperatureTransitionElement!=PT_NUM)
-							t = elements[t].HighTemperatureTransitionElement;
-						else if (t==PT_ICEI || t==PT_SNOW) {
-							if (IsValidElement(parts[i].ctype) && parts[i].ctype!=t) {
-								if (elements[parts[i].ctype].LowTemperatureTransitionElement==PT_ICEI || elements[parts[i].ctype].LowTemperatureTransitionElement==PT_SNOW)
-								{
-									if (pt<elements[parts[i].ctype].LowTemperatureTransitionThreshold)
-										s = 0;
-								}
-								else if (pt<273.15f)
- 									s = 0;
-
-								if (s)
-								{
-									t = parts[i].ctype;
-									parts[i].ctype = PT_NONE;
-									parts[i].life = 0;
-								}
-							}
-							else s = 0;
+					else
+						t = PT_LAVA;
+				}
+				else s = 0;
+			} else if (ctempl<elements[t].LowTemperatureTransitionThreshold && elements[t].LowTemperatureTransitionElement>-1) {
+				// particle type change due to low temperature
+				if (elements[t].LowTemperatureTransitionElement!=PT_NUM)
+					t = elements[t].LowTemperatureTransitionElement;
+				else if (t==PT_WTRV) {
+					if (pt<273.0f) t = PT_RIME;
+					else t = PT_DSTW;
+				}
+				else if (t==PT_LAVA) {
+					if (IsValidElement(parts[i].ctype) && parts[i].ctype!=PT_LAVA) {
+						if (parts[i].ctype==PT_THRM && pt>=elements[PT_BMTL].HighTemperatureTransitionThreshold) s = 0;
+						else if ((parts[i].ctype==PT_VIBR || parts[i].ctype==PT_BVBR) && pt>=273.15f) s = 0;
+						else if (parts[i].ctype==PT_TUNG) {
+							// TUNG does its own melting in its update function, so HighTemperatureTransition is not LAVA so it won't be handled by the code for HighTemperatureTransition==PT_LAVA below
+							// However, the threshold is stored in HighTemperature to allow it to be changed from Lua
+							if (pt>=elements[parts[i].ctype].HighTemperatureTransitionThreshold)
+								s = 0;
 						}
-						else if (t==PT_SLTW) {
-							if (rng.chance<1,4>()) t = PT_SALT;
-							else t = PT_WTRV;
+						else if (elements[parts[i].ctype].HighTemperatureTransitionElement==PT_LAVA) {
+							if (pt>=elements[parts[i].ctype].HighTemperatureTransitionThreshold) s = 0;
 						}
-						else if (t == PT_BRMT)
-						{
-							if (parts[i].ctype == PT_TUNG)
-							{
-								if (ctemph < elements[parts[i].ctype].HighTemperatureTransitionThreshold)
-									s = 0;
-								else
-								{
-									t = PT_LAVA;
-									parts[i].ctype = PT_TUNG;
-								}
+						else if (pt>=973.0f) s = 0; // freezing point for lava with any other (not set to turn into lava at high temperature) ctype
+						if (s) {
+							t = parts[i].ctype;
+							parts[i].ctype = PT_NONE;
+							if (t==PT_THRM) {
+								parts[i].tmp = 0;
+								t = PT_BMTL;
 							}
-							else
+							if (t==PT_PLUT)
+							{
+								parts[i].tmp = 0;
 								t = PT_LAVA;
-						}
-						else s = 0;
-					} else if (ctempl<elements[t].LowTemperatureTransitionThreshold && elements[t].LowTemperatureTransitionElement>-1) {
-						// particle type change due to low temperature
-						if (elements[t].LowTemperatureTransitionElement!=PT_NUM)
-							t = elements[t].LowTemperatureTransitionElement;
-						else if (t==PT_WTRV) {
-							if (pt<273.0f) t = PT_RIME;
-							else t = PT_DSTW;
-						}
-						else if (t==PT_LAVA) {
-							if (IsValidElement(parts[i].ctype) && parts[i].ctype!=PT_LAVA) {
-								if (parts[i].ctype==PT_THRM && pt>=elements[PT_BMTL].HighTemperatureTransitionThreshold) s = 0;
-								else if ((parts[i].ctype==PT_VIBR || parts[i].ctype==PT_BVBR) && pt>=273.15f) s = 0;
-								else if (parts[i].ctype==PT_TUNG) {
-									// TUNG does its own melting in its update function, so HighTemperatureTransition is not LAVA so it won't be handled by the code for HighTemperatureTransition==PT_LAVA below
-									// However, the threshold is stored in HighTemperature to allow it to be changed from Lua
-									if (pt>=elements[parts[i].ctype].HighTemperatureTransitionThreshold)
-										s = 0;
-								}
-								else if (elements[parts[i].ctype].HighTemperatureTransitionElement==PT_LAVA) {
-									if (pt>=elements[parts[i].ctype].HighTemperatureTransitionThreshold) s = 0;
-								}
-								else if (pt>=973.0f) s = 0; // freezing point for lava with any other (not set to turn into lava at high temperature) ctype
-								if (s) {
-									t = parts[i].ctype;
-									parts[i].ctype = PT_NONE;
-									if (t==PT_THRM) {
-										parts[i].tmp = 0;
-										t = PT_BMTL;
-									}
-									if (t==PT_PLUT)
-									{
-										parts[i].tmp = 0;
-										t = PT_LAVA;
-									}
-								}
 							}
-							else if (pt<973.0f) t = PT_STNE;
-							else s = 0;
-						}
-						else s = 0;
-					}
-					else s = 0;
-					if (s) { // particle type change occurred
-						if (t==PT_LAVA && parts[i].type==PT_BRMT && parts[i].ctype==PT_TUNG)
-						{}// ctype already set correctly
-						else if (t==PT_ICEI||t==PT_LAVA||t==PT_SNOW)
-							parts[i].ctype = parts[i].type;
-						if (!(t==PT_ICEI&&parts[i].ctype==PT_FRZW)) parts[i].life = 0;
-						if ((elements[t].Properties&TYPE_GAS) && !(elements[parts[i].type].Properties&TYPE_GAS))
-							air.pv.add(cellPos, 0.50f);
-						if (t==PT_NONE)
-						{
-							part_kill(i);
-							goto killed;
-						}
-						part_change_type(i,x,y,t);
-						if (t==PT_FIRE)
-						{
-							parts[i].tmp = 0;// if tmp isn't 0 the FIRE might turn into DSTW later
-						}
-						if (t==PT_FIRE||t==PT_PLSM||t==PT_HFLM)
-						{
-							parts[i].life = rng.randInt<120,120+49>();
-						}
-						if (t==PT_LAVA) {
-							if (parts[i].ctype==PT_BRMT) parts[i].ctype = PT_BMTL;
-							else if (parts[i].ctype==PT_SAND) parts[i].ctype = PT_GLAS;
-							else if (parts[i].ctype==PT_BGLA) parts[i].ctype = PT_GLAS;
-							else if (parts[i].ctype==PT_PQRT) parts[i].ctype = PT_QRTZ;
-							parts[i].life = rng.randInt<240,240+119>();
-						}
-						transitionOccurred = true;
-					}
-
-					pt = parts[i].temp = tptmath::clamp_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
-					if (t==PT_LAVA) {
-						parts[i].life = tptmath::clamp_flt((parts[i].temp-700)/7, 0, 400);
-						if (parts[i].ctype==PT_THRM&&parts[i].tmp>0)
-						{
-							parts[i].tmp--;
-							parts[i].temp = 3500;
-						}
-						if (parts[i].ctype==PT_PLUT&&parts[i].tmp>0)
-						{
-							parts[i].tmp--;
-							parts[i].temp = MAX_TEMP;
-						}
-					}
-				}
-				else
-				{
-					air.blockh_inc(cellPos);
-					parts[i].temp = tptmath::clamp_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
-				}
-			}
-
-			//spark updates from walls
-			if ((elements[t].Properties&PROP_CONDUCTS) || t==PT_SPRK)
-			{
-				nx = x % CELL;
-				if (nx == 0)
-					nx = x/CELL - 1;
-				else if (nx == CELL-1)
-					nx = x/CELL + 1;
-				else
-					nx = x/CELL;
-				ny = y % CELL;
-				if (ny == 0)
-					ny = y/CELL - 1;
-				else if (ny == CELL-1)
-					ny = y/CELL + 1;
-				else
-					ny = y/CELL;
-				SimPosCell c(nx, ny);
-				if (pos_isValid(c))
-				{
-					if (t!=PT_SPRK)
-					{
-						if (walls.electricity(c)==12 && !parts[i].life)
-						{
-							if (spark_particle_conductiveOnly(i, x, y))
-								t = PT_SPRK;
 						}
 					}
-					else if (walls.isConductive(c))
-						walls.makeSpark(c);
-				}
-			}
-
-			//the basic explosion, from the .explosive variable
-			if ((elements[t].Explosive&2) && air.pv.get(cellPos)>2.5f)
-			{
-				parts[i].life = rng.randInt<180,180+79>();
-				// TODO: add to existing temp instead of setting temp? Might break compatibility.
-				part_set_temp(parts[i], elements[PT_FIRE].DefaultProperties.temp + (elements[t].Flammable/2));
-				t = PT_FIRE;
-				part_change_type(i,x,y,t);
-				air.pv.add(cellPos, 0.25f * CFDS);
-			}
-
-
-			s = 1;
-			gravtot = fabs(gravy[(y/CELL)*(XRES/CELL)+(x/CELL)])+fabs(gravx[(y/CELL)*(XRES/CELL)+(x/CELL)]);
-			if (air.pv.get(cellPos)>elements[t].HighPressureTransitionThreshold && elements[t].HighPressureTransitionElement>-1) {
-				// particle type change due to high pressure
-				if (elements[t].HighPressureTransitionElement!=PT_NUM)
-					t = elements[t].HighPressureTransitionElement;
-				else if (t==PT_BMTL) {
-					if (air.pv.get(cellPos)>2.5f)
-						t = PT_BRMT;
-					else if (air.pv.get(cellPos)>1.0f && parts[i].tmp==1)
-						t = PT_BRMT;
-					else s = 0;
-				}
-				else s = 0;
-			} else if (air.pv.get(cellPos)<elements[t].LowPressureTransitionThreshold && elements[t].LowPressureTransitionElement>-1) {
-				// particle type change due to low pressure
-				if (elements[t].LowPressureTransitionElement!=PT_NUM)
-					t = elements[t].LowPressureTransitionElement;
-				else s = 0;
-			} else if (gravtot>(elements[t].HighPressureTransitionThreshold/4.0f) && elements[t].HighPressureTransitionElement>-1) {
-				// particle type change due to high gravity
-				if (elements[t].HighPressureTransitionElement!=PT_NUM)
-					t = elements[t].HighPressureTransitionElement;
-				else if (t==PT_BMTL) {
-					if (gravtot>0.625f)
-						t = PT_BRMT;
-					else if (gravtot>0.25f && parts[i].tmp==1)
-						t = PT_BRMT;
+					else if (pt<973.0f) t = PT_STNE;
 					else s = 0;
 				}
 				else s = 0;
-			} else s = 0;
+			}
+			else s = 0;
 			if (s) { // particle type change occurred
-				parts[i].life = 0;
+				if (t==PT_LAVA && parts[i].type==PT_BRMT && parts[i].ctype==PT_TUNG)
+				{}// ctype already set correctly
+				else if (t==PT_ICEI||t==PT_LAVA||t==PT_SNOW)
+					parts[i].ctype = parts[i].type;
+				if (!(t==PT_ICEI&&parts[i].ctype==PT_FRZW)) parts[i].life = 0;
+				if ((elements[t].Properties&TYPE_GAS) && !(elements[parts[i].type].Properties&TYPE_GAS))
+					air.pv.add(cellPos, 0.50f);
 				if (t==PT_NONE)
 				{
 					part_kill(i);
-					goto killed;
+					return false;
 				}
 				part_change_type(i,x,y,t);
 				if (t==PT_FIRE)
+				{
+					parts[i].tmp = 0;// if tmp isn't 0 the FIRE might turn into DSTW later
+				}
+				if (t==PT_FIRE||t==PT_PLSM||t==PT_HFLM)
+				{
 					parts[i].life = rng.randInt<120,120+49>();
+				}
+				if (t==PT_LAVA) {
+					if (parts[i].ctype==PT_BRMT) parts[i].ctype = PT_BMTL;
+					else if (parts[i].ctype==PT_SAND) parts[i].ctype = PT_GLAS;
+					else if (parts[i].ctype==PT_BGLA) parts[i].ctype = PT_GLAS;
+					else if (parts[i].ctype==PT_PQRT) parts[i].ctype = PT_QRTZ;
+					parts[i].life = rng.randInt<240,240+119>();
+				}
 				transitionOccurred = true;
 			}
 
-			//call the particle update function, if there is one
-#ifdef LUACONSOLE
-			if (elements[t].Update && lua_el_mode[t] != 2)
-#else
-			if (elements[t].Update)
-#endif
-			{
-				if ((*(elements[t].Update))(this, i,x,y,surround_space,nt,parts))
-					continue;
-				else if (t==PT_WARP)
+			pt = parts[i].temp = tptmath::clamp_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
+			if (t==PT_LAVA) {
+				parts[i].life = tptmath::clamp_flt((parts[i].temp-700)/7, 0, 400);
+				if (parts[i].ctype==PT_THRM&&parts[i].tmp>0)
+				{
+					parts[i].tmp--;
+					parts[i].temp = 3500;
+				}
+				if (parts[i].ctype==PT_PLUT&&parts[i].tmp>0)
 				{
-					// Warp does some movement in its update func, update variables to avoid incorrect data in pmap
-					x = (int)(parts[i].x+0.5f);
-					y = (int)(parts[i].y+0.5f);
+					parts[i].tmp--;
+					parts[i].temp = MAX_TEMP;
 				}
 			}
-#ifdef LUACONSOLE
-			if(lua_el_mode[t])
+		}
+		else
+		{
+			air.blockh_inc(cellPos);
+			parts[i].temp = tptmath::clamp_flt(parts[i].temp, MIN_TEMP, MAX_TEMP);
+		}
+	}
+
+	//spark updates from walls
+	// Conductors only need checking if a wall cell is sparking them this frame, so idle circuits do not need the wall position calculated for every particle
+	if (((elements[t].Properties&PROP_CONDUCTS) && (walls.hasSparkingCells() || !skipIdleElectronicsChecks)) || t==PT_SPRK)
+	{
+		nx = x % CELL;
+		if (nx == 0)
+			nx = x/CELL - 1;
+		else if (nx == CELL-1)
+			nx = x/CELL + 1;
+		else
+			nx = x/CELL;
+		ny = y % CELL;
+		if (ny == 0)
+			ny = y/CELL - 1;
+		else if (ny == CELL-1)
+			ny = y/CELL + 1;
+		else
+			ny = y/CELL;
+		SimPosCell c(nx, ny);
+		if (pos_isValid(c))
+		{
+			if (t!=PT_SPRK)
 			{
-				if(luacon_part_update(t,i,x,y,surround_space,nt))
-					continue;
-				// Need to update variables, in case they've been changed by Lua
-				x = (int)(parts[i].x+0.5f);
-				y = (int)(parts[i].y+0.5f);
+				if (walls.electricity(c)==12 && !parts[i].life)
+				{
+					if (spark_particle_conductiveOnly(i, x, y))
+						t = PT_SPRK;
+				}
 			}
+			else if (walls.isConductive(c))
+				walls.makeSpark(c);
+		}
+	}
+
+	//the basic explosion, from the .explosive variable
+	if ((elements[t].Explosive&2) && air.pv.get(cellPos)>2.5f)
+	{
+		parts[i].life = rng.randInt<180,180+79>();
+		// TODO: add to existing temp instead of setting temp? Might break compatibility.
+		part_set_temp(parts[i], elements[PT_FIRE].DefaultProperties.temp + (elements[t].Flammable/2));
+		t = PT_FIRE;
+		part_change_type(i,x,y,t);
+		air.pv.add(cellPos, 0.25f * CFDS);
+	}
+
+
+	s = 1;
+	gravtot = fabs(gravy[(y/CELL)*(XRES/CELL)+(x/CELL)])+fabs(gravx[(y/CELL)*(XRES/CELL)+(x/CELL)]);
+	if (air.pv.get(cellPos)>elements[t].HighPressureTransitionThreshold && elements[t].HighPressureTransitionElement>-1) {
+		// particle type change due to high pressure
+		if (elements[t].HighPressureTransitionElement!=PT_NUM)
+			t = elements[t].HighPressureTransitionElement;
+		else if (t==PT_BMTL) {
+			if (air.pv.get(cellPos)>2.5f)
+				t = PT_BRMT;
+			else if (air.pv.get(cellPos)>1.0f && parts[i].tmp==1)
+				t = PT_BRMT;
+			else s = 0;
+		}
+		else s = 0;
+	} else if (air.pv.get(cellPos)<elements[t].LowPressureTransitionThreshold && elements[t].LowPressureTransitionElement>-1) {
+		// particle type change due to low pressure
+		if (elements[t].LowPressureTransitionElement!=PT_NUM)
+			t = elements[t].LowPressureTransitionElement;
+		else s = 0;
+	} else if (gravtot>(elements[t].HighPressureTransitionThreshold/4.0f) && elements[t].HighPressureTransitionElement>-1) {
+		// particle type change due to high gravity
+		if (elements[t].HighPressureTransitionElement!=PT_NUM)
+			t = elements[t].HighPressureTransitionElement;
+		else if (t==PT_BMTL) {
+			if (gravtot>0.625f)
+				t = PT_BRMT;
+			else if (gravtot>0.25f && parts[i].tmp==1)
+				t = PT_BRMT;
+			else s = 0;
+		}
+		else s = 0;
+	} else s = 0;
+	if (s) { // particle type change occurred
+		parts[i].life = 0;
+		if (t==PT_NONE)
+		{
+			part_kill(i);
+			return false;
+		}
+		part_change_type(i,x,y,t);
+		if (t==PT_FIRE)
+			parts[i].life = rng.randInt<120,120+49>();
+		transitionOccurred = true;
+	}
+
+
+	st.t = t;
+	st.x = x;
+	st.y = y;
+	st.surround_space = surround_space;
+	st.nt = nt;
+	st.pGravX = pGravX;
+	st.pGravY = pGravY;
+	st.transitionOccurred = transitionOccurred;
+	return true;
+}
+
+bool Simulation::UpdateParticle_element(UpdateParticleState &st)
+{
+	const int i = st.i, t = st.t, surround_space = st.surround_space, nt = st.nt;
+	const bool transitionOccurred = st.transitionOccurred;
+	int x = st.x, y = st.y;
+
+	//call the particle update function, if there is one
+#ifdef LUACONSOLE
+	if (elements[t].Update && lua_el_mode[t] != 2)
+#else
+	if (elements[t].Update)
 #endif
-			if (option_heatMode()==HeatMode::Legacy)//if heat sim is off
-				ElementsShared_noHeatSim::update(this, i,x,y,surround_space,nt,parts);
+	{
+		if ((*(elements[t].Update))(this, i,x,y,surround_space,nt,parts))
+			return false;
+		else if (t==PT_WARP)
+		{
+			// Warp does some movement in its update func, update variables to avoid incorrect data in pmap
+			x = (int)(parts[i].x+0.5f);
+			y = (int)(parts[i].y+0.5f);
+		}
+	}
+#ifdef LUACONSOLE
+	if(lua_el_mode[t])
+	{
+		if(luacon_part_update(t,i,x,y,surround_space,nt))
+			return false;
+		// Need to update variables, in case they've been changed by Lua
+		x = (int)(parts[i].x+0.5f);
+		y = (int)(parts[i].y+0.5f);
+	}
+#endif
+	if (option_heatMode()==HeatMode::Legacy)//if heat sim is off
+		ElementsShared_noHeatSim::update(this, i,x,y,surround_space,nt,parts);
 
-killed:
-			if (parts[i].type == PT_NONE)//if its dead, skip to next particle
-				continue;
+	if (parts[i].type == PT_NONE)//if its dead, skip to next particle
+		return false;
 
-			if (transitionOccurred)
-				continue;
+	if (transitionOccurred)
+		return false;
 
-			if (!parts[i].vx&&!parts[i].vy)//if its not moving, skip to next particle, movement code is next
-				continue;
+	if (!parts[i].vx&&!parts[i].vy)//if its not moving, skip to next particle, movement code is next
+		return false;
 
-			InterpolateMoveResult imove;
-			interpolateMove(imove, true, parts[i]);
-			if (imove.limitApplied)
-			{
-				float deltaSize = std::max(std::abs(parts[i].vx), std::abs(parts[i].vy));
-				parts[i].vx *= maxVelocity/deltaSize;
-				parts[i].vy *= maxVelocity/deltaSize;
-			}
+	st.x = x;
+	st.y = y;
+	return true;
+}
 
-			fin_x = imove.dest.x, fin_y = imove.dest.y;
-			clear_x = imove.clear.x, clear_y = imove.clear.y;
-			fin_xf = imove.destf.x, fin_yf = imove.destf.y;
-			clear_xf = imove.clearf.x, clear_yf = imove.clearf.y;
+void Simulation::UpdateParticle_move(UpdateParticleState &st)
+{
+	const int i = st.i, t = st.t, x = st.x, y = st.y, surround_space = st.surround_space, nt = st.nt;
+	const float pGravX = st.pGravX, pGravY = st.pGravY;
+	int j, nx, ny, r, rt;
+	float mv, dx, dy, nrx, nry, dp;
+	int fin_x, fin_y, clear_x, clear_y, stagnant;
+	float fin_xf, fin_yf, clear_xf, clear_yf;
+	float nn, ct1, ct2;
 
-			stagnant = parts[i].flags & FLAG_STAGNANT;
-			parts[i].flags &= ~FLAG_STAGNANT;
+	InterpolateMoveResult imove;
+	interpolateMove(imove, true, parts[i]);
+	if (imove.limitApplied)
+	{
+		float deltaSize = std::max(std::abs(parts[i].vx), std::abs(parts[i].vy));
+		parts[i].vx *= maxVelocity/deltaSize;
+		parts[i].vy *= maxVelocity/deltaSize;
+	}
+
+	fin_x = imove.dest.x, fin_y = imove.dest.y;
+	clear_x = imove.clear.x, clear_y = imove.clear.y;
+	fin_xf = imove.destf.x, fin_yf = imove.destf.y;
+	clear_xf = imove.clearf.x, clear_yf = imove.clearf.y;
+
+	stagnant = parts[i].flags & FLAG_STAGNANT;
+	parts[i].flags &= ~FLAG_STAGNANT;
 
-			if (t==PT_STKM || t==PT_STKM2 || t==PT_FIGH)
+	if (t==PT_STKM || t==PT_STKM2 || t==PT_FIGH)
+	{
+		//head movement, let head pass through anything
+		if (edgeMode != 2)
+		{
+			part_set_pos(i, x, y, parts[i].x+parts[i].vx, parts[i].y+parts[i].vy);
+		}
+		else
+		{
+			int nx = (int)((float)parts[i].x+parts[i].vx+0.5f);
+			int ny = (int)((float)parts[i].y+parts[i].vy+0.5f);
+			int diffx = 0, diffy = 0;
+			if (nx < CELL)
+				diffx = XRES-CELL*2;
+			if (nx >= XRES-CELL)
+				diffx = -(XRES-CELL*2);
+			if (ny < CELL)
+				diffy = YRES-CELL*2;
+			if (ny >= YRES-CELL)
+				diffy = -(YRES-CELL*2);
+			if (diffx || diffy) //when moving from left to right stickmen might be able to fall through solid things, fix with "part_canMove(t, nx+diffx, ny+diffy)" but then they die instead
 			{
-				//head movement, let head pass through anything
-				if (edgeMode != 2)
-				{
-					part_set_pos(i, x, y, parts[i].x+parts[i].vx, parts[i].y+parts[i].vy);
-				}
-				else
-				{
-					int nx = (int)((float)parts[i].x+parts[i].vx+0.5f);
-					int ny = (int)((float)parts[i].y+parts[i].vy+0.5f);
-					int diffx = 0, diffy = 0;
-					if (nx < CELL)
-						diffx = XRES-CELL*2;
-					if (nx >= XRES-CELL)
-						diffx = -(XRES-CELL*2);
-					if (ny < CELL)
-						diffy = YRES-CELL*2;
-					if (ny >= YRES-CELL)
-						diffy = -(YRES-CELL*2);
-					if (diffx || diffy) //when moving from left to right stickmen might be able to fall through solid things, fix with "part_canMove(t, nx+diffx, ny+diffy)" but then they die instead
+				//adjust stickmen legs
+				Stickman_data* playerp = Stickman_data::get(this, parts[i]);
+				if (playerp)
+					for (int i = 0; i < 16; i+=2)
 					{
-						//adjust stickmen legs
-						Stickman_data* playerp = Stickman_data::get(this, parts[i]);
-						if (playerp)
-							for (int i = 0; i < 16; i+=2)
-							{
-								playerp->legs[i] += diffx;
-								playerp->legs[i+1] += diffy;
-							}
+						playerp->legs[i] += diffx;
+						playerp->legs[i+1] += diffy;
 					}
-					part_set_pos(i, x, y, parts[i].x+parts[i].vx+diffx, parts[i].y+parts[i].vy+diffy);
-				}
-				continue;
 			}
-			else if (elements[t].Properties & TYPE_ENERGY)
-			{
-				if (t == PT_PHOT)
-				{
-					// refraction and total internal reflection
+			part_set_pos(i, x, y, parts[i].x+parts[i].vx+diffx, parts[i].y+parts[i].vy+diffy);
+		}
+		return;
+	}
+	else if (elements[t].Properties & TYPE_ENERGY)
+	{
+		if (t == PT_PHOT)
+		{
+			// refraction and total internal reflection
 
-					if (parts[i].flags&FLAG_SKIPMOVE)
-					{
-						parts[i].flags &= ~FLAG_SKIPMOVE;
-						continue;
-					}
+			if (parts[i].flags&FLAG_SKIPMOVE)
+			{
+				parts[i].flags &= ~FLAG_SKIPMOVE;
+				return;
+			}
 
-					int ri = pmap_find_one(fin_x, fin_y, PT_GLAS);
-					int li = pmap_find_one(x, y, PT_GLAS);
+			int ri = pmap_find_one(fin_x, fin_y, PT_GLAS);
+			int li = pmap_find_one(x, y, PT_GLAS);
 
-					if (MoveResult::WillSucceed(part_canMove(PT_PHOT, fin_x, fin_y)) && ((ri>=0 && li<0) || (ri<0 && li>=0))) {
-						if (!get_normal_interp(REFRACT|t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry)) {
-							part_kill(i);
-							continue;
-						}
+			if (MoveResult::WillSucceed(part_canMove(PT_PHOT, fin_x, fin_y)) && ((ri>=0 && li<0) || (ri<0 && li>=0))) {
+				if (!get_normal_interp(REFRACT|t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry)) {
+					part_kill(i);
+					return;
+				}
 
-						r = Element_PHOT::get_wavelength_bin(this, &parts[i].ctype);
-						if (r == -1) {
-							part_kill(i);
-							continue;
-						}
-						nn = GLASS_IOR - GLASS_DISP*(r-15)/15.0f;
-						nn *= nn;
-						nrx = -nrx;
-						nry = -nry;
-						if (ri>=0 && li<0) //if entering glass
-							nn = 1.0f/nn;
-						ct1 = parts[i].vx*nrx + parts[i].vy*nry;
-						ct2 = 1.0f - (nn*nn)*(1.0f-(ct1*ct1));
-						if (ct2 < 0.0f) {
-							// total internal reflection
-							parts[i].vx -= 2.0f*ct1*nrx;
-							parts[i].vy -= 2.0f*ct1*nry;
-							fin_xf = parts[i].x;
-							fin_yf = parts[i].y;
-							fin_x = x;
-							fin_y = y;
-						} else {
-							// refraction
-							ct2 = sqrtf(ct2);
-							ct2 = ct2 - nn*ct1;
-							parts[i].vx = nn*parts[i].vx + ct2*nrx;
-							parts[i].vy = nn*parts[i].vy + ct2*nry;
-						}
-					}
+				r = Element_PHOT::get_wavelength_bin(this, &parts[i].ctype);
+				if (r == -1) {
+					part_kill(i);
+					return;
 				}
-				if (stagnant)//FLAG_STAGNANT set, was reflected on previous frame
-				{
-					// cast coords as int then back to float for compatibility with existing saves. TODO: remove when breaking compatibility
-					MoveResult::Code moveResult = part_move(i, x, y, (float)fin_x, (float)fin_y);
-					if (MoveResult::WasBlocked(moveResult))
-					{
-						part_kill(i);
-						continue;
-					}
-					else if (MoveResult::WasKilled(moveResult))
-					{
-						continue;
-					}
+				nn = GLASS_IOR - GLASS_DISP*(r-15)/15.0f;
+				nn *= nn;
+				nrx = -nrx;
+				nry = -nry;
+				if (ri>=0 && li<0) //if entering glass
+					nn = 1.0f/nn;
+				ct1 = parts[i].vx*nrx + parts[i].vy*nry;
+				ct2 = 1.0f - (nn*nn)*(1.0f-(ct1*ct1));
+				if (ct2 < 0.0f) {
+					// total internal reflection
+					parts[i].vx -= 2.0f*ct1*nrx;
+					parts[i].vy -= 2.0f*ct1*nry;
+					fin_xf = parts[i].x;
+					fin_yf = parts[i].y;
+					fin_x = x;
+					fin_y = y;
+				} else {
+					// refraction
+					ct2 = sqrtf(ct2);
+					ct2 = ct2 - nn*ct1;
+					parts[i].vx = nn*parts[i].vx + ct2*nrx;
+					parts[i].vy = nn*parts[i].vy + ct2*nry;
 				}
-				else if (MoveResult::WasBlocked(part_move(i, x, y, fin_xf, fin_yf)))
-				{
-					// reflection
-					parts[i].flags |= FLAG_STAGNANT;
-					if (t==PT_NEUT && rng.chance<1,10>())
-					{
-						part_kill(i);
-						continue;
-					}
+			}
+		}
+		if (stagnant)//FLAG_STAGNANT set, was reflected on previous frame
+		{
+			// cast coords as int then back to float for compatibility with existing saves. TODO: remove when breaking compatibility
+			MoveResult::Code moveResult = part_move(i, x, y, (float)fin_x, (float)fin_y);
+			if (MoveResult::WasBlocked(moveResult))
+			{
+				part_kill(i);
+				return;
+			}
+			else if (MoveResult::WasKilled(moveResult))
+			{
+				return;
+			}
+		}
+		else if (MoveResult::WasBlocked(part_move(i, x, y, fin_xf, fin_yf)))
+		{
+			// reflection
+			parts[i].flags |= FLAG_STAGNANT;
+			if (t==PT_NEUT && rng.chance<1,10>())
+			{
+				part_kill(i);
+				return;
+			}
 
-					if (get_normal_interp(t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry)) {
-						dp = nrx*parts[i].vx + nry*parts[i].vy;
-						parts[i].vx -= 2.0f*dp*nrx;
-						parts[i].vy -= 2.0f*dp*nry;
-						// leave the actual movement until next frame so that reflection of fast particles and refraction happen correctly
-					} else {
-						if (t!=PT_NEUT)
-							part_kill(i);
-						continue;
-					}
-					if (!(parts[i].ctype&0x3FFFFFFF) && t == PT_PHOT) {
-						part_kill(i);
-						continue;
-					}
-				}
-				goto movedone;
+			if (get_normal_interp(t, parts[i].x, parts[i].y, parts[i].vx, parts[i].vy, &nrx, &nry)) {
+				dp = nrx*parts[i].vx + nry*parts[i].vy;
+				parts[i].vx -= 2.0f*dp*nrx;
+				parts[i].vy -= 2.0f*dp*nry;
+				// leave the actual movement until next frame so that reflection of fast particles and refraction happen correctly
+			} else {
+				if (t!=PT_NEUT)
+					part_kill(i);
+				return;
+			}
+			if (!(parts[i].ctype&0x3FFFFFFF) && t == PT_PHOT) {
+				part_kill(i);
+				return;
 			}
-			else if (elements[t].Falldown==0)
+		}
+		return;
+	}
+	else if (elements[t].Falldown==0)
+	{
+		// gases and solids (but not powders)
+		if (MoveResult::WasBlocked(part_move(i, x, y, fin_xf, fin_yf)))
+		{
+			// can't move there, so bounce off
+			// TODO
+			if (fin_x>x+ISTP) fin_x=x+ISTP;
+			if (fin_x<x-ISTP) fin_x=x-ISTP;
+			if (fin_y>y+ISTP) fin_y=y+ISTP;
+			if (fin_y<y-ISTP) fin_y=y-ISTP;
+			if (MoveResult::Succeeded(part_move(i, x, y, 0.25f+(float)(2*x-fin_x), 0.25f+fin_y)))
+			{
+				parts[i].vx *= elements[t].Collision;
+			}
+			else if (MoveResult::Succeeded(part_move(i, x, y, 0.25f+fin_x, 0.25f+(float)(2*y-fin_y))))
 			{
-				// gases and solids (but not powders)
-				if (MoveResult::WasBlocked(part_move(i, x, y, fin_xf, fin_yf)))
+				parts[i].vy *= elements[t].Collision;
+			}
+			else
+			{
+				parts[i].vx *= elements[t].Collision;
+				parts[i].vy *= elements[t].Collision;
+			}
+		}
+		return;
+	}
+	else
+	{
+		if (water_equal_test && elements[t].Falldown == 2 && rng.chance<1,400>())//checking stagnant is cool, but then it doesn't update when you change it later.
+		{
+			if (!flood_water(x,y,i,y, parts[i].flags&FLAG_WATEREQUAL))
+				return;
+		}
+		// liquids and powders
+		// First try to move in the direction of the particle velocity
+		if (MoveResult::WasBlocked(part_move(i, x, y, fin_xf, fin_yf)))
+		{
+			MoveResult::Code moveResult;
+			// Now try moving a little less in the direction of the particle velocity
+			if (fin_x!=x && MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, fin_xf, clear_yf)))
+			{
+				if (!MoveResult::WasKilled(moveResult))
 				{
-					// can't move there, so bounce off
-					// TODO
-					if (fin_x>x+ISTP) fin_x=x+ISTP;
-					if (fin_x<x-ISTP) fin_x=x-ISTP;
-					if (fin_y>y+ISTP) fin_y=y+ISTP;
-					if (fin_y<y-ISTP) fin_y=y-ISTP;
-					if (MoveResult::Succeeded(part_move(i, x, y, 0.25f+(float)(2*x-fin_x), 0.25f+fin_y)))
-					{
-						parts[i].vx *= elements[t].Collision;
-					}
-					else if (MoveResult::Succeeded(part_move(i, x, y, 0.25f+fin_x, 0.25f+(float)(2*y-fin_y))))
-					{
-						parts[i].vy *= elements[t].Collision;
-					}
-					else
-					{
-						parts[i].vx *= elements[t].Collision;
-						parts[i].vy *= elements[t].Collision;
-					}
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
 				}
-				goto movedone;
 			}
-			else
+			else if (fin_y!=y && MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, clear_xf, fin_yf)))
 			{
-				if (water_equal_test && elements[t].Falldown == 2 && rng.chance<1,400>())//checking stagnant is cool, but then it doesn't update when you change it later.
+				if (!MoveResult::WasKilled(moveResult))
 				{
-					if (!flood_water(x,y,i,y, parts[i].flags&FLAG_WATEREQUAL))
-						goto movedone;
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
 				}
-				// liquids and powders
-				// First try to move in the direction of the particle velocity
-				if (MoveResult::WasBlocked(part_move(i, x, y, fin_xf, fin_yf)))
+			}
+			else
+			{
+				// Movement in velocity direction is blocked, try moving diagonally and (for liquids) horizontally
+				r = rng.randInt<0,1>()*2 - 1;// position search direction (left/right first)
+				if ((clear_x!=x || clear_y!=y || nt || surround_space) &&
+					(fabsf(parts[i].vx)>0.01f || fabsf(parts[i].vy)>0.01f))
 				{
-					MoveResult::Code moveResult;
-					// Now try moving a little less in the direction of the particle velocity
-					if (fin_x!=x && MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, fin_xf, clear_yf)))
+					// allow diagonal movement if target position is blocked
+					// but no point trying this if particle is stuck in a block of identical particles
+					dx = parts[i].vx - parts[i].vy*r;
+					dy = parts[i].vy + parts[i].vx*r;
+					if (fabsf(dy)>fabsf(dx))
+						mv = fabsf(dy);
+					else
+						mv = fabsf(dx);
+					dx /= mv;
+					dy /= mv;
+					if (MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, clear_xf+dx, clear_yf+dy)))
 					{
 						if (!MoveResult::WasKilled(moveResult))
 						{
 							parts[i].vx *= elements[t].Collision;
 							parts[i].vy *= elements[t].Collision;
 						}
+						return;
 					}
-					else if (fin_y!=y && MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, clear_xf, fin_yf)))
+					if (MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, clear_xf+dy*r, clear_yf-dx*r)))// perpendicular to previous vector
 					{
 						if (!MoveResult::WasKilled(moveResult))
 						{
 							parts[i].vx *= elements[t].Collision;
 							parts[i].vy *= elements[t].Collision;
 						}
+						return;
 					}
+				}
+				if (elements[t].Falldown>1 && !ngrav_enable && gravityMode==0 && parts[i].vy>fabsf(parts[i].vx))
+				{
+					moveResult = MoveResult::BLOCK;
+					// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
+					if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
+						rt = 30;//slight less water lag, although it changes how it moves a lot
 					else
+						rt = 10;
+
+					if (t==PT_GEL)
+						rt = parts[i].tmp*0.20f+5.0f;
+
+					for (j=clear_x+r; j>=0 && j>=clear_x-rt && j<clear_x+rt && j<XRES; j+=r)
 					{
-						// Movement in velocity direction is blocked, try moving diagonally and (for liquids) horizontally
-						s = 1;
-						r = rng.randInt<0,1>()*2 - 1;// position search direction (left/right first)
-						if ((clear_x!=x || clear_y!=y || nt || surround_space) &&
-							(fabsf(parts[i].vx)>0.01f || fabsf(parts[i].vy)>0.01f))
+						if (pmap_find_one(j, fin_y, t)<0 || walls.type(SimPosI(j,fin_y)))
 						{
-							// allow diagonal movement if target position is blocked
-							// but no point trying this if particle is stuck in a block of identical particles
-							dx = parts[i].vx - parts[i].vy*r;
-							dy = parts[i].vy + parts[i].vx*r;
-							if (fabsf(dy)>fabsf(dx))
-								mv = fabsf(dy);
-							else
-								mv = fabsf(dx);
-							dx /= mv;
-							dy /= mv;
-							if (MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, clear_xf+dx, clear_yf+dy)))
+							moveResult = part_move(i, x, y, (float)j, fin_yf);
+							if (MoveResult::Succeeded_MaybeKilled(moveResult))
 							{
 								if (!MoveResult::WasKilled(moveResult))
 								{
-									parts[i].vx *= elements[t].Collision;
-									parts[i].vy *= elements[t].Collision;
+									nx = (int)(parts[i].x+0.5f);
+									ny = (int)(parts[i].y+0.5f);
 								}
-								goto movedone;
+								break;
 							}
-							if (MoveResult::Succeeded_MaybeKilled(moveResult=part_move(i, x, y, clear_xf+dy*r, clear_yf-dx*r)))// perpendicular to previous vector
+						}
+						if (fin_y!=clear_y && (pmap_find_one(j, clear_y, t)<0 || walls.type(SimPosI(j,clear_y))))
+						{
+							moveResult = part_move(i, x, y, (float)j, clear_yf);
+							if (MoveResult::Succeeded_MaybeKilled(moveResult))
 							{
 								if (!MoveResult::WasKilled(moveResult))
 								{
-									parts[i].vx *= elements[t].Collision;
-									parts[i].vy *= elements[t].Collision;
+									nx = (int)(parts[i].x+0.5f);
+									ny = (int)(parts[i].y+0.5f);
 								}
-								goto movedone;
+								break;
 							}
 						}
-						if (elements[t].Falldown>1 && !ngrav_enable && gravityMode==0 && parts[i].vy>fabsf(parts[i].vx))
+						if (pmap_find_one(j, clear_y, t)<0 || walls.isProperWall(SimPosI(j,clear_y)))
+							break;
+					}
+					if (MoveResult::WasKilled(moveResult))
+						return;
+					if (MoveResult::Succeeded(moveResult))
+					{
+						if (parts[i].vy>0)
+							r = 1;
+						else
+							r = -1;
+						parts[i].vx *= elements[t].Collision;
+						parts[i].vy *= elements[t].Collision;
+						for (j=ny+r; j>=0 && j<YRES && j>=ny-rt && j<ny+rt; j+=r)
 						{
-							moveResult = MoveResult::BLOCK;
-							// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
-							if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
-								rt = 30;//slight less water lag, although it changes how it moves a lot
-							else
-								rt = 10;
-
-							if (t==PT_GEL)
-								rt = parts[i].tmp*0.20f+5.0f;
-
-							for (j=clear_x+r; j>=0 && j>=clear_x-rt && j<clear_x+rt && j<XRES; j+=r)
-							{
-								if (pmap_find_one(j, fin_y, t)<0 || walls.type(SimPosI(j,fin_y)))
-								{
-									moveResult = part_move(i, x, y, (float)j, fin_yf);
-									if (MoveResult::Succeeded_MaybeKilled(moveResult))
-									{
-										if (!MoveResult::WasKilled(moveResult))
-										{
-											nx = (int)(parts[i].x+0.5f);
-											ny = (int)(parts[i].y+0.5f);
-										}
-										break;
-									}
-								}
-								if (fin_y!=clear_y && (pmap_find_one(j, clear_y, t)<0 || walls.type(SimPosI(j,clear_y))))
-								{
-									moveResult = part_move(i, x, y, (float)j, clear_yf);
-									if (MoveResult::Succeeded_MaybeKilled(moveResult))
-									{
-										if (!MoveResult::WasKilled(moveResult))
-										{
-											nx = (int)(parts[i].x+0.5f);
-											ny = (int)(parts[i].y+0.5f);
-										}
-										break;
-									}
-								}
-								if (pmap_find_one(j, clear_y, t)<0 || walls.isProperWall(SimPosI(j,clear_y)))
-									break;
-							}
-							if (MoveResult::WasKilled(moveResult))
-								continue;
-							if (MoveResult::Succeeded(moveResult))
+							bool tmp = (pmap_find_one(nx, j, t)<0);// true if no particles of the same type are at nx,j
+							if ((tmp || walls.type(SimPosI(nx,j))) && MoveResult::Succeeded_MaybeKilled(part_move(i, nx, ny, (float)nx, (float)j)))
+								break;
+							if (tmp || walls.isProperWall(SimPosI(nx,j)))
+								break;
+						}
+					}
+					else
+					{
+						parts[i].vx *= elements[t].Collision;
+						parts[i].vy *= elements[t].Collision;
+						if ((clear_x!=x||clear_y!=y) && part_move(i, x, y, clear_xf, clear_yf)!=0) {}
+						else parts[i].flags |= FLAG_STAGNANT;
+					}
+				}
+				// fabsf stuff here is checking whether the component of the velocity parallel to the gravity direction is greater than the perpendicular component, indicating the particle is fairly stationary, with the velocity being due mainly to the acceleration by gravity
+				else if (elements[t].Falldown>1 && fabsf(pGravX*parts[i].vx+pGravY*parts[i].vy)>fabsf(pGravY*parts[i].vx-pGravX*parts[i].vy))
+				{
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
+					float nxf, nyf, pGravX, pGravY, prev_pGravX, prev_pGravY, ptGrav = elements[t].Gravity;
+					moveResult = MoveResult::BLOCK;
+					// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
+					if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
+						rt = 30;//slight less water lag, although it changes how it moves a lot
+					else
+						rt = 10;
+					// clear_xf, clear_yf is the last known position that the particle should almost certainly be able to move to
+					nxf = clear_xf;
+					nyf = clear_yf;
+					nx = clear_x;
+					ny = clear_y;
+					// Look for spaces to move horizontally (perpendicular to gravity direction), keep going until a space is found or the number of positions examined = rt
+					for (j=0;j<rt;j++)
+					{
+						GetGravityAccel(nx,ny, ptGrav, 1.0f, pGravX, pGravY);
+						// Scale gravity vector so that the largest component is 1 pixel
+						if (fabsf(pGravY)>fabsf(pGravX))
+							mv = fabsf(pGravY);
+						else
+							mv = fabsf(pGravX);
+						if (mv<0.0001f) break;
+						pGravX /= mv;
+						pGravY /= mv;
+						// Move 1 pixel perpendicularly to gravity
+						// r is +1/-1, to try moving left or right at random
+						if (j)
+						{
+							// Not quite the gravity direction
+							// Gravity direction + last change in gravity direction
+							// This makes liquid movement a bit less frothy, particularly for balls of liquid in radial gravity. With radial gravity, instead of just moving along a tangent, the attempted movement will follow the curvature a bit better.
+							nxf += r*(pGravY*2.0f-prev_pGravY);
+							nyf += -r*(pGravX*2.0f-prev_pGravX);
+						}
+						else
+						{
+							nxf += r*pGravY;
+							nyf += -r*pGravX;
+						}
+						prev_pGravX = pGravX;
+						prev_pGravY = pGravY;
+						nx = (int)(nxf+0.5f);
+						ny = (int)(nyf+0.5f);
+						// Check whether movement is allowed
+						if (!InBounds(nx,ny))
+							break;
+						if (pmap_find_one(nx,ny,t)<0 || walls.type(SimPosI(nx,ny)))
+						{
+							moveResult = part_move(i, x, y, nxf, nyf);
+							if (MoveResult::Succeeded_MaybeKilled(moveResult))
 							{
-								if (parts[i].vy>0)
-									r = 1;
-								else
-									r = -1;
-								parts[i].vx *= elements[t].Collision;
-								parts[i].vy *= elements[t].Collision;
-								for (j=ny+r; j>=0 && j<YRES && j>=ny-rt && j<ny+rt; j+=r)
+								if (!MoveResult::WasKilled(moveResult))
 								{
-									bool tmp = (pmap_find_one(nx, j, t)<0);// true if no particles of the same type are at nx,j
-									if ((tmp || walls.type(SimPosI(nx,j))) && MoveResult::Succeeded_MaybeKilled(part_move(i, nx, ny, (float)nx, (float)j)))
-										break;
-									if (tmp || walls.isProperWall(SimPosI(nx,j)))
-										break;
+									nx = (int)(parts[i].x+0.5f);
+									ny = (int)(parts[i].y+0.5f);
 								}
+								break;
 							}
-							else
-							{
-								parts[i].vx *= elements[t].Collision;
-								parts[i].vy *= elements[t].Collision;
-								if ((clear_x!=x||clear_y!=y) && part_move(i, x, y, clear_xf, clear_yf)!=0) {}
-								else parts[i].flags |= FLAG_STAGNANT;
-							}
+							// A particle of a different type, or a wall, was found. Stop trying to move any further horizontally unless the wall should be completely invisible to particles.
+							if (walls.isProperWall(SimPosI(nx,ny)) || pmap_differentElemExists(SimPosI(nx,ny), t, PMapCategory::Plain))
+								break;
 						}
-						// fabsf stuff here is checking whether the component of the velocity parallel to the gravity direction is greater than the perpendicular component, indicating the particle is fairly stationary, with the velocity being due mainly to the acceleration by gravity
-						else if (elements[t].Falldown>1 && fabsf(pGravX*parts[i].vx+pGravY*parts[i].vy)>fabsf(pGravY*parts[i].vx-pGravX*parts[i].vy))
+					}
+					if (MoveResult::WasKilled(moveResult))
+						return;
+					if (MoveResult::Succeeded(moveResult))
+					{
+						// The particle managed to move horizontally, now try to move vertically (parallel to gravity direction)
+						// Keep going until the particle is blocked (by something that isn't the same element) or the number of positions examined = rt
+						clear_x = nx;
+						clear_y = ny;
+						for (j=0;j<rt;j++)
 						{
-							parts[i].vx *= elements[t].Collision;
-							parts[i].vy *= elements[t].Collision;
-							float nxf, nyf, pGravX, pGravY, prev_pGravX, prev_pGravY, ptGrav = elements[t].Gravity;
-							moveResult = MoveResult::BLOCK;
-							// stagnant is true if FLAG_STAGNANT was set for this particle in previous frame
-							if (!stagnant || nt) //nt is if there is an something else besides the current particle type, around the particle
-								rt = 30;//slight less water lag, although it changes how it moves a lot
+							// Calculate overall gravity direction
+							GetGravityAccel(nx,ny, ptGrav, 1.0f, pGravX, pGravY);
+							// Scale gravity vector so that the largest component is 1 pixel
+							if (fabsf(pGravY)>fabsf(pGravX))
+								mv = fabsf(pGravY);
 							else
-								rt = 10;
-							// clear_xf, clear_yf is the last known position that the particle should almost certainly be able to move to
-							nxf = clear_xf;
-							nyf = clear_yf;
-							nx = clear_x;
-							ny = clear_y;
-							// Look for spaces to move horizontally (perpendicular to gravity direction), keep going until a space is found or the number of positions examined = rt
-							for (j=0;j<rt;j++)
-							{
-								GetGravityAccel(nx,ny, ptGrav, 1.0f, pGravX, pGravY);
-								// Scale gravity vector so that the largest component is 1 pixel
-								if (fabsf(pGravY)>fabsf(pGravX))
-									mv = fabsf(pGravY);
-								else
-									mv = fabsf(pGravX);
-								if (mv<0.0001f) break;
-								pGravX /= mv;
-								pGravY /= mv;
-								// Move 1 pixel perpendicularly to gravity
-								// r is +1/-1, to try moving left or right at random
-								if (j)
-								{
-									// Not quite the gravity direction
-									// Gravity direction + last change in gravity direction
-									// This makes liquid movement a bit less frothy, particularly for balls of liquid in radial gravity. With radial gravity, instead of just moving along a tangent, the attempted movement will follow the curvature a bit better.
-									nxf += r*(pGravY*2.0f-prev_pGravY);
-									nyf += -r*(pGravX*2.0f-prev_pGravX);
-								}
-								else
-								{
-									nxf += r*pGravY;
-									nyf += -r*pGravX;
-								}
-								prev_pGravX = pGravX;
-								prev_pGravY = pGravY;
-								nx = (int)(nxf+0.5f);
-								ny = (int)(nyf+0.5f);
-								// Check whether movement is allowed
-								if (!InBounds(nx,ny))
-									break;
-								if (pmap_find_one(nx,ny,t)<0 || walls.type(SimPosI(nx,ny)))
-								{
-									moveResult = part_move(i, x, y, nxf, nyf);
-									if (MoveResult::Succeeded_MaybeKilled(moveResult))
-									{
-										if (!MoveResult::WasKilled(moveResult))
-										{
-											nx = (int)(parts[i].x+0.5f);
-											ny = (int)(parts[i].y+0.5f);
-										}
-										break;
-									}
-									// A particle of a different type, or a wall, was found. Stop trying to move any further horizontally unless the wall should be completely invisible to particles.
-									if (walls.isProperWall(SimPosI(nx,ny)) || pmap_differentElemExists(SimPosI(nx,ny), t, PMapCategory::Plain))
-										break;
-								}
-							}
-							if (MoveResult::WasKilled(moveResult))
-								continue;
-							if (MoveResult::Succeeded(moveResult))
+								mv = fabsf(pGravX);
+							if (mv<0.0001f) break;
+							pGravX /= mv;
+							pGravY /= mv;
+							// Move 1 pixel in the direction of gravity
+							nxf += pGravX;
+							nyf += pGravY;
+							nx = (int)(nxf+0.5f);
+							ny = (int)(nyf+0.5f);
+							if (nx<0 || ny<0 || nx>=XRES || ny>=YRES)
+								break;
+							// If the space is anything except the same element (so is a wall, empty space, or occupied by a particle of a different element), try to move into it
+							if (pmap_find_one(nx,ny,t)<0 || walls.type(SimPosI(nx,ny)))
 							{
-								// The particle managed to move horizontally, now try to move vertically (parallel to gravity direction)
-								// Keep going until the particle is blocked (by something that isn't the same element) or the number of positions examined = rt
-								clear_x = nx;
-								clear_y = ny;
-								for (j=0;j<rt;j++)
-								{
-									// Calculate overall gravity direction
-									GetGravityAccel(nx,ny, ptGrav, 1.0f, pGravX, pGravY);
-									// Scale gravity vector so that the largest component is 1 pixel
-									if (fabsf(pGravY)>fabsf(pGravX))
-										mv = fabsf(pGravY);
-									else
-										mv = fabsf(pGravX);
-									if (mv<0.0001f) break;
-									pGravX /= mv;
-									pGravY /= mv;
-									// Move 1 pixel in the direction of gravity
-									nxf += pGravX;
-									nyf += pGravY;
-									nx = (int)(nxf+0.5f);
-									ny = (int)(nyf+0.5f);
-									if (nx<0 || ny<0 || nx>=XRES || ny>=YRES)
-										break;
-									// If the space is anything except the same element (so is a wall, empty space, or occupied by a particle of a different element), try to move into it
-									if (pmap_find_one(nx,ny,t)<0 || walls.type(SimPosI(nx,ny)))
-									{
-										moveResult = part_move(i, clear_x, clear_y, nxf, nyf);
-										if (MoveResult::Succeeded(moveResult) || walls.isProperWall(SimPosI(nx,ny)) || pmap_differentElemExists(SimPosI(nx,ny), t, PMapCategory::Plain))
-											break;// found the edge of the liquid and movement into it succeeded, so stop moving down
-									}
-								}
+								moveResult = part_move(i, clear_x, clear_y, nxf, nyf);
+								if (MoveResult::Succeeded(moveResult) || walls.isProperWall(SimPosI(nx,ny)) || pmap_differentElemExists(SimPosI(nx,ny), t, PMapCategory::Plain))
+									break;// found the edge of the liquid and movement into it succeeded, so stop moving down
 							}
-							else if ((clear_x!=x||clear_y!=y) && part_move(i, x, y, clear_xf, clear_yf)) {} // try moving to the last clear position
-							else parts[i].flags |= FLAG_STAGNANT;
-						}
-						else
-						{
-							// if interpolation was done, try moving to last clear position
-							if ((clear_x!=x||clear_y!=y) && part_move(i, x, y, clear_xf, clear_yf)!=0) {}
-							else parts[i].flags |= FLAG_STAGNANT;
-							parts[i].vx *= elements[t].Collision;
-							parts[i].vy *= elements[t].Collision;
 						}
 					}
+					else if ((clear_x!=x||clear_y!=y) && part_move(i, x, y, clear_xf, clear_yf)) {} // try moving to the last clear position
+					else parts[i].flags |= FLAG_STAGNANT;
+				}
+				else
+				{
+					// if interpolation was done, try moving to last clear position
+					if ((clear_x!=x||clear_y!=y) && part_move(i, x, y, clear_xf, clear_yf)!=0) {}
+					else parts[i].flags |= FLAG_STAGNANT;
+					parts[i].vx *= elements[t].Collision;
+					parts[i].vy *= elements[t].Collision;
 				}
 			}
-movedone:
-			continue;
 		}
+	}
+}
+
+//the main function for updating particles
+void Simulation::UpdateParticles()
+{
+	int i, t;
+	int lighting_ok=1;
+	unsigned int elem_properties;
+
+	if (spatialSortInterval>0 && (!sys_pause||framerender) && ++framesSinceSpatialSort>=spatialSortInterval)
+	{
+		parts_sortSpatially();
+		framesSinceSpatialSort = 0;
+	}
+	recalc_freeParticles();
+	if (!sys_pause||framerender)
+	{
+		walls.simBeforeUpdate();
+		air.initBlockingData();
+	}
+
+	if (sys_pause && lighting_recreate>0 && elementCount[PT_LIGH])
+    {
+        for (int i : partsByType.get(PT_LIGH))
+        {
+            if (parts[i].type==PT_LIGH && parts[i].tmp2>0)
+            {
+                lighting_ok=0;
+                break;
+            }
+        }
+    }
+	
+	if (lighting_ok)
+        lighting_recreate--;
+
+    if (lighting_recreate<0)
+        lighting_recreate=1;
+
+    if (lighting_recreate>21)
+        lighting_recreate=21;
+	
+	if (sys_pause&&!framerender)//do nothing if paused
+		return;
+		
+
+	if (stackingCheckQueued || rng.chance<1,10>())
+		StackingCheck();
+
+	//wire!
+	elemData<WIRE_ElemDataSim>(PT_WIRE)->beforeUpdate();
+
+	if (ppip_changed)
+	{
+		for (int i : partsByType.get(PT_PPIP))
+		{
+			if (parts[i].type==PT_PPIP)
+			{
+				parts[i].tmp |= (parts[i].tmp&0xE0000000)>>3;
+				parts[i].tmp &= ~0xE0000000;
+			}
+		}
+		ppip_changed = 0;
+	}
+
+	hook_beforeUpdate.Trigger();
+	for (i=parts_firstActive(); i>=0; i=parts_nextActive(i))
+		if (parts[i].type)
+		{
+			t = parts[i].type;
+#ifdef OGLR
+			parts[i].lastX = parts[i].x;
+			parts[i].lastY = parts[i].y;
+#endif
+			if (t<0 || t>=PT_NUM)
+			{
+				part_kill(i);
+				continue;
+			}
+			elem_properties = elements[t].Properties;
+			if (parts[i].life>0 && (elem_properties&PROP_LIFE_DEC))
+			{
+				// automatically decrease life
+				parts[i].life--;
+				if (parts[i].life<=0 && (elem_properties&(PROP_LIFE_KILL_DEC|PROP_LIFE_KILL)))
+				{
+					// kill on change to no life
+					part_kill(i);
+					continue;
+				}
+			}
+			else if (parts[i].life<=0 && (elem_properties&PROP_LIFE_KILL))
+			{
+				// kill if no life
+				part_kill(i);
+				continue;
+			}
+		}
+	if (tiledUpdate)
+	{
+		tiledUpdate->update();
+	}
+	else
+	{
+		//the main particle loop function, goes over all particles.
+		for (int i=parts_firstActive(); i>=0; i=parts_nextActive(i))
+			if (parts[i].type)
+				UpdateParticle(i);
+	}
 
 	hook_afterUpdate.Trigger();
 }
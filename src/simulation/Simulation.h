@@ -27,6 +27,8 @@
 #include "gravity.h"
 #include <vector>
 #include <array>
+#include <memory>
+#include <mutex>
 #include "common/Observer.h"
 #include "common/tptmath.h"
 #include "common/tpt-rng.h"
@@ -170,7 +172,18 @@ enum class HeatMode : short
 	Normal=1
 };
 
+// Variables which are passed between the stages of the particle update (see Simulation::UpdateParticle)
+class UpdateParticleState
+{
+public:
+	int i, t, x, y;
+	int surround_space, nt;
+	float pGravX, pGravY;
+	bool transitionOccurred;
+};
+
 class SimulationSharedData;
+class SimTiledUpdate;
 
 class Simulation;
 
@@ -180,19 +193,35 @@ class Simulation :
 public:
 	//simulation random number generator, should only be used for simulation, not graphics or scripts
 	tpt_rng rngBase;
-	RandomStore_auto rng;
+	RandomStore_threadable rng;
 public:
 	SimAir air;
 	SimWalls walls;
 
 	MoveResult::Code can_move[PT_NUM][PT_NUM];
+	// Whether heat is conducted from a particle of the first type to a neighbouring particle of the second type (HSWC also needs life==10, which is checked separately). Calculated in InitCanMove.
+	bool heat_conduct_pair[PT_NUM][PT_NUM];
 	static constexpr float maxVelocity = 1e4f;
 
 protected:
 	HeatMode heatMode;
 	short edgeMode;// TODO: make into enum
 	bool stackingCheckQueued;
+	int framesSinceSpatialSort;
+	std::unique_ptr<SimTiledUpdate> tiledUpdate;
+	// Particle creation, deletion, and type changes are done one at a time while partsLockEnabled is true (set during the tiled update)
+	std::recursive_mutex partsMutex;
+	bool partsLockEnabled;
+	std::unique_lock<std::recursive_mutex> part_lock()
+	{
+		if (partsLockEnabled)
+			return std::unique_lock<std::recursive_mutex>(partsMutex);
+		return std::unique_lock<std::recursive_mutex>();
+	}
+	friend class SimTiledUpdate;
 public:
+	int spatialSortInterval;// if >0, parts_sortSpatially is called every spatialSortInterval frames. Off by default, since it changes particle IDs (which scripts may be holding on to).
+	bool skipIdleElectronicsChecks;// if true (the default), conductors skip the wall spark check when no wall cells are sparking this frame, and SWCH skips looking for red BRAY when there is no BRAY. Turning it off gives the same results, more slowly.
 	short airMode;
 	int ambientHeatEnabled;// TODO: should really be bool, but quickmenu can only handle ints
 	float ambientTemp;
@@ -207,6 +236,10 @@ public:
 	void option_edgeMode(short newMode);
 	HeatMode option_heatMode() { return heatMode; }
 	void option_heatMode(HeatMode newMode);
+	// Number of threads used for the tiled particle update (see SimTiledUpdate), or 0 for the normal update which goes through particles in ID order.
+	// Off by default, since it gives different results to the normal update and the results are not reproducible.
+	int option_tiledUpdateThreads();
+	void option_tiledUpdateThreads(int threadCount);
 
 	template<class ElemDataClass_T, typename... Args>
 	void elemData_create(int elementId, Args&&... args)
@@ -222,6 +255,10 @@ public:
 	void StackingCheck();
 	void queueStackingCheck();
 	void UpdateParticles();
+	void UpdateParticle(int i);
+	bool UpdateParticle_start(UpdateParticleState &st);
+	bool UpdateParticle_element(UpdateParticleState &st);
+	void UpdateParticle_move(UpdateParticleState &st);
 
 	int part_create(int p, SimPosF newPosF, int t);
 	bool part_change_type(int i, SimPosI pos, int t);
@@ -0,0 +1,228 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation/TiledUpdate.hpp"
+#include "simulation/Element.h"
+#include "common/tpt-rng.h"
+#ifdef LUACONSOLE
+#include "luaconsole.h"
+#endif
+#include <algorithm>
+#include <cmath>
+
+SimTiledUpdate::SimTiledUpdate(Simulation *sim_, int threadCount_)
+	: sim(sim_), threadCount(std::max(threadCount_, 1)), workers(WorkerThreads::getShared())
+{}
+
+void SimTiledUpdate::update()
+{
+	prepare();
+
+	sim->partsLockEnabled = true;
+	sim->partsFreeDelay = true;
+	sim->pmap.concurrentUpdates = true;
+	sim->rng.enableThreadStores(true);
+	for (int colour=0; colour<4; colour++)
+		updateColour(colour);
+	sim->rng.enableThreadStores(false);
+	sim->partsLockEnabled = false;
+	sim->pmap.concurrentUpdates = false;
+	sim->part_freeDelayedFinish();
+
+	updateDeferred();
+}
+
+void SimTiledUpdate::prepare()
+{
+	for (int t=0; t<PT_NUM; t++)
+	{
+		elementDeferred[t] = (sim->elements[t].Update!=nullptr || sim->option_heatMode()==HeatMode::Legacy);
+#ifdef LUACONSOLE
+		if (lua_el_mode[t])
+			elementDeferred[t] = true;
+#endif
+	}
+
+	frameRngSeed = sim->rng.randUint64();
+	for (Tile &tile : tiles)
+	{
+		tile.parts.clear();
+		tile.deferred.clear();
+	}
+	for (int i=sim->parts_firstActive(); i>=0; i=sim->parts_nextActive(i))
+	{
+		if (!sim->parts[i].type)
+			continue;
+		// Particles outside the simulation are put in the nearest tile, and will be deferred by updateTile since they are in an unsafe cell
+		SimPosI pos = sim->pos_clampValid(SimPosI((int)(sim->parts[i].x+0.5f), (int)(sim->parts[i].y+0.5f)));
+		tiles[(pos.y/tileSize)*tilesX + pos.x/tileSize].parts.push_back(i);
+	}
+
+	prepare_unsafeCells();
+}
+
+void SimTiledUpdate::prepare_unsafeCells()
+{
+	// Mark cells containing walls, and cells too close to the edge of the main simulation area, then expand the marked area by enough that particles in unmarked cells cannot reach the marked cells
+	constexpr int dilateCells = reach/CELL + 2;
+	constexpr int cellsX = XRES/CELL, cellsY = YRES/CELL;
+	CellsUChar marked;
+	for (int y=0; y<cellsY; y++)
+	{
+		for (int x=0; x<cellsX; x++)
+		{
+			marked(x,y) = (x<1 || y<1 || x>=cellsX-1 || y>=cellsY-1 || sim->walls.type(SimPosCell(x,y))) ? 1 : 0;
+		}
+	}
+
+	// Horizontal then vertical pass, counting the marked cells in a sliding window
+	CellsUChar dilatedX;
+	for (int y=0; y<cellsY; y++)
+	{
+		int count = 0;
+		for (int x=0; x<std::min(dilateCells, cellsX); x++)
+			count += marked(x,y);
+		for (int x=0; x<cellsX; x++)
+		{
+			if (x+dilateCells<cellsX)
+				count += marked(x+dilateCells,y);
+			if (x-dilateCells-1>=0)
+				count -= marked(x-dilateCells-1,y);
+			dilatedX(x,y) = count ? 1 : 0;
+		}
+	}
+	for (int x=0; x<cellsX; x++)
+	{
+		int count = 0;
+		for (int y=0; y<std::min(dilateCells, cellsY); y++)
+			count += dilatedX(x,y);
+		for (int y=0; y<cellsY; y++)
+		{
+			if (y+dilateCells<cellsY)
+				count += dilatedX(x,y+dilateCells);
+			if (y-dilateCells-1>=0)
+				count -= dilatedX(x,y-dilateCells-1);
+			unsafeCells(x,y) = count ? 1 : 0;
+		}
+	}
+}
+
+void SimTiledUpdate::updateColour(int colour)
+{
+	colourTiles.clear();
+	for (int ty=0; ty<tilesY; ty++)
+	{
+		for (int tx=0; tx<tilesX; tx++)
+		{
+			int tileId = ty*tilesX + tx;
+			if ((tx&1) + 2*(ty&1) == colour && !tiles[tileId].parts.empty())
+				colourTiles.push_back(tileId);
+		}
+	}
+	if (colourTiles.empty())
+		return;
+
+	// One tile per chunk, since the number of particles (and so the time taken) varies a lot between tiles
+	workers->parallel_for(0, colourTiles.size(), 1, [this](int begin, int end) {
+		for (int k=begin; k<end; k++)
+			updateTile(colourTiles[k]);
+	}, threadCount);
+}
+
+void SimTiledUpdate::updateTile(int tileId)
+{
+	Tile &tile = tiles[tileId];
+	const int x0 = (tileId%tilesX)*tileSize, y0 = (tileId/tilesX)*tileSize;
+	const int x1 = x0+tileSize, y1 = y0+tileSize;
+
+	tpt_rng particleRng;
+	RandomStore_auto particleRngStore(&particleRng);
+	RandomStore_threadable::setThreadStore(&particleRngStore);
+
+	for (int i : tile.parts)
+	{
+		const particle &p = sim->parts[i];
+		if (!p.type)
+			continue;
+		// Random numbers for this particle's update come from a stream keyed by the particle ID, so they do not depend on which tiles are updated first or on which threads
+		particleRng.seed(frameRngSeed, i);
+		particleRngStore.clearStore();
+		UpdateParticleState st;
+		st.i = i;
+		// Particles may have been moved into a different tile (or an unsafe cell) by the updates of other particles in this tile
+		int x = (int)(p.x+0.5f), y = (int)(p.y+0.5f);
+		if (x<x0 || y<y0 || x>=x1 || y>=y1 || !sim->pos_isValid(SimPosI(x,y)) || unsafeCells(x/CELL, y/CELL))
+		{
+			tile.deferred.emplace_back(DeferredUpdate::Stage::All, st);
+			continue;
+		}
+		if (!sim->UpdateParticle_start(st))
+			continue;
+		if (elementDeferred[st.t])
+		{
+			tile.deferred.emplace_back(DeferredUpdate::Stage::Element, st);
+			continue;
+		}
+		if (!sim->UpdateParticle_element(st))
+			continue;
+		if (moveDeferred(st))
+		{
+			tile.deferred.emplace_back(DeferredUpdate::Stage::Move, st);
+			continue;
+		}
+		sim->UpdateParticle_move(st);
+	}
+
+	RandomStore_threadable::setThreadStore(nullptr);
+}
+
+bool SimTiledUpdate::moveDeferred(const UpdateParticleState &st) const
+{
+	const Element &elem = sim->elements[st.t];
+	if (elem.Falldown>1 || (elem.Properties&TYPE_ENERGY))
+		return true;
+	const particle &p = sim->parts[st.i];
+	return !(std::fabs(p.vx)<=maxMove && std::fabs(p.vy)<=maxMove);
+}
+
+void SimTiledUpdate::updateDeferred()
+{
+	deferred.clear();
+	for (Tile &tile : tiles)
+		deferred.insert(deferred.end(), tile.deferred.begin(), tile.deferred.end());
+	std::sort(deferred.begin(), deferred.end(), [](const DeferredUpdate &a, const DeferredUpdate &b) {
+		return a.st.i < b.st.i;
+	});
+
+	for (DeferredUpdate &d : deferred)
+	{
+		const int i = d.st.i;
+		const particle &p = sim->parts[i];
+		if (d.stage==DeferredUpdate::Stage::All)
+		{
+			if (p.type)
+				sim->UpdateParticle(i);
+			continue;
+		}
+		// Skip the rest of the update if the particle has been killed or changed by other particles since its update was started
+		if (p.type!=d.st.t)
+			continue;
+		d.st.x = (int)(p.x+0.5f);
+		d.st.y = (int)(p.y+0.5f);
+		if (d.stage==DeferredUpdate::Stage::Element && !sim->UpdateParticle_element(d.st))
+			continue;
+		sim->UpdateParticle_move(d.st);
+	}
+}
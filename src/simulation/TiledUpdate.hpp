@@ -0,0 +1,95 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef simulation_TiledUpdate_h
+#define simulation_TiledUpdate_h
+
+#include "simulation/Config.hpp"
+#include "simulation/CellsData.hpp"
+#include "simulation/ElementNumbers.h"
+#include "simulation/Simulation.h"
+#include "common/Threading.hpp"
+#include "common/tpt-stdint.h"
+#include <memory>
+#include <vector>
+
+/* Multithreaded version of the main particle update loop in Simulation::UpdateParticles.
+ *
+ * The simulation area is divided into square tiles, coloured in a 2x2 checkerboard pattern. Tiles of one colour are updated at the same time on different threads, then the next colour, and so on.
+ * Tiles of the same colour are at least one tile apart, so as long as a particle update only reads and writes pixels and air cells within 'reach' of the particle, updates in different tiles of the same colour cannot interfere with each other.
+ *
+ * Only the generic parts of the update (heat conduction, transitions, and simple movement) are known to stay within that distance. The rest is deferred, and done afterwards on the main thread in particle ID order:
+ *  - element update functions (including Lua) and legacy heat, since these can affect particles anywhere
+ *  - movement of liquids, energy particles, and particles moving faster than maxMove
+ *  - particles in or near walls (spark flood fills, e-hole, etc) or near the edges of the simulation
+ *
+ * Particle creation, deletion, and type changes in tiles are serialised using Simulation::part_lock, and freed IDs are not reused until all tiles have finished (so that each tile's list of particles stays valid).
+ * The update of each particle in a tile uses its own random number stream, keyed by a per-frame seed from the main generator and the particle ID (the counter within the stream is the number of random numbers the particle has used so far). So the random numbers used do not depend on the number of threads, or on which thread updates a tile or in which order.
+ * However, new particle IDs depend on the thread timing of particle creation, so results are only reproducible if no particles are created during the tiled part of the update.
+ */
+class SimTiledUpdate
+{
+public:
+	static constexpr int tileSize = 48;
+	static constexpr int tilesX = (XRES+tileSize-1)/tileSize;
+	static constexpr int tilesY = (YRES+tileSize-1)/tileSize;
+	// Maximum speed (in pixels per frame, in each direction) of particles which are moved during the tiled part of the update
+	static constexpr int maxMove = 8;
+	// Maximum distance from a particle to any pixel read or written by the tiled part of its update: movement, neighbouring pixels (+2 for movement to a pixel next to the blocked one), and the air cells at x/CELL+1, y/CELL+1
+	static constexpr int reach = maxMove + 2 + 2*CELL;
+	static_assert(tileSize%CELL == 0, "tileSize must be a multiple of CELL");
+	static_assert(tileSize > 2*reach, "tiles of the same colour must be far enough apart that updates in them cannot affect the same pixels");
+
+protected:
+	class DeferredUpdate
+	{
+	public:
+		enum class Stage { All, Element, Move };
+		Stage stage;
+		UpdateParticleState st;
+		DeferredUpdate(Stage stage_, const UpdateParticleState &st_) : stage(stage_), st(st_) {}
+	};
+	class Tile
+	{
+	public:
+		std::vector<int> parts;// IDs of particles in this tile at the start of the frame
+		std::vector<DeferredUpdate> deferred;
+	};
+
+	Simulation *sim;
+	int threadCount;
+	std::shared_ptr<WorkerThreads> workers;
+	Tile tiles[tilesX*tilesY];
+	// Cells where the tiled update is not used, because they are near walls or the edge of the simulation
+	CellsUChar unsafeCells;
+	bool elementDeferred[PT_NUM];
+	uint64_t frameRngSeed;
+	std::vector<int> colourTiles;
+	std::vector<DeferredUpdate> deferred;
+
+	void prepare();
+	void prepare_unsafeCells();
+	void updateColour(int colour);
+	void updateTile(int tileId);
+	bool moveDeferred(const UpdateParticleState &st) const;
+	void updateDeferred();
+public:
+	SimTiledUpdate(Simulation *sim_, int threadCount_);
+	int getThreadCount() const { return threadCount; }
+	// Does the equivalent of the main loop in Simulation::UpdateParticles (calling UpdateParticle for each particle)
+	void update();
+};
+
+#endif
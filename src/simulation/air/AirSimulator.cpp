@@ -26,13 +26,13 @@
 #include "simulation/air/AirSimulator_v1.hpp"
 
 
-std::unique_ptr<AirSimulator_sync> AirSimulator_sync::create(int airSimVersion)
+std::unique_ptr<AirSimulator_sync> AirSimulator_sync::create(int airSimVersion, unsigned int threadCount)
 {
 	switch (airSimVersion)
 	{
 	case 1:
 	default:
-		return std::unique_ptr<AirSimulator_sync>(new AirSimulator_v1());
+		return std::unique_ptr<AirSimulator_sync>(new AirSimulator_v1(threadCount));
 	case 0:
 		return std::unique_ptr<AirSimulator_sync>(new AirSimulator_v0());
 	}
@@ -94,7 +94,7 @@ AirSimulator_async::AirSimulator_async(int airSimVersion) :
 {}
 
 AirSimulator_async::AirSimulator_async(std::unique_ptr<AirSimulator_sync> airSim) :
-	internalSim(std::move(airSim)), worker(new WorkerThreads(1))
+	internalSim(std::move(airSim)), worker(WorkerThreads::getShared())
 {}
 
 std::unique_ptr<AirSimulator_async> AirSimulator_async::create(int airSimVersion) {
@@ -106,19 +106,30 @@ std::unique_ptr<AirSimulator_async> AirSimulator_async::create(std::unique_ptr<A
 }
 
 AirSimulator_async::~AirSimulator_async()
-{}
+{
+	if (lastRun.valid())
+		lastRun.wait();
+}
 
 std::shared_future<void> AirSimulator_async::simulate(AirSimulator_params_roInput params)
 {
-	return worker->asyncTask([this](AirSimulator_params_roInput params){
+	std::shared_future<void> prevRun = lastRun;
+	lastRun = worker->asyncTask([this, prevRun](AirSimulator_params_roInput params){
+		if (prevRun.valid())
+			prevRun.wait();
 		internalSim->simulate(params);
 	}, params);
+	return lastRun;
 }
 
 std::shared_future<void> AirSimulator_async::simulate(AirSimulator_params_rwInput params)
 {
-	return worker->asyncTask([this](AirSimulator_params_rwInput params){
+	std::shared_future<void> prevRun = lastRun;
+	lastRun = worker->asyncTask([this, prevRun](AirSimulator_params_rwInput params){
+		if (prevRun.valid())
+			prevRun.wait();
 		internalSim->simulate(params);
 	}, params);
+	return lastRun;
 }
 
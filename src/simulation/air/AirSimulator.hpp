@@ -64,7 +64,7 @@ public:
 // AirSimulator base classes
 
 // AirSimulator_sync: synchronous simulator, simulate() will return when air simulation has finished
-// AirSimulator_async: asynchronous simulator (wraps a synchronous simulator), simulate() returns a shared_future which will be made valid when air simulation has finished
+// AirSimulator_async: asynchronous simulator (wraps a synchronous simulator), simulate() returns a shared_future which will be made valid when air simulation has finished. Runs on the shared WorkerThreads pool.
 
 
 // NB: in the current simulators, AirSimulator_sync::simulate() is not thread safe. It should not be called simultaneously from different threads. To use it from different threads, wrap the AirSimulator_sync inside AirSimulator_async (which will serialise simulation runs, they will be performed one at a time).
@@ -83,7 +83,8 @@ protected:
 public:
 	virtual ~AirSimulator_sync();
 	// Factory method, returns a new air simulator of the specified version
-	static std::unique_ptr<AirSimulator_sync> create(int airSimVersion);
+	// threadCount is the number of threads to use for each simulate() call (0 = number of hardware threads), if supported by that version (currently only version 1). Does not affect results.
+	static std::unique_ptr<AirSimulator_sync> create(int airSimVersion, unsigned int threadCount=1);
 	// Run air sim
 	virtual void simulate(AirSimulator_params_roInput params);
 	virtual void simulate(AirSimulator_params_rwInput params);
@@ -95,7 +96,9 @@ class AirSimulator_async
 {
 protected:
 	std::unique_ptr<AirSimulator_sync> internalSim;
-	std::unique_ptr<WorkerThreads> worker;
+	std::shared_ptr<WorkerThreads> worker;
+	// Most recently started simulation run, each run waits for the previous one to finish so that internalSim is not used by two threads at once
+	std::shared_future<void> lastRun;
 
 	AirSimulator_async(int airSimVersion);
 	AirSimulator_async(std::unique_ptr<AirSimulator_sync> airSim);
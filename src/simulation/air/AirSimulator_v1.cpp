@@ -14,7 +14,10 @@
  */
 
 #include "simulation/air/AirSimulator_v1.hpp"
+#include "simulation/air/AirSimulator_v1_kernels.hpp"
 #include "common/tptmath.h"
+#include "common/Threading.hpp"
+#include <algorithm>
 #include <cmath>
 
 #include "simulation/WallNumbers.hpp"
@@ -22,6 +25,28 @@
 
 // TPT_NOINLINE is used in some of these functions (the ones which aren't called inside a loop) to make it easier to use callgrind to track where time is spent
 
+AirSimulator_v1::AirSimulator_v1(unsigned int threadCount_) :
+	AirSimulator_sync(),
+	threadCount(threadCount_)
+{
+	if (!threadCount)
+		threadCount = std::max(std::thread::hardware_concurrency(), 1u);
+	if (threadCount>1)
+		workers = WorkerThreads::getShared();
+}
+
+AirSimulator_v1::~AirSimulator_v1()
+{}
+
+void AirSimulator_v1::forEachRowBand(int yStart, int yEnd, const std::function<void(int, int)> &f)
+{
+	// Each row is calculated by the same code however the rows are split up, so results do not depend on threadCount
+	if (threadCount>1)
+		workers->parallel_for(yStart, yEnd, minBandRows, f, threadCount);
+	else
+		f(yStart, yEnd);
+}
+
 TPT_NOINLINE void AirSimulator_v1::setEdges_h(CellsFloatRP data, float value)
 {
 	// set temperature at the edges to ambient
@@ -94,16 +119,23 @@ TPT_NOINLINE void AirSimulator_v1::pressureFromVelocity(
 	for (int x=0; x<XRES/CELL; x++)
 		dest_pv[0][x] = src_pv[0][x]*AIR_PLOSS;
 
+	forEachRowBand(1, YRES/CELL, [&](int yStart, int yEnd) {
+		pressureFromVelocity_rows(src_pv, src_vx, src_vy, dest_pv, yStart, yEnd);
+	});
+}
+
+TPT_NOINLINE void AirSimulator_v1::pressureFromVelocity_rows(
+	const_CellsFloatRP src_pv,
+	const_CellsFloatRP src_vx, const_CellsFloatRP src_vy,
+	CellsFloatRP dest_pv,
+	int yStart, int yEnd
+)
+{
 	// pressure adjustments from velocity
 	// (in each cell, change in pressure = amount of air flowing in - amount of air flowing out = velocity in - velocity out
-	for (int y=1; y<YRES/CELL; y++)
-		for (int x=1; x<XRES/CELL; x++)
-		{
-			float pv = 0.0f;
-			pv += src_vx[y][x-1] - src_vx[y][x];// (x velocity in) - (x velocity out)
-			pv += src_vy[y-1][x] - src_vy[y][x];// (y velocity in) - (y velocity out)
-			dest_pv[y][x] = src_pv[y][x]*AIR_PLOSS + pv*AIR_TSTEPP;
-		}
+	AirSimulator_v1_kernels::Kernel_pressureFromVelocity kernel(&src_pv[0][0], &src_vx[0][0], &src_vy[0][0], &dest_pv[0][0]);
+	for (int y=yStart; y<yEnd; y++)
+		tptalgo::for_each_i(kernel, y*(XRES/CELL)+1, (y+1)*(XRES/CELL));
 }
 
 TPT_NOINLINE void AirSimulator_v1::velocityFromPressure(
@@ -123,16 +155,23 @@ TPT_NOINLINE void AirSimulator_v1::velocityFromPressure(
 		dest_vy[YRES/CELL-1][x] = src_vy[YRES/CELL-1][x]*AIR_VLOSS;
 	}
 
+	forEachRowBand(0, YRES/CELL-1, [&](int yStart, int yEnd) {
+		velocityFromPressure_rows(src_pv, src_vx, src_vy, dest_vx, dest_vy, yStart, yEnd);
+	});
+}
+
+TPT_NOINLINE void AirSimulator_v1::velocityFromPressure_rows(
+	const_CellsFloatRP src_pv,
+	const_CellsFloatRP src_vx, const_CellsFloatRP src_vy,
+	CellsFloatRP dest_vx, CellsFloatRP dest_vy,
+	int yStart, int yEnd
+)
+{
 	// velocity adjustments from pressure
 	// (in each cell, change in velocity = net force acting = pressure difference between adjacent cells)
-	for (int y=0; y<YRES/CELL-1; y++)
-		for (int x=0; x<XRES/CELL-1; x++)
-		{
-			float dx = src_pv[y][x] - src_pv[y][x+1];// dp/dx
-			float dy = src_pv[y][x] - src_pv[y+1][x];// dp/dy
-			dest_vx[y][x] = src_vx[y][x]*AIR_VLOSS + dx*AIR_TSTEPV;
-			dest_vy[y][x] = src_vy[y][x]*AIR_VLOSS + dy*AIR_TSTEPV;
-		}
+	AirSimulator_v1_kernels::Kernel_velocityFromPressure kernel(&src_pv[0][0], &src_vx[0][0], &src_vy[0][0], &dest_vx[0][0], &dest_vy[0][0]);
+	for (int y=yStart; y<yEnd; y++)
+		tptalgo::for_each_i(kernel, y*(XRES/CELL), (y+1)*(XRES/CELL)-1);
 }
 
 
@@ -165,26 +204,34 @@ TPT_NOINLINE void AirSimulator_v1::wallsBlockAir(CellsFloatRP vx, CellsFloatRP v
 }
 
 
-// Apply a Gaussian blur to a single CellsArrayFloat
-// Does not blur the edges or check for walls. These limitations, plus separating into two 1D convolutions and only doing one CellsArrayFloatP at a time, make the loops simple enough for g++ to be able to use some SIMD instructions
-TPT_NOINLINE void AirSimulator_v1::blur_centreData(const_CellsFloatRP src, CellsFloatRP dest, CellsFloatRP tmp)
+// Normalised Gaussian kernel for blur_centreData_x and blur_centreData_y
+// Separable filter, so 1D x blur then 1D y blur is equivalent to a 2D blur
+static void blur_centreData_kernel(float &k0, float &k1)
 {
-	// Normalised Gaussian kernel
-	// Separable filter, so 1D x blur then 1D y blur is equivalent to a 2D blur
-	float k0 = 1.0f;
-	float k1 = expf(-2.0f);
+	k0 = 1.0f;
+	k1 = expf(-2.0f);
 	float ksum = k0 + 2*k1;
 	k0 /= ksum;
 	k1 /= ksum;
+}
 
-	// Blur in x direction
-	for (int y=0; y<YRES/CELL; y++)
+// Apply a Gaussian blur to a single CellsArrayFloat, in two passes: blur_centreData_x for all rows, then blur_centreData_y (rows 1 to YRES/CELL-2) using the output of the x pass
+// Does not blur the edges or check for walls. These limitations, plus separating into two 1D convolutions and only doing one CellsArrayFloatP at a time, make the loops simple enough for g++ to be able to use some SIMD instructions
+TPT_NOINLINE void AirSimulator_v1::blur_centreData_x(const_CellsFloatRP src, CellsFloatRP tmp, int yStart, int yEnd)
+{
+	float k0, k1;
+	blur_centreData_kernel(k0, k1);
+	for (int y=yStart; y<yEnd; y++)
 		for (int x=1; x<XRES/CELL-1; x++)
 		{
 			tmp[y][x] = src[y][x-1]*k1 + src[y][x]*k0 + src[y][x+1]*k1;
 		}
-	// Blur in y direction
-	for (int y=1; y<YRES/CELL-1; y++)
+}
+TPT_NOINLINE void AirSimulator_v1::blur_centreData_y(const_CellsFloatRP tmp, CellsFloatRP dest, int yStart, int yEnd)
+{
+	float k0, k1;
+	blur_centreData_kernel(k0, k1);
+	for (int y=yStart; y<yEnd; y++)
 		for (int x=0; x<XRES/CELL; x++)
 		{
 			dest[y][x] = tmp[y-1][x]*k1 + tmp[y][x]*k0 + tmp[y+1][x]*k1;
@@ -192,6 +239,14 @@ TPT_NOINLINE void AirSimulator_v1::blur_centreData(const_CellsFloatRP src, Cells
 }
 
 
+// Weights for the SIMD blur kernels: 0.0f for cells where (block&mask) is nonzero, 1.0f for other cells
+TPT_NOINLINE void AirSimulator_v1::blur_notBlockedWeights(const_CellsUCharRP block, unsigned char mask, CellsFloatRP dest)
+{
+	for (int y=0; y<YRES/CELL; y++)
+		for (int x=0; x<XRES/CELL; x++)
+			dest[y][x] = (block[y][x]&mask) ? 0.0f : 1.0f;
+}
+
 // Apply a Gaussian blur to a single cell
 // For neighbouring cells which don't exist or are walls, uses the values from the centre cell
 void AirSimulator_v1::blur_cell_vp(
@@ -275,24 +330,42 @@ TPT_NOINLINE void AirSimulator_v1::blur_pressureAndVelocity(
 	if (blockCount > (XRES/CELL)*(YRES/CELL)/2) // TODO: determine the best threshold to use
 	{
 		// Single stage blur, if there are lots of walls which would cause recalculations in multi stage version
+		// Cells not at the edges use Kernel_blur_vp (which does not need to check whether neighbouring cells exist), edges use blur_cell_vp
 
-		for (int y=0; y<YRES/CELL; y++)
-		{
-			for (int x=0; x<XRES/CELL; x++)
+		CellsFloat notBlocked;
+		blur_notBlockedWeights(blockair, 0xFF, notBlocked);
+		AirSimulator_v1_kernels::Kernel_blur_vp blurKernel(kernel, &blockair[0][0], &notBlocked[0][0], &src_vx[0][0], &src_vy[0][0], &src_pv[0][0], &dest_vx[0][0], &dest_vy[0][0], &dest_pv[0][0]);
+		forEachRowBand(0, YRES/CELL, [&](int yStart, int yEnd) {
+			for (int y=yStart; y<yEnd; y++)
 			{
-				blur_cell_vp(x, y, src_vx, src_vy, src_pv, blockair, dest_vx, dest_vy, dest_pv);
+				if (y==0 || y==YRES/CELL-1)
+				{
+					for (int x=0; x<XRES/CELL; x++)
+						blur_cell_vp(x, y, src_vx, src_vy, src_pv, blockair, dest_vx, dest_vy, dest_pv);
+					continue;
+				}
+				blur_cell_vp(0, y, src_vx, src_vy, src_pv, blockair, dest_vx, dest_vy, dest_pv);
+				tptalgo::for_each_i(blurKernel, y*(XRES/CELL)+1, (y+1)*(XRES/CELL)-1);
+				blur_cell_vp(XRES/CELL-1, y, src_vx, src_vy, src_pv, blockair, dest_vx, dest_vy, dest_pv);
 			}
-		}
+		});
 	}
 	else
 	{
 		// Multi stage blur
 
 		// Initial blur, which for speed does not check for edges or walls
-		CellsFloat tmp;
-		blur_centreData(src_vx, dest_vx, tmp);
-		blur_centreData(src_vy, dest_vy, tmp);
-		blur_centreData(src_pv, dest_pv, tmp);
+		CellsFloat tmp_vx, tmp_vy, tmp_pv;
+		forEachRowBand(0, YRES/CELL, [&](int yStart, int yEnd) {
+			blur_centreData_x(src_vx, tmp_vx, yStart, yEnd);
+			blur_centreData_x(src_vy, tmp_vy, yStart, yEnd);
+			blur_centreData_x(src_pv, tmp_pv, yStart, yEnd);
+		});
+		forEachRowBand(1, YRES/CELL-1, [&](int yStart, int yEnd) {
+			blur_centreData_y(tmp_vx, dest_vx, yStart, yEnd);
+			blur_centreData_y(tmp_vy, dest_vy, yStart, yEnd);
+			blur_centreData_y(tmp_pv, dest_pv, yStart, yEnd);
+		});
 
 
 		// Now fix places where initial blur gets it wrong:
@@ -344,14 +417,25 @@ TPT_NOINLINE void AirSimulator_v1::blur_heat(const_CellsFloatRP src_hv, const_Ce
 	if (blockCount > (XRES/CELL)*(YRES/CELL)/2) // TODO: determine the best threshold to use
 	{
 		// Single stage blur, if there are lots of walls which would cause recalculations in multi stage version
+		// Cells not at the edges use Kernel_blur_h, edges use blur_cell_h
 
-		for (int y=0; y<YRES/CELL; y++)
-		{
-			for (int x=0; x<XRES/CELL; x++)
+		CellsFloat notBlocked;
+		blur_notBlockedWeights(blockairh, 0x8, notBlocked);
+		AirSimulator_v1_kernels::Kernel_blur_h blurKernel(kernel, &blockairh[0][0], &notBlocked[0][0], &src_hv[0][0], &dest_hv[0][0]);
+		forEachRowBand(0, YRES/CELL, [&](int yStart, int yEnd) {
+			for (int y=yStart; y<yEnd; y++)
 			{
-				blur_cell_h(x, y, src_hv, dest_hv, blockairh);
+				if (y==0 || y==YRES/CELL-1)
+				{
+					for (int x=0; x<XRES/CELL; x++)
+						blur_cell_h(x, y, src_hv, dest_hv, blockairh);
+					continue;
+				}
+				blur_cell_h(0, y, src_hv, dest_hv, blockairh);
+				tptalgo::for_each_i(blurKernel, y*(XRES/CELL)+1, (y+1)*(XRES/CELL)-1);
+				blur_cell_h(XRES/CELL-1, y, src_hv, dest_hv, blockairh);
 			}
-		}
+		});
 	}
 	else
 	{
@@ -359,7 +443,12 @@ TPT_NOINLINE void AirSimulator_v1::blur_heat(const_CellsFloatRP src_hv, const_Ce
 
 		// Initial blur, which for speed does not check for edges or walls
 		CellsFloat tmp;
-		blur_centreData(src_hv, dest_hv, tmp);
+		forEachRowBand(0, YRES/CELL, [&](int yStart, int yEnd) {
+			blur_centreData_x(src_hv, tmp, yStart, yEnd);
+		});
+		forEachRowBand(1, YRES/CELL-1, [&](int yStart, int yEnd) {
+			blur_centreData_y(tmp, dest_hv, yStart, yEnd);
+		});
 
 
 		// Now fix places where initial blur gets it wrong:
@@ -416,12 +505,26 @@ TPT_NOINLINE void AirSimulator_v1::velocityAdvection(
 	const_CellsUCharRP blockair,
 	const_CellsUCharRP bmap, const_CellsFloatRP fvx, const_CellsFloatRP fvy
 )
+{
+	forEachRowBand(0, YRES/CELL, [&](int yStart, int yEnd) {
+		velocityAdvection_rows(src_vx, src_vy, src_avx, src_avy, dest_vx, dest_vy, blockair, bmap, fvx, fvy, yStart, yEnd);
+	});
+}
+
+TPT_NOINLINE void AirSimulator_v1::velocityAdvection_rows(
+	const_CellsFloatRP src_vx, const_CellsFloatRP src_vy,
+	const_CellsFloatRP src_avx, const_CellsFloatRP src_avy,
+	CellsFloatRP dest_vx, CellsFloatRP dest_vy,
+	const_CellsUCharRP blockair,
+	const_CellsUCharRP bmap, const_CellsFloatRP fvx, const_CellsFloatRP fvy,
+	int yStart, int yEnd
+)
 {
 	int x, y, i, j;
 	float dx, dy, tx, ty;
 	float stepX, stepY;
 	int stepLimit, step;
-	for (y=0; y<YRES/CELL; y++)
+	for (y=yStart; y<yEnd; y++)
 	{
 		for (x=0; x<XRES/CELL; x++)
 		{
@@ -503,13 +606,20 @@ TPT_NOINLINE void AirSimulator_v1::velocityAdvection(
 }
 
 TPT_NOINLINE void AirSimulator_v1::heatAdvection(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_hv, const_CellsFloatRP src_ahv, const_CellsUCharRP blockairh, CellsFloatRP dest_hv)
+{
+	forEachRowBand(0, YRES/CELL, [&](int yStart, int yEnd) {
+		heatAdvection_rows(src_vx, src_vy, src_hv, src_ahv, blockairh, dest_hv, yStart, yEnd);
+	});
+}
+
+TPT_NOINLINE void AirSimulator_v1::heatAdvection_rows(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_hv, const_CellsFloatRP src_ahv, const_CellsUCharRP blockairh, CellsFloatRP dest_hv, int yStart, int yEnd)
 {
 	float odh, dh, dx, dy, tx, ty;
 	int x, y, i, j;
 	float stepX, stepY;
 	int stepLimit, step;
 
-	for (y=0; y<YRES/CELL; y++)
+	for (y=yStart; y<yEnd; y++)
 	{
 		for (x=0; x<XRES/CELL; x++)
 		{
@@ -17,24 +17,41 @@
 #define Simulation_Air_AirSimulatorV1_h
 
 #include "simulation/air/AirSimulator.hpp"
+#include <functional>
+#include <memory>
+
+class WorkerThreads;
 
 class AirSimulator_v1 : public AirSimulator_sync
 {
 protected:
 	static constexpr float advDistanceMult = 0.7f;
+	static const int minBandRows = 8;
+
+	unsigned int threadCount;// including the thread which calls simulate()
+	std::shared_ptr<WorkerThreads> workers;// only set if threadCount>1
 
 	AirData tmpData;
 	AirData tmpData2;
 	AirData blurredData;
 
+	// Calls f(bandStart, bandEnd) for some set of bands which together cover rows yStart to yEnd-1, and returns once they have all finished.
+	// Used for the parts of air simulation where each row can be calculated independently. If threadCount>1, bands are run on multiple threads (from the shared worker pool), otherwise this just calls f(yStart, yEnd).
+	void forEachRowBand(int yStart, int yEnd, const std::function<void(int, int)> &f);
+
 	void setEdges_h(CellsFloatRP data, float value);
 	void reduceEdges_p(CellsFloatRP data, float multiplier);
 	void reduceEdges_v(CellsFloatRP data, float multiplier);
 	void pressureFromVelocity(const_CellsFloatRP src_pv, const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, CellsFloatRP dest_pv);
+	void pressureFromVelocity_rows(const_CellsFloatRP src_pv, const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, CellsFloatRP dest_pv, int yStart, int yEnd);
 	void velocityFromPressure(const_CellsFloatRP src_pv, const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, CellsFloatRP dest_vx, CellsFloatRP dest_vy);
+	void velocityFromPressure_rows(const_CellsFloatRP src_pv, const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, CellsFloatRP dest_vx, CellsFloatRP dest_vy, int yStart, int yEnd);
 
 	void wallsBlockAir(CellsFloatRP vx, CellsFloatRP vy, const_CellsUCharRP blockair);
-	void blur_centreData(const_CellsFloatRP src, CellsFloatRP dest, CellsFloatRP tmp);
+	void blur_centreData_x(const_CellsFloatRP src, CellsFloatRP tmp, int yStart, int yEnd);
+	void blur_centreData_y(const_CellsFloatRP tmp, CellsFloatRP dest, int yStart, int yEnd);
+
+	void blur_notBlockedWeights(const_CellsUCharRP block, unsigned char mask, CellsFloatRP dest);
 
 	void blur_pressureAndVelocity(const_AirDataP src, AirDataP dest, const AirSimulator_params_base &params);
 	void blur_pressureAndVelocity(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_pv, const_CellsUCharP blockair, CellsFloatRP dest_vx, CellsFloatRP dest_vy, CellsFloatRP dest_pv);
@@ -44,15 +61,18 @@ protected:
 	void blur_cell_h(int x, int y, const_CellsFloatRP src_hv, CellsFloatRP dest_hv, const_CellsUCharRP blockairh);
 
 	void velocityAdvection(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_avx, const_CellsFloatRP src_avy, CellsFloatRP dest_vx, CellsFloatRP dest_vy, const_CellsUCharRP blockair, const_CellsUCharRP bmap, const_CellsFloatRP fvx, const_CellsFloatRP fvy);
+	void velocityAdvection_rows(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_avx, const_CellsFloatRP src_avy, CellsFloatRP dest_vx, CellsFloatRP dest_vy, const_CellsUCharRP blockair, const_CellsUCharRP bmap, const_CellsFloatRP fvx, const_CellsFloatRP fvy, int yStart, int yEnd);
 	void velocityAdvection(const_AirDataP blurredSrc, const_AirDataP advSrc, AirDataP dest, const AirSimulator_params_base &params);
 	void heatAdvection(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_hv, const_CellsFloatRP src_ahv, const_CellsUCharRP blockairh, CellsFloatRP dest_hv);
+	void heatAdvection_rows(const_CellsFloatRP src_vx, const_CellsFloatRP src_vy, const_CellsFloatRP src_hv, const_CellsFloatRP src_ahv, const_CellsUCharRP blockairh, CellsFloatRP dest_hv, int yStart, int yEnd);
 
 	void heatPressure(const_CellsFloatRP old_hv, CellsFloatRP new_hv, CellsFloatRP new_pv);
 	void heatRise(const_CellsFloatRP old_hv, CellsFloatRP new_vx, CellsFloatRP new_vy, const AirSimulator_params_base &params);
 
 public:
-	AirSimulator_v1() : AirSimulator_sync() {}
-	virtual ~AirSimulator_v1() {}
+	// threadCount=0 means use the number of hardware threads. Results are exactly the same for any number of threads.
+	AirSimulator_v1(unsigned int threadCount_=1);
+	virtual ~AirSimulator_v1();
 	virtual void sim_impl_rwInput(AirDataP inputData, AirDataP outputData, AirSimulator_params_base &params);
 };
 
@@ -0,0 +1,397 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef Simulation_Air_AirSimulatorV1Kernels_h
+#define Simulation_Air_AirSimulatorV1Kernels_h
+
+#include "simulation/Config.hpp"
+#include "common/Intrinsics.hpp"
+#include "algorithm/for_each_i.hpp"
+#include "common/tpt-stdint.h"
+
+/* tptalgo kernels for the stencil passes in AirSimulator_v1.
+ *
+ * All pointers point to the start of a [YRES/CELL][XRES/CELL] array, and the index i passed to i_op is y*(XRES/CELL)+x.
+ * The kernels read neighbouring cells without checking for the edge of the array, so for_each_i must only be called on ranges where the stencil stays inside the array (see the comment for each kernel).
+ *
+ * Each kernel has:
+ *  - a single cell implementation, which does the calculation in the same way as the original scalar code
+ *  - an implementation which does 4 cells at a time using plain arrays (which compilers can usually vectorise), for when libsimdpp is not available
+ *  - a libsimdpp implementation
+ * The multi-cell implementations do the same floating point operations in the same order as the single cell implementation, so results are identical (unless compiled with options such as -ffast-math which allow the compiler to reorder operations).
+ *
+ * For the blur kernels, walls are handled in the multi-cell implementations by multiplying the kernel weights by notBlocked (1.0f for cells which do not block air, 0.0f for walls) instead of skipping blocked cells. Since fsum and the blurred values start at +0.0f, adding a (+/-)0.0f contribution from a blocked cell does not change them, which gives the same result as skipping that cell (as long as the air data is finite).
+ */
+
+namespace AirSimulator_v1_kernels
+{
+
+static constexpr size_t rowLength = XRES/CELL;
+
+// Use for rows 1 to YRES/CELL-1, x from 1 to XRES/CELL-1
+class Kernel_pressureFromVelocity : public tptalgo::Kernel_i_base
+{
+public:
+	TPTALGO_KERN_I_COMMON(Kernel_pressureFromVelocity)
+
+	const float * const src_pv, * const src_vx, * const src_vy;
+	float * const dest_pv;
+
+	Kernel_pressureFromVelocity(const float *src_pv_, const float *src_vx_, const float *src_vy_, float *dest_pv_) :
+		src_pv(src_pv_), src_vx(src_vx_), src_vy(src_vy_), dest_pv(dest_pv_)
+	{}
+
+	TPTALGO_KERN_I_IMPL(1, 1)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float pv = 0.0f;
+			pv += k.src_vx[i-1] - k.src_vx[i];// (x velocity in) - (x velocity out)
+			pv += k.src_vy[i-rowLength] - k.src_vy[i];// (y velocity in) - (y velocity out)
+			k.dest_pv[i] = k.src_pv[i]*AIR_PLOSS + pv*AIR_TSTEPP;
+		}
+	};
+
+	TPTALGO_KERN_I_IMPL(4, 2)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float pv[4];
+			for (int j=0; j<4; j++)
+				pv[j] = 0.0f;
+			for (int j=0; j<4; j++)
+				pv[j] += k.src_vx[i+j-1] - k.src_vx[i+j];
+			for (int j=0; j<4; j++)
+				pv[j] += k.src_vy[i+j-rowLength] - k.src_vy[i+j];
+			for (int j=0; j<4; j++)
+				k.dest_pv[i+j] = k.src_pv[i+j]*AIR_PLOSS + pv[j]*AIR_TSTEPP;
+		}
+	};
+
+#if HAVE_LIBSIMDPP
+	TPTALGO_KERN_I_IMPL(simdpp::float32v::length, 3)
+	{
+	public:
+		using T = simdpp::float32v;
+		const T vec_PLOSS, vec_TSTEPP;
+		i_impl(const Kernel &kernel) : vec_PLOSS(simdpp::splat(AIR_PLOSS)), vec_TSTEPP(simdpp::splat(AIR_TSTEPP)) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			T pv = simdpp::make_zero();
+			T vxIn = simdpp::load_u(k.src_vx+i-1), vxOut = simdpp::load_u(k.src_vx+i);
+			T vyIn = simdpp::load_u(k.src_vy+i-rowLength), vyOut = simdpp::load_u(k.src_vy+i);
+			T oldPv = simdpp::load_u(k.src_pv+i);
+			pv = pv + (vxIn - vxOut);
+			pv = pv + (vyIn - vyOut);
+			simdpp::store_u(k.dest_pv+i, T(oldPv*vec_PLOSS + pv*vec_TSTEPP));
+		}
+	};
+#endif
+};
+
+// Use for rows 0 to YRES/CELL-2, x from 0 to XRES/CELL-2
+class Kernel_velocityFromPressure : public tptalgo::Kernel_i_base
+{
+public:
+	TPTALGO_KERN_I_COMMON(Kernel_velocityFromPressure)
+
+	const float * const src_pv, * const src_vx, * const src_vy;
+	float * const dest_vx, * const dest_vy;
+
+	Kernel_velocityFromPressure(const float *src_pv_, const float *src_vx_, const float *src_vy_, float *dest_vx_, float *dest_vy_) :
+		src_pv(src_pv_), src_vx(src_vx_), src_vy(src_vy_), dest_vx(dest_vx_), dest_vy(dest_vy_)
+	{}
+
+	TPTALGO_KERN_I_IMPL(1, 1)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float dx = k.src_pv[i] - k.src_pv[i+1];// dp/dx
+			float dy = k.src_pv[i] - k.src_pv[i+rowLength];// dp/dy
+			k.dest_vx[i] = k.src_vx[i]*AIR_VLOSS + dx*AIR_TSTEPV;
+			k.dest_vy[i] = k.src_vy[i]*AIR_VLOSS + dy*AIR_TSTEPV;
+		}
+	};
+
+	TPTALGO_KERN_I_IMPL(4, 2)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float dx[4], dy[4];
+			for (int j=0; j<4; j++)
+			{
+				dx[j] = k.src_pv[i+j] - k.src_pv[i+j+1];
+				dy[j] = k.src_pv[i+j] - k.src_pv[i+j+rowLength];
+			}
+			for (int j=0; j<4; j++)
+			{
+				k.dest_vx[i+j] = k.src_vx[i+j]*AIR_VLOSS + dx[j]*AIR_TSTEPV;
+				k.dest_vy[i+j] = k.src_vy[i+j]*AIR_VLOSS + dy[j]*AIR_TSTEPV;
+			}
+		}
+	};
+
+#if HAVE_LIBSIMDPP
+	TPTALGO_KERN_I_IMPL(simdpp::float32v::length, 3)
+	{
+	public:
+		using T = simdpp::float32v;
+		const T vec_VLOSS, vec_TSTEPV;
+		i_impl(const Kernel &kernel) : vec_VLOSS(simdpp::splat(AIR_VLOSS)), vec_TSTEPV(simdpp::splat(AIR_TSTEPV)) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			T pv = simdpp::load_u(k.src_pv+i);
+			T pvRight = simdpp::load_u(k.src_pv+i+1);
+			T pvBelow = simdpp::load_u(k.src_pv+i+rowLength);
+			T vx = simdpp::load_u(k.src_vx+i), vy = simdpp::load_u(k.src_vy+i);
+			T dx = pv - pvRight;
+			T dy = pv - pvBelow;
+			simdpp::store_u(k.dest_vx+i, T(vx*vec_VLOSS + dx*vec_TSTEPV));
+			simdpp::store_u(k.dest_vy+i, T(vy*vec_VLOSS + dy*vec_TSTEPV));
+		}
+	};
+#endif
+};
+
+// Gaussian blur of vx, vy and pv, ignoring cells which block air. Same calculation as AirSimulator_v1::blur_cell_vp.
+// Use for rows 1 to YRES/CELL-2, x from 1 to XRES/CELL-2
+class Kernel_blur_vp : public tptalgo::Kernel_i_base
+{
+public:
+	TPTALGO_KERN_I_COMMON(Kernel_blur_vp)
+
+	const float * const weights;// 3x3 blur kernel
+	const uint8_t * const blockair;
+	const float * const notBlocked;
+	const float * const src_vx, * const src_vy, * const src_pv;
+	float * const dest_vx, * const dest_vy, * const dest_pv;
+
+	Kernel_blur_vp(const float *weights_, const uint8_t *blockair_, const float *notBlocked_, const float *src_vx_, const float *src_vy_, const float *src_pv_, float *dest_vx_, float *dest_vy_, float *dest_pv_) :
+		weights(weights_), blockair(blockair_), notBlocked(notBlocked_),
+		src_vx(src_vx_), src_vy(src_vy_), src_pv(src_pv_),
+		dest_vx(dest_vx_), dest_vy(dest_vy_), dest_pv(dest_pv_)
+	{}
+
+	TPTALGO_KERN_I_IMPL(1, 1)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float fsum = 0.0f, dx = 0.0f, dy = 0.0f, dp = 0.0f;
+			for (int j=-1; j<2; j++)
+				for (int x=-1; x<2; x++)
+				{
+					size_t n = i + j*rowLength + x;
+					if (!k.blockair[n])
+					{
+						float f = k.weights[x+1+(j+1)*3];
+						fsum += f;
+						dx += k.src_vx[n]*f;
+						dy += k.src_vy[n]*f;
+						dp += k.src_pv[n]*f;
+					}
+				}
+			if (fsum<0.99f)
+			{
+				dx += k.src_vx[i]*(1.0f-fsum);
+				dy += k.src_vy[i]*(1.0f-fsum);
+				dp += k.src_pv[i]*(1.0f-fsum);
+			}
+			k.dest_vx[i] = dx;
+			k.dest_vy[i] = dy;
+			k.dest_pv[i] = dp;
+		}
+	};
+
+	TPTALGO_KERN_I_IMPL(4, 2)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float fsum[4] = {}, dx[4] = {}, dy[4] = {}, dp[4] = {};
+			for (int j=-1; j<2; j++)
+				for (int x=-1; x<2; x++)
+				{
+					size_t n = i + j*rowLength + x;
+					float w = k.weights[x+1+(j+1)*3];
+					for (int c=0; c<4; c++)
+					{
+						float f = w*k.notBlocked[n+c];
+						fsum[c] += f;
+						dx[c] += k.src_vx[n+c]*f;
+						dy[c] += k.src_vy[n+c]*f;
+						dp[c] += k.src_pv[n+c]*f;
+					}
+				}
+			for (int c=0; c<4; c++)
+			{
+				if (fsum[c]<0.99f)
+				{
+					dx[c] += k.src_vx[i+c]*(1.0f-fsum[c]);
+					dy[c] += k.src_vy[i+c]*(1.0f-fsum[c]);
+					dp[c] += k.src_pv[i+c]*(1.0f-fsum[c]);
+				}
+				k.dest_vx[i+c] = dx[c];
+				k.dest_vy[i+c] = dy[c];
+				k.dest_pv[i+c] = dp[c];
+			}
+		}
+	};
+
+#if HAVE_LIBSIMDPP
+	TPTALGO_KERN_I_IMPL(simdpp::float32v::length, 3)
+	{
+	public:
+		using T = simdpp::float32v;
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			T fsum = simdpp::make_zero(), dx = simdpp::make_zero(), dy = simdpp::make_zero(), dp = simdpp::make_zero();
+			for (int j=-1; j<2; j++)
+				for (int x=-1; x<2; x++)
+				{
+					size_t n = i + j*rowLength + x;
+					T f = simdpp::splat(k.weights[x+1+(j+1)*3]);
+					f = f * T(simdpp::load_u(k.notBlocked+n));
+					fsum = fsum + f;
+					dx = dx + T(simdpp::load_u(k.src_vx+n))*f;
+					dy = dy + T(simdpp::load_u(k.src_vy+n))*f;
+					dp = dp + T(simdpp::load_u(k.src_pv+n))*f;
+				}
+			// Where fsum<0.99f, add the centre cell values for the missing part of the kernel. Elsewhere, add +0.0f (which does not change the result).
+			simdpp::mask_float32v needsCentre = simdpp::cmp_lt(fsum, T(simdpp::splat(0.99f)));
+			T centreWeight = T(simdpp::splat(1.0f)) - fsum;
+			dx = dx + simdpp::bit_and(T(T(simdpp::load_u(k.src_vx+i))*centreWeight), needsCentre);
+			dy = dy + simdpp::bit_and(T(T(simdpp::load_u(k.src_vy+i))*centreWeight), needsCentre);
+			dp = dp + simdpp::bit_and(T(T(simdpp::load_u(k.src_pv+i))*centreWeight), needsCentre);
+			simdpp::store_u(k.dest_vx+i, dx);
+			simdpp::store_u(k.dest_vy+i, dy);
+			simdpp::store_u(k.dest_pv+i, dp);
+		}
+	};
+#endif
+};
+
+// Gaussian blur of ambient heat, ignoring cells which block heat (blockairh&0x8). Same calculation as AirSimulator_v1::blur_cell_h.
+// Use for rows 1 to YRES/CELL-2, x from 1 to XRES/CELL-2
+class Kernel_blur_h : public tptalgo::Kernel_i_base
+{
+public:
+	TPTALGO_KERN_I_COMMON(Kernel_blur_h)
+
+	const float * const weights;// 3x3 blur kernel
+	const uint8_t * const blockairh;
+	const float * const notBlocked;
+	const float * const src_hv;
+	float * const dest_hv;
+
+	Kernel_blur_h(const float *weights_, const uint8_t *blockairh_, const float *notBlocked_, const float *src_hv_, float *dest_hv_) :
+		weights(weights_), blockairh(blockairh_), notBlocked(notBlocked_), src_hv(src_hv_), dest_hv(dest_hv_)
+	{}
+
+	TPTALGO_KERN_I_IMPL(1, 1)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float fsum = 0.0f, dh = 0.0f;
+			for (int j=-1; j<2; j++)
+				for (int x=-1; x<2; x++)
+				{
+					size_t n = i + j*rowLength + x;
+					if (!(k.blockairh[n]&0x8))
+					{
+						float f = k.weights[x+1+(j+1)*3];
+						fsum += f;
+						dh += k.src_hv[n]*f;
+					}
+				}
+			if (fsum<0.99f)
+			{
+				dh += k.src_hv[i]*(1.0f-fsum);
+			}
+			k.dest_hv[i] = dh;
+		}
+	};
+
+	TPTALGO_KERN_I_IMPL(4, 2)
+	{
+	public:
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			float fsum[4] = {}, dh[4] = {};
+			for (int j=-1; j<2; j++)
+				for (int x=-1; x<2; x++)
+				{
+					size_t n = i + j*rowLength + x;
+					float w = k.weights[x+1+(j+1)*3];
+					for (int c=0; c<4; c++)
+					{
+						float f = w*k.notBlocked[n+c];
+						fsum[c] += f;
+						dh[c] += k.src_hv[n+c]*f;
+					}
+				}
+			for (int c=0; c<4; c++)
+			{
+				if (fsum[c]<0.99f)
+					dh[c] += k.src_hv[i+c]*(1.0f-fsum[c]);
+				k.dest_hv[i+c] = dh[c];
+			}
+		}
+	};
+
+#if HAVE_LIBSIMDPP
+	TPTALGO_KERN_I_IMPL(simdpp::float32v::length, 3)
+	{
+	public:
+		using T = simdpp::float32v;
+		i_impl(...) {}
+		void i_op(const Kernel &k, size_t i, bool isAligned) const
+		{
+			T fsum = simdpp::make_zero(), dh = simdpp::make_zero();
+			for (int j=-1; j<2; j++)
+				for (int x=-1; x<2; x++)
+				{
+					size_t n = i + j*rowLength + x;
+					T f = simdpp::splat(k.weights[x+1+(j+1)*3]);
+					f = f * T(simdpp::load_u(k.notBlocked+n));
+					fsum = fsum + f;
+					dh = dh + T(simdpp::load_u(k.src_hv+n))*f;
+				}
+			simdpp::mask_float32v needsCentre = simdpp::cmp_lt(fsum, T(simdpp::splat(0.99f)));
+			T centreWeight = T(simdpp::splat(1.0f)) - fsum;
+			dh = dh + simdpp::bit_and(T(T(simdpp::load_u(k.src_hv+i))*centreWeight), needsCentre);
+			simdpp::store_u(k.dest_hv+i, dh);
+		}
+	};
+#endif
+};
+
+}
+
+#endif
@@ -82,8 +82,11 @@ public:
 			return;
 
 		// Work out which grid cells have at least one particle of this type inside them
-		for (int i=0; i<=sim->parts_lastActiveIndex; i++)
+		// Backwards, since part_kill moves the last item in the list into the position of the killed particle
+		const std::vector<int> &ids = sim->partsByType.get(patternElement);
+		for (int j=ids.size()-1; j>=0; j--)
 		{
+			int i = ids[j];
 			if (parts[i].type==patternElement)
 			{
 				int x = int(parts[i].x+0.5f)-MinX, y = int(parts[i].y+0.5f)-MinY;
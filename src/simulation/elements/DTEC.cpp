@@ -39,21 +39,26 @@ int DTEC_update(UPDATE_FUNC_ARGS)
 	}
 	bool setFilt = false;
 	int photonWl = 0;
-	for (rx=-rd; rx<rd+1; rx++)
-		for (ry=-rd; ry<rd+1; ry++)
-			if (x+rx>=0 && y+ry>0 && x+rx<XRES && y+ry<YRES && (rx || ry))
-			{
-				FOR_PMAP_POSITION(sim, x+rx, y+ry, rcount, ri, rnext)
-				{
-					if (parts[ri].type == parts[i].ctype && (parts[i].ctype != PT_LIFE || parts[i].tmp == parts[ri].ctype || !parts[i].tmp))
-						parts[i].life = 1;
-					if (parts[ri].type == PT_PHOT || (parts[ri].type == PT_BRAY && parts[ri].tmp!=2))
-					{
-						setFilt = true;
-						photonWl = parts[ri].ctype;
-					}
-				}
-			}
+	// Only the last photon in the window sets photonWl, so search the window backwards, stopping once both a photon and a particle matching ctype have been found.
+	// Row 0 and the detector's own position are not included.
+	sim->pmap_forEachOccupied(SimPosI(x-rd, std::max(y-rd, 1)), SimPosI(x+rd, y+rd), PMapCategory::All, true, [&](SimPosI pos) {
+		if (pos.x==x && pos.y==y)
+			return false;
+		int photon = -1;
+		FOR_PMAP_POSITION(sim, pos.x, pos.y, rcount, ri, rnext)
+		{
+			if (parts[ri].type == parts[i].ctype && (parts[i].ctype != PT_LIFE || parts[i].tmp == parts[ri].ctype || !parts[i].tmp))
+				parts[i].life = 1;
+			if (!setFilt && (parts[ri].type == PT_PHOT || (parts[ri].type == PT_BRAY && parts[ri].tmp!=2)))
+				photon = ri;
+		}
+		if (photon>=0)
+		{
+			setFilt = true;
+			photonWl = parts[photon].ctype;
+		}
+		return (setFilt && parts[i].life);
+	});
 	if (setFilt)
 	{
 		int nx, ny;
@@ -104,7 +104,7 @@ void EMP_ElemDataSim::Simulation_AfterUpdate()
 
 	float prob_randDLAY = tptmath::binomial_gte1(triggerCount, 1.0f/70);
 
-	for (int i=0; i<=sim->parts_lastActiveIndex; i++)
+	for (int i=sim->parts_firstActive(); i>=0; i=sim->parts_nextActive(i))
 	{
 		int t = parts[i].type;
 		if (t==PT_SPRK || (t==PT_SWCH && parts[i].life!=0 && parts[i].life!=10) || (t==PT_WIRE && !Element_WIRE::wasInactive(parts[i])))
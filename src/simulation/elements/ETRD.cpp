@@ -18,31 +18,6 @@
 
 #include <algorithm>
 
-ETRD_ElemDataShared::ETRD_ElemDataShared(SimulationSharedData *s, int t) : ElemDataShared(s,t)
-{
-	// TODO: this value needs tuning:
-	initDeltaPos(12);
-}
-
-void ETRD_ElemDataShared::initDeltaPos(int maxLength_)
-{
-	maxLength = maxLength_;
-	deltaPos.clear();
-	for (int ry=-maxLength; ry<=maxLength; ry++)
-		for (int rx=-maxLength; rx<=maxLength; rx++)
-		{
-			SimPosDI d(rx, ry);
-			if (d.length_1()<=maxLength)
-				deltaPos.push_back({d, d.length_1()});
-		}
-	auto compareFunc = [](const ETRD_deltaWithLength &a, const ETRD_deltaWithLength &b)
-	{
-		return a.length < b.length;
-	};
-	std::stable_sort(deltaPos.begin(), deltaPos.end(), compareFunc);
-}
-
-
 ETRD_ElemDataSim::ETRD_ElemDataSim(Simulation *s, int t) :
 	ElemDataSim(s,t),
 	obs_simCleared(sim->hook_cleared, this, &ETRD_ElemDataSim::invalidate),
@@ -50,6 +25,12 @@ ETRD_ElemDataSim::ETRD_ElemDataSim(Simulation *s, int t) :
 	obs_simAfterUpdate(sim->hook_afterUpdate, this, &ETRD_ElemDataSim::invalidate)
 {
 	invalidate();
+	if (!sim->partsByBucket.isTracked(t))
+	{
+		sim->partsByBucket.track(t);
+		for (int i : sim->partsByType.get(t))
+			sim->partsByBucket.add(i, SimPosF(sim->parts[i].x, sim->parts[i].y), t);
+	}
 }
 
 void ETRD_ElemDataSim::invalidate()
@@ -65,85 +46,74 @@ int Element_ETRD::nearestSparkablePart(Simulation *sim, int targetId)
 	if (!sim->elementCount[PT_ETRD])
 		return -1;
 	ETRD_ElemDataSim *ed = sim->elemData<ETRD_ElemDataSim>(PT_ETRD);
-	ETRD_ElemDataShared *eds = sim->elemDataShared<ETRD_ElemDataShared>(PT_ETRD);
-	if (ed->isValid && ed->countLife0<=0)
+	particle *parts = sim->parts;
+	if (!ed->isValid)
+	{
+		int countLife0 = 0;
+		for (int i : sim->partsByType.get(PT_ETRD))
+		{
+			if (parts[i].type==PT_ETRD && !parts[i].life)
+				countLife0++;
+		}
+		ed->countLife0 = countLife0;
+		ed->isValid = true;
+	}
+	if (ed->countLife0<=0)
 		return -1;
 
-	particle *parts = sim->parts;
 	int foundDistance = SimPosDI(XRES,YRES).length_1();
 	int foundI = -1;
 	SimPosI targetPos = SimPosF(parts[targetId].x, parts[targetId].y);
 
-	if (ed->isValid)
-	{
-		// countLife0 doesn't need recalculating, so just focus on finding the nearest particle
-
-		// If the simulation contains lots of particles, check near the target position first since going through all particles will be slow.
-		// Threshold = number of positions checked, *2 because it's likely to access memory all over the place (less cache friendly) and there's extra logic needed
-		// TODO: probably not optimal if excessive stacking is used
-		if (sim->parts_lastActiveIndex > (int)eds->deltaPos.size()*2)
+	auto checkPart = [&](int i) {
+		if (parts[i].type==PT_ETRD && !parts[i].life)
 		{
-			for (ETRD_deltaWithLength delta : eds->deltaPos)
+			SimPosI checkPos = SimPosF(parts[i].x, parts[i].y);
+			int checkDistance = (checkPos-targetPos).length_1();
+			// Lists are not sorted, so compare IDs to select the particle with the lowest ID at that distance
+			if ((checkDistance<foundDistance || (checkDistance==foundDistance && i<foundI)) && i!=targetId)
 			{
-				SimPosI checkPos = targetPos + delta.d;
-				int checkDistance = delta.length;
-				if (foundDistance<checkDistance)
-				{
-					// eds->deltaPos is sorted in order of ascending length, so foundDistance<checkDistance means all later items are further away.
-					break;
-				}
-				if (sim->pos_isValid(checkPos) && checkDistance<=foundDistance)
-				{
-					FOR_SIM_PMAP_POS(sim, PMapCategory::Plain, checkPos, i)
-					{
-						// "i<foundI || foundI<0" to match the results from an all-particles loop, which selects the particle with the lowest ID at that distance
-						if (parts[i].type==PT_ETRD && !parts[i].life && i!=targetId && (checkDistance<foundDistance || i<foundI || foundI<0))
-						{
-							foundDistance = checkDistance;
-							foundI = i;
-						}
-					}
-				}
+				foundDistance = checkDistance;
+				foundI = i;
 			}
 		}
-		// If neighbour search didn't find a suitable particle, search all particles
-		if (foundI<0)
+	};
+
+	// Check rings of buckets around the bucket containing the target, until the next ring is further away than the closest particle found so far.
+	// Positions in ring r are at least (r-1)*bucketSize+1 away from the target.
+	// Going through a short list of particles is quicker than checking lots of mostly empty buckets, so if there are only a few suitable particles spread out over a large area, give up and check all ETRD particles instead.
+	const int bucketLimit = sim->elementCount[PT_ETRD]/8;
+	int bucketCount = 0;
+	auto checkBucket = [&](int bx, int by) {
+		if (bx<0 || by<0 || bx>=ParticleTypeBuckets::bucketsX || by>=ParticleTypeBuckets::bucketsY)
+			return;
+		if (ParticleTypeBuckets::minDistance(targetPos, bx, by) > foundDistance)
+			return;
+		bucketCount++;
+		for (int i : sim->partsByBucket.get(PT_ETRD, bx, by))
+			checkPart(i);
+	};
+	const int centreX = targetPos.x/ParticleTypeBuckets::bucketSize, centreY = targetPos.y/ParticleTypeBuckets::bucketSize;
+	const int maxRing = std::max(std::max(centreX, ParticleTypeBuckets::bucketsX-1-centreX), std::max(centreY, ParticleTypeBuckets::bucketsY-1-centreY));
+	checkBucket(centreX, centreY);
+	for (int r=1; r<=maxRing && (r-1)*ParticleTypeBuckets::bucketSize+1<=foundDistance; r++)
+	{
+		if (bucketCount>bucketLimit)
 		{
-			for (int i=0; i<=sim->parts_lastActiveIndex; i++)
-			{
-				if (parts[i].type==PT_ETRD && !parts[i].life)
-				{
-					SimPosI checkPos = SimPosF(parts[i].x, parts[i].y);
-					int checkDistance = (checkPos-targetPos).length_1();
-					if (checkDistance<foundDistance && i!=targetId)
-					{
-						foundDistance = checkDistance;
-						foundI = i;
-					}
-				}
-			}
+			for (int i : sim->partsByType.get(PT_ETRD))
+				checkPart(i);
+			break;
 		}
-	}
-	else
-	{
-		// Recalculate countLife0, and search for the closest suitable particle
-		int countLife0 = 0;
-		for (int i=0; i<=sim->parts_lastActiveIndex; i++)
+		for (int bx=centreX-r; bx<=centreX+r; bx++)
 		{
-			if (parts[i].type==PT_ETRD && !parts[i].life)
-			{
-				countLife0++;
-				SimPosI checkPos = SimPosF(parts[i].x, parts[i].y);
-				int checkDistance = (checkPos-targetPos).length_1();
-				if (checkDistance<foundDistance && i!=targetId)
-				{
-					foundDistance = checkDistance;
-					foundI = i;
-				}
-			}
+			checkBucket(bx, centreY-r);
+			checkBucket(bx, centreY+r);
+		}
+		for (int by=centreY-r+1; by<centreY+r; by++)
+		{
+			checkBucket(centreX-r, by);
+			checkBucket(centreX+r, by);
 		}
-		ed->countLife0 = countLife0;
-		ed->isValid = true;
 	}
 	return foundI;
 }
@@ -211,7 +181,6 @@ void ETRD_init_element(ELEMENT_INIT_FUNC_ARGS)
 	elem->Update = NULL;
 	elem->Graphics = NULL;
 	elem->Func_ChangeType = &ETRD_ChangeType;
-	simSD->elemData_create<ETRD_ElemDataShared>(t);
 	elem->Func_SimInit = &SimInit_createElemData<ETRD_ElemDataSim>;
 }
 
@@ -16,27 +16,9 @@
 #ifndef simulation_elements_ETRD_h
 #define simulation_elements_ETRD_h
 
-#include "../ElemDataShared.h"
 #include "../ElemDataSim.h"
 #include "../Simulation.h"
 #include "common/Observer.h"
-#include <vector>
-
-class ETRD_deltaWithLength
-{
-public:
-	SimPosDI d;
-	int length;
-};
-
-class ETRD_ElemDataShared : public ElemDataShared
-{
-public:
-	std::vector<ETRD_deltaWithLength> deltaPos;
-	int maxLength;
-	ETRD_ElemDataShared(SimulationSharedData *s, int t);
-	void initDeltaPos(int maxLength_);
-};
 
 class ETRD_ElemDataSim : public ElemDataSim
 {
@@ -48,6 +30,7 @@ public:
 	bool isValid;
 	int countLife0;
 	void invalidate();
+	void Simulation_PartsRenumbered(const int *newIds) { invalidate(); }
 	ETRD_ElemDataSim(Simulation *s, int t);
 };
 
@@ -97,6 +97,13 @@ public:
 	{
 		return (usedCount<maxFighters) || storageActionPending;
 	}
+	void Simulation_PartsRenumbered(const int *newIds)
+	{
+		for (int i=0; i<maxFighters; i++)
+		{
+			fighters[i].Simulation_PartsRenumbered(sim, newIds);
+		}
+	}
 };
 
 #endif
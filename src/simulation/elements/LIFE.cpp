@@ -18,7 +18,7 @@
 #include "simulation/ElemDataSim.h"
 #include "LIFE.hpp"
 #include "common/Format.hpp"
-#include "common/Intrinsics.hpp"
+#include "common/tptmath.h"
 
 #include <algorithm>
 #include <sstream>
@@ -240,28 +240,176 @@ bool Element_LIFE::isValidType(Simulation *sim, int type)
 	return false;
 }
 
+void LIFE_Bitboard::wrapEdges()
+{
+	for (int y=CELL; y<YRES-CELL; y++)
+	{
+		set(CELL-1, y, get(XRES-CELL-1, y));
+		set(XRES-CELL, y, get(CELL, y));
+	}
+	std::memcpy(rows[CELL-1], rows[YRES-CELL-1], sizeof(rows[0]));
+	std::memcpy(rows[YRES-CELL], rows[CELL], sizeof(rows[0]));
+}
+
+void LIFE_Bitboard::clear(const LIFE_TileSet &tiles)
+{
+	tiles.forEachRow(0, YRES, [&](int y) {
+		for (int w=0; w<wordsPerRow; w++)
+			rows[y][w] &= ~tiles.mask(y, w);
+	});
+}
+
+void LIFE_TileSet::dilateWrapped(const LIFE_TileSet &src)
+{
+	clear();
+	const int mainWidth = XRES-CELL*2, mainHeight = YRES-CELL*2;
+	auto wrapX = [=](int x) { return (x<CELL) ? x+mainWidth : ((x>=XRES-CELL) ? x-mainWidth : x); };
+	auto wrapY = [=](int y) { return (y<CELL) ? y+mainHeight : ((y>=YRES-CELL) ? y-mainHeight : y); };
+	for (int ty=0; ty<tilesY; ty++)
+	{
+		// Part of the tile inside the main area
+		const int y0 = std::max(ty*tileSize, CELL), y1 = std::min((ty+1)*tileSize, YRES-CELL)-1;
+		for (int tx=0; tx<tilesX; tx++)
+		{
+			const int x0 = std::max(tx*tileSize, CELL), x1 = std::min((tx+1)*tileSize, XRES-CELL)-1;
+			if (x0>x1 || y0>y1 || !src.contains(tx, ty))
+				continue;
+			// The neighbours of the positions in this tile are in the tiles containing the rows and columns just outside it
+			for (int y : {wrapY(y0-1), y0, wrapY(y1+1)})
+				for (int x : {wrapX(x0-1), x0, wrapX(x1+1)})
+					add(x, y);
+		}
+	}
+}
+
+// Word w of a row, shifted so that bit x contains position x-1 (left) or x+1 (right)
+static inline uint64_t LIFE_wordLeft(const uint64_t *row, int w)
+{
+	return (row[w]<<1) | (w>0 ? row[w-1]>>63 : 0);
+}
+static inline uint64_t LIFE_wordRight(const uint64_t *row, int w)
+{
+	return (row[w]>>1) | (w<LIFE_Bitboard::wordsPerRow-1 ? row[w+1]<<63 : 0);
+}
+// Whether anything is set in words w-1 to w+1 of the three rows, close enough to affect the 3x3 neighbourhoods of positions in word w
+static inline bool LIFE_anyNearby(const uint64_t *above, const uint64_t *row, const uint64_t *below, int w)
+{
+	uint64_t v = above[w] | row[w] | below[w];
+	if (w>0)
+		v |= (above[w-1] | row[w-1] | below[w-1]) >> 63;
+	if (w<LIFE_Bitboard::wordsPerRow-1)
+		v |= (above[w+1] | row[w+1] | below[w+1]) << 63;
+	return v!=0;
+}
+// Full adder for 64 bits at once
+static inline void LIFE_add3(uint64_t a, uint64_t b, uint64_t c, uint64_t &sum, uint64_t &carry)
+{
+	uint64_t ab = a^b;
+	sum = ab^c;
+	carry = (a&b) | (ab&c);
+}
+
+void LIFE_Bitboard::neighbourCounts(LIFE_Bitboard counts[4], const LIFE_TileSet &tiles) const
+{
+	for (int i=0; i<4; i++)
+		counts[i].clear(tiles);
+	tiles.forEachRow(CELL, YRES-CELL, [&](int y) {
+		const uint64_t *above = rows[y-1], *row = rows[y], *below = rows[y+1];
+		for (int w=0; w<wordsPerRow; w++)
+		{
+			uint64_t mask = tiles.mask(y, w) & mainAreaMask(w);
+			if (!mask || !LIFE_anyNearby(above, row, below, w))
+				continue;
+			// Count for each row as a 2 bit number (x0 + 2*x1)
+			uint64_t a0, a1, b0, b1, c0, c1;
+			LIFE_add3(LIFE_wordLeft(above, w), above[w], LIFE_wordRight(above, w), a0, a1);
+			LIFE_add3(LIFE_wordLeft(row, w), row[w], LIFE_wordRight(row, w), b0, b1);
+			LIFE_add3(LIFE_wordLeft(below, w), below[w], LIFE_wordRight(below, w), c0, c1);
+			// Add the three rows: ones + 2*(twos + carry from ones) + 4*carry from twos
+			uint64_t ones, onesCarry, twos, twosCarry;
+			LIFE_add3(a0, b0, c0, ones, onesCarry);
+			LIFE_add3(a1, b1, c1, twos, twosCarry);
+			uint64_t bit1 = twos ^ onesCarry;
+			uint64_t bit1Carry = twos & onesCarry;
+			counts[0].rows[y][w] |= ones & mask;
+			counts[1].rows[y][w] |= bit1 & mask;
+			counts[2].rows[y][w] |= (twosCarry ^ bit1Carry) & mask;
+			counts[3].rows[y][w] |= (twosCarry & bit1Carry) & mask;
+		}
+	});
+}
+
+void LIFE_Bitboard::dilate(LIFE_Bitboard &dest, const LIFE_TileSet &tiles) const
+{
+	dest.clear(tiles);
+	tiles.forEachRow(CELL, YRES-CELL, [&](int y) {
+		const uint64_t *above = rows[y-1], *row = rows[y], *below = rows[y+1];
+		for (int w=0; w<wordsPerRow; w++)
+		{
+			uint64_t mask = tiles.mask(y, w) & mainAreaMask(w);
+			if (!mask || !LIFE_anyNearby(above, row, below, w))
+				continue;
+			uint64_t v = LIFE_wordLeft(above, w) | above[w] | LIFE_wordRight(above, w);
+			v |= LIFE_wordLeft(row, w) | row[w] | LIFE_wordRight(row, w);
+			v |= LIFE_wordLeft(below, w) | below[w] | LIFE_wordRight(below, w);
+			dest.rows[y][w] |= v & mask;
+		}
+	});
+}
+
+uint64_t LIFE_Bitboard::countMatches(const LIFE_Bitboard counts[4], int y, int w, uint16_t countBits)
+{
+	const uint64_t c0 = counts[0].rows[y][w], c1 = counts[1].rows[y][w], c2 = counts[2].rows[y][w], c3 = counts[3].rows[y][w];
+	uint64_t result = 0;
+	for (int n=0; n<16; n++)
+	{
+		if (countBits & (1<<n))
+			result |= ((n&1) ? c0 : ~c0) & ((n&2) ? c1 : ~c1) & ((n&4) ? c2 : ~c2) & ((n&8) ? c3 : ~c3);
+	}
+	return result & mainAreaMask(w);
+}
+
+
 void LIFE_ElemDataSim::readLife()
 {
-	//TODO: maybe this should only loop through active particles
-	//go through every particle and set neighbor map
-	// ruleMap contains rule ID +1, 0 means no active LIFE particle there
+	// Find LIFE particles, and build bitboards of live cells (overall and for each rule)
+	// Only tiles containing LIFE particles are looked at, and within those only positions set in the pmap occupancy bits
 	auto sim = this->sim;// put in stack/register instead of indirect access via this, since used a lot
 	std::vector<LIFE_Rule> &rules = sim->elemDataShared<LIFE_ElemDataShared>(PT_LIFE)->rules;
 	const PMapCategory lifeCat = PMapCategory::Plain; //or sim->pmap_category(PT_LIFE), but hardcoded value is faster
 	int rulesSize = rules.size();
-	for (int ny=CELL; ny<YRES-CELL; ny++)
+
+	// The bitboards of LIFE particles are only written in lifeTiles, so clearing the tiles used last time clears all of them
+	lifeCells.clear(lifeTiles);
+	liveCells.clear(lifeTiles);
+	for (size_t slot=0; slot<usedRules.size(); slot++)
+		ruleLiveCells[slot].clear(lifeTiles);
+	ruleSlots.assign(rulesSize, -1);
+	usedRules.clear();
+
+	lifeTiles.clear();
+	for (int i : sim->partsByType.get(PT_LIFE))
 	{
-		for (int nx=CELL; nx<XRES-CELL; nx++)
+		if (sim->parts[i].type!=PT_LIFE)
+			continue;
+		SimPosI pos = SimPosF(sim->parts[i].x, sim->parts[i].y);
+		if (sim->pos_inMainArea(pos))
+			lifeTiles.add(pos.x, pos.y);
+	}
+
+	lifeTiles.forEachRow(CELL, YRES-CELL, [&](int ny) {
+		for (int w=0; w<LIFE_Bitboard::wordsPerRow; w++)
 		{
-			SimPosI pos(nx,ny);
-			if (!sim->pmap(pos).count(lifeCat))
-			{
-				ruleMap[ny][nx] = 0;
-				continue;
-			}
-			int r = sim->pmap(pos).find_one(sim->parts, PT_LIFE, lifeCat);
-			if (r>=0)
+			uint64_t occupied = sim->pmap.plainOccupiedWord(ny, w) & lifeTiles.mask(ny, w) & LIFE_Bitboard::mainAreaMask(w);
+			while (occupied)
 			{
+				int nx = w*64 + tptmath::ctz64(occupied);
+				occupied &= occupied-1;
+				SimPosI pos(nx,ny);
+				int r = sim->pmap(pos).find_one(sim->parts, PT_LIFE, lifeCat);
+				if (r<0)
+					continue;
+				lifeCells.set(nx, ny);
 				int ruleId = parts[r].ctype;
 				if (ruleId<0 || ruleId>=rulesSize)
 				{
@@ -271,76 +419,124 @@ void LIFE_ElemDataSim::readLife()
 				ruleMap[ny][nx] = ruleId+1;
 				if (sim->parts[r].tmp == rules[ruleId].liveStates())
 				{
-					for (int nnx=-1; nnx<2; nnx++)
+					if (ruleSlots[ruleId]<0)
 					{
-						for (int nny=-1; nny<2; nny++)//it will count itself as its own neighbor, which is needed, but will have 1 extra for delete check
+						ruleSlots[ruleId] = usedRules.size();
+						usedRules.push_back(ruleId);
+						if (ruleLiveCells.size()<usedRules.size())
 						{
-							SimPosI npos = sim->pos_wrapMainArea_simple(pos+SimPosDI(nnx,nny));
-							neighbourTotalMap[npos.y][npos.x]++;
-							//insert golnum into neighbor table
-							/* neighbour table size is 6 because any other neighbours would not be able to meet creation threshold in updateLife():
-							 *  If table already contains 6 neighbours all of different types:
-							 *   threshold = ceil(6/2) = 3
-							 *   Only 2 more neighbours left (each position has 8 neighbours).
-							 *   Even if the 2 neighbours were both the same new life type they would not meet the threshold
-							 *   So it's pointless to store them in the table
-							 */
-							for (int i=0; i<6; i++)
-							{
-								if (!neighbourMap[npos.y][npos.x][i])
-								{
-									neighbourMap[npos.y][npos.x][i] = (ruleId<<4)+1;
-									break;
-								}
-								else if((neighbourMap[npos.y][npos.x][i]>>4)==ruleId)
-								{
-									neighbourMap[npos.y][npos.x][i]++;
-									break;
-								}
-							}
+							ruleLiveCells.resize(usedRules.size());
+							ruleLiveCells.back().clear();
 						}
 					}
+					liveCells.set(nx, ny);
+					ruleLiveCells[ruleSlots[ruleId]].set(nx, ny);
 				}
 			}
 		}
+	});
+	liveCells.wrapEdges();
+	for (size_t i=0; i<usedRules.size(); i++)
+		ruleLiveCells[i].wrapEdges();
+}
+
+int LIFE_ElemDataSim::chooseBornRule(SimPosI pos, int totalNeighbourCount, std::vector<LIFE_Rule> &rules)
+{
+	// Count the live neighbours of each type (at most 8 different types)
+	int neighbourRules[8], neighbourCounts[8], typeCount = 0;
+	for (int nny=-1; nny<2; nny++)
+	{
+		for (int nnx=-1; nnx<2; nnx++)
+		{
+			SimPosI npos = sim->pos_wrapMainArea_simple(pos+SimPosDI(nnx,nny));
+			if (!liveCells.get(npos.x, npos.y))
+				continue;
+			int ruleId = ruleMap[npos.y][npos.x]-1;
+			int i;
+			for (i=0; i<typeCount && neighbourRules[i]!=ruleId; i++);
+			if (i==typeCount)
+			{
+				neighbourRules[typeCount] = ruleId;
+				neighbourCounts[typeCount] = 0;
+				typeCount++;
+			}
+			neighbourCounts[i]++;
+		}
+	}
+
+	// A life type can only be created if at least half the total LIFE neighbours are of that type, and the total number of LIFE neighbours is a "born" number for that life type.
+	int threshold = (totalNeighbourCount+1)/2;
+	int createRuleId = -1;
+	for (int i=0; i<typeCount; i++)
+	{
+		if (rules[neighbourRules[i]].born(totalNeighbourCount) && neighbourCounts[i]>=threshold)
+		{
+			// Conflict resolution based on ruleNum, where there are two LIFE types, each comprising exactly half the neighbours.
+			// (Unfortunately, this makes custom LIFE types a bit more difficult, though not impossible, and can't be changed due to the requirement for compatibility.)
+			if (createRuleId<0 || neighbourRules[i]<createRuleId)
+				createRuleId = neighbourRules[i];
+		}
 	}
+	return createRuleId;
 }
 
 void LIFE_ElemDataSim::updateLife()
 {
-	//go through every particle again, but check neighbor map, then update particles
 	auto sim = this->sim;// put in stack/register, since used a lot
 	std::vector<LIFE_Rule> &rules = sim->elemDataShared<LIFE_ElemDataShared>(PT_LIFE)->rules;
 	const PMapCategory lifeCat = PMapCategory::Plain;
 	bool didSomething = false;
-	for (int ny=CELL; ny<YRES-CELL; ny++)
+
+	// Positions which might change are either in lifeTiles or next to a live cell, so only the tiles around lifeTiles need looking at
+	activeTiles.dilateWrapped(lifeTiles);
+
+	// Total number of live cells in the 3x3 neighbourhood of each position. This counts live cells as their own neighbour, so survive checks subtract 1.
+	liveCells.neighbourCounts(liveCounts, activeTiles);
+
+	// Find positions where a new LIFE particle might be created.
+	// Where only one rule has live cells nearby, the total neighbour count is the count for that rule, so the born numbers for that rule can be checked for 64 positions at once.
+	// Where the neighbourhoods of different rules overlap, each position needs its neighbours counting by type, which is done by chooseBornRule().
+	covered.clear(activeTiles);
+	overlap.clear(activeTiles);
+	birthCandidates.clear(activeTiles);
+	for (size_t slot=0; slot<usedRules.size(); slot++)
 	{
-		for (int nx=CELL; nx<XRES-CELL; nx++)
+		// born(0) is not checked, since positions with no neighbours are never created
+		uint16_t bornBits = rules[usedRules[slot]].bornBits() & ~1;
+		ruleLiveCells[slot].dilate(dilated, activeTiles);
+		activeTiles.forEachRow(CELL, YRES-CELL, [&](int ny) {
+			for (int w=0; w<LIFE_Bitboard::wordsPerRow; w++)
+			{
+				uint64_t near = dilated.rows[ny][w] & activeTiles.mask(ny, w);
+				if (!near)
+					continue;
+				overlap.rows[ny][w] |= covered.rows[ny][w] & near;
+				covered.rows[ny][w] |= near;
+				if (bornBits)
+					birthCandidates.rows[ny][w] |= near & LIFE_Bitboard::countMatches(liveCounts, ny, w, bornBits);
+			}
+		});
+	}
+
+	// Go through positions which contain LIFE or might have LIFE created in them, in the same order as a scan of every position would
+	activeTiles.forEachRow(CELL, YRES-CELL, [&](int ny) {
+		for (int w=0; w<LIFE_Bitboard::wordsPerRow; w++)
 		{
-			SimPosI pos(nx,ny);
-			int totalNeighbourCount = neighbourTotalMap[ny][nx];
-			if (totalNeighbourCount)
+			uint64_t tileMask = activeTiles.mask(ny, w);
+			if (!tileMask)
+				continue;
+			uint64_t births = birthCandidates.rows[ny][w] | overlap.rows[ny][w];
+			uint64_t todo = (lifeCells.rows[ny][w] | (births & ~sim->pmap.plainOccupiedWord(ny, w))) & tileMask;
+			while (todo)
 			{
-				if (!sim->pmap(pos).count(lifeCat))
+				int nx = w*64 + tptmath::ctz64(todo);
+				todo &= todo-1;
+				SimPosI pos(nx,ny);
+				int totalNeighbourCount = liveCounts[0].get(nx,ny) | (liveCounts[1].get(nx,ny)<<1) | (liveCounts[2].get(nx,ny)<<2) | (liveCounts[3].get(nx,ny)<<3);
+				if (totalNeighbourCount && !sim->pmap(pos).count(lifeCat))
 				{
-					// Find which type we can try and create
-					// A life type can only be created if at least half the total LIFE neighbours are of that type, and the total number of LIFE neighbours is a "born" number for that life type.
-					int threshold = (totalNeighbourCount+1)/2;
-					int createRuleId = 0xFF;
-					for (int i=0; i<6; i++)
-					{
-						if (!neighbourMap[ny][nx][i])
-							break;
-						int checkRuleId = (neighbourMap[ny][nx][i]>>4);
-						if (rules[checkRuleId].born(totalNeighbourCount) && (neighbourMap[ny][nx][i]&0xF)>=threshold)
-						{
-							// Conflict resolution based on ruleNum, where there are two LIFE types, each comprising exactly half the neighbours.
-							// (Unfortunately, this makes custom LIFE types a bit more difficult, though not impossible, and can't be changed due to the requirement for compatibility.)
-							if (checkRuleId<createRuleId)
-								createRuleId = checkRuleId;
-						}
-					}
-					if (createRuleId<0xFF)
+					int createRuleId = chooseBornRule(pos, totalNeighbourCount, rules);
+					if (createRuleId>=0)
 					{
 						int p = sim->part_create(-1, pos, PT_LIFE);
 						if (p>=0)
@@ -351,57 +547,43 @@ void LIFE_ElemDataSim::updateLife()
 					}
 				}
 
-				// Clear neighbour maps
-#if defined(HAVE_LIBSIMDPP) && (defined(__ARM_NEON__) || (defined(__SSE__) && !defined(__x86_64__)))
-				// Unaligned store of 16 bytes in order to zero 12 bytes in the neighbourMap (all entries in neighbourMap[ny][nx])
-				// (Store the extra 4 bytes in front of the current position - this is OK because neighbourMap is being iterated in ascending order, and is padded)
-				simdpp::store_u(&neighbourMap[ny][nx][0]-(8-6), (simdpp::uint16x8)simdpp::make_zero());
-#elif defined(__x86_64__) || defined(__i386)
-				// In theory, decent compilers should turn this memset into a movq(int64) + movl(int32) on 64 bit, or 3*movl(int32) on 32 bit
-				std::memset(&neighbourMap[ny][nx][0], 0, sizeof(uint16_t)*6);
-#else
-				for (int i=0; i<6; i++)
-					neighbourMap[ny][nx][i] = 0;
-#endif
-				neighbourTotalMap[ny][nx] = 0;
-			}
-			if (ruleMap[ny][nx])
-			{
-				int r = sim->pmap(pos).find_one(sim->parts, PT_LIFE, lifeCat);
-				if (r>=0)
+				if (lifeCells.get(nx,ny))
 				{
-					if (ruleMap[ny][nx]==0xFF)
-					{
-						sim->part_kill(r, pos);
-						continue;
-					}
-					int ruleId = ruleMap[ny][nx]-1;
-					//subtract 1 from totalNeighbourCount in survive check because it counted itself
-					if (!rules[ruleId].survive(totalNeighbourCount-1) || sim->parts[r].tmp!=rules[ruleId].liveStates())
+					int r = sim->pmap(pos).find_one(sim->parts, PT_LIFE, lifeCat);
+					if (r>=0)
 					{
-						sim->parts[r].tmp --;
-						didSomething = true;
-					}
-					//we still need to kill things with 0 neighbors (higher state life)
-					if (sim->parts[r].tmp<=0)
-					{
-						sim->part_kill(r, pos);
-						didSomething = true;
-						continue;
+						if (ruleMap[ny][nx]==0xFF)
+						{
+							sim->part_kill(r, pos);
+							continue;
+						}
+						int ruleId = ruleMap[ny][nx]-1;
+						//subtract 1 from totalNeighbourCount in survive check because it counted itself
+						if (!rules[ruleId].survive(totalNeighbourCount-1) || sim->parts[r].tmp!=rules[ruleId].liveStates())
+						{
+							sim->parts[r].tmp --;
+							didSomething = true;
+						}
+						//we still need to kill things with 0 neighbors (higher state life)
+						if (sim->parts[r].tmp<=0)
+						{
+							sim->part_kill(r, pos);
+							didSomething = true;
+							continue;
+						}
+						sim->part_add_temp(parts[r], -50.0f);
 					}
-					sim->part_add_temp(parts[r], -50.0f);
 				}
 			}
 		}
-	}
+	});
 	if (didSomething)
 		generation++;
 }
 
 void LIFE_ElemDataSim::Simulation_Cleared()
 {
-	std::fill_n(&neighbourMap[0][0][0], YRES*XRES*6, 0);
-	std::fill_n(&neighbourTotalMap[0][0], YRES*XRES, 0);
+	lifeTiles.fill();
 	speedCounter = 0;
 	generation = 0;
 }
@@ -19,6 +19,7 @@
 #include "../ElemDataShared.h"
 #include "../ElemDataSim.h"
 #include "../Simulation.h"
+#include "LIFE_Bitboard.hpp"
 #include "LIFE_Rule.hpp"
 
 #include "common/Observer.h"
@@ -52,12 +53,23 @@ class LIFE_ElemDataSim : public ElemDataSim
 protected:
 	Observer_ClassMember<LIFE_ElemDataSim> obs_simCleared;
 	Observer_ClassMember<LIFE_ElemDataSim> obs_simBeforeUpdate;
+	// Rule ID +1 for positions where lifeCells is set, or 0xFF if the LIFE particle there has an invalid ctype
 	uint8_t ruleMap[YRES][XRES];
-	uint8_t neighbourTotalMap[YRES][XRES];
-	uint16_t neighbourMap[YRES][XRES][6];
+	// Tiles which contained LIFE particles in readLife(), and those tiles plus the tiles around them
+	LIFE_TileSet lifeTiles, activeTiles;
+	// Positions which contained a LIFE particle in readLife()
+	LIFE_Bitboard lifeCells;
+	// LIFE particles which are in their live state (tmp==liveStates), and the number of them in the 3x3 neighbourhood of each position
+	LIFE_Bitboard liveCells, liveCounts[4];
+	// Live cells for each rule which has any, indexed by ruleSlots[ruleId]
+	std::vector<LIFE_Bitboard> ruleLiveCells;
+	std::vector<int> ruleSlots, usedRules;
+	// Temporary bitboards for updateLife()
+	LIFE_Bitboard dilated, covered, overlap, birthCandidates;
 	unsigned int speedCounter;
 	void readLife();
 	void updateLife();
+	int chooseBornRule(SimPosI pos, int totalNeighbourCount, std::vector<LIFE_Rule> &rules);
 public:
 	unsigned int speed;
 	unsigned int generation;
@@ -0,0 +1,143 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef simulation_elements_LIFE_Bitboard_H
+#define simulation_elements_LIFE_Bitboard_H
+
+#include "simulation/Config.hpp"
+#include "common/tpt-stdint.h"
+#include <algorithm>
+#include <cstring>
+
+class LIFE_TileSet;
+
+/* One bit for each position in the simulation area, in the same layout as the ParticleMap occupancy bits (bit x&63 of word x>>6 in row y).
+ * LIFE uses these to count the neighbours of 64 positions at once with bitwise adders.
+ * Neighbourhoods wrap around the edges of the main area. wrapEdges() copies the edges of the main area into the positions just outside it, so that the neighbourhood functions do not need to handle wrapping themselves.
+ */
+class LIFE_Bitboard
+{
+public:
+	static const int wordsPerRow = (XRES+63)/64;
+	uint64_t rows[YRES][wordsPerRow];
+
+	void clear()
+	{
+		std::memset(rows, 0, sizeof(rows));
+	}
+	// Clears only the positions in the given tiles
+	void clear(const LIFE_TileSet &tiles);
+	bool get(int x, int y) const
+	{
+		return (rows[y][x>>6] >> (x&63)) & 1;
+	}
+	void set(int x, int y)
+	{
+		rows[y][x>>6] |= uint64_t(1) << (x&63);
+	}
+	void set(int x, int y, bool value)
+	{
+		const uint64_t bit = uint64_t(1) << (x&63);
+		rows[y][x>>6] = value ? (rows[y][x>>6]|bit) : (rows[y][x>>6]&~bit);
+	}
+	// Bits of word w which are inside the main area (CELL <= x < XRES-CELL)
+	static uint64_t mainAreaMask(int w)
+	{
+		const int first = w*64, last = first+63;
+		uint64_t mask = ~uint64_t(0);
+		if (first<CELL)
+			mask &= ~uint64_t(0) << (CELL-first);
+		if (last>=XRES-CELL)
+			mask &= (XRES-CELL-first<=0) ? 0 : (~uint64_t(0) >> (64-(XRES-CELL-first)));
+		return mask;
+	}
+
+	void wrapEdges();
+	// Sets counts to the number of set bits in the 3x3 neighbourhood of each position in the main area (including the position itself), as bit planes: count = counts[0] + 2*counts[1] + 4*counts[2] + 8*counts[3]
+	// Only positions in the given tiles are written. Positions outside the main area are 0.
+	void neighbourCounts(LIFE_Bitboard counts[4], const LIFE_TileSet &tiles) const;
+	// Sets each position in the main area of dest if any position in its 3x3 neighbourhood is set in this bitboard. Only positions in the given tiles are written.
+	void dilate(LIFE_Bitboard &dest, const LIFE_TileSet &tiles) const;
+	// Returns the bits of word w in row y where the count in the bit planes is one of the numbers in countBits (bit n set means count n)
+	static uint64_t countMatches(const LIFE_Bitboard counts[4], int y, int w, uint16_t countBits);
+};
+
+/* A set of 32x32 tiles, used by LIFE to only look at the parts of the simulation which contain LIFE particles.
+ * Stored as a mask of the positions covered by the tiles for each bitboard word in a row of tiles, so that bitboard words can be masked directly.
+ */
+class LIFE_TileSet
+{
+public:
+	static const int tileSize = 32;
+	static const int tilesX = (XRES+tileSize-1)/tileSize;
+	static const int tilesY = (YRES+tileSize-1)/tileSize;
+	uint64_t wordMasks[tilesY][LIFE_Bitboard::wordsPerRow];
+
+	void clear()
+	{
+		std::memset(wordMasks, 0, sizeof(wordMasks));
+	}
+	void fill()
+	{
+		std::memset(wordMasks, 0xFF, sizeof(wordMasks));
+	}
+	// Adds the tile containing position (x,y)
+	void add(int x, int y)
+	{
+		wordMasks[y/tileSize][x>>6] |= tileMask(x/tileSize);
+	}
+	bool contains(int tx, int ty) const
+	{
+		return (wordMasks[ty][(tx*tileSize)>>6] & tileMask(tx))!=0;
+	}
+	// Mask of positions in the tiles for word w of row y
+	uint64_t mask(int y, int w) const
+	{
+		return wordMasks[y/tileSize][w];
+	}
+	bool rowEmpty(int ty) const
+	{
+		for (int w=0; w<LIFE_Bitboard::wordsPerRow; w++)
+			if (wordMasks[ty][w])
+				return false;
+		return true;
+	}
+	// Calls f(y) for each row y in [yBegin,yEnd) which has any tiles in it, in ascending order
+	template<class Function>
+	void forEachRow(int yBegin, int yEnd, Function &&f) const
+	{
+		for (int ty=yBegin/tileSize; ty<tilesY && ty*tileSize<yEnd; ty++)
+		{
+			if (rowEmpty(ty))
+				continue;
+			const int rowEnd = std::min((ty+1)*tileSize, yEnd);
+			for (int y=std::max(ty*tileSize, yBegin); y<rowEnd; y++)
+				f(y);
+		}
+	}
+	// Sets this to the tiles in src plus the tiles next to them, where "next to" wraps around the edges of the main area in the same way as LIFE neighbourhoods.
+	// The result contains every tile which has a position within 1 pixel of a position in the main area of src.
+	void dilateWrapped(const LIFE_TileSet &src);
+
+protected:
+	static uint64_t tileMask(int tx)
+	{
+		// Each 64 bit word covers two tiles
+		static_assert(tileSize==32, "tileMask assumes two tiles per bitboard word");
+		return (tx&1) ? 0xFFFFFFFF00000000ULL : 0x00000000FFFFFFFFULL;
+	}
+};
+
+#endif
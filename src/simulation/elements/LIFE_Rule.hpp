@@ -47,6 +47,11 @@ public:
 	{
 		return ruleS & (1<<neighbours);
 	}
+	// Bit n is set if the rule has n in its "born" list
+	uint16_t bornBits()
+	{
+		return ruleB;
+	}
 	std::string getRuleString();
 	LIFE_Rule(std::string b, std::string s, int states_=2);
 	LIFE_Rule(std::string ruleString);
@@ -28,7 +28,7 @@ int LIGH_nearest_part(Simulation *sim, int ci, int max_d)
 	int i = 0;
 	int cx = (int)parts[ci].x;
 	int cy = (int)parts[ci].y;
-	for (i=0; i<=sim->parts_lastActiveIndex; i++)
+	for (i=sim->parts_firstActive(); i>=0; i=sim->parts_nextActive(i))
 	{
 		if (parts[i].type && !parts[i].life && i!=ci && parts[i].type!=PT_LIGH && parts[i].type!=PT_THDR && parts[i].type!=PT_NEUT && parts[i].type!=PT_PHOT)
 		{
@@ -49,6 +49,7 @@ int NEUT_DeutExplosion(Simulation *sim, int n, int x, int y, float vx, float vy,
 		parts[i].vy = r*sinf(a);
 		sim->pmap_add(i, SimPosI(x, y), PT_NEUT);
 		sim->elementCount[PT_NEUT]++;
+		sim->partsByType.set(i, PT_NEUT);
 
 		sim->air.pv.add(SimPosI(x,y), 6.0f * CFDS);
 	}
@@ -14,6 +14,7 @@
  */
 
 #include "simulation/ElementsCommon.h"
+#include "simulation/elements/SOAP.h"
 
 const float SOAP_freezetemp = 248.15f;
 
@@ -55,6 +56,27 @@ void SOAP_detach(Simulation *sim, int i)
 	sim->parts[i].ctype = 0;
 }
 
+// tmp and tmp2 are the IDs of the attached SOAP particles (if ctype&2 and ctype&4 respectively)
+static void SOAP_renumberLink(int &link, int &ctype, int flag, const int *newIds)
+{
+	// tmp/tmp2 are not IDs if the link flag is not set, so leave them unchanged
+	if (!(ctype&flag) || link<0 || link>=NPART)
+		return;
+	if (newIds[link]>=0)
+		link = newIds[link];
+	else
+		ctype &= ~flag;
+}
+
+void SOAP_ElemDataSim::Simulation_PartsRenumbered(const int *newIds)
+{
+	for (int i : sim->partsByType.get(PT_SOAP))
+	{
+		SOAP_renumberLink(sim->parts[i].tmp, sim->parts[i].ctype, 2, newIds);
+		SOAP_renumberLink(sim->parts[i].tmp2, sim->parts[i].ctype, 4, newIds);
+	}
+}
+
 int SOAP_update(UPDATE_FUNC_ARGS) 
 {
 	int rx, ry, rt, nr, ng, nb, na;
@@ -334,5 +356,6 @@ void SOAP_init_element(ELEMENT_INIT_FUNC_ARGS)
 	elem->Update = &SOAP_update;
 	elem->Graphics = &SOAP_graphics;
 	elem->Func_ChangeType = &SOAP_ChangeType;
+	elem->Func_SimInit = &SimInit_createElemData<SOAP_ElemDataSim>;
 }
 
@@ -16,8 +16,16 @@
 #ifndef Simulation_Elements_SOAP_H
 #define Simulation_Elements_SOAP_H 
 
+#include "simulation/ElemDataSim.h"
 #include "simulation/Simulation.h"
 
+class SOAP_ElemDataSim : public ElemDataSim
+{
+public:
+	SOAP_ElemDataSim(Simulation *s, int t) : ElemDataSim(s, t) {}
+	void Simulation_PartsRenumbered(const int *newIds);
+};
+
 void SOAP_attach(Simulation *sim, int i1, int i2);
 void SOAP_detach(Simulation *sim, int i);
 
@@ -64,6 +64,16 @@ void Stickman_data::set_particle(particle * p)
 	if (part) set_legs_pos(part->x, part->y);
 }
 
+void Stickman_data::Simulation_PartsRenumbered(Simulation * sim, const int *newIds)
+{
+	// part may also point to a particle stored in portal data, which is not affected
+	if (part && part>=sim->parts && part<sim->parts+NPART)
+	{
+		int newId = newIds[part-sim->parts];
+		part = (newId>=0) ? &sim->parts[newId] : NULL;
+	}
+}
+
 void STKM_ElemDataSim::on_part_create(particle &p)
 {
 	player.set_particle(&p);
@@ -90,6 +100,11 @@ void STKM_ElemDataSim::on_part_kill(particle &p)
 	storageActionPending = false;
 }
 
+void STKM_ElemDataSim::Simulation_PartsRenumbered(const int *newIds)
+{
+	player.Simulation_PartsRenumbered(sim, newIds);
+}
+
 Stickman_data * Stickman_data::get(Simulation * sim, const particle &p)
 {
 	if (p.type==PT_STKM || p.type==PT_STKM2)
@@ -47,6 +47,7 @@ public:
 	void set_legs_pos(int x, int y);
 	void set_legs_pos(float x, float y) { set_legs_pos((int)(x+0.5f), (int)(y+0.5f)); }
 	void set_particle(particle * p);
+	void Simulation_PartsRenumbered(Simulation * sim, const int *newIds);
 	void commandOn(STKM_commands::command commOn) { comm |= commOn; }
 	void commandOff(STKM_commands::command commOff)
 	{
@@ -86,6 +87,7 @@ public:
 	}
 	void on_part_create(particle & p);
 	void on_part_kill(particle & p);
+	void Simulation_PartsRenumbered(const int *newIds);
 };
 
 void STKM_interact(Simulation *sim, Stickman_data* playerp, int i, int x, int y);
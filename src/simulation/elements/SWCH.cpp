@@ -57,7 +57,7 @@ int SWCH_update(UPDATE_FUNC_ARGS)
 				}
 			}
 	//turn SWCH on/off from two red BRAYS. There must be one either above or below, and one either left or right to work, and it can't come from the side, it must be a diagonal beam
-	if (!isRedBRAY(sim,x-1,y-1) && !isRedBRAY(sim,x+1,y-1) && (isRedBRAY(sim, x, y-1) || isRedBRAY(sim, x, y+1)) && (isRedBRAY(sim, x+1, y) || isRedBRAY(sim, x-1, y)))
+	if ((sim->elementCount[PT_BRAY] || !sim->skipIdleElectronicsChecks) && !isRedBRAY(sim,x-1,y-1) && !isRedBRAY(sim,x+1,y-1) && (isRedBRAY(sim, x, y-1) || isRedBRAY(sim, x, y+1)) && (isRedBRAY(sim, x+1, y) || isRedBRAY(sim, x-1, y)))
 	{
 		if (parts[i].life == 10)
 			parts[i].life = 9;
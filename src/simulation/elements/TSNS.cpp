@@ -41,16 +41,20 @@ int TSNS_update(UPDATE_FUNC_ARGS)
 					}
 				}
 	}
-	for (rx=-rd; rx<rd+1; rx++)
-		for (ry=-rd; ry<rd+1; ry++)
-			if (x+rx>=0 && y+ry>0 && x+rx<XRES && y+ry<YRES && (rx || ry))
+	// Stops at the first particle found which is hot enough. Row 0 and the sensor's own position are not included.
+	sim->pmap_forEachOccupied(SimPosI(x-rd, std::max(y-rd, 1)), SimPosI(x+rd, y+rd), PMapCategory::All, false, [&](SimPosI pos) {
+		if (pos.x==x && pos.y==y)
+			return false;
+		FOR_PMAP_POSITION(sim, pos.x, pos.y, rcount, ri, rnext)
+		{
+			if (parts[ri].type != PT_TSNS && parts[ri].type != PT_METL && parts[ri].temp >= parts[i].temp)
 			{
-				FOR_PMAP_POSITION(sim, x+rx, y+ry, rcount, ri, rnext)
-				{
-					if (parts[ri].type != PT_TSNS && parts[ri].type != PT_METL && parts[ri].temp >= parts[i].temp)
-						parts[i].life = 1;
-				}
+				parts[i].life = 1;
+				return true;
 			}
+		}
+		return false;
+	});
 	return 0;
 }
 
@@ -16,6 +16,103 @@
 #include "simulation/ElementsCommon.h"
 #include "WIRE.hpp"
 
+WIRE_ElemDataSim::WIRE_ElemDataSim(Simulation *s, int t) :
+	ElemDataSim(s,t),
+	obs_simCleared(sim->hook_cleared, this, &WIRE_ElemDataSim::invalidate),
+	obs_simAfterUpdate(sim->hook_afterUpdate, this, &WIRE_ElemDataSim::invalidate),
+	isValid(false)
+{
+	headCells.clear();
+	fastCells.clear();
+	sparkCells.clear();
+	wireTiles.clear();
+	// Neighbours which make WIRE_update look at the particles around it
+	sim->typeChanges.track(PT_WIRE);
+	sim->typeChanges.track(PT_SPRK);
+	sim->typeChanges.track(PT_NSCN);
+}
+
+void WIRE_ElemDataSim::invalidate()
+{
+	isValid = false;
+	sim->typeChanges.stop();
+}
+
+void WIRE_ElemDataSim::removeFast(SimPosI pos)
+{
+	for (int y=std::max(pos.y-1, 0); y<=std::min(pos.y+1, YRES-1); y++)
+		for (int x=std::max(pos.x-1, 0); x<=std::min(pos.x+1, XRES-1); x++)
+			fastCells.set(x, y, false);
+}
+
+void WIRE_ElemDataSim::beforeUpdate()
+{
+	// The bitboards are only written in wireTiles, so clearing the tiles used last time clears all of them
+	headCells.clear(wireTiles);
+	fastCells.clear(wireTiles);
+	sparkCells.clear(wireTiles);
+	wireTiles.clear();
+	isValid = false;
+	if (!sim->elementCount[PT_WIRE])
+	{
+		sim->typeChanges.stop();
+		return;
+	}
+
+	particle *parts = sim->parts;
+	// Positions around which WIRE particles need to look at their neighbours
+	std::vector<SimPosI> slowPositions;
+	for (int i : sim->partsByType.get(PT_WIRE))
+	{
+		if (parts[i].type!=PT_WIRE)
+			continue;
+		if (parts[i].tmp!=parts[i].ctype)
+			parts[i].tmp = parts[i].ctype;
+		SimPosI pos = SimPosF(parts[i].x, parts[i].y);
+		// Counting neighbours with bitboards only works for one WIRE particle per position
+		if (fastCells.get(pos.x, pos.y))
+			slowPositions.push_back(pos);
+		// Also check that WIRE_update will be given the same position as the pmap (which rounds differently)
+		SimPosI updatePos((int)(parts[i].x+0.5f), (int)(parts[i].y+0.5f));
+		if (updatePos.x!=pos.x || updatePos.y!=pos.y)
+		{
+			slowPositions.push_back(pos);
+			slowPositions.push_back(updatePos);
+		}
+		fastCells.set(pos.x, pos.y);
+		if (Element_WIRE::wasHead(parts[i]))
+			headCells.set(pos.x, pos.y);
+		wireTiles.add(pos.x, pos.y);
+	}
+	for (SimPosI pos : slowPositions)
+		removeFast(pos);
+	for (int t : {PT_SPRK, PT_NSCN})
+	{
+		for (int i : sim->partsByType.get(t))
+		{
+			if (parts[i].type==t)
+				removeFast(SimPosF(parts[i].x, parts[i].y));
+		}
+	}
+
+	headCells.neighbourCounts(headCounts, wireTiles);
+	wireTiles.forEachRow(CELL, YRES-CELL, [&](int y) {
+		for (int w=0; w<LIFE_Bitboard::wordsPerRow; w++)
+		{
+			if (fastCells.rows[y][w])
+				sparkCells.rows[y][w] = fastCells.rows[y][w] & LIFE_Bitboard::countMatches(headCounts, y, w, (1<<1)|(1<<2));
+		}
+	});
+
+	sim->typeChanges.start();
+	isValid = true;
+}
+
+bool WIRE_ElemDataSim::canUseBitboards(SimPosI pos) const
+{
+	return isValid && fastCells.get(pos.x, pos.y) && !sim->typeChanges.changedNear(pos);
+}
+
 int WIRE_update(UPDATE_FUNC_ARGS)
 {
 	int rx,ry,rt;
@@ -37,6 +134,15 @@ int WIRE_update(UPDATE_FUNC_ARGS)
 		}
 	}
 
+	// Nothing around this particle except WIRE and particles which do not affect it, so the number of neighbouring spark heads can be taken from the bitboards
+	WIRE_ElemDataSim *wireData = sim->elemData<WIRE_ElemDataSim>(PT_WIRE);
+	if (wireData->canUseBitboards(SimPosI(x,y)))
+	{
+		if (Element_WIRE::canSpark(parts[i]) && wireData->headCountSparks(SimPosI(x,y)))
+			Element_WIRE::setState(parts[i], Element_WIRE::State::HeadNormal);
+		return 0;
+	}
+
 	int count=0;
 	for(rx=-1; rx<2; rx++)
 		for(ry=-1; ry<2; ry++)
@@ -136,5 +242,6 @@ void WIRE_init_element(ELEMENT_INIT_FUNC_ARGS)
 
 	elem->Update = &WIRE_update;
 	elem->Graphics = &WIRE_graphics;
+	elem->Func_SimInit = &SimInit_createElemData<WIRE_ElemDataSim>;
 }
 
@@ -16,7 +16,11 @@
 #ifndef Simulation_Elements_WIRE_h
 #define Simulation_Elements_WIRE_h
 
+#include "simulation/ElemDataSim.h"
 #include "simulation/Particle.h"
+#include "simulation/Position.hpp"
+#include "simulation/elements/LIFE_Bitboard.hpp"
+#include "common/Observer.h"
 
 class Element_WIRE
 {
@@ -107,4 +111,39 @@ public:
 	}
 };
 
+/* Bitboards built once per frame by beforeUpdate(), so that most WIRE particles do not need to look at their neighbours in WIRE_update.
+ * The number of neighbouring WIRE particles which were spark heads in the previous frame is worked out for 64 positions at once using the LIFE bitboard adders.
+ * This is only used for WIRE particles which have no SPRK, NSCN, or stacked WIRE particles around them (the only neighbours which would need handling individually),
+ * and only while none of the WIRE, SPRK, or NSCN particles around them have changed since beforeUpdate() (checked using Simulation::typeChanges).
+ * Other WIRE particles go through their neighbours in the same way as before.
+ */
+class WIRE_ElemDataSim : public ElemDataSim
+{
+protected:
+	Observer_ClassMember<WIRE_ElemDataSim> obs_simCleared;
+	Observer_ClassMember<WIRE_ElemDataSim> obs_simAfterUpdate;
+	// Tiles which contained WIRE particles in beforeUpdate(), which are the only places where the bitboards can have bits set
+	LIFE_TileSet wireTiles;
+	// WIRE particles which were spark heads in the previous frame, and the number of them in the 3x3 neighbourhood of each position
+	LIFE_Bitboard headCells, headCounts[4];
+	// WIRE particles which can use the bitboards instead of looking at their neighbours
+	LIFE_Bitboard fastCells;
+	// WIRE particles in fastCells which have 1 or 2 neighbouring spark heads
+	LIFE_Bitboard sparkCells;
+	bool isValid;
+	// Removes the 3x3 area around pos from fastCells
+	void removeFast(SimPosI pos);
+public:
+	// Copies the current state of each WIRE particle to its previous state (ctype to tmp), then builds the bitboards. Called by Simulation::UpdateParticles.
+	void beforeUpdate();
+	void invalidate();
+	bool canUseBitboards(SimPosI pos) const;
+	// Whether the WIRE particle at pos has 1 or 2 neighbouring spark heads. Only valid if canUseBitboards(pos).
+	bool headCountSparks(SimPosI pos) const
+	{
+		return sparkCells.get(pos.x, pos.y);
+	}
+	WIRE_ElemDataSim(Simulation *s, int t);
+};
+
 #endif
@@ -0,0 +1,42 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation/gravity/GravitySimulator.hpp"
+#include "common/Threading.hpp"
+#include "gravity.h"
+#include <cstring>
+
+GravitySimulator_async::GravitySimulator_async() :
+	worker(WorkerThreads::getShared())
+{}
+
+GravitySimulator_async::~GravitySimulator_async()
+{
+	if (lastRun.valid())
+		lastRun.wait();
+}
+
+std::shared_future<bool> GravitySimulator_async::simulate()
+{
+	std::shared_future<bool> prevRun = lastRun;
+	lastRun = worker->asyncTask([prevRun]() {
+		if (prevRun.valid())
+			prevRun.wait();
+		update_grav();
+		memset(th_gravmap, 0, (XRES/CELL)*(YRES/CELL)*sizeof(float));
+		return th_gravchanged!=0;
+	});
+	return lastRun;
+}
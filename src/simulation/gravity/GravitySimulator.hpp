@@ -0,0 +1,39 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef Simulation_Gravity_GravitySimulator_h
+#define Simulation_Gravity_GravitySimulator_h
+
+#include <future>
+#include <memory>
+
+class WorkerThreads;
+
+// GravitySimulator_async: runs update_grav() (Newtonian gravity, see gravity.h) in the background on the shared WorkerThreads pool.
+// simulate() returns a shared_future which will be made valid when the run has finished. Its value is true if the gravity field changed, in which case th_gravx, th_gravy and th_gravp contain the new field.
+// While a run is in progress, it owns the th_* gravity maps, so they must not be accessed by other threads until the future is ready.
+// After each run, th_gravmap is cleared, ready to be swapped with the main thread's gravmap for the next frame.
+class GravitySimulator_async
+{
+protected:
+	std::shared_ptr<WorkerThreads> worker;
+	std::shared_future<bool> lastRun;
+public:
+	GravitySimulator_async();
+	virtual ~GravitySimulator_async();
+	std::shared_future<bool> simulate();
+};
+
+#endif
@@ -18,10 +18,11 @@
 #include "simulation/walls/SimWalls.hpp"
 #include "simulation/Simulation.h"
 #include <cmath>
+#include <cstring>
 #include <algorithm>
 #include <utility>
 
-SimWalls::SimWalls(Simulation *sim_) : sim(sim_)
+SimWalls::SimWalls(Simulation *sim_) : sim(sim_), sparkingCells(false)
 {
 	setManipData(data);
 	clear();
@@ -58,6 +59,8 @@ void SimWalls::clear_fanVelocity()
 void SimWalls::simBeforeUpdate()
 {
 	CellsData_subtract_sat(data.electricity, data.electricity, 1);
+	// Walls are set to 16 when sparked, so this does not change until the next frame
+	sparkingCells = (std::memchr(data.electricity, 12, (XRES/CELL)*(YRES/CELL))!=nullptr);
 	if (gravwl_timeout>0)
 		gravwl_timeout--;
 }
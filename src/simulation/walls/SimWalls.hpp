@@ -27,6 +27,7 @@ class SimWalls : public WallsManipulator
 protected:
 	WallsData data;
 	Simulation *sim;
+	bool sparkingCells;
 
 public:
 	SimWalls(Simulation *sim_);
@@ -38,6 +39,11 @@ public:
 	void clear_fanVelocity();
 	void clear();
 	void simBeforeUpdate();
+	// Whether any cells spark conductive particles in them this frame (electricity==12). Updated by simBeforeUpdate.
+	bool hasSparkingCells() const
+	{
+		return sparkingCells;
+	}
 
 };
 
@@ -0,0 +1,232 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common/Threading.hpp"
+#include "catch.hpp"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Gives tests access to the asyncTask slots
+class WorkerThreads_slotsTest : public WorkerThreads
+{
+public:
+	using WorkerThreads::WorkerThreads;
+	using WorkerThreads::TaskSlot;
+	size_t getSlotCount()
+	{
+		std::lock_guard<std::mutex> l(slotsMutex);
+		return slotCount;
+	}
+	// Waits until every slot has been released. Slots are released just after the task's future is ready, so this can be slightly later than get() returning.
+	void waitForSlots()
+	{
+		for (;;)
+		{
+			{
+				std::lock_guard<std::mutex> l(slotsMutex);
+				if (freeSlots.size()==slotCount)
+					return;
+			}
+			std::this_thread::yield();
+		}
+	}
+	// Puts a function in a new slot without running it. The slot goes on the free list when run.
+	template<class Function>
+	TaskSlot *createSlot(Function &&f)
+	{
+		{
+			std::lock_guard<std::mutex> l(slotsMutex);
+			slotCount++;
+		}
+		TaskSlot *slot = new TaskSlot(this);
+		slot->set(std::forward<Function>(f));
+		return slot;
+	}
+};
+
+TEST_CASE("WorkerThreads asyncTask", "[threading]")
+{
+	WorkerThreads workers(3);
+	std::vector<std::shared_future<int>> results;
+	for (int i=0; i<1000; i++)
+		results.push_back(workers.asyncTask([](int x) { return x*2; }, i));
+	for (int i=0; i<1000; i++)
+		REQUIRE( results[i].get() == i*2 );
+
+	// Tasks added by a task go on that worker's own deque, and may be stolen by the other workers
+	auto outer = workers.asyncTask([&workers]() {
+		std::vector<std::shared_future<int>> inner;
+		for (int i=0; i<100; i++)
+			inner.push_back(workers.asyncTask([](int x) { return x+1; }, i));
+		int sum = 0;
+		for (auto &f : inner)
+			sum += f.get();
+		return sum;
+	});
+	CHECK( outer.get() == 5050 );
+}
+
+TEST_CASE("WorkerThreads asyncTask slots", "[threading]")
+{
+	WorkerThreads_slotsTest workers(2);
+
+	// Slots are reused, so the number of slots only depends on how many tasks are waiting or running at once, not on the total number of tasks
+	const int n = 50;
+	std::vector<std::shared_future<int>> results;
+	for (int batch=0; batch<20; batch++)
+	{
+		results.clear();
+		for (int i=0; i<n; i++)
+			results.push_back(workers.asyncTask([batch](int x) { return x+batch; }, i));
+		for (int i=0; i<n; i++)
+			REQUIRE( results[i].get() == i+batch );
+		workers.waitForSlots();
+	}
+	CHECK( workers.getSlotCount() <= size_t(n) );
+
+	// Small functions are stored in the slot, and functions which are too large are allocated separately
+	int count = 0;
+	auto smallSlot = workers.createSlot([&count]() { count++; });
+	CHECK( smallSlot->isInline() );
+	smallSlot->run();
+	struct Large { char data[1024]; };
+	Large large = {};
+	large.data[100] = 3;
+	auto largeSlot = workers.createSlot([&count, large]() { count += large.data[100]; });
+	CHECK_FALSE( largeSlot->isInline() );
+	largeSlot->run();
+	CHECK( count == 4 );
+}
+
+TEST_CASE("WorkerThreads destructor runs tasks which were not started", "[threading]")
+{
+	std::atomic<int> count(0);
+	{
+		WorkerThreads workers(0);
+		for (int i=0; i<10; i++)
+			workers.asyncTask([&count]() { count++; });
+		CHECK( count == 0 );
+	}
+	CHECK( count == 10 );
+}
+
+TEST_CASE("WorkerThreads parallel_for", "[threading]")
+{
+	WorkerThreads workers(3);
+	const int n = 1000;
+	std::vector<std::atomic<int>> counts(n);
+
+	// Catch assertions are not thread safe, so chunks which are the wrong size are counted and checked afterwards
+	auto check = [&](int begin, int end, int grain, int maxThreads) {
+		for (auto &c : counts)
+			c = 0;
+		std::atomic<int> badChunks(0);
+		workers.parallel_for(begin, end, grain, [&](int rangeBegin, int rangeEnd) {
+			if (rangeBegin>=rangeEnd || rangeEnd-rangeBegin > std::max(grain, 1))
+				badChunks++;
+			for (int i=rangeBegin; i<rangeEnd; i++)
+				counts[i]++;
+		}, maxThreads);
+		REQUIRE( badChunks == 0 );
+		for (int i=0; i<n; i++)
+			REQUIRE( counts[i] == ((i>=begin && i<end) ? 1 : 0) );
+	};
+
+	SECTION("ranges and grain sizes")
+	{
+		check(0, n, 1, 0);
+		check(0, n, 7, 0);
+		check(13, 900, 64, 0);
+		check(5, 6, 10, 0);
+		check(10, 10, 4, 0);
+		check(0, n, 0, 0);
+		check(0, n, 16, 2);
+	}
+	SECTION("maxThreads=1 runs everything on the calling thread")
+	{
+		std::thread::id caller = std::this_thread::get_id();
+		std::atomic<bool> otherThread(false);
+		workers.parallel_for(0, n, 1, [&](int, int) {
+			if (std::this_thread::get_id()!=caller)
+				otherThread = true;
+		}, 1);
+		CHECK_FALSE( otherThread );
+	}
+	SECTION("nested")
+	{
+		for (auto &c : counts)
+			c = 0;
+		workers.parallel_for(0, 10, 1, [&](int outerBegin, int outerEnd) {
+			for (int j=outerBegin; j<outerEnd; j++)
+			{
+				workers.parallel_for(j*100, (j+1)*100, 3, [&](int rangeBegin, int rangeEnd) {
+					for (int i=rangeBegin; i<rangeEnd; i++)
+						counts[i]++;
+				});
+			}
+		});
+		for (int i=0; i<n; i++)
+			REQUIRE( counts[i] == 1 );
+	}
+	SECTION("from inside a task")
+	{
+		auto done = workers.asyncTask([&]() {
+			check(0, n, 5, 0);
+		});
+		done.get();
+	}
+}
+
+// Hidden test, run with: powdertests "[.benchmark]"
+TEST_CASE("WorkerThreads task spawn latency", "[threading][.benchmark]")
+{
+	typedef std::chrono::steady_clock clock;
+	auto shared = WorkerThreads::getShared();
+	WorkerThreads &workers = *shared;
+	const int iterations = 20000;
+
+	// Round trip of a single task, as used for the background air and gravity updates
+	auto start = clock::now();
+	for (int i=0; i<iterations; i++)
+		workers.asyncTask([]() {}).get();
+	double tRoundTrip = std::chrono::duration<double>(clock::now()-start).count();
+
+	// Many tasks in flight at once
+	std::vector<std::shared_future<void>> futures;
+	futures.reserve(iterations);
+	start = clock::now();
+	for (int i=0; i<iterations; i++)
+		futures.push_back(workers.asyncTask([]() {}));
+	for (auto &f : futures)
+		f.get();
+	double tBatch = std::chrono::duration<double>(clock::now()-start).count();
+
+	// parallel_for with trivial chunks, which measures the cost of handing out work to the other threads and waiting for it
+	std::atomic<int> sum(0);
+	start = clock::now();
+	for (int i=0; i<iterations; i++)
+	{
+		workers.parallel_for(0, 64, 1, [&sum](int begin, int end) {
+			sum.fetch_add(end-begin, std::memory_order_relaxed);
+		});
+	}
+	double tParallelFor = std::chrono::duration<double>(clock::now()-start).count();
+
+	WARN(workers.threadCount() << " workers: asyncTask round trip " << tRoundTrip/iterations*1e6 << "us, asyncTask batch " << tBatch/iterations*1e6 << "us per task, parallel_for(64 chunks) " << tParallelFor/iterations*1e6 << "us per call");
+	CHECK( sum == iterations*64 );
+}
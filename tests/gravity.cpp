@@ -0,0 +1,185 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "gravity.h"
+#include "simulation/gravity/GravitySimulator.hpp"
+#include "simulation/Config.hpp"
+#include "catch.hpp"
+#include <cmath>
+#include <cstring>
+#include <random>
+#include <vector>
+
+static const int gravCells = (XRES/CELL)*(YRES/CELL);
+
+static void gravityReset()
+{
+	if (!th_gravmap)
+		gravity_init();
+	grav_clear();
+	std::memset(th_gravmap, 0, gravCells*sizeof(float));
+	std::memset(th_gravx, 0, gravCells*sizeof(float));
+	std::memset(th_gravy, 0, gravCells*sizeof(float));
+	std::memset(th_gravp, 0, gravCells*sizeof(float));
+}
+
+// Checks th_gravx/y against the field calculated directly from each cell in a gravity map
+static void checkGravField(const std::vector<float> &mass)
+{
+	std::vector<double> gx(gravCells, 0.0), gy(gravCells, 0.0);
+	for (int c=0; c<gravCells; c++)
+	{
+		if (!mass[c])
+			continue;
+		int cx = c%(XRES/CELL), cy = c/(XRES/CELL);
+		for (int y=0; y<YRES/CELL; y++)
+		{
+			for (int x=0; x<XRES/CELL; x++)
+			{
+				if (x==cx && y==cy)
+					continue;
+				double d = std::sqrt(double((cx-x)*(cx-x) + (cy-y)*(cy-y)));
+				gx[y*(XRES/CELL)+x] += M_GRAV * mass[c] * (cx-x) / (d*d*d);
+				gy[y*(XRES/CELL)+x] += M_GRAV * mass[c] * (cy-y) / (d*d*d);
+			}
+		}
+	}
+	double maxErr = 0.0, maxVal = 0.0;
+	for (int i=0; i<gravCells; i++)
+	{
+		maxErr = std::max(maxErr, std::max(std::fabs(gx[i]-th_gravx[i]), std::fabs(gy[i]-th_gravy[i])));
+		maxVal = std::max(maxVal, std::max(std::fabs(gx[i]), std::fabs(gy[i])));
+	}
+	CHECK( maxErr <= maxVal*1e-4 );
+}
+
+TEST_CASE("update_grav", "[gravity]")
+{
+	gravityReset();
+	std::vector<float> mass(gravCells, 0.0f);
+	std::mt19937 gen(1234);
+	std::uniform_int_distribution<int> cellDist(0, gravCells-1);
+
+	SECTION("no changes")
+	{
+		update_grav();
+		for (int i=0; i<gravCells; i++)
+		{
+			REQUIRE( th_gravx[i] == 0.0f );
+			REQUIRE( th_gravy[i] == 0.0f );
+		}
+	}
+	SECTION("few changed cells")
+	{
+		for (int n=0; n<3; n++)
+		{
+			for (int k=0; k<5; k++)
+				mass[cellDist(gen)] = float(k+n+1);
+			std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+			update_grav();
+			checkGravField(mass);
+		}
+		// Removing all the mass should leave a (nearly) zero field
+		std::fill(mass.begin(), mass.end(), 0.0f);
+		std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+		update_grav();
+		for (int i=0; i<gravCells; i++)
+		{
+			REQUIRE( std::fabs(th_gravx[i]) < 1e-4f );
+			REQUIRE( std::fabs(th_gravy[i]) < 1e-4f );
+		}
+	}
+	SECTION("many changed cells")
+	{
+		for (int k=0; k<1000; k++)
+			mass[cellDist(gen)] = float(k%7)-3.0f;
+		std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+		update_grav();
+		checkGravField(mass);
+		mass[cellDist(gen)] = 10.0f;
+		std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+		update_grav();
+		checkGravField(mass);
+	}
+
+	gravityReset();
+}
+
+TEST_CASE("update_grav does not drift over many small changes", "[gravity]")
+{
+	// Large masses which are added and later removed leave rounding errors behind in an incrementally updated field, which are large compared to the field of the small masses left afterwards.
+	// The field should be recalculated from scratch often enough that these errors do not last.
+	gravityReset();
+	std::vector<float> mass(gravCells, 0.0f);
+	std::mt19937 gen(4321);
+	std::uniform_int_distribution<int> cellDist(0, gravCells-1);
+	std::uniform_int_distribution<int> countDist(1, 4);
+	std::uniform_real_distribution<float> heavyDist(-1000.0f, 1000.0f);
+	std::vector<int> heavyCells;
+	for (int frame=0; frame<5000; frame++)
+	{
+		int count = countDist(gen);
+		for (int k=0; k<count; k++)
+		{
+			if (heavyCells.size()>8 || (!heavyCells.empty() && k%2))
+			{
+				mass[heavyCells.back()] = 0.0f;
+				heavyCells.pop_back();
+			}
+			else
+			{
+				int c = cellDist(gen);
+				mass[c] = heavyDist(gen);
+				heavyCells.push_back(c);
+			}
+		}
+		std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+		update_grav();
+	}
+	for (int c : heavyCells)
+		mass[c] = 0.0f;
+
+	// Then a long run of single cell changes to small masses
+	const int lightCells[] = { 20*(XRES/CELL)+30, 60*(XRES/CELL)+120, 80*(XRES/CELL)+40 };
+	for (int frame=0; frame<10000; frame++)
+	{
+		mass[lightCells[frame%3]] = float(frame%5+1)*0.25f;
+		std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+		update_grav();
+	}
+	checkGravField(mass);
+	gravityReset();
+}
+
+TEST_CASE("GravitySimulator_async", "[gravity]")
+{
+	gravityReset();
+	std::vector<float> mass(gravCells, 0.0f);
+	mass[10*(XRES/CELL)+20] = 5.0f;
+	mass[50*(XRES/CELL)+100] = -2.0f;
+	std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+	{
+		GravitySimulator_async gravSim;
+		CHECK( gravSim.simulate().get() );
+		checkGravField(mass);
+		// Input map is cleared after each run, ready for reuse as the main thread's gravmap
+		for (int i=0; i<gravCells; i++)
+			REQUIRE( th_gravmap[i] == 0.0f );
+
+		std::memcpy(th_gravmap, mass.data(), gravCells*sizeof(float));
+		CHECK_FALSE( gravSim.simulate().get() );
+	}
+	gravityReset();
+}
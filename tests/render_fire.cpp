@@ -0,0 +1,150 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "graphics.h"
+#include "catch.hpp"
+#include <cstring>
+#include <random>
+#include <vector>
+
+// Original render_fire, which draws and then decays each cell in turn
+static void render_fire_reference(pixel *vid)
+{
+	int i,j,x,y,r,g,b;
+	for (j=0; j<YRES/CELL; j++)
+		for (i=0; i<XRES/CELL; i++)
+		{
+			r = fire_r[j][i];
+			g = fire_g[j][i];
+			b = fire_b[j][i];
+			if (r || g || b)
+			{
+				for (y=-CELL; y<2*CELL; y++)
+					for (x=-CELL; x<2*CELL; x++)
+						addpixel(vid, i*CELL+x, j*CELL+y, r, g, b, fire_alpha[y+CELL][x+CELL]);
+			}
+
+			r *= 8;
+			g *= 8;
+			b *= 8;
+			for (y=-1; y<2; y++)
+				for (x=-1; x<2; x++)
+					if ((x || y) && i+x>=0 && j+y>=0 && i+x<XRES/CELL && j+y<YRES/CELL)
+					{
+						r += fire_r[j+y][i+x];
+						g += fire_g[j+y][i+x];
+						b += fire_b[j+y][i+x];
+					}
+			r /= 16;
+			g /= 16;
+			b /= 16;
+			fire_r[j][i] = r>4 ? r-4 : 0;
+			fire_g[j][i] = g>4 ? g-4 : 0;
+			fire_b[j][i] = b>4 ? b-4 : 0;
+		}
+}
+
+class FireState
+{
+public:
+	std::vector<pixel> vid;
+	std::vector<unsigned char> r, g, b;
+	FireState() : vid((XRES+BARSIZE)*(YRES+MENUSIZE)), r(sizeof(fire_r)), g(sizeof(fire_g)), b(sizeof(fire_b)) {}
+	void save(const pixel *src)
+	{
+		std::memcpy(vid.data(), src, vid.size()*sizeof(pixel));
+		std::memcpy(r.data(), fire_r, r.size());
+		std::memcpy(g.data(), fire_g, g.size());
+		std::memcpy(b.data(), fire_b, b.size());
+	}
+	void restore(pixel *dest) const
+	{
+		std::memcpy(dest, vid.data(), vid.size()*sizeof(pixel));
+		std::memcpy(fire_r, r.data(), r.size());
+		std::memcpy(fire_g, g.data(), g.size());
+		std::memcpy(fire_b, b.data(), b.size());
+	}
+	bool operator==(const FireState &other) const
+	{
+		return (vid==other.vid && r==other.r && g==other.g && b==other.b);
+	}
+};
+
+TEST_CASE("render_fire matches the original version", "[graphics]")
+{
+	std::mt19937 gen(1234);
+	std::vector<pixel> vid((XRES+BARSIZE)*(YRES+MENUSIZE));
+	for (auto &p : vid)
+		p = gen();
+
+	auto fill = [&](int percent) {
+		std::uniform_int_distribution<int> percentDist(0, 99), valueDist(0, 255);
+		for (int j=0; j<YRES/CELL; j++)
+			for (int i=0; i<XRES/CELL; i++)
+			{
+				bool onFire = percentDist(gen)<percent;
+				fire_r[j][i] = onFire ? valueDist(gen) : 0;
+				fire_g[j][i] = onFire ? valueDist(gen) : 0;
+				fire_b[j][i] = onFire ? ((j+i)%7 ? valueDist(gen) : 255) : 0;
+			}
+		// Cells on the edges, so that the area drawn goes outside the screen
+		fire_r[0][0] = fire_g[0][XRES/CELL-1] = fire_b[YRES/CELL-1][0] = fire_r[YRES/CELL-1][XRES/CELL-1] = 255;
+	};
+
+	auto check = [&]() {
+		FireState start, expected;
+		start.save(vid.data());
+		// Several frames, so that the decay is checked as well as the drawing
+		for (int frame=0; frame<3; frame++)
+			render_fire_reference(vid.data());
+		expected.save(vid.data());
+
+		for (int impl=RENDER_FIRE_SCALAR; impl<RENDER_FIRE_IMPL_COUNT; impl++)
+		{
+			if (!render_fire_supported(impl))
+				continue;
+			INFO("implementation " << impl);
+			start.restore(vid.data());
+			render_fire_impl = impl;
+			for (int frame=0; frame<3; frame++)
+				render_fire(vid.data());
+			FireState result;
+			result.save(vid.data());
+			CHECK( result==expected );
+		}
+		render_fire_impl = RENDER_FIRE_AUTO;
+	};
+
+	SECTION("default fire alpha")
+	{
+		prepare_alpha(CELL, 1.0f);
+		fill(5);
+		check();
+		fill(60);
+		check();
+	}
+	SECTION("fire alpha values over 255")
+	{
+		prepare_alpha(CELL, 40.0f);
+		REQUIRE( fire_alpha[CELL+1][CELL+1] > 255 );
+		fill(20);
+		check();
+	}
+
+	prepare_alpha(CELL, 1.0f);
+	std::memset(fire_r, 0, sizeof(fire_r));
+	std::memset(fire_g, 0, sizeof(fire_g));
+	std::memset(fire_b, 0, sizeof(fire_b));
+}
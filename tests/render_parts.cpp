@@ -0,0 +1,106 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "graphics.h"
+#include "powdergraphics.h"
+#include "simulation/ElementNumbers.h"
+#include "simulation/elements/SOAP.h"
+#include "simulation/SimulationTestHelpers.hpp"
+#include "catch.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Particles with effects which reach outside their own pixel (glow, blur, flares, spark lines, soap lines, stickmen), spread over all the rows of the screen so that some are drawn across the boundaries between strips
+static void createRenderScene(Simulation *sim)
+{
+	const int elementList[] = { PT_PLSM, PT_FIRE, PT_BOMB, PT_DEST, PT_DEUT, PT_LIGH, PT_BRAY, PT_ACID, PT_LAVA, PT_EMBR, PT_PHOT, PT_NEUT, PT_SPRK, PT_WATR, PT_GBMB, PT_DMG, PT_EXOT, PT_WIRE, PT_SWCH, PT_ACEL, PT_DCEL, PT_BIZR, PT_VIRS, PT_FIRW, PT_STOR };
+	int column = 0;
+	for (int t : elementList)
+	{
+		int x = 20 + column*18;
+		for (int y=3; y<YRES-3; y+=5)
+		{
+			int i = sim->part_create(-1, SimPosI(x + (y/5)%3, y), t);
+			if (i>=0)
+			{
+				sim->parts[i].temp = 300.0f + (y*7)%3000;
+				sim->parts[i].life = y%20 + 1;
+				sim->parts[i].tmp = y%4;
+				sim->parts[i].vx = float(y%7)-3.0f;
+				sim->parts[i].vy = float(y%5)-2.0f;
+			}
+		}
+		column++;
+	}
+
+	// Pairs of linked SOAP, vertically and diagonally, so that the lines between them cross strip boundaries
+	const int soapX = 20 + column*18;
+	for (int y=4; y<YRES-20; y+=9)
+	{
+		int a = sim->part_create(-1, SimPosI(soapX, y), PT_SOAP);
+		int b = sim->part_create(-1, SimPosI(soapX + (y/9)%3*4, y+11), PT_SOAP);
+		if (a>=0 && b>=0)
+			SOAP_attach(sim, a, b);
+	}
+
+	// Stickmen away from the mouse position (so that their HP is not drawn), at heights near a variety of strip boundaries
+	sim->part_create(-1, SimPosI(500, 100), PT_STKM);
+	sim->part_create(-1, SimPosI(520, 200), PT_STKM2);
+	for (int y=30; y<YRES-20; y+=37)
+		sim->part_create(-1, SimPosI(550 + (y%3)*15, y), PT_FIGH);
+}
+
+static std::vector<pixel> renderWithThreads(int threads)
+{
+	std::vector<pixel> vid((XRES+BARSIZE)*(YRES+MENUSIZE), 0);
+	// Preparing particles for drawing uses random numbers and updates the fire arrays, so reset them before each run
+	std::memset(fire_r, 0, sizeof(fire_r));
+	std::memset(fire_g, 0, sizeof(fire_g));
+	std::memset(fire_b, 0, sizeof(fire_b));
+	srand(1);
+	globalSim->rngBase.seed(54321);
+	globalSim->rng.clearStore();
+	render_threads = threads;
+	render_parts(vid.data());
+	render_threads = 0;
+	return vid;
+}
+
+TEST_CASE("render_parts gives the same result when drawn in strips", "[graphics]")
+{
+	auto sim = createTestSimulation();
+	mousex = mousey = 0;
+	decorations_enable = 1;
+	display_mode = 0;
+	createRenderScene(sim.get());
+
+	const unsigned int renderModes[] = { RENDER_EFFE, RENDER_FIRE, RENDER_GLOW, RENDER_BLUR, RENDER_BLOB, RENDER_BASC, RENDER_NONE };
+	for (unsigned int mode : renderModes)
+	{
+		render_mode = mode;
+		std::vector<pixel> expected = renderWithThreads(1);
+		for (int threads : { 2, 3, 7 })
+		{
+			INFO("render mode " << mode << ", " << threads << " threads");
+			std::vector<pixel> result = renderWithThreads(threads);
+			int mismatches = 0;
+			for (size_t k=0; k<expected.size(); k++)
+				if (result[k]!=expected[k])
+					mismatches++;
+			CHECK(mismatches == 0);
+		}
+	}
+	render_mode = RENDER_BASC;
+}
@@ -0,0 +1,136 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "simulation/ParticleMap.hpp"
+#include <memory>
+#include <vector>
+
+static_assert(sizeof(ParticleMapEntry)==8, "ParticleMapEntry should be packed into 8 bytes");
+
+// IDs of the particles in a pmap list, in list order
+static std::vector<int> pmapList(const ParticleMapEntry &entry, const std::vector<particle> &parts, PMapCategory c)
+{
+	std::vector<int> ids;
+	int next = entry.first(c);
+	for (int n=entry.count(c); n>0; n--)
+	{
+		ids.push_back(next);
+		next = parts[next].pmap_next;
+	}
+	return ids;
+}
+
+TEST_CASE("ParticleMapEntry add and remove", "[simulation][pmap]")
+{
+	std::vector<particle> parts(10);
+	ParticleMapEntry entry;
+	CHECK( entry.count() == 0 );
+
+	entry.add(parts.data(), 1, PMapCategory::Plain);
+	CHECK( entry.count() == 1 );
+	CHECK( entry.first(PMapCategory::Plain) == 1 );
+	entry.add(parts.data(), 2, PMapCategory::Energy);
+	entry.add(parts.data(), 3, PMapCategory::Plain);
+	entry.add(parts.data(), 4, PMapCategory::Energy);
+	CHECK( entry.count(PMapCategory::Plain) == 2 );
+	CHECK( entry.count(PMapCategory::Energy) == 2 );
+	CHECK( entry.count() == 4 );
+	CHECK( pmapList(entry, parts, PMapCategory::All) == std::vector<int>({3, 1, 4, 2}) );
+	CHECK( pmapList(entry, parts, PMapCategory::Plain) == std::vector<int>({3, 1}) );
+	CHECK( pmapList(entry, parts, PMapCategory::Energy) == std::vector<int>({4, 2}) );
+
+	entry.remove(parts.data(), 1, PMapCategory::Plain);
+	entry.remove(parts.data(), 4, PMapCategory::Energy);
+	CHECK( pmapList(entry, parts, PMapCategory::All) == std::vector<int>({3, 2}) );
+	entry.remove(parts.data(), 2, PMapCategory::Energy);
+	CHECK( pmapList(entry, parts, PMapCategory::All) == std::vector<int>({3}) );
+	// With no energy particles, first(Energy) is the last plain particle
+	CHECK( entry.first(PMapCategory::Energy) == 3 );
+	entry.remove(parts.data(), 3, PMapCategory::Plain);
+	CHECK( entry.count() == 0 );
+}
+
+TEST_CASE("ParticleMapEntry stacking threshold", "[simulation][pmap]")
+{
+	std::vector<particle> parts(10);
+	ParticleMapEntry entry;
+	for (int i=0; i<ParticleMapEntry::stackingThreshold; i++)
+		CHECK_FALSE( entry.add(parts.data(), i, PMapCategory::Plain) );
+	CHECK( entry.add(parts.data(), ParticleMapEntry::stackingThreshold, PMapCategory::Plain) );
+	CHECK_FALSE( entry.add(parts.data(), ParticleMapEntry::stackingThreshold+1, PMapCategory::Plain) );
+}
+
+TEST_CASE("ParticleMapEntry count overflow", "[simulation][pmap]")
+{
+	// Counts which do not fit in the packed entry are stored separately
+	const int n = 20000;
+	std::vector<particle> parts(n+1);
+	ParticleMapEntry entry;
+	entry.add(parts.data(), n, PMapCategory::Plain);
+	for (int i=0; i<n; i++)
+		entry.add(parts.data(), i, PMapCategory::Energy);
+	CHECK( entry.count(PMapCategory::Energy) == n );
+	CHECK( entry.count(PMapCategory::Plain) == 1 );
+	CHECK( entry.count() == n+1 );
+	CHECK( (int)pmapList(entry, parts, PMapCategory::Energy).size() == n );
+	for (int i=0; i<n-10; i++)
+		entry.remove(parts.data(), i, PMapCategory::Energy);
+	CHECK( entry.count(PMapCategory::Energy) == 10 );
+	CHECK( pmapList(entry, parts, PMapCategory::All).front() == n );
+	entry.clear();
+	CHECK( entry.count() == 0 );
+}
+
+TEST_CASE("ParticleMap occupancy bits", "[simulation][pmap]")
+{
+	std::vector<particle> parts(10);
+	std::unique_ptr<ParticleMap> pmap(new ParticleMap());
+	const SimPosI plainPos(63, 10), energyPos(64, 10), bothPos(XRES-1, 10);
+	pmap->add(parts.data(), 1, plainPos, PMapCategory::Plain);
+	pmap->add(parts.data(), 2, energyPos, PMapCategory::Energy);
+	pmap->add(parts.data(), 3, bothPos, PMapCategory::Plain);
+	pmap->add(parts.data(), 4, bothPos, PMapCategory::Energy);
+	pmap->add(parts.data(), 5, energyPos, PMapCategory::Energy);
+
+	CHECK( pmap->occupied(plainPos, PMapCategory::Plain) );
+	CHECK_FALSE( pmap->occupied(plainPos, PMapCategory::Energy) );
+	CHECK( pmap->occupied(energyPos) );
+	CHECK_FALSE( pmap->occupied(energyPos, PMapCategory::Plain) );
+	CHECK( pmap->occupied(bothPos, PMapCategory::Plain) );
+	CHECK( pmap->occupied(bothPos, PMapCategory::Energy) );
+	CHECK_FALSE( pmap->occupied(SimPosI(62, 10)) );
+
+	// Spans which cross a word boundary
+	CHECK( pmap->occupiedSpan(PMapCategory::All, 60, 10, 8) == 0x18 );
+	CHECK( pmap->occupiedSpan(PMapCategory::Plain, 60, 10, 8) == 0x08 );
+	CHECK( pmap->occupiedSpan(PMapCategory::Energy, 1, 10, 64) == (uint64_t(1)<<63) );
+	CHECK( pmap->occupiedSpan(PMapCategory::All, 0, 10, 64) == (uint64_t(1)<<63) );
+	CHECK( pmap->occupiedSpan(PMapCategory::All, XRES-64, 10, 64) == (uint64_t(1)<<63) );
+	CHECK( pmap->occupiedSpan(PMapCategory::All, 60, 11, 8) == 0 );
+
+	// Bits are only cleared when the last particle of that category is removed
+	pmap->remove(parts.data(), 2, energyPos, PMapCategory::Energy);
+	CHECK( pmap->occupied(energyPos, PMapCategory::Energy) );
+	pmap->remove(parts.data(), 5, energyPos, PMapCategory::Energy);
+	CHECK_FALSE( pmap->occupied(energyPos) );
+	pmap->remove(parts.data(), 4, bothPos, PMapCategory::Energy);
+	CHECK( pmap->occupied(bothPos) );
+	CHECK_FALSE( pmap->occupied(bothPos, PMapCategory::Energy) );
+
+	pmap->clear();
+	CHECK( pmap->occupiedSpan(PMapCategory::All, 0, 10, 64) == 0 );
+	CHECK_FALSE( pmap->occupied(bothPos) );
+}
@@ -0,0 +1,78 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "catch.hpp"
+#include "simulation/ParticleTypeBuckets.hpp"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+static std::vector<int> sortedBucket(const ParticleTypeBuckets &b, int t, SimPosI pos)
+{
+	std::vector<int> ids = b.get(t, pos.x/ParticleTypeBuckets::bucketSize, pos.y/ParticleTypeBuckets::bucketSize);
+	std::sort(ids.begin(), ids.end());
+	return ids;
+}
+
+TEST_CASE("ParticleTypeBuckets add and remove", "[simulation]")
+{
+	std::unique_ptr<ParticleTypeBuckets> b(new ParticleTypeBuckets());
+	const int t = 1, untracked = 2;
+	const SimPosI pos1(20, 20), pos2(21, 30), pos3(XRES-1, YRES-1);
+	b->track(t);
+	CHECK( b->isTracked(t) );
+	CHECK_FALSE( b->isTracked(untracked) );
+
+	b->add(1, pos1, t);
+	b->add(2, pos2, t);
+	b->add(3, pos1, t);
+	b->add(4, pos3, t);
+	b->add(5, pos1, untracked);
+	CHECK( sortedBucket(*b, t, pos1) == std::vector<int>({1, 2, 3}) );
+	CHECK( sortedBucket(*b, t, pos3) == std::vector<int>({4}) );
+	CHECK( b->check(2, pos2, t) );
+	CHECK_FALSE( b->check(4, pos1, t) );
+	CHECK( b->check(5, pos1, untracked) );
+
+	b->remove(1, pos1, t);
+	CHECK( sortedBucket(*b, t, pos1) == std::vector<int>({2, 3}) );
+	CHECK( b->check(3, pos1, t) );
+	// Removing a particle which is not in the list (e.g. because its type was changed directly) does nothing
+	b->remove(4, pos1, t);
+	b->remove(1, pos1, t);
+	CHECK( sortedBucket(*b, t, pos1) == std::vector<int>({2, 3}) );
+	CHECK( b->check(4, pos3, t) );
+
+	b->clear();
+	CHECK( b->isTracked(t) );
+	CHECK( sortedBucket(*b, t, pos1).empty() );
+	CHECK( sortedBucket(*b, t, pos3).empty() );
+}
+
+TEST_CASE("ParticleTypeBuckets minDistance", "[simulation]")
+{
+	const int size = ParticleTypeBuckets::bucketSize;
+	for (int y=0; y<3*size; y+=3)
+		for (int x=0; x<3*size; x+=5)
+			for (int by=0; by<3; by++)
+				for (int bx=0; bx<3; bx++)
+				{
+					int expected = XRES+YRES;
+					for (int py=by*size; py<(by+1)*size; py++)
+						for (int px=bx*size; px<(bx+1)*size; px++)
+							expected = std::min(expected, (SimPosI(px, py)-SimPosI(x, y)).length_1());
+					REQUIRE( ParticleTypeBuckets::minDistance(SimPosI(x, y), bx, by) == expected );
+				}
+}
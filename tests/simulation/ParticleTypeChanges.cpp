@@ -0,0 +1,64 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "catch.hpp"
+#include "simulation/ParticleTypeChanges.hpp"
+#include <memory>
+
+TEST_CASE("ParticleTypeChanges", "[simulation]")
+{
+	std::unique_ptr<ParticleTypeChanges> c(new ParticleTypeChanges());
+	const int t = 1, untracked = 2;
+	c->track(t);
+	CHECK( c->isTracked(t) );
+	CHECK_FALSE( c->isTracked(untracked) );
+
+	// Changes are not recorded until start()
+	c->mark(SimPosI(20, 20), t);
+	c->start();
+	CHECK_FALSE( c->changedNear(SimPosI(20, 20)) );
+
+	c->mark(SimPosI(63, 20), t);
+	c->mark(SimPosI(100, 100), untracked);
+	for (int y=18; y<=22; y++)
+		for (int x=61; x<=65; x++)
+		{
+			INFO("x=" << x << " y=" << y);
+			CHECK( c->changedNear(SimPosI(x, y)) == (x>=62 && x<=64 && y>=19 && y<=21) );
+		}
+	CHECK_FALSE( c->changedNear(SimPosI(100, 100)) );
+
+	// Edges of the simulation
+	c->mark(SimPosI(0, 0), t);
+	c->mark(SimPosI(XRES-1, YRES-1), t);
+	CHECK( c->changedNear(SimPosI(1, 1)) );
+	CHECK( c->changedNear(SimPosI(XRES-2, YRES-2)) );
+
+	c->stop();
+	c->mark(SimPosI(200, 200), t);
+	CHECK_FALSE( c->changedNear(SimPosI(200, 200)) );
+	CHECK( c->changedNear(SimPosI(63, 20)) );
+
+	c->start();
+	CHECK_FALSE( c->changedNear(SimPosI(63, 20)) );
+	CHECK_FALSE( c->changedNear(SimPosI(1, 1)) );
+
+	// Neighbourhood starting at the last position in a word
+	c->mark(SimPosI(128, 40), t);
+	for (int x=125; x<=131; x++)
+	{
+		INFO("x=" << x);
+		CHECK( c->changedNear(SimPosI(x, 40)) == (x>=127 && x<=129) );
+	}
+}
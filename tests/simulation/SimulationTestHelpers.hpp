@@ -0,0 +1,55 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef tests_simulation_SimulationTestHelpers_h
+#define tests_simulation_SimulationTestHelpers_h
+
+#include "graphics.h"
+#include "gravity.h"
+#include "powder.h"
+#include "powdergraphics.h"
+#include "simulation/Simulation.h"
+#include "simulation/SimulationSharedData.h"
+#include <cstdlib>
+#include <memory>
+
+// Creates a Simulation for tests which need to run particle updates. The new simulation becomes globalSim.
+// The global state used by the simulation and renderer (gravity maps, graphics caches, etc) is initialised the first time this is called.
+inline std::shared_ptr<Simulation> createTestSimulation()
+{
+	static bool globalsInitialised = false;
+	static std::shared_ptr<SimulationSharedData> sharedData;
+	if (!globalsInitialised)
+	{
+		sharedData = std::make_shared<SimulationSharedData>();
+		gravity_init();
+		pers_bg = (pixel*)calloc((XRES+BARSIZE)*YRES, PIXELSIZE);
+		colour_mode = COLOUR_DEFAULT;
+		init_display_modes();
+		TRON_init_graphics();
+		prepare_alpha(CELL, 1.0f);
+		prepare_graphicscache();
+		flm_data = generate_gradient(flm_data_colours, flm_data_pos, flm_data_points, 200);
+		plasma_data = generate_gradient(plasma_data_colours, plasma_data_pos, plasma_data_points, 200);
+		globalsInitialised = true;
+	}
+	auto sim = std::make_shared<Simulation>(sharedData);
+	clear_sim();
+	sim->rngBase.seed(12345);
+	sim->rng.clearStore();
+	sys_pause = framerender = 0;
+	return sim;
+}
+
+#endif
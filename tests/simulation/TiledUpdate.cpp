@@ -0,0 +1,148 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "simulation/Simulation.h"
+#include "simulation/ElementNumbers.h"
+#include "SimulationTestHelpers.hpp"
+#include "catch.hpp"
+#include <vector>
+
+// Powders and liquids falling onto a floor, across many tiles. None of these elements create or kill particles at normal temperatures, so the same particle IDs should be present after any number of frames.
+static std::shared_ptr<Simulation> createFallingScene()
+{
+	auto sim = createTestSimulation();
+	for (int y=60; y<160; y+=2)
+		for (int x=50; x<550; x+=2)
+			sim->part_create(-1, SimPosI(x, y), ((x/30+y/30)%2) ? PT_SAND : PT_DUST);
+	for (int y=170; y<250; y++)
+		for (int x=50; x<550; x+=2)
+			sim->part_create(-1, SimPosI(x+(y%2), y), (x<300) ? PT_WATR : PT_OIL);
+	for (int x=20; x<XRES-20; x++)
+	{
+		sim->part_create(-1, SimPosI(x, 340), PT_METL);
+		sim->part_create(-1, SimPosI(x, 341), PT_GLAS);
+	}
+	return sim;
+}
+
+static std::vector<int> activeIds(Simulation *sim)
+{
+	std::vector<int> ids;
+	for (int i=sim->parts_firstActive(); i>=0; i=sim->parts_nextActive(i))
+		if (sim->parts[i].type)
+			ids.push_back(i);
+	return ids;
+}
+
+// Each particle must be in the pmap list for its position exactly once, and no other particle may be in any pmap list
+static void checkPmapIds(Simulation *sim)
+{
+	std::vector<int> seen(NPART, 0);
+	for (int y=0; y<YRES; y++)
+		for (int x=0; x<XRES; x++)
+		{
+			if (!sim->pmap[y][x].count())
+				continue;
+			for (int i=sim->pmap[y][x].first(); i>=0; i=sim->parts[i].pmap_next)
+				seen[i]++;
+		}
+	int missing = 0, duplicated = 0, extra = 0;
+	for (int i=0; i<NPART; i++)
+	{
+		if (sim->parts[i].type)
+		{
+			if (!seen[i])
+				missing++;
+			else if (seen[i]>1)
+				duplicated++;
+		}
+		else if (seen[i])
+			extra++;
+	}
+	CHECK(missing == 0);
+	CHECK(duplicated == 0);
+	CHECK(extra == 0);
+}
+
+TEST_CASE("Tiled particle update keeps particles consistent", "[simulation][tiled]")
+{
+	std::vector<int> serialIds, tiledIds;
+	int serialCount, tiledCount;
+	{
+		auto sim = createFallingScene();
+		const std::vector<int> startIds = activeIds(sim.get());
+		for (int frame=0; frame<20; frame++)
+			sim->UpdateParticles();
+		REQUIRE(sim->Check());
+		checkPmapIds(sim.get());
+		serialIds = activeIds(sim.get());
+		serialCount = sim->parts_count;
+		CHECK(serialIds == startIds);
+	}
+	{
+		auto sim = createFallingScene();
+		const std::vector<int> startIds = activeIds(sim.get());
+		sim->option_tiledUpdateThreads(4);
+		for (int frame=0; frame<20; frame++)
+			sim->UpdateParticles();
+		REQUIRE(sim->Check());
+		checkPmapIds(sim.get());
+		tiledIds = activeIds(sim.get());
+		tiledCount = sim->parts_count;
+		CHECK(tiledIds == startIds);
+	}
+	CHECK(tiledCount == serialCount);
+	CHECK((int)tiledIds.size() == tiledCount);
+	CHECK(tiledIds == serialIds);
+}
+
+static void runTiledFrames(Simulation *sim, int threadCount, int frames)
+{
+	sim->option_tiledUpdateThreads(threadCount);
+	for (int frame=0; frame<frames; frame++)
+		sim->UpdateParticles();
+}
+
+TEST_CASE("Tiled particle update gives the same results for any number of threads", "[simulation][tiled]")
+{
+	// Varied temperatures, so that heat conduction uses random numbers as well as movement
+	auto simA = createFallingScene();
+	for (int i=simA->parts_firstActive(); i>=0; i=simA->parts_nextActive(i))
+		simA->parts[i].temp = 273.15f + (i*37)%200;
+	runTiledFrames(simA.get(), 1, 20);
+
+	auto simB = createFallingScene();
+	for (int i=simB->parts_firstActive(); i>=0; i=simB->parts_nextActive(i))
+		simB->parts[i].temp = 273.15f + (i*37)%200;
+	runTiledFrames(simB.get(), 4, 20);
+
+	int mismatches = 0;
+	for (int i=0; i<NPART; i++)
+	{
+		const particle &a = simA->parts[i], &b = simB->parts[i];
+		if (a.type!=b.type || a.x!=b.x || a.y!=b.y || a.vx!=b.vx || a.vy!=b.vy || a.temp!=b.temp || a.life!=b.life || a.ctype!=b.ctype || a.tmp!=b.tmp || a.tmp2!=b.tmp2)
+		{
+			if (mismatches<5)
+			{
+				INFO("particle " << i);
+				CHECK(a.type == b.type);
+				CHECK(a.x == b.x);
+				CHECK(a.y == b.y);
+				CHECK(a.temp == b.temp);
+			}
+			mismatches++;
+		}
+	}
+	CHECK(mismatches == 0);
+}
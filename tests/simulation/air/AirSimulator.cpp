@@ -0,0 +1,112 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation/air/AirSimulator.hpp"
+#include "simulation/air/AirSimulator_v1.hpp"
+#include "simulation/walls/WallsData.hpp"
+#include "simulation/WallNumbers.hpp"
+#include "catch.hpp"
+#include <cstring>
+#include <random>
+
+static void fillRandom(CellsFloatP data, std::mt19937 &gen, float range)
+{
+	std::uniform_real_distribution<float> dist(-range, range);
+	for (int y=0; y<YRES/CELL; y++)
+		for (int x=0; x<XRES/CELL; x++)
+			data[y][x] = dist(gen);
+}
+
+static bool cellsEqual(const_CellsFloatP a, const_CellsFloatP b)
+{
+	return !memcmp(a, b, sizeof(float)*(XRES/CELL)*(YRES/CELL));
+}
+
+static void checkSameAsV1(AirSimulator_sync &testSim, float wallFraction)
+{
+	std::mt19937 gen(1234);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	AirData input;
+	fillRandom(input.vx, gen, 20.0f);
+	fillRandom(input.vy, gen, 20.0f);
+	fillRandom(input.pv, gen, 100.0f);
+	fillRandom(input.hv, gen, 500.0f);
+	for (int y=0; y<YRES/CELL; y++)
+		for (int x=0; x<XRES/CELL; x++)
+			input.hv[y][x] += 1000.0f;
+
+	WallsData walls;
+	CellsUChar blockair, blockairh;
+	fillRandom(walls.fanVX, gen, 1.0f);
+	fillRandom(walls.fanVY, gen, 1.0f);
+	for (int y=0; y<YRES/CELL; y++)
+		for (int x=0; x<XRES/CELL; x++)
+		{
+			bool isWall = dist(gen)<wallFraction;
+			walls.wallType[y][x] = isWall ? WL_WALL : ((dist(gen)<0.05f) ? WL_FAN : 0);
+			walls.electricity[y][x] = 0;
+			blockair[y][x] = isWall ? 1 : 0;
+			blockairh[y][x] = isWall ? 0x8 : 0;
+		}
+
+	auto v1 = AirSimulator_sync::create(1);
+	AirData expected, result;
+	AirSimulator_params_roInput params;
+	params.airMode = 0;
+	params.gravityMode = 0;
+	params.ambientTemp = 295.15f;
+	params.wallsData = walls;
+	params.blockair = blockair;
+	params.blockairh = blockairh;
+	params.prevData = input;
+	params.inputData = input;
+
+	for (int heat=0; heat<2; heat++)
+	{
+		params.ambientHeatEnabled = heat;
+		params.outputData = expected;
+		v1->simulate(params);
+		params.outputData = result;
+		testSim.simulate(params);
+
+		INFO("ambient heat " << heat);
+		CHECK( cellsEqual(expected.vx, result.vx) );
+		CHECK( cellsEqual(expected.vy, result.vy) );
+		CHECK( cellsEqual(expected.pv, result.pv) );
+		CHECK( cellsEqual(expected.hv, result.hv) );
+	}
+}
+
+TEST_CASE("Multithreaded AirSimulator_v1 gives same results as single threaded", "[simulation][air]")
+{
+	SECTION("few walls (multi stage blur)")
+	{
+		AirSimulator_v1 sim2(2), sim3(3), sim7(7);
+		checkSameAsV1(sim2, 0.02f);
+		checkSameAsV1(sim3, 0.02f);
+		checkSameAsV1(sim7, 0.02f);
+	}
+	SECTION("mostly walls (single stage blur)")
+	{
+		AirSimulator_v1 sim3(3);
+		checkSameAsV1(sim3, 0.7f);
+	}
+	SECTION("created through AirSimulator_sync::create")
+	{
+		auto sim = AirSimulator_sync::create(1, 0);
+		checkSameAsV1(*sim, 0.02f);
+	}
+}
@@ -0,0 +1,176 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "simulation/air/AirSimulator_v1_kernels.hpp"
+#include "simulation/CellsData.hpp"
+#include "catch.hpp"
+#include <cfloat>
+#include <cmath>
+#include <random>
+
+// Checks that the multi-cell implementations of the AirSimulator_v1 kernels (4 cells at a time, or SIMD if libsimdpp is available) give the same results as the single cell implementation
+
+using namespace AirSimulator_v1_kernels;
+
+static void fillRandom(CellsFloatP data, std::mt19937 &gen, float range)
+{
+	std::uniform_real_distribution<float> dist(-range, range);
+	for (int y=0; y<YRES/CELL; y++)
+		for (int x=0; x<XRES/CELL; x++)
+			data[y][x] = dist(gen);
+}
+
+// Whether a result is close enough to the expected value.
+// The multi-cell implementations do the same operations as the single cell implementation, but when the compiler is allowed to (e.g. -ffast-math) it may contract or reorder them differently in each one.
+// The difference allowed is a few float epsilons relative to the magnitude of the input data, since results near zero can come from cancellation between much larger values.
+static bool floatsClose(float expected, float result, float inputMagnitude)
+{
+	return std::fabs(expected-result) <= 8*FLT_EPSILON*inputMagnitude;
+}
+
+static void checkCellsClose(const_CellsFloatP expected, const_CellsFloatP result, float inputMagnitude, int xStart, int xEnd, int yStart, int yEnd)
+{
+	int mismatches = 0;
+	for (int y=yStart; y<yEnd; y++)
+		for (int x=xStart; x<xEnd; x++)
+		{
+			if (!floatsClose(expected[y][x], result[y][x], inputMagnitude))
+			{
+				// only report the first few mismatches
+				if (mismatches<5)
+				{
+					INFO("x=" << x << " y=" << y);
+					CHECK(result[y][x] == expected[y][x]);
+				}
+				mismatches++;
+			}
+		}
+	CHECK(mismatches == 0);
+}
+
+// Runs the kernel for each row, with either the single cell implementation or for_each_i (which picks the best multi-cell implementation)
+template<class Kernel>
+static void runRows(const Kernel &kernel, bool single, int xStart, int xEnd, int yStart, int yEnd)
+{
+	for (int y=yStart; y<yEnd; y++)
+	{
+		size_t start = y*(XRES/CELL)+xStart, end = y*(XRES/CELL)+xEnd;
+		if (single)
+			tptalgo::detail::for_each_i::single(kernel, start, end);
+		else
+			tptalgo::for_each_i(kernel, start, end);
+	}
+}
+
+TEST_CASE("AirSimulator_v1 kernels", "[air]")
+{
+	std::mt19937 gen(5678);
+	std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+	CellsFloat src_vx, src_vy, src_pv, src_hv;
+	const float velocityRange = 20.0f, pressureRange = 100.0f, heatRange = 500.0f;
+	fillRandom(src_vx, gen, velocityRange);
+	fillRandom(src_vy, gen, velocityRange);
+	fillRandom(src_pv, gen, pressureRange);
+	fillRandom(src_hv, gen, heatRange);
+
+	CellsUChar blockair, blockairh;
+	CellsFloat notBlocked, notBlockedH;
+	for (int y=0; y<YRES/CELL; y++)
+		for (int x=0; x<XRES/CELL; x++)
+		{
+			blockair[y][x] = (dist(gen)<0.3f) ? 1 : 0;
+			blockairh[y][x] = (blockair[y][x] || dist(gen)<0.1f) ? 0x8 : 0;
+			notBlocked[y][x] = blockair[y][x] ? 0.0f : 1.0f;
+			notBlockedH[y][x] = (blockairh[y][x]&0x8) ? 0.0f : 1.0f;
+		}
+
+	CellsFloat expected_vx, expected_vy, expected_pv, result_vx, result_vy, result_pv;
+	CellsData_fill<float>(expected_vx, 0.0f);
+	CellsData_fill<float>(expected_vy, 0.0f);
+	CellsData_fill<float>(expected_pv, 0.0f);
+	CellsData_fill<float>(result_vx, 0.0f);
+	CellsData_fill<float>(result_vy, 0.0f);
+	CellsData_fill<float>(result_pv, 0.0f);
+
+	SECTION("pressureFromVelocity")
+	{
+		Kernel_pressureFromVelocity kExpected(&src_pv[0][0], &src_vx[0][0], &src_vy[0][0], &expected_pv[0][0]);
+		Kernel_pressureFromVelocity kResult(&src_pv[0][0], &src_vx[0][0], &src_vy[0][0], &result_pv[0][0]);
+		runRows(kExpected, true, 1, XRES/CELL, 1, YRES/CELL);
+		runRows(kResult, false, 1, XRES/CELL, 1, YRES/CELL);
+		checkCellsClose(expected_pv, result_pv, pressureRange, 0, XRES/CELL, 0, YRES/CELL);
+		// spot check against the formula
+		CHECK(floatsClose(expected_pv[5][7], src_pv[5][7]*AIR_PLOSS + ((src_vx[5][6]-src_vx[5][7]) + (src_vy[4][7]-src_vy[5][7]))*AIR_TSTEPP, pressureRange));
+	}
+	SECTION("velocityFromPressure")
+	{
+		Kernel_velocityFromPressure kExpected(&src_pv[0][0], &src_vx[0][0], &src_vy[0][0], &expected_vx[0][0], &expected_vy[0][0]);
+		Kernel_velocityFromPressure kResult(&src_pv[0][0], &src_vx[0][0], &src_vy[0][0], &result_vx[0][0], &result_vy[0][0]);
+		runRows(kExpected, true, 0, XRES/CELL-1, 0, YRES/CELL-1);
+		runRows(kResult, false, 0, XRES/CELL-1, 0, YRES/CELL-1);
+		checkCellsClose(expected_vx, result_vx, pressureRange, 0, XRES/CELL, 0, YRES/CELL);
+		checkCellsClose(expected_vy, result_vy, pressureRange, 0, XRES/CELL, 0, YRES/CELL);
+		CHECK(floatsClose(expected_vx[5][7], src_vx[5][7]*AIR_VLOSS + (src_pv[5][7]-src_pv[5][8])*AIR_TSTEPV, pressureRange));
+		CHECK(floatsClose(expected_vy[5][7], src_vy[5][7]*AIR_VLOSS + (src_pv[5][7]-src_pv[6][7])*AIR_TSTEPV, pressureRange));
+	}
+
+	float weights[9];
+	float wsum = 0.0f;
+	for (int j=-1; j<2; j++)
+		for (int i=-1; i<2; i++)
+			wsum += weights[i+1+(j+1)*3] = expf(-2.0f*(i*i+j*j));
+	for (int i=0; i<9; i++)
+		weights[i] /= wsum;
+
+	SECTION("blur_vp")
+	{
+		Kernel_blur_vp kExpected(weights, &blockair[0][0], &notBlocked[0][0], &src_vx[0][0], &src_vy[0][0], &src_pv[0][0], &expected_vx[0][0], &expected_vy[0][0], &expected_pv[0][0]);
+		Kernel_blur_vp kResult(weights, &blockair[0][0], &notBlocked[0][0], &src_vx[0][0], &src_vy[0][0], &src_pv[0][0], &result_vx[0][0], &result_vy[0][0], &result_pv[0][0]);
+		runRows(kExpected, true, 1, XRES/CELL-1, 1, YRES/CELL-1);
+		runRows(kResult, false, 1, XRES/CELL-1, 1, YRES/CELL-1);
+		checkCellsClose(expected_vx, result_vx, velocityRange, 0, XRES/CELL, 0, YRES/CELL);
+		checkCellsClose(expected_vy, result_vy, velocityRange, 0, XRES/CELL, 0, YRES/CELL);
+		checkCellsClose(expected_pv, result_pv, pressureRange, 0, XRES/CELL, 0, YRES/CELL);
+	}
+	SECTION("blur_h")
+	{
+		Kernel_blur_h kExpected(weights, &blockairh[0][0], &notBlockedH[0][0], &src_hv[0][0], &expected_pv[0][0]);
+		Kernel_blur_h kResult(weights, &blockairh[0][0], &notBlockedH[0][0], &src_hv[0][0], &result_pv[0][0]);
+		runRows(kExpected, true, 1, XRES/CELL-1, 1, YRES/CELL-1);
+		runRows(kResult, false, 1, XRES/CELL-1, 1, YRES/CELL-1);
+		checkCellsClose(expected_pv, result_pv, heatRange, 0, XRES/CELL, 0, YRES/CELL);
+	}
+	SECTION("blur with no walls")
+	{
+		// Cells surrounded by walls keep their original value, cells with no walls nearby are a weighted average of all 9 cells
+		CellsData_fill<unsigned char>(blockairh, 0);
+		CellsData_fill<float>(notBlockedH, 1.0f);
+		blockairh[10][11] = blockairh[10][9] = blockairh[9][10] = blockairh[11][10] = 0x8;
+		blockairh[9][9] = blockairh[9][11] = blockairh[11][9] = blockairh[11][11] = 0x8;
+		notBlockedH[10][11] = notBlockedH[10][9] = notBlockedH[9][10] = notBlockedH[11][10] = 0.0f;
+		notBlockedH[9][9] = notBlockedH[9][11] = notBlockedH[11][9] = notBlockedH[11][11] = 0.0f;
+		Kernel_blur_h kResult(weights, &blockairh[0][0], &notBlockedH[0][0], &src_hv[0][0], &result_pv[0][0]);
+		runRows(kResult, false, 1, XRES/CELL-1, 1, YRES/CELL-1);
+		// Only the centre weight is used, and the rest of the total weight is made up by adding src_hv*(1-weight)
+		float centreWeight = weights[4];
+		CHECK(floatsClose(result_pv[10][10], src_hv[10][10]*centreWeight + src_hv[10][10]*(1.0f-centreWeight), heatRange));
+		float avg = 0.0f;
+		for (int j=-1; j<2; j++)
+			for (int i=-1; i<2; i++)
+				avg += src_hv[30+j][40+i]*weights[i+1+(j+1)*3];
+		CHECK(floatsClose(result_pv[30][40], avg, heatRange));
+	}
+}
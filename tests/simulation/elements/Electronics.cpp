@@ -0,0 +1,184 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "simulation/ElementNumbers.h"
+#include "simulation/WallNumbers.hpp"
+#include "../SimulationTestHelpers.hpp"
+#include "catch.hpp"
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+// State of the particles and walls after a frame
+struct CircuitState
+{
+	struct Part
+	{
+		int type, ctype, life, tmp, tmp2, flags;
+		float x, y, vx, vy, temp;
+		bool operator==(const Part &other) const
+		{
+			return type==other.type && ctype==other.ctype && life==other.life && tmp==other.tmp && tmp2==other.tmp2 && flags==other.flags &&
+				x==other.x && y==other.y && vx==other.vx && vy==other.vy && temp==other.temp;
+		}
+	};
+	std::vector<Part> parts;
+	std::vector<unsigned char> wallElectricity;
+	explicit CircuitState(Simulation *sim)
+	{
+		parts.reserve(NPART);
+		for (int i=0; i<NPART; i++)
+		{
+			const particle &p = sim->parts[i];
+			parts.push_back({ p.type, p.ctype, p.life, p.tmp, p.tmp2, p.flags, p.x, p.y, p.vx, p.vy, p.temp });
+		}
+		for (int y=0; y<YRES/CELL; y++)
+			for (int x=0; x<XRES/CELL; x++)
+				wallElectricity.push_back(sim->walls.electricity(SimPosCell(x, y)));
+	}
+};
+
+// Rows of wire made from random conductors, with some sparks, batteries and conductive or detector walls
+static void createCircuitRows(Simulation *sim, unsigned int seed)
+{
+	std::mt19937 gen(seed);
+	auto randInt = [&gen](int n) { return int(gen()%n); };
+	const int elems[] = { PT_METL, PT_METL, PT_METL, PT_METL, PT_METL, PT_PSCN, PT_NSCN, PT_INST, PT_SWCH, PT_INWR, PT_NTCT, PT_PTCT, PT_METL, PT_METL, PT_METL };
+	for (int y=CELL+2; y<YRES-CELL-2; y+=3)
+	{
+		int x = CELL+2;
+		while (x<XRES-CELL-2)
+		{
+			int len = 5+randInt(40);
+			int t = elems[randInt(15)];
+			for (int k=0; k<len && x<XRES-CELL-2; k++, x++)
+			{
+				int i = sim->part_create(-1, SimPosI(x, y), t);
+				if (i>=0 && t==PT_SWCH && randInt(2))
+					sim->parts[i].life = 10;
+			}
+		}
+		if (randInt(12)==0)
+			sim->part_create(-1, SimPosI(CELL+1, y), PT_BTRY);
+		if (randInt(4)==0)
+			sim->part_create(-1, SimPosI(CELL+2+randInt(200), y+1), PT_METL);
+	}
+	for (int k=0; k<60; k++)
+	{
+		int x = CELL+randInt(XRES-2*CELL), y = CELL+randInt(YRES-2*CELL);
+		sim->spark_particle(sim->pmap[y][x].count() ? sim->pmap[y][x].first() : -1, x, y);
+	}
+	for (int k=0; k<20; k++)
+		sim->walls.type(SimPosCell(1+randInt(XRES/CELL-2), 1+randInt(YRES/CELL-2)), randInt(2) ? WL_ALLOWALLELEC : WL_DETECT);
+}
+
+// METL wires which run through detector and conductive walls, so that sparks travel from the wires into the walls and back out into other wires
+static void createWallCircuit(Simulation *sim)
+{
+	for (int n=0; n<6; n++)
+	{
+		int y = CELL*4 + n*CELL*6 + CELL/2;
+		for (int x=CELL*2; x<XRES/2; x++)
+			sim->part_create(-1, SimPosI(x, y), PT_METL);
+		for (int x=XRES/2+CELL*4; x<XRES-CELL*2; x++)
+			sim->part_create(-1, SimPosI(x, y), (n%2) ? PT_PSCN : PT_METL);
+		for (int cx=XRES/2/CELL-1; cx<XRES/2/CELL+5; cx++)
+			sim->walls.type(SimPosCell(cx, y/CELL), (n%3) ? WL_DETECT : WL_WALLELEC);
+		sim->part_create(-1, SimPosI(CELL*2-1, y), PT_BTRY);
+		int i = sim->pmap_find_one(SimPosI(CELL*2+n*7, y), PT_METL);
+		REQUIRE(i>=0);
+		sim->spark_particle(i, CELL*2+n*7, y);
+	}
+	// Vertical wall wire joining some of the rows
+	for (int cy=4; cy<YRES/CELL-8; cy++)
+		sim->walls.type(SimPosCell(XRES/CELL-6, cy), WL_WALLELEC);
+}
+
+// SWCH blocks next to red BRAY, which turn the SWCH on or off depending on which sides the BRAY is on
+static void createBrayCircuit(Simulation *sim)
+{
+	std::mt19937 gen(7);
+	auto randInt = [&gen](int n) { return int(gen()%n); };
+	for (int y=CELL*3; y<YRES-CELL*3; y+=6)
+	{
+		for (int x=CELL*3; x<XRES-CELL*3; x+=8)
+		{
+			int i = sim->part_create(-1, SimPosI(x, y), PT_SWCH);
+			REQUIRE(i>=0);
+			sim->parts[i].life = randInt(2) ? 10 : 0;
+			sim->part_create(-1, SimPosI(x+1, y), PT_METL);
+			sim->part_create(-1, SimPosI(x+2, y), PT_SWCH);
+			const SimPosDI offsets[] = { SimPosDI(0,-1), SimPosDI(0,1), SimPosDI(-1,0), SimPosDI(-1,-1), SimPosDI(1,-1) };
+			for (const SimPosDI &d : offsets)
+			{
+				if (randInt(3))
+					continue;
+				int b = sim->part_create(-1, SimPosI(x, y)+d, PT_BRAY);
+				if (b>=0)
+				{
+					sim->parts[b].tmp = randInt(4) ? 2 : 0;
+					sim->parts[b].life = 5+randInt(40);
+				}
+			}
+			if (randInt(5)==0)
+				sim->spark_particle(sim->pmap_find_one(SimPosI(x+1, y), PT_METL), x+1, y);
+		}
+	}
+}
+
+TEST_CASE("Skipping idle electronics checks does not change circuit results", "[elements][electronics]")
+{
+	struct Scene
+	{
+		std::string name;
+		std::function<void(Simulation*)> create;
+	};
+	const std::vector<Scene> scenes = {
+		{ "circuit rows 1", [](Simulation *sim) { createCircuitRows(sim, 1); } },
+		{ "circuit rows 2", [](Simulation *sim) { createCircuitRows(sim, 2); } },
+		{ "circuit rows 3", [](Simulation *sim) { createCircuitRows(sim, 3); } },
+		{ "walls", createWallCircuit },
+		{ "BRAY and SWCH", createBrayCircuit },
+	};
+	auto runScene = [](const Scene &scene, bool skipIdleChecks) {
+		auto sim = createTestSimulation();
+		sim->skipIdleElectronicsChecks = skipIdleChecks;
+		scene.create(sim.get());
+		std::vector<CircuitState> frames;
+		for (int frame=0; frame<120; frame++)
+		{
+			sim->UpdateParticles();
+			frames.emplace_back(sim.get());
+		}
+		REQUIRE(sim->Check());
+		return frames;
+	};
+	for (const Scene &scene : scenes)
+	{
+		INFO(scene.name);
+		std::vector<CircuitState> expected = runScene(scene, false);
+		std::vector<CircuitState> result = runScene(scene, true);
+		for (size_t frame=0; frame<expected.size(); frame++)
+		{
+			INFO("frame " << frame);
+			int mismatches = 0;
+			for (int i=0; i<NPART; i++)
+				if (!(result[frame].parts[i]==expected[frame].parts[i]))
+					mismatches++;
+			REQUIRE(mismatches == 0);
+			REQUIRE(result[frame].wallElectricity == expected[frame].wallElectricity);
+		}
+	}
+}
@@ -13,8 +13,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "simulation/elements/LIFE.hpp"
+#include "simulation/elements/LIFE_Bitboard.hpp"
 #include "simulation/elements/LIFE_Rule.hpp"
+#include "../SimulationTestHelpers.hpp"
 #include "catch.hpp"
+#include <cstring>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
 
 static void checkSTAR(LIFE_Rule &rule)
 {
@@ -57,3 +65,301 @@ TEST_CASE("LIFE_rule", "[elements][PT_LIFE]")
 		checkSTAR(rule);
 	}
 }
+
+TEST_CASE("LIFE_Bitboard", "[elements][PT_LIFE]")
+{
+	std::unique_ptr<LIFE_Bitboard> board(new LIFE_Bitboard), dilated(new LIFE_Bitboard);
+	std::unique_ptr<LIFE_Bitboard[]> counts(new LIFE_Bitboard[4]);
+	LIFE_TileSet allTiles;
+	allTiles.fill();
+	std::mt19937 gen(42);
+	const int mainWidth = XRES-CELL*2, mainHeight = YRES-CELL*2;
+	auto wrap = [&](int x, int y) {
+		return board->get((x-CELL+mainWidth)%mainWidth+CELL, (y-CELL+mainHeight)%mainHeight+CELL);
+	};
+
+	for (int percent : {1, 20, 90})
+	{
+		INFO("percent " << percent);
+		board->clear();
+		for (int y=CELL; y<YRES-CELL; y++)
+			for (int x=CELL; x<XRES-CELL; x++)
+				if (int(gen()%100)<percent)
+					board->set(x, y);
+		board->set(CELL, CELL);
+		board->set(XRES-CELL-1, YRES-CELL-1);
+		board->wrapEdges();
+		board->neighbourCounts(counts.get(), allTiles);
+		board->dilate(*dilated, allTiles);
+
+		int wrongCounts = 0, wrongDilated = 0, wrongMatches = 0, wrongOutside = 0;
+		const uint16_t countBits = (1<<2) | (1<<3) | (1<<9);
+		for (int y=0; y<YRES; y++)
+		{
+			for (int x=0; x<XRES; x++)
+			{
+				int count = counts[0].get(x,y) | (counts[1].get(x,y)<<1) | (counts[2].get(x,y)<<2) | (counts[3].get(x,y)<<3);
+				bool match = (LIFE_Bitboard::countMatches(counts.get(), y, x>>6, countBits) >> (x&63)) & 1;
+				if (x<CELL || y<CELL || x>=XRES-CELL || y>=YRES-CELL)
+				{
+					if (count || dilated->get(x,y) || match)
+						wrongOutside++;
+					continue;
+				}
+				int expected = 0;
+				for (int dy=-1; dy<=1; dy++)
+					for (int dx=-1; dx<=1; dx++)
+						expected += wrap(x+dx, y+dy);
+				if (count!=expected)
+					wrongCounts++;
+				if (dilated->get(x,y)!=(expected>0))
+					wrongDilated++;
+				if (match!=bool(countBits & (1<<expected)))
+					wrongMatches++;
+			}
+		}
+		CHECK( wrongCounts==0 );
+		CHECK( wrongDilated==0 );
+		CHECK( wrongMatches==0 );
+		CHECK( wrongOutside==0 );
+	}
+}
+
+TEST_CASE("LIFE_TileSet", "[elements][PT_LIFE]")
+{
+	const int mainWidth = XRES-CELL*2, mainHeight = YRES-CELL*2;
+	std::unique_ptr<LIFE_Bitboard> board(new LIFE_Bitboard), dilated(new LIFE_Bitboard), partialDilated(new LIFE_Bitboard);
+	std::unique_ptr<LIFE_Bitboard[]> counts(new LIFE_Bitboard[4]), partialCounts(new LIFE_Bitboard[4]);
+	LIFE_TileSet allTiles, tiles, activeTiles;
+	allTiles.fill();
+
+	// Some positions in the middle of tiles, and some on the edges and corners of the main area so that the neighbouring tiles wrap around
+	std::vector<std::pair<int,int>> positions = {
+		{100, 100}, {CELL, CELL}, {XRES-CELL-1, YRES-CELL-1}, {CELL, YRES/2}, {XRES-CELL-1, 50}, {300, CELL}, {64, 63}
+	};
+	for (auto p : positions)
+	{
+		INFO("position " << p.first << "," << p.second);
+		board->clear();
+		board->set(p.first, p.second);
+		board->wrapEdges();
+		tiles.clear();
+		tiles.add(p.first, p.second);
+		activeTiles.dilateWrapped(tiles);
+
+		// Every neighbour of the position must be in activeTiles
+		int missing = 0;
+		for (int dy=-1; dy<=1; dy++)
+		{
+			for (int dx=-1; dx<=1; dx++)
+			{
+				int x = (p.first+dx-CELL+mainWidth)%mainWidth+CELL, y = (p.second+dy-CELL+mainHeight)%mainHeight+CELL;
+				if (!activeTiles.contains(x/LIFE_TileSet::tileSize, y/LIFE_TileSet::tileSize))
+					missing++;
+			}
+		}
+		CHECK( missing==0 );
+
+		// Restricting the bitboard functions to activeTiles gives the same results as doing the whole area
+		board->neighbourCounts(counts.get(), allTiles);
+		board->dilate(*dilated, allTiles);
+		for (int i=0; i<4; i++)
+			std::memset(partialCounts[i].rows, 0xFF, sizeof(partialCounts[i].rows));
+		std::memset(partialDilated->rows, 0xFF, sizeof(partialDilated->rows));
+		board->neighbourCounts(partialCounts.get(), activeTiles);
+		board->dilate(*partialDilated, activeTiles);
+		int wrong = 0;
+		for (int y=0; y<YRES; y++)
+		{
+			for (int x=0; x<XRES; x++)
+			{
+				if (!activeTiles.contains(x/LIFE_TileSet::tileSize, y/LIFE_TileSet::tileSize))
+					continue;
+				for (int i=0; i<4; i++)
+					if (counts[i].get(x,y)!=partialCounts[i].get(x,y))
+						wrong++;
+				if (dilated->get(x,y)!=partialDilated->get(x,y))
+					wrong++;
+			}
+		}
+		CHECK( wrong==0 );
+	}
+}
+
+// LIFE state of each position in the main simulation area, as rule ID and tmp (ruleId=-1 for no LIFE)
+class LIFE_Grid
+{
+public:
+	static const int width = XRES-CELL*2, height = YRES-CELL*2;
+	std::vector<int> ruleIds, states;
+	LIFE_Grid() : ruleIds(width*height, -1), states(width*height, 0) {}
+	int index(int x, int y) const { return (y-CELL)*width + (x-CELL); }
+	int wrappedIndex(int x, int y) const { return index((x-CELL+width)%width+CELL, (y-CELL+height)%height+CELL); }
+};
+
+static LIFE_Grid readGrid(Simulation *sim)
+{
+	LIFE_Grid grid;
+	for (int y=CELL; y<YRES-CELL; y++)
+	{
+		for (int x=CELL; x<XRES-CELL; x++)
+		{
+			int i = sim->pmap_find_one(SimPosI(x, y), PT_LIFE);
+			if (i>=0)
+			{
+				grid.ruleIds[grid.index(x,y)] = sim->parts[i].ctype;
+				grid.states[grid.index(x,y)] = sim->parts[i].tmp;
+			}
+		}
+	}
+	return grid;
+}
+
+// One generation of the original per-position LIFE update (a table of up to 6 neighbouring rule types for each position, filled in by scattering each live cell into its 3x3 neighbourhood), for a simulation containing only LIFE
+static void updateLife_reference(LIFE_Grid &grid, std::vector<LIFE_Rule> &rules)
+{
+	const int rulesSize = rules.size();
+	std::vector<int> ruleMap(grid.ruleIds.size(), 0), neighbourTotalMap(grid.ruleIds.size(), 0);
+	std::vector<uint16_t> neighbourMap(grid.ruleIds.size()*6, 0);
+	for (int y=CELL; y<YRES-CELL; y++)
+	{
+		for (int x=CELL; x<XRES-CELL; x++)
+		{
+			int ruleId = grid.ruleIds[grid.index(x,y)];
+			if (ruleId==-1)
+				continue;
+			if (ruleId<0 || ruleId>=rulesSize)
+			{
+				ruleMap[grid.index(x,y)] = 0xFF;
+				continue;
+			}
+			ruleMap[grid.index(x,y)] = ruleId+1;
+			if (grid.states[grid.index(x,y)]!=rules[ruleId].liveStates())
+				continue;
+			for (int dx=-1; dx<2; dx++)
+			{
+				for (int dy=-1; dy<2; dy++)
+				{
+					int n = grid.wrappedIndex(x+dx, y+dy);
+					neighbourTotalMap[n]++;
+					for (int k=0; k<6; k++)
+					{
+						uint16_t &entry = neighbourMap[n*6+k];
+						if (!entry)
+						{
+							entry = (ruleId<<4)+1;
+							break;
+						}
+						else if ((entry>>4)==ruleId)
+						{
+							entry++;
+							break;
+						}
+					}
+				}
+			}
+		}
+	}
+	for (int y=CELL; y<YRES-CELL; y++)
+	{
+		for (int x=CELL; x<XRES-CELL; x++)
+		{
+			const int n = grid.index(x,y);
+			const int total = neighbourTotalMap[n];
+			if (total && grid.ruleIds[n]==-1)
+			{
+				int threshold = (total+1)/2;
+				int createRuleId = 0xFF;
+				for (int k=0; k<6; k++)
+				{
+					uint16_t entry = neighbourMap[n*6+k];
+					if (!entry)
+						break;
+					int checkRuleId = entry>>4;
+					if (rules[checkRuleId].born(total) && (entry&0xF)>=threshold && checkRuleId<createRuleId)
+						createRuleId = checkRuleId;
+				}
+				if (createRuleId<0xFF)
+				{
+					grid.ruleIds[n] = createRuleId;
+					grid.states[n] = rules[createRuleId].liveStates();
+				}
+			}
+			if (ruleMap[n])
+			{
+				if (ruleMap[n]==0xFF)
+				{
+					grid.ruleIds[n] = -1;
+					grid.states[n] = 0;
+					continue;
+				}
+				int ruleId = ruleMap[n]-1;
+				if (!rules[ruleId].survive(total-1) || grid.states[n]!=rules[ruleId].liveStates())
+					grid.states[n]--;
+				if (grid.states[n]<=0)
+				{
+					grid.ruleIds[n] = -1;
+					grid.states[n] = 0;
+				}
+			}
+		}
+	}
+}
+
+TEST_CASE("LIFE update matches the per-position reference", "[elements][PT_LIFE]")
+{
+	// Mixtures of rules, including ones with more than 2 states, rules which can be born from 1 neighbour, and a rule which survives with 0 neighbours
+	const std::vector<std::vector<int>> ruleSets = {
+		{ 0 },// GOL
+		{ 0, 1 },// GOL, HLIF
+		{ 21, 22, 23 },// STAR, FROG, BRAN
+		{ 4, 5, 9, 18 },// DANI, AMOE, 34, MYST
+		{ 12, 16, 17, 19, 20 }// SEED, GNAR, REPL, LOTE, FRG2
+	};
+	std::mt19937 gen(2024);
+	int soup = 0;
+	for (auto &ruleSet : ruleSets)
+	{
+		for (int percent : { 8, 35 })
+		{
+			INFO("soup " << soup << ", " << percent << "%");
+			soup++;
+			auto sim = createTestSimulation();
+			std::vector<LIFE_Rule> &rules = sim->elemDataShared<LIFE_ElemDataShared>(PT_LIFE)->rules;
+			for (int y=CELL; y<YRES-CELL; y++)
+			{
+				for (int x=CELL; x<XRES-CELL; x++)
+				{
+					// Denser along the edges of the main area, to check that neighbourhoods wrap around
+					bool nearEdge = (x<CELL+3 || y<CELL+3 || x>=XRES-CELL-3 || y>=YRES-CELL-3);
+					if (int(gen()%100) >= (nearEdge ? 50 : percent))
+						continue;
+					int i = sim->part_create(-1, SimPosI(x, y), PT_LIFE);
+					REQUIRE(i>=0);
+					int ruleId = ruleSet[gen()%ruleSet.size()];
+					Element_LIFE::setType(sim.get(), sim->parts[i], ruleId);
+					// Some cells part way through dying
+					if (rules[ruleId].liveStates()>1 && gen()%4==0)
+						sim->parts[i].tmp = 1 + gen()%rules[ruleId].liveStates();
+					// A few cells with an invalid type, which should be removed
+					if (gen()%5000==0)
+						sim->parts[i].ctype = 200;
+				}
+			}
+
+			LIFE_Grid expected = readGrid(sim.get());
+			for (int generation=1; generation<=6; generation++)
+			{
+				INFO("generation " << generation);
+				updateLife_reference(expected, rules);
+				sim->UpdateParticles();
+				LIFE_Grid result = readGrid(sim.get());
+				int mismatches = 0;
+				for (size_t n=0; n<expected.ruleIds.size(); n++)
+					if (result.ruleIds[n]!=expected.ruleIds[n] || result.states[n]!=expected.states[n])
+						mismatches++;
+				REQUIRE(mismatches == 0);
+			}
+		}
+	}
+}
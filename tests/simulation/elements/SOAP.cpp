@@ -0,0 +1,58 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "simulation/elements/SOAP.h"
+#include "../SimulationTestHelpers.hpp"
+#include "catch.hpp"
+
+TEST_CASE("SOAP links after renumbering", "[elements][PT_SOAP]")
+{
+	auto sim = createTestSimulation();
+	particle *parts = sim->parts;
+
+	// Created in reverse spatial order, so that sorting changes the IDs
+	int a = sim->part_create(-1, SimPosI(300, 200), PT_SOAP);
+	int b = sim->part_create(-1, SimPosI(200, 200), PT_SOAP);
+	int unlinked = sim->part_create(-1, SimPosI(100, 200), PT_SOAP);
+	REQUIRE(a>=0);
+	REQUIRE(b>=0);
+	REQUIRE(unlinked>=0);
+	SOAP_attach(sim.get(), a, b);
+	// Values which look like particle IDs, but are not links because ctype&2 and ctype&4 are not set
+	parts[unlinked].ctype = 1;
+	parts[unlinked].tmp = a;
+	parts[unlinked].tmp2 = 0;
+	const int unlinkedTmp = parts[unlinked].tmp, unlinkedTmp2 = parts[unlinked].tmp2;
+
+	sim->parts_sortSpatially();
+
+	int newA = sim->pmap_find_one(SimPosI(300, 200), PT_SOAP);
+	int newB = sim->pmap_find_one(SimPosI(200, 200), PT_SOAP);
+	int newUnlinked = sim->pmap_find_one(SimPosI(100, 200), PT_SOAP);
+	REQUIRE(newA>=0);
+	REQUIRE(newB>=0);
+	REQUIRE(newUnlinked>=0);
+	CHECK(newA!=a);
+	CHECK(newUnlinked!=unlinked);
+
+	CHECK((parts[newA].ctype&2));
+	CHECK(parts[newA].tmp == newB);
+	CHECK((parts[newB].ctype&4));
+	CHECK(parts[newB].tmp2 == newA);
+
+	CHECK(parts[newUnlinked].ctype == 1);
+	CHECK(parts[newUnlinked].tmp == unlinkedTmp);
+	CHECK(parts[newUnlinked].tmp2 == unlinkedTmp2);
+	CHECK(sim->Check());
+}
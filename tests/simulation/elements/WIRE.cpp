@@ -0,0 +1,135 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "simulation/elements/WIRE.hpp"
+#include "simulation/ElementNumbers.h"
+#include "common/Observer.h"
+#include "../SimulationTestHelpers.hpp"
+#include "catch.hpp"
+#include <memory>
+#include <random>
+#include <vector>
+
+// WIRE grid with random spark heads and tails, with PSCN sparks feeding into it, NSCN being sparked by it, and some stacked WIRE particles and WIRE particles whose pmap position is rounded differently
+static void createWireCircuit(Simulation *sim)
+{
+	std::mt19937 gen(4321);
+	auto randInt = [&gen](int n) { return int(gen()%n); };
+	for (int y=60; y<260; y++)
+	{
+		for (int x=60; x<400; x++)
+		{
+			// Mostly WIRE, with gaps so that sparks travel in many directions
+			if (randInt(10)<2)
+				continue;
+			int i = sim->part_create(-1, SimPosI(x, y), PT_WIRE);
+			REQUIRE(i>=0);
+			int state = randInt(10);
+			if (state==0)
+				Element_WIRE::setState(sim->parts[i], Element_WIRE::State::HeadNormal);
+			else if (state==1)
+				Element_WIRE::setState(sim->parts[i], Element_WIRE::State::Tail);
+			sim->parts[i].tmp = sim->parts[i].ctype;
+		}
+	}
+	for (int k=0; k<300; k++)
+	{
+		SimPosI pos(60+randInt(340), 60+randInt(200));
+		int i;
+		switch (randInt(4))
+		{
+		case 0:
+			// Sparked PSCN, which sparks the WIRE around it
+			i = sim->pmap_find_one(pos, PT_WIRE);
+			if (i>=0)
+				sim->part_create(i, pos, PT_PSCN);
+			else
+				i = sim->part_create(-1, pos, PT_PSCN);
+			sim->spark_particle(i, pos.x, pos.y);
+			break;
+		case 1:
+			// NSCN, which is sparked by spark heads next to it
+			i = sim->pmap_find_one(pos, PT_WIRE);
+			if (i>=0)
+				sim->part_create(i, pos, PT_NSCN);
+			else
+				sim->part_create(-1, pos, PT_NSCN);
+			break;
+		case 2:
+			// Stacked WIRE
+			i = sim->part_create(-3, pos, PT_WIRE);
+			if (randInt(2))
+				Element_WIRE::setState(sim->parts[i], Element_WIRE::State::HeadNormal);
+			sim->parts[i].tmp = sim->parts[i].ctype;
+			break;
+		case 3:
+			// WIRE which WIRE_update is given a different position for than the pmap
+			i = sim->pmap_find_one(pos, PT_WIRE);
+			if (i>=0)
+				sim->part_set_pos(i, SimPosF(pos.x+0.5f, pos.y+0.5f));
+			break;
+		}
+	}
+}
+
+TEST_CASE("WIRE bitboards give the same results as looking at neighbours", "[elements][PT_WIRE]")
+{
+	struct Result
+	{
+		int type, ctype, tmp, life;
+		bool operator==(const Result &other) const
+		{
+			return type==other.type && ctype==other.ctype && tmp==other.tmp && life==other.life;
+		}
+	};
+	auto runCircuit = [](bool useBitboards) {
+		auto sim = createTestSimulation();
+		createWireCircuit(sim.get());
+		// The bitboards are built before hook_beforeUpdate, so invalidating them then makes every WIRE particle go through its neighbours
+		WIRE_ElemDataSim *wireData = sim->elemData<WIRE_ElemDataSim>(PT_WIRE);
+		std::unique_ptr<Observer_ClassMember<WIRE_ElemDataSim>> disableBitboards;
+		if (!useBitboards)
+			disableBitboards.reset(new Observer_ClassMember<WIRE_ElemDataSim>(sim->hook_beforeUpdate, wireData, &WIRE_ElemDataSim::invalidate));
+		std::vector<std::vector<Result>> frames;
+		for (int frame=0; frame<30; frame++)
+		{
+			sim->UpdateParticles();
+			std::vector<Result> parts;
+			for (int i=0; i<NPART; i++)
+			{
+				const particle &p = sim->parts[i];
+				parts.push_back({ p.type, p.ctype, p.tmp, p.life });
+			}
+			frames.push_back(parts);
+		}
+		return frames;
+	};
+
+	std::vector<std::vector<Result>> expected = runCircuit(false);
+	std::vector<std::vector<Result>> result = runCircuit(true);
+	for (size_t frame=0; frame<expected.size(); frame++)
+	{
+		INFO("frame " << frame);
+		int mismatches = 0, heads = 0;
+		for (int i=0; i<NPART; i++)
+		{
+			if (!(result[frame][i]==expected[frame][i]))
+				mismatches++;
+			if (expected[frame][i].type==PT_WIRE && expected[frame][i].ctype==int(Element_WIRE::State::HeadNormal))
+				heads++;
+		}
+		CHECK(heads > 0);
+		REQUIRE(mismatches == 0);
+	}
+}
@@ -0,0 +1,42 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "simulation/walls/SimWalls.hpp"
+#include "simulation/WallNumbers.hpp"
+#include "catch.hpp"
+#include <memory>
+
+TEST_CASE("SimWalls sparking cells", "[simulation][walls]")
+{
+	std::unique_ptr<SimWalls> walls(new SimWalls(nullptr));
+	SimPosCell c(10, 10);
+	walls->type(c, WL_DETECT);
+	walls->simBeforeUpdate();
+	CHECK(!walls->hasSparkingCells());
+
+	walls->makeSpark(c);
+	REQUIRE(walls->electricity(c) == 16);
+	// Conductors are sparked when the electricity has decreased to 12
+	for (int i=15; i>12; i--)
+	{
+		walls->simBeforeUpdate();
+		CHECK(walls->electricity(c) == i);
+		CHECK(!walls->hasSparkingCells());
+	}
+	walls->simBeforeUpdate();
+	CHECK(walls->electricity(c) == 12);
+	CHECK(walls->hasSparkingCells());
+	walls->simBeforeUpdate();
+	CHECK(!walls->hasSparkingCells());
+}
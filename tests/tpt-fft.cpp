@@ -0,0 +1,111 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common/tpt-fft.h"
+#include "catch.hpp"
+#include <cmath>
+#include <random>
+#include <vector>
+
+typedef std::complex<double> cpxd;
+
+static std::vector<cpxd> naiveDft(const std::vector<tpt_fft::cpx> &in, int sign)
+{
+	const double pi = 3.14159265358979323846;
+	int n = in.size();
+	std::vector<cpxd> out(n);
+	for (int k=0; k<n; k++)
+	{
+		for (int j=0; j<n; j++)
+			out[k] += cpxd(in[j]) * std::polar(1.0, sign*2*pi*double(j)*k/n);
+	}
+	return out;
+}
+
+TEST_CASE("tpt_fft matches DFT", "[fft]")
+{
+	std::mt19937 gen(42);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	for (int n : {1, 2, 3, 4, 5, 8, 12, 17, 18, 30, 64, 96, 153, 192, 306})
+	{
+		INFO("n=" << n);
+		std::vector<tpt_fft::cpx> in(n), out(n);
+		for (auto &v : in)
+			v = tpt_fft::cpx(dist(gen), dist(gen));
+		tpt_fft fft(n);
+
+		fft.forward(in.data(), out.data());
+		std::vector<cpxd> expected = naiveDft(in, -1);
+		for (int k=0; k<n; k++)
+			REQUIRE( std::abs(cpxd(out[k])-expected[k]) < 1e-4*n );
+
+		fft.inverse(in.data(), out.data());
+		expected = naiveDft(in, 1);
+		for (int k=0; k<n; k++)
+			REQUIRE( std::abs(cpxd(out[k])-expected[k]) < 1e-4*n );
+	}
+}
+
+TEST_CASE("tpt_fft strided input", "[fft]")
+{
+	const int n = 12, stride = 3;
+	std::vector<tpt_fft::cpx> in(n*stride), packed(n), out1(n), out2(n);
+	for (int j=0; j<n*stride; j++)
+		in[j] = tpt_fft::cpx(j%7, j%5);
+	for (int j=0; j<n; j++)
+		packed[j] = in[j*stride];
+	tpt_fft fft(n);
+	fft.forward(in.data(), out1.data(), stride);
+	fft.forward(packed.data(), out2.data());
+	for (int k=0; k<n; k++)
+		CHECK( out1[k]==out2[k] );
+}
+
+TEST_CASE("tpt_fft_real2d", "[fft]")
+{
+	const double pi = 3.14159265358979323846;
+	std::mt19937 gen(43);
+	std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+	const int sizes[][2] = { {6, 4}, {5, 3}, {8, 1}, {18, 12} };
+	for (auto &size : sizes)
+	{
+		const int nx = size[0], ny = size[1], nxc = nx/2+1;
+		INFO("nx=" << nx << " ny=" << ny);
+		std::vector<float> in(nx*ny), back(nx*ny);
+		for (auto &v : in)
+			v = dist(gen);
+		tpt_fft_real2d fft(nx, ny);
+		REQUIRE( fft.complexSize()==ny*nxc );
+		std::vector<tpt_fft_real2d::cpx> out(fft.complexSize());
+		fft.forward(in.data(), out.data());
+
+		for (int ky=0; ky<ny; ky++)
+		{
+			for (int kx=0; kx<nxc; kx++)
+			{
+				cpxd expected;
+				for (int y=0; y<ny; y++)
+					for (int x=0; x<nx; x++)
+						expected += double(in[y*nx+x]) * std::polar(1.0, -2*pi*(double(kx)*x/nx + double(ky)*y/ny));
+				REQUIRE( std::abs(cpxd(out[ky*nxc+kx])-expected) < 1e-4 );
+			}
+		}
+
+		// Inverse is unnormalised, so the round trip multiplies by nx*ny
+		fft.inverse(out.data(), back.data());
+		for (int i=0; i<nx*ny; i++)
+			REQUIRE( back[i] == Approx(in[i]*nx*ny).margin(1e-4) );
+	}
+}
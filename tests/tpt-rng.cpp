@@ -13,6 +13,8 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <chrono>
+#include <random>
 #include <vector>
 #include "common/tpt-rng.h"
 #include "catch.hpp"
@@ -58,3 +60,116 @@ TEST_CASE("CountBitsOccupied template", "[tptrng]")
 	CHECK( CountBitsOccupied<0xFFFFFFFE>::bits == 32);
 	CHECK( CountBitsOccupied<0xFFFFFFFF>::bits == 32);
 }
+
+TEST_CASE("philox4x32 known answers", "[tptrng]")
+{
+	// Test vectors from the Random123 reference implementation (kat_vectors, philox4x32 10 rounds)
+	uint32_t out[4];
+	{
+		const uint32_t ctr[4] = {0, 0, 0, 0}, key[2] = {0, 0};
+		tpt_rng::philox4x32(ctr, key, out);
+		CHECK( out[0] == 0x6627e8d5 );
+		CHECK( out[1] == 0xe169c58d );
+		CHECK( out[2] == 0xbc57ac4c );
+		CHECK( out[3] == 0x9b00dbd8 );
+	}
+	{
+		const uint32_t ctr[4] = {0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, key[2] = {0xffffffff, 0xffffffff};
+		tpt_rng::philox4x32(ctr, key, out);
+		CHECK( out[0] == 0x408f276d );
+		CHECK( out[1] == 0x41c83b0e );
+		CHECK( out[2] == 0xa20bc7c6 );
+		CHECK( out[3] == 0x6d5451fd );
+	}
+	{
+		const uint32_t ctr[4] = {0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, key[2] = {0xa4093822, 0x299f31d0};
+		tpt_rng::philox4x32(ctr, key, out);
+		CHECK( out[0] == 0xd16cfe09 );
+		CHECK( out[1] == 0x94fdcceb );
+		CHECK( out[2] == 0x5001e420 );
+		CHECK( out[3] == 0x24126ea1 );
+	}
+}
+
+TEST_CASE("tpt_rng streams", "[tptrng]")
+{
+	const uint64_t seedVal = 0x123456789ULL;
+	std::vector<uint_fast32_t> stream0, stream1;
+	tpt_rng a, b;
+	a.seed(seedVal, 0);
+	b.seed(seedVal, 1);
+	for (int i=0; i<100; i++)
+	{
+		stream0.push_back(a.randUint32());
+		stream1.push_back(b.randUint32());
+	}
+	CHECK( stream0 != stream1 );
+
+	// Reseeding with the same seed and stream gives the same numbers, regardless of what other streams have been used in the meantime
+	tpt_rng c;
+	c.seed(seedVal, 1);
+	for (int i=0; i<100; i++)
+		CHECK( c.randUint32() == stream1[i] );
+	c.seed(seedVal, 0);
+	for (int i=0; i<100; i++)
+		CHECK( c.randUint32() == stream0[i] );
+}
+
+namespace
+{
+// Wrapper with the same interface as the old tpt_rng, for comparing speed
+class mt19937_rng
+{
+protected:
+	std::mt19937 gen;
+public:
+	mt19937_rng() : gen(12345) {}
+	uint_fast32_t randUint32()
+	{
+		return gen();
+	}
+	int randInt(int minVal, int maxVal)
+	{
+		const uint_fast32_t resultRange = (maxVal-minVal+1);
+		const uint_fast32_t scaling = uint_fast32_t(uint_fast32_t(0xFFFFFFFF) / resultRange);
+		const uint_fast32_t regenThreshold = resultRange * scaling;
+		uint_fast32_t ret;
+		do
+			ret = randUint32();
+		while (ret>=regenThreshold);
+		return ret/scaling + minVal;
+	}
+	bool chance(uint_fast32_t numerator, uint_fast32_t denominator)
+	{
+		return (randUint32() < uint_fast32_t(double(numerator)/denominator*4294967296.0));
+	}
+};
+
+template<class Rng>
+double benchmark_rng(Rng &rng, int iterations, unsigned long long &result)
+{
+	auto start = std::chrono::steady_clock::now();
+	for (int i=0; i<iterations; i++)
+	{
+		result += rng.chance(1, 10);
+		result += rng.randInt(0, 7);
+		result += rng.randInt(-5, 200);
+	}
+	auto end = std::chrono::steady_clock::now();
+	return std::chrono::duration<double>(end-start).count();
+}
+}
+
+// Hidden test, run with: powdertests "[.benchmark]"
+TEST_CASE("tpt_rng throughput", "[tptrng][.benchmark]")
+{
+	const int iterations = 10000000;
+	unsigned long long result = 0;
+	tpt_rng philox;
+	philox.seed(12345);
+	mt19937_rng mt;
+	double tPhilox = benchmark_rng(philox, iterations, result);
+	double tMt = benchmark_rng(mt, iterations, result);
+	WARN("chance/randInt, " << iterations*3 << " calls: philox4x32 " << tPhilox*1000 << "ms, mt19937 " << tMt*1000 << "ms (" << result << ")");
+	CHECK( result > 0 );
+}
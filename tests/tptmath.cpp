@@ -22,6 +22,38 @@ TEST_CASE("remainder_p", "[tptmath]")
 	CHECK( tptmath::remainder_p(-5,3) == 1);
 }
 
+TEST_CASE("ctz64 and bsr64", "[tptmath]")
+{
+	CHECK( tptmath::ctz64(1) == 0);
+	CHECK( tptmath::ctz64(0x80) == 7);
+	CHECK( tptmath::ctz64(uint64_t(1)<<63) == 63);
+	CHECK( tptmath::ctz64(0xF0F0000000000000ULL) == 52);
+	CHECK( tptmath::bsr64(1) == 0);
+	CHECK( tptmath::bsr64(0x81) == 7);
+	CHECK( tptmath::bsr64(~uint64_t(0)) == 63);
+}
+
+TEST_CASE("popcount32", "[tptmath]")
+{
+	CHECK( tptmath::popcount32(0) == 0);
+	CHECK( tptmath::popcount32(1) == 1);
+	CHECK( tptmath::popcount32(0x1EF) == 8);
+	CHECK( tptmath::popcount32(0x80000001) == 2);
+	CHECK( tptmath::popcount32(0xFFFFFFFF) == 32);
+}
+
+TEST_CASE("morton2d", "[tptmath]")
+{
+	CHECK( tptmath::morton2d(0, 0) == 0);
+	CHECK( tptmath::morton2d(1, 0) == 1);
+	CHECK( tptmath::morton2d(0, 1) == 2);
+	CHECK( tptmath::morton2d(3, 3) == 15);
+	CHECK( tptmath::morton2d(0xFFFF, 0) == 0x55555555);
+	CHECK( tptmath::morton2d(0, 0xFFFF) == 0xAAAAAAAA);
+	// 611 = 0b1001100011, 383 = 0b0101111111
+	CHECK( tptmath::morton2d(611, 383) == 0x63EAF);
+}
+
 TEST_CASE("binomial_gte1", "[tptmath]")
 {
 	CHECK( tptmath::binomial_gte1(0, 0.2) == Approx(0));